@@ -0,0 +1,1139 @@
+/*
+ * crypto_bench
+ *
+ * Runs the encrypt/decrypt path of each onion layer, and the UDF kernels
+ * the server runs per row, over a grid of value sizes, batch sizes and
+ * thread counts. Prints one JSON object per measurement; with -c it
+ * compares against a saved run and fails when something got slower.
+ *
+ *   obj/bench/crypto_bench -u root -p letmein -s 16,256 -b 1,64 -j 1,4 \
+ *       > baseline.json
+ *   obj/bench/crypto_bench -u root -p letmein -s 16,256 -b 1,64 -j 1,4 \
+ *       -c baseline.json
+ *
+ * The layers are the EncLayers of main/CryptoHandlers.cc, built by
+ * EncLayerFactory from the Create_field of a column, and they read and
+ * write Items as the rewriter hands them over; so, like trace_bench,
+ * they need the embedded server and a backend to start it against. The
+ * UDFs are the ones in udf/edb.cc, called the way mysqld calls them, and
+ * need neither.
+ */
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gmp.h>
+
+#include <main/rewrite_main.hh>
+#include <main/rewrite_util.hh>
+#include <main/CryptoHandlers.hh>
+#include <parser/embedmysql.hh>
+#include <parser/mysql_type_metadata.hh>
+#include <parser/sql_utils.hh>
+#include <crypto/BasicCrypto.hh>
+#include <crypto/blowfish.hh>
+#include <crypto/paillier.hh>
+#include <crypto/prng.hh>
+#include <crypto/SWPSearch.hh>
+#include <util/util.hh>
+
+extern "C" {
+my_bool   cryptdb_decrypt_int_sem_init(UDF_INIT *const initid,
+                                       UDF_ARGS *const args,
+                                       char *const message);
+ulonglong cryptdb_decrypt_int_sem(UDF_INIT *const initid,
+                                  UDF_ARGS *const args,
+                                  char *const is_null, char *const error);
+my_bool   cryptdb_decrypt_text_sem_init(UDF_INIT *const initid,
+                                        UDF_ARGS *const args,
+                                        char *const message);
+void      cryptdb_decrypt_text_sem_deinit(UDF_INIT *const initid);
+char *    cryptdb_decrypt_text_sem(UDF_INIT *const initid,
+                                   UDF_ARGS *const args, char *const result,
+                                   unsigned long *const length,
+                                   char *const is_null, char *const error);
+my_bool   cryptdb_decrypt_text_det_init(UDF_INIT *const initid,
+                                        UDF_ARGS *const args,
+                                        char *const message);
+void      cryptdb_decrypt_text_det_deinit(UDF_INIT *const initid);
+char *    cryptdb_decrypt_text_det(UDF_INIT *const initid,
+                                   UDF_ARGS *const args, char *const result,
+                                   unsigned long *const length,
+                                   char *const is_null, char *const error);
+my_bool   cryptdb_searchSWP_init(UDF_INIT *const initid, UDF_ARGS *const args,
+                                 char *const message);
+void      cryptdb_searchSWP_deinit(UDF_INIT *const initid);
+ulonglong cryptdb_searchSWP(UDF_INIT *const initid, UDF_ARGS *const args,
+                            char *const is_null, char *const error);
+my_bool   cryptdb_agg_init(UDF_INIT *const initid, UDF_ARGS *const args,
+                           char *const message);
+void      cryptdb_agg_deinit(UDF_INIT *const initid);
+void      cryptdb_agg_clear(UDF_INIT *const initid, char *const is_null,
+                            char *const error);
+my_bool   cryptdb_agg_add(UDF_INIT *const initid, UDF_ARGS *const args,
+                          char *const is_null, char *const error);
+}
+
+/*
+ * Allocation counting
+ *
+ * Every operator new and every GMP allocation bumps a per thread
+ * counter; NTL's own allocations are not seen.
+ */
+
+static __thread uint64_t nallocs = 0;
+
+void *
+operator new(size_t n)
+{
+    nallocs++;
+    void *const p = malloc(n ? n : 1);
+    if (NULL == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void
+operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static void *
+gmp_alloc(size_t n)
+{
+    nallocs++;
+    return malloc(n);
+}
+
+static void *
+gmp_realloc(void *p, size_t, size_t n)
+{
+    nallocs++;
+    return realloc(p, n);
+}
+
+static void
+gmp_free(void *p, size_t)
+{
+    free(p);
+}
+
+static uint64_t
+now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Cases
+ */
+
+// Runs one batch; built once per thread, so it may keep state.
+typedef std::function<void()> bench_op;
+
+struct bench_case {
+    std::string name;
+    bool sized;                     // whether the value size matters
+    bool layer;                     // whether it runs on an embedded THD
+    std::function<bench_op(size_t size, size_t batch)> make;
+};
+
+static urandom &
+rng()
+{
+    static __thread urandom *u = NULL;
+    if (NULL == u) {
+        u = new urandom();
+    }
+    return *u;
+}
+
+static std::vector<uint64_t>
+rand_u64s(size_t n)
+{
+    std::vector<uint64_t> out(n);
+    for (auto &it : out) {
+        it = rng().rand<uint64_t>();
+    }
+    return out;
+}
+
+static std::vector<std::string>
+rand_strings(size_t n, size_t size)
+{
+    std::vector<std::string> out(n);
+    for (auto &it : out) {
+        it = rng().rand_string(size);
+    }
+    return out;
+}
+
+// Words of seven letters, as a text column holds them.
+static std::string
+rand_text(size_t size)
+{
+    std::string out;
+    while (out.length() < size) {
+        if (!out.empty()) {
+            out += " ";
+        }
+        for (unsigned int i = 0; i < 7; i++) {
+            out += static_cast<char>('a' + rng().rand<uint8_t>() % 26);
+        }
+    }
+    return out.substr(0, size);
+}
+
+/*
+ * Layers
+ */
+
+// The embedded THD a thread builds its layers and Items on.
+// > Items live as long as their THD, so the thread swaps it for a fresh
+//   one between batches, outside the measurement.
+class bench_thd {
+public:
+    explicit bench_thd(const SharedProxyState *const shared) {
+        if (NULL == shared) {
+            return;
+        }
+        assert(0 == mysql_thread_init());
+        {
+            const std::lock_guard<std::mutex> lock(setup);
+            ps.reset(new ProxyState(*shared));
+        }
+        thread_ps = ps.get();
+        ps->safeCreateEmbeddedTHD();
+    }
+    ~bench_thd() {
+        if (ps) {
+            ps->releaseTHDs();
+            thread_ps = NULL;
+            const std::lock_guard<std::mutex> lock(setup);
+            ps.reset();
+        }
+    }
+
+    void recycle() {
+        if (ps) {
+            ps->releaseTHDs();
+            ps->safeCreateEmbeddedTHD();
+        }
+    }
+
+private:
+    // > ProxyState and Connect are not safe to build concurrently
+    static std::mutex setup;
+    std::unique_ptr<ProxyState> ps;
+
+    bench_thd(const bench_thd &) = delete;
+    bench_thd &operator=(const bench_thd &) = delete;
+};
+
+std::mutex bench_thd::setup;
+
+// Builds a layer from the Create_field of its column, as OnionMeta does
+// (see main/schema.cc).
+typedef std::function<std::unique_ptr<EncLayer>(const Create_field &cf,
+                                                const std::string &key)>
+    layer_builder;
+
+static layer_builder
+factory(onion o, SECLEVEL l)
+{
+    return [o, l](const Create_field &cf, const std::string &key) {
+        return EncLayerFactory::encLayer(o, l, cf, key);
+    };
+}
+
+// A layer, and the types of its column under and over it.
+struct bench_layer {
+    std::unique_ptr<EncLayer> layer;
+    enum enum_field_types plain_type;
+    enum enum_field_types ciph_type;
+};
+
+// The layer of a column declared as 'type'. It is keyed by the case
+// name alone, so each thread builds the same one; what the layer
+// derives from its key, which for HOM is seconds of Paillier key
+// generation, is derived by the first thread and restored by the rest.
+static std::shared_ptr<bench_layer>
+make_layer(const std::string &name, const std::string &type,
+           const layer_builder &build)
+{
+    const auto out = std::make_shared<bench_layer>();
+    {
+        query_parse p("cryptdb_bench", "CREATE TABLE t (c " + type + ");");
+        auto cf_it =
+            List_iterator<Create_field>(p.lex()->alter_info.create_list);
+        const Create_field *const cf = cf_it++;
+        throw_c(NULL != cf, "no column in " + type);
+        out->layer = build(*cf, "bench " + name);
+        out->plain_type = cf->sql_type;
+        out->ciph_type = out->layer->newCreateField(*cf)->sql_type;
+    }
+    // > the parse took the THD of the query with it
+    assert(thread_ps);
+    thread_ps->safeCreateEmbeddedTHD();
+
+    static std::mutex lock;
+    static std::map<std::string, std::string> expanded;
+    const std::lock_guard<std::mutex> guard(lock);
+    const auto &it = expanded.find(name);
+    if (expanded.end() == it) {
+        expanded[name] = out->layer->expandedKey();
+    } else if (false == it->second.empty()) {
+        out->layer->restoreExpandedKey(it->second);
+    }
+    return out;
+}
+
+// Items of a column as the rewriter and the backend's results hand
+// them to the layers.
+static std::vector<const Item *>
+column_items(enum enum_field_types type,
+             const std::vector<std::string> &values)
+{
+    std::vector<const Item *> out;
+    out.reserve(values.size());
+    for (const auto &it : values) {
+        out.push_back(MySQLFieldTypeToItem(type, it));
+    }
+    return out;
+}
+
+// A single value goes through encrypt(...) and decrypt(...), as the
+// constants of a query do; a larger batch through encryptBatch(...) and
+// decryptBatch(...), as the rows of an INSERT and of a result set do.
+// The Items are built from the values in the batch.
+static bench_op
+layer_op(const std::string &name, const std::string &type,
+         const layer_builder &build, const std::vector<std::string> &plains,
+         bool enc)
+{
+    const std::shared_ptr<bench_layer> l = make_layer(name, type, build);
+    const size_t batch = plains.size();
+    const auto IVs =
+        std::make_shared<std::vector<uint64_t> >(rand_u64s(batch));
+
+    // > as if the column held the batch already, so that encrypt is
+    //   the lookup of a value in the tree
+    if ("MOPE_int" == l->layer->name()) {
+        const MOPE_int &mope = static_cast<const MOPE_int &>(*l->layer);
+        mope.load(std::vector<std::string>());
+        for (const auto &it : plains) {
+            mope.current(strtoull(it.c_str(), NULL, 10));
+        }
+        mope.takeMoved();
+    }
+
+    std::vector<std::string> in = plains;
+    if (!enc) {
+        const std::vector<const Item *> &items =
+            column_items(l->plain_type, plains);
+        for (size_t i = 0; i < batch; i++) {
+            in[i] = ItemToString(*l->layer->encrypt(*items[i], (*IVs)[i]));
+        }
+    }
+    const auto vals = std::make_shared<std::vector<std::string> >(in);
+    const enum enum_field_types in_type = enc ? l->plain_type : l->ciph_type;
+
+    return [=]() {
+        const std::vector<const Item *> &items = column_items(in_type, *vals);
+        if (1 == batch) {
+            enc ? l->layer->encrypt(*items[0], (*IVs)[0])
+                : l->layer->decrypt(*items[0], (*IVs)[0]);
+        } else {
+            enc ? l->layer->encryptBatch(items, *IVs)
+                : l->layer->decryptBatch(items, *IVs);
+        }
+    };
+}
+
+static std::vector<std::string>
+rand_ints(size_t n, unsigned int bits)
+{
+    std::vector<std::string> out;
+    for (auto it : rand_u64s(n)) {
+        out.push_back(std::to_string(it >> (64 - bits)));
+    }
+    return out;
+}
+
+static std::vector<std::string>
+rand_texts(size_t n, size_t size)
+{
+    std::vector<std::string> out(n);
+    for (auto &it : out) {
+        it = rand_text(size);
+    }
+    return out;
+}
+
+// A column of integers as wide as a BIGINT UNSIGNED.
+static bench_op
+int_layer_op(const std::string &name, const layer_builder &build,
+             size_t batch, bool enc)
+{
+    return layer_op(name, "BIGINT UNSIGNED", build, rand_ints(batch, 64),
+                    enc);
+}
+
+// A column of text of the given size.
+static bench_op
+str_layer_op(const std::string &name, const std::string &type,
+             const layer_builder &build, size_t size, size_t batch,
+             bool enc)
+{
+    return layer_op(name, type, build, rand_texts(batch, size), enc);
+}
+
+static std::string
+varchar(size_t size)
+{
+    return "VARCHAR(" + std::to_string(std::max<size_t>(size, 1)) + ")";
+}
+
+/*
+ * UDFs
+ */
+
+// The arguments of one UDF call; values stay where mysqld would put
+// them for as long as the object lives.
+class udf_args {
+public:
+    udf_args() {}
+
+    void add(const std::string &s) {
+        strings.push_back(s);
+        types.push_back(STRING_RESULT);
+        which.push_back(strings.size() - 1);
+    }
+    void add(uint64_t v) {
+        ints.push_back(v);
+        types.push_back(INT_RESULT);
+        which.push_back(ints.size() - 1);
+    }
+    void set(unsigned int i, const std::string &s) {
+        strings[which[i]] = s;
+        args[i] = const_cast<char *>(strings[which[i]].data());
+        lengths[i] = s.length();
+    }
+
+    UDF_ARGS *get() {
+        args.clear();
+        lengths.clear();
+        for (unsigned int i = 0; i < types.size(); i++) {
+            if (STRING_RESULT == types[i]) {
+                const std::string &s = strings[which[i]];
+                args.push_back(const_cast<char *>(s.data()));
+                lengths.push_back(s.length());
+            } else {
+                args.push_back(reinterpret_cast<char *>(&ints[which[i]]));
+                lengths.push_back(sizeof(ulonglong));
+            }
+        }
+
+        memset(&a, 0, sizeof(a));
+        a.arg_count = types.size();
+        a.arg_type = types.data();
+        a.args = args.data();
+        a.lengths = lengths.data();
+        return &a;
+    }
+
+private:
+    std::deque<std::string> strings;
+    std::deque<ulonglong> ints;
+    std::vector<Item_result> types;
+    std::vector<unsigned int> which;
+    std::vector<char *> args;
+    std::vector<unsigned long> lengths;
+    UDF_ARGS a;
+
+    udf_args(const udf_args &) = delete;
+    udf_args &operator=(const udf_args &) = delete;
+};
+
+// The UDF_INIT of one statement; deinit runs with the last batch.
+class udf_state {
+public:
+    udf_state(my_bool (*init)(UDF_INIT *, UDF_ARGS *, char *),
+              void (*deinit)(UDF_INIT *), UDF_ARGS *args)
+        : deinit(deinit)
+    {
+        char message[MYSQL_ERRMSG_SIZE];
+        memset(&initid, 0, sizeof(initid));
+        throw_c(0 == init(&initid, args, message), "udf init failed");
+    }
+    ~udf_state() {
+        if (deinit) {
+            deinit(&initid);
+        }
+    }
+
+    UDF_INIT initid;
+
+private:
+    void (*const deinit)(UDF_INIT *);
+
+    udf_state(const udf_state &) = delete;
+    udf_state &operator=(const udf_state &) = delete;
+};
+
+// Calls the UDF once per row, each row with its own ciphertext as the
+// first argument.
+template <typename F>
+static bench_op
+udf_rows_op(my_bool (*init)(UDF_INIT *, UDF_ARGS *, char *),
+            void (*deinit)(UDF_INIT *),
+            const std::shared_ptr<udf_args> &args,
+            const std::vector<std::string> &rows, F call)
+{
+    const auto state = std::make_shared<udf_state>(init, deinit, args->get());
+    const auto vals = std::make_shared<std::vector<std::string> >(rows);
+
+    return [=]() {
+        for (const auto &it : *vals) {
+            args->set(0, it);
+            call(&state->initid, args->get());
+        }
+    };
+}
+
+static bench_op
+udf_decrypt_int_sem_op(size_t batch)
+{
+    const std::string key = rng().rand_string(16);
+    const blowfish bf(key);
+    const uint64_t salt = rng().rand<uint64_t>();
+    const auto cts = std::make_shared<std::vector<uint64_t> >();
+    for (auto it : rand_u64s(batch)) {
+        cts->push_back(bf.encrypt(it ^ salt));
+    }
+
+    const auto args = std::make_shared<udf_args>();
+    args->add(static_cast<uint64_t>(0));
+    args->add(key);
+    args->add(salt);
+    const auto state =
+        std::make_shared<udf_state>(cryptdb_decrypt_int_sem_init, nullptr,
+                                    args->get());
+
+    return [=]() {
+        char is_null = 0, error = 0;
+        UDF_ARGS *const a = args->get();
+        for (auto it : *cts) {
+            *reinterpret_cast<ulonglong *>(a->args[0]) = it;
+            cryptdb_decrypt_int_sem(&state->initid, a, &is_null, &error);
+        }
+    };
+}
+
+static bench_op
+udf_decrypt_text_op(size_t size, size_t batch, bool sem)
+{
+    const std::string key = rng().rand_string(16);
+    const std::unique_ptr<AES_KEY> enc_key(get_AES_enc_key(key));
+    const uint64_t salt = rng().rand<uint64_t>();
+    std::vector<std::string> rows;
+    for (const auto &it : rand_strings(batch, size)) {
+        rows.push_back(sem ? encrypt_AES_CBC(it, enc_key.get(),
+                                       BytesFromInt(salt, SALT_LEN_BYTES))
+                           : encrypt_AES_CMC(it, enc_key.get()));
+    }
+
+    const auto args = std::make_shared<udf_args>();
+    args->add(std::string());
+    args->add(key);
+    if (sem) {
+        args->add(salt);
+    }
+
+    auto call = [=](UDF_INIT *initid, UDF_ARGS *a) {
+        char is_null = 0, error = 0;
+        unsigned long length;
+        sem ? cryptdb_decrypt_text_sem(initid, a, NULL, &length, &is_null,
+                                       &error)
+            : cryptdb_decrypt_text_det(initid, a, NULL, &length, &is_null,
+                                       &error);
+        // > each call replaces the previous row's buffer without
+        //   freeing it; do that here so a long run does not grow
+        delete[] initid->ptr;
+        initid->ptr = NULL;
+    };
+    return sem ? udf_rows_op(cryptdb_decrypt_text_sem_init,
+                             cryptdb_decrypt_text_sem_deinit, args, rows,
+                             call)
+               : udf_rows_op(cryptdb_decrypt_text_det_init,
+                             cryptdb_decrypt_text_det_deinit, args, rows,
+                             call);
+}
+
+// A LIKE '%word%' over rows that mostly do not hold the word.
+static bench_op
+udf_searchSWP_op(size_t size, size_t batch)
+{
+    const std::string key = rng().rand_string(16);
+    std::vector<std::string> rows;
+    for (size_t i = 0; i < batch; i++) {
+        const std::list<std::string> words = split(rand_text(size), " ");
+        const std::unique_ptr<std::list<std::string> >
+            ciphs(SWP::encrypt(key, words));
+        std::string row = SWP::bloom(key, words);
+        for (const auto &it : *ciphs) {
+            row += it;
+        }
+        rows.push_back(row);
+    }
+
+    const std::string word = "abcdefg";
+    const Token t = SWP::token(key, word);
+    const auto args = std::make_shared<udf_args>();
+    args->add(std::string());
+    args->add(t.ciph);
+    args->add(t.wordKey);
+    args->add(SWP::bloomMask(key, word));
+
+    return udf_rows_op(cryptdb_searchSWP_init, cryptdb_searchSWP_deinit,
+                       args, rows, [](UDF_INIT *initid, UDF_ARGS *a) {
+        char is_null = 0, error = 0;
+        cryptdb_searchSWP(initid, a, &is_null, &error);
+    });
+}
+
+// Key generation takes seconds, so all threads share one key.
+static const std::vector<NTL::ZZ> &
+paillier_key()
+{
+    static const std::vector<NTL::ZZ> sk =
+        Paillier_priv::keygen(&rng(), 1024);
+    return sk;
+}
+
+// SUM over a HOM onion; one batch is one group of batch rows.
+static bench_op
+udf_agg_op(size_t batch)
+{
+    Paillier_priv p(paillier_key());
+    const std::string n2 = StringFromZZ(p.hompubkey());
+    std::vector<std::string> rows;
+    for (auto it : rand_u64s(batch)) {
+        rows.push_back(p.encrypt_u64(it >> 16));
+    }
+
+    const auto args = std::make_shared<udf_args>();
+    args->add(std::string());
+    args->add(n2);
+
+    return udf_rows_op(cryptdb_agg_init, cryptdb_agg_deinit, args, rows,
+                       [](UDF_INIT *initid, UDF_ARGS *a) {
+        char is_null = 0, error = 0;
+        cryptdb_agg_add(initid, a, &is_null, &error);
+    });
+}
+
+static std::vector<bench_case>
+bench_cases()
+{
+    const layer_builder ffx = [](const Create_field &cf,
+                                 const std::string &key) {
+        return EncLayerFactory::ffxLayer(SECLEVEL::DET, cf, key);
+    };
+    const layer_builder mope = [](const Create_field &cf,
+                                  const std::string &key) {
+        return std::unique_ptr<EncLayer>(new MOPE_int(cf, key));
+    };
+
+    return {
+        {"RND_int.encrypt", false, true, [](size_t, size_t batch) {
+            return int_layer_op("RND_int", factory(oDET, SECLEVEL::RND),
+                                batch, true); }},
+        {"RND_int.decrypt", false, true, [](size_t, size_t batch) {
+            return int_layer_op("RND_int", factory(oDET, SECLEVEL::RND),
+                                batch, false); }},
+        {"RND_str.encrypt", true, true, [](size_t size, size_t batch) {
+            return str_layer_op("RND_str", varchar(size),
+                                factory(oDET, SECLEVEL::RND), size, batch,
+                                true); }},
+        {"RND_str.decrypt", true, true, [](size_t size, size_t batch) {
+            return str_layer_op("RND_str", varchar(size),
+                                factory(oDET, SECLEVEL::RND), size, batch,
+                                false); }},
+        {"DET_int.encrypt", false, true, [](size_t, size_t batch) {
+            return int_layer_op("DET_int", factory(oDET, SECLEVEL::DET),
+                                batch, true); }},
+        {"DET_int.decrypt", false, true, [](size_t, size_t batch) {
+            return int_layer_op("DET_int", factory(oDET, SECLEVEL::DET),
+                                batch, false); }},
+        {"DET_str.encrypt", true, true, [](size_t size, size_t batch) {
+            return str_layer_op("DET_str", varchar(size),
+                                factory(oDET, SECLEVEL::DET), size, batch,
+                                true); }},
+        {"DET_str.decrypt", true, true, [](size_t size, size_t batch) {
+            return str_layer_op("DET_str", varchar(size),
+                                factory(oDET, SECLEVEL::DET), size, batch,
+                                false); }},
+        // > the 8 byte codes FFX is meant for
+        {"DET_ffx.encrypt", false, true, [ffx](size_t, size_t batch) {
+            return str_layer_op("DET_ffx", "CHAR(8) CHARACTER SET latin1",
+                                ffx, 8, batch, true); }},
+        {"DET_ffx.decrypt", false, true, [ffx](size_t, size_t batch) {
+            return str_layer_op("DET_ffx", "CHAR(8) CHARACTER SET latin1",
+                                ffx, 8, batch, false); }},
+        {"OPE_int.encrypt", false, true, [](size_t, size_t batch) {
+            return layer_op("OPE_int", "INT UNSIGNED",
+                            factory(oOPE, SECLEVEL::OPE),
+                            rand_ints(batch, 32), true); }},
+        {"OPE_int.decrypt", false, true, [](size_t, size_t batch) {
+            return layer_op("OPE_int", "INT UNSIGNED",
+                            factory(oOPE, SECLEVEL::OPE),
+                            rand_ints(batch, 32), false); }},
+        {"MOPE_int.encrypt", false, true, [mope](size_t, size_t batch) {
+            return int_layer_op("MOPE_int", mope, batch, true); }},
+        {"MOPE_int.decrypt", false, true, [mope](size_t, size_t batch) {
+            return int_layer_op("MOPE_int", mope, batch, false); }},
+        {"HOM.encrypt", false, true, [](size_t, size_t batch) {
+            return int_layer_op("HOM", factory(oAGG, SECLEVEL::HOM),
+                                batch, true); }},
+        {"HOM.decrypt", false, true, [](size_t, size_t batch) {
+            return int_layer_op("HOM", factory(oAGG, SECLEVEL::HOM),
+                                batch, false); }},
+        {"SEARCH.encrypt", true, true, [](size_t size, size_t batch) {
+            return str_layer_op("SEARCH", "TEXT",
+                                factory(oSWP, SECLEVEL::SEARCH), size,
+                                batch, true); }},
+        {"udf.decrypt_int_sem", false, false, [](size_t, size_t batch) {
+            return udf_decrypt_int_sem_op(batch); }},
+        {"udf.decrypt_text_sem", true, false,
+         [](size_t size, size_t batch) {
+            return udf_decrypt_text_op(size, batch, true); }},
+        {"udf.decrypt_text_det", true, false,
+         [](size_t size, size_t batch) {
+            return udf_decrypt_text_op(size, batch, false); }},
+        {"udf.searchSWP", true, false, [](size_t size, size_t batch) {
+            return udf_searchSWP_op(size, batch); }},
+        {"udf.agg", false, false, [](size_t, size_t batch) {
+            return udf_agg_op(batch); }},
+    };
+}
+
+/*
+ * Measurement
+ */
+
+struct bench_result {
+    std::string name;
+    size_t size;
+    size_t batch;
+    unsigned int threads;
+    uint64_t ops;
+    double ns_per_op;               // per thread, so latency
+    double ops_per_s;               // all threads together
+    double allocs_per_op;
+
+    std::string key() const {
+        std::stringstream ss;
+        ss << name << "/" << size << "/" << batch << "/" << threads;
+        return ss.str();
+    }
+};
+
+// Runs n batches; returns the nanoseconds and allocations they took. A
+// layer case gets a fresh THD after each batch, which is not counted.
+static std::pair<uint64_t, uint64_t>
+timed(const bench_case &c, const bench_op &op, bench_thd &thd, uint64_t n)
+{
+    if (!c.layer) {
+        nallocs = 0;
+        const uint64_t start = now_nsec();
+        for (uint64_t i = 0; i < n; i++) {
+            op();
+        }
+        return std::make_pair(now_nsec() - start, nallocs);
+    }
+
+    uint64_t nsec = 0, allocs = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        nallocs = 0;
+        const uint64_t start = now_nsec();
+        op();
+        nsec += now_nsec() - start;
+        allocs += nallocs;
+        thd.recycle();
+    }
+    return std::make_pair(nsec, allocs);
+}
+
+// Batches a thread runs so that it takes about min_ms; estimated on
+// one thread, ahead of the measurement.
+static uint64_t
+calibrate(const bench_case &c, size_t size, size_t batch,
+          unsigned int min_ms, const SharedProxyState *const shared)
+{
+    bench_thd thd(c.layer ? shared : NULL);
+    const bench_op op = c.make(size, batch);
+    timed(c, op, thd, 1);
+
+    uint64_t n = 0;
+    uint64_t elapsed = 0;
+    do {
+        elapsed += timed(c, op, thd, 1).first;
+        n++;
+    } while (elapsed < 10 * 1000000ULL && n < 1000000);
+
+    const double per_batch = static_cast<double>(elapsed) / n;
+    return std::max<uint64_t>(1, min_ms * 1e6 / per_batch);
+}
+
+static bench_result
+run(const bench_case &c, size_t size, size_t batch, unsigned int nthreads,
+    unsigned int min_ms, const SharedProxyState *const shared)
+{
+    const uint64_t nbatches = calibrate(c, size, batch, min_ms, shared);
+
+    std::vector<uint64_t> allocs(nthreads, 0);
+    std::vector<uint64_t> nsecs(nthreads, 0);
+    std::atomic<unsigned int> ready(0);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < nthreads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            bench_thd thd(c.layer ? shared : NULL);
+            const bench_op op = c.make(size, batch);
+            // warm up caches and lazy tables
+            timed(c, op, thd, 1);
+
+            ready++;
+            while (!go) {
+            }
+
+            const std::pair<uint64_t, uint64_t> &m =
+                timed(c, op, thd, nbatches);
+            nsecs[t] = m.first;
+            allocs[t] = m.second;
+        }));
+    }
+    while (ready < nthreads) {
+    }
+    go = true;
+    for (auto &it : threads) {
+        it.join();
+    }
+
+    bench_result r;
+    r.name = c.name;
+    r.size = c.sized ? size : 0;
+    r.batch = batch;
+    r.threads = nthreads;
+    r.ops = nbatches * batch * nthreads;
+
+    uint64_t total_ns = 0, total_allocs = 0;
+    for (unsigned int t = 0; t < nthreads; t++) {
+        total_ns += nsecs[t];
+        total_allocs += allocs[t];
+    }
+    r.ns_per_op = static_cast<double>(total_ns) / r.ops;
+    // > the threads start together, so the slowest one's time is the
+    //   wall time less the THD swaps
+    r.ops_per_s = r.ops * 1e9 / *std::max_element(nsecs.begin(),
+                                                   nsecs.end());
+    r.allocs_per_op = static_cast<double>(total_allocs) / r.ops;
+    return r;
+}
+
+/*
+ * Output and comparison
+ */
+
+static std::string
+toJSON(const bench_result &r)
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2)
+       << "{\"name\": \"" << r.name << "\", \"size\": " << r.size
+       << ", \"batch\": " << r.batch << ", \"threads\": " << r.threads
+       << ", \"ops\": " << r.ops << ", \"ns_per_op\": " << r.ns_per_op
+       << ", \"ops_per_s\": " << r.ops_per_s
+       << ", \"allocs_per_op\": " << r.allocs_per_op << "}";
+    return ss.str();
+}
+
+// Reads back what toJSON() wrote, one object per line; not a general
+// JSON parser.
+static std::string
+jsonField(const std::string &line, const std::string &field)
+{
+    const std::string tag = "\"" + field + "\": ";
+    size_t pos = line.find(tag);
+    if (std::string::npos == pos) {
+        return "";
+    }
+    pos += tag.length();
+    if ('"' == line[pos]) {
+        return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+    }
+    return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+static std::map<std::string, bench_result>
+readBaseline(const std::string &filename)
+{
+    std::ifstream in(filename);
+    throw_c(in.is_open(), "cannot open baseline " + filename);
+
+    std::map<std::string, bench_result> out;
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::string &name = jsonField(line, "name");
+        if (name.empty()) {
+            continue;
+        }
+        bench_result r;
+        r.name = name;
+        r.size = strtoull(jsonField(line, "size").c_str(), NULL, 10);
+        r.batch = strtoull(jsonField(line, "batch").c_str(), NULL, 10);
+        r.threads = strtoul(jsonField(line, "threads").c_str(), NULL, 10);
+        r.ns_per_op = strtod(jsonField(line, "ns_per_op").c_str(), NULL);
+        r.ops_per_s = strtod(jsonField(line, "ops_per_s").c_str(), NULL);
+        r.allocs_per_op =
+            strtod(jsonField(line, "allocs_per_op").c_str(), NULL);
+        out[r.key()] = r;
+    }
+    return out;
+}
+
+// Returns false if r is more than tolerance percent slower, or
+// allocates more, than its baseline.
+static bool
+compare(const bench_result &r,
+        const std::map<std::string, bench_result> &baseline,
+        double tolerance, std::ostream &out)
+{
+    const auto &it = baseline.find(r.key());
+    if (baseline.end() == it) {
+        out << std::left << std::setw(40) << r.key() << " (new)\n";
+        return true;
+    }
+
+    const bench_result &b = it->second;
+    const double change = 100.0 * (r.ns_per_op - b.ns_per_op) / b.ns_per_op;
+    const bool slower = change > tolerance;
+    const bool allocs = r.allocs_per_op > b.allocs_per_op + 0.01;
+    out << std::left << std::setw(40) << r.key() << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << b.ns_per_op << " -> "
+        << std::setw(12) << r.ns_per_op << " ns/op "
+        << std::showpos << std::setw(7) << change << "%" << std::noshowpos
+        << (slower ? "  SLOWER" : "")
+        << (allocs ? "  MORE ALLOCATIONS" : "") << "\n";
+    return !slower && !allocs;
+}
+
+static std::vector<size_t>
+parseList(const std::string &s)
+{
+    std::vector<size_t> out;
+    for (const auto &it : split(s, ",")) {
+        out.push_back(strtoul(it.c_str(), NULL, 10));
+    }
+    throw_c(!out.empty(), "empty list: " + s);
+    return out;
+}
+
+static void help(const char *prog)
+{
+    std::cout << "Usage: " << prog <<
+        " [-s sizes] [-b batches] [-j threads] [-t ms per case]"
+        " [-f name filter] [-c baseline file] [-r tolerance %]"
+        " [-o output file] [-l] [-u user -p password]"
+        " [-k master key] [-e embedded dir]" << "\n";
+}
+
+int main(int argc, char **argv)
+{
+    int c, optind = 0;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"list", no_argument, 0, 'l'},
+        {"sizes", required_argument, 0, 's'},
+        {"batches", required_argument, 0, 'b'},
+        {"threads", required_argument, 0, 'j'},
+        {"time", required_argument, 0, 't'},
+        {"filter", required_argument, 0, 'f'},
+        {"compare", required_argument, 0, 'c'},
+        {"tolerance", required_argument, 0, 'r'},
+        {"output", required_argument, 0, 'o'},
+        {"username", required_argument, 0, 'u'},
+        {"password", required_argument, 0, 'p'},
+        {"key", required_argument, 0, 'k'},
+        {"embedded", required_argument, 0, 'e'},
+        {NULL, 0, 0, 0},
+    };
+
+    std::string sizes("16,256");
+    std::string batches("1,64");
+    std::string nthreads("1");
+    unsigned int min_ms = 200;
+    std::string filter("");
+    std::string baseline("");
+    double tolerance = 10.0;
+    std::string output("");
+    bool list = false;
+    std::string username("");
+    std::string password("");
+    std::string master_key("2392834");
+    std::string embed_dir("/var/lib/shadow-mysql");
+
+    while(1)
+    {
+        c = getopt_long(argc, argv, "hls:b:j:t:f:c:r:o:u:p:k:e:",
+                        long_options, &optind);
+        if(c == -1)
+            break;
+
+        switch(c)
+        {
+            case 'h':
+                help(argv[0]);
+                exit(0);
+            case 'l':
+                list = true;
+                break;
+            case 's':
+                sizes = optarg;
+                break;
+            case 'b':
+                batches = optarg;
+                break;
+            case 'j':
+                nthreads = optarg;
+                break;
+            case 't':
+                min_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'c':
+                baseline = optarg;
+                break;
+            case 'r':
+                tolerance = strtod(optarg, NULL);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'u':
+                username = optarg;
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            case 'k':
+                master_key = optarg;
+                break;
+            case 'e':
+                embed_dir = optarg;
+                break;
+            case '?':
+                break;
+            default:
+                break;
+        }
+    }
+
+    mp_set_memory_functions(gmp_alloc, gmp_realloc, gmp_free);
+
+    const std::vector<bench_case> cases = bench_cases();
+    if (list) {
+        for (const auto &it : cases) {
+            std::cout << it.name << "\n";
+        }
+        return 0;
+    }
+
+    // > only the layers need the embedded server
+    std::vector<bench_case> selected;
+    bool layers = false;
+    for (const auto &it : cases) {
+        if (filter.empty() || std::string::npos != it.name.find(filter)) {
+            selected.push_back(it);
+            layers = layers || it.layer;
+        }
+    }
+    std::unique_ptr<SharedProxyState> shared;
+    if (layers) {
+        if (username.empty() || password.empty()) {
+            std::cerr << "the layer cases need -u and -p\n";
+            help(argv[0]);
+            return 1;
+        }
+        const ConnectionInfo ci("localhost", username, password);
+        shared.reset(new SharedProxyState(ci, embed_dir, master_key,
+                                          determineSecurityRating()));
+    }
+
+    std::map<std::string, bench_result> base;
+    if (!baseline.empty()) {
+        base = readBaseline(baseline);
+    }
+
+    std::ofstream file;
+    if (!output.empty()) {
+        file.open(output);
+        assert(file.is_open());
+    }
+    std::ostream &out = output.empty() ? std::cout : file;
+
+    bool ok = true;
+    bool first = true;
+    out << "[\n";
+    for (const auto &bc : selected) {
+        // > sizes do not apply to integer layers; measure those once
+        std::vector<size_t> case_sizes = parseList(sizes);
+        if (!bc.sized) {
+            case_sizes.resize(1);
+        }
+        for (auto size : case_sizes) {
+            for (auto batch : parseList(batches)) {
+                for (auto threads : parseList(nthreads)) {
+                    const bench_result &r =
+                        run(bc, size, batch, threads, min_ms,
+                            shared.get());
+                    out << (first ? "" : ",\n") << toJSON(r);
+                    out.flush();
+                    first = false;
+                    if (!baseline.empty()) {
+                        ok = compare(r, base, tolerance, std::cerr) && ok;
+                    }
+                }
+            }
+        }
+    }
+    out << "\n]\n";
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,661 @@
+/*
+ * trace_bench
+ *
+ * Replays a query trace through the rewriter, the executors and
+ * Rewriter::decryptResults without a running proxy, and reports the
+ * latency of each phase (see main/phase.hh) and the throughput of N
+ * concurrent sessions.
+ *
+ *   obj/bench/trace_bench -u root -p letmein -d wordpress \
+ *       -s traces/wordpress-install.sql -f traces/wordpress-usage.sql -j 4
+ *
+ * The setup trace (-s) runs once, unmeasured; every session then runs
+ * the workload trace (-f) -n times.
+ *
+ * Like mysql-proxy, the sessions take turns in the rewriter and only
+ * wait on the backend concurrently; each session has a connection of
+ * its own.
+ *
+ * Canned results: -w <file> saves the result set of every backend
+ * query that returns one; a later run with -r <file> answers those
+ * queries from the file, so that backend time drops out of the
+ * measurement. Queries without a canned result (writes, DDL and the
+ * metadata they update) still go to the server.
+ */
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <getopt.h>
+
+#include <main/rewrite_main.hh>
+#include <main/rewrite_util.hh>
+#include <main/phase.hh>
+#include <main/trace.hh>
+#include <parser/mysql_type_metadata.hh>
+#include <parser/sql_utils.hh>
+
+static void help(const char *prog)
+{
+    std::cout << "Usage: " << prog <<
+        " -u user -p password -d database -f workload trace"
+        " [-s setup trace] [-j sessions] [-n repeat]"
+        " [-w save results] [-r canned results] [-o histogram file]"
+        " [-k master key] [-e embedded dir]"
+        " [-t chrome trace file] [-m trace one statement in m]" << "\n";
+}
+
+/*
+ * Traces
+ */
+
+// Same format cryptdblearn reads: a statement ends at a line ending
+// with ';' or at a blank line; lines starting with '--' are comments.
+static std::vector<std::string>
+readTrace(const std::string &filename)
+{
+    std::ifstream input(filename);
+    assert(input.is_open());
+
+    std::vector<std::string> out;
+    std::string line;
+    std::string s;
+    while (std::getline(input, line)) {
+        if (0 == line.compare(0, 2, "--")) {
+            continue;
+        }
+
+        if (line.empty()) {
+            if (!s.empty()) {
+                out.push_back(s);
+                s.clear();
+            }
+            continue;
+        }
+
+        if (!s.empty()) {
+            s += "\n";
+        }
+        if (';' == *line.rbegin()) {
+            s += line.substr(0, line.size() - 1);
+            out.push_back(s);
+            s.clear();
+            continue;
+        }
+        s += line;
+    }
+    if (!s.empty()) {
+        out.push_back(s);
+    }
+
+    return out;
+}
+
+/*
+ * Canned results
+ *
+ * One record per result set:
+ *   <query length> <query>
+ *   <affected rows> <insert id> <columns> <rows>
+ *   per column: <type> <name length> <name>
+ *   per cell:   <length> <bytes>, or -1 for NULL
+ */
+
+struct CannedResult {
+    uint64_t affected_rows;
+    uint64_t insert_id;
+    std::vector<std::string> names;
+    std::vector<enum_field_types> types;
+    // > the string of a NULL cell is empty
+    std::vector<std::vector<std::string> > rows;
+    std::vector<std::vector<bool> > nulls;
+};
+
+static void
+writeBytes(std::ostream &out, const std::string &s)
+{
+    out << s.length() << " ";
+    out.write(s.data(), s.length());
+    out << "\n";
+}
+
+static bool
+readBytes(std::istream &in, std::string *const s)
+{
+    long long len;
+    if (!(in >> len) || len < 0) {
+        return false;
+    }
+    in.get();
+    s->resize(len);
+    in.read(&(*s)[0], len);
+    return !in.fail();
+}
+
+static void
+saveResult(std::ostream &out, const std::string &query, const ResType &res)
+{
+    writeBytes(out, query);
+    out << res.affected_rows << " " << res.insert_id << " "
+        << res.names.size() << " " << res.rows.size() << "\n";
+    for (unsigned int i = 0; i < res.names.size(); ++i) {
+        out << res.types[i] << " ";
+        writeBytes(out, res.names[i]);
+    }
+    for (const auto &row : res.rows) {
+        for (const Item *const item : row) {
+            if (item->is_null()) {
+                out << "-1\n";
+            } else {
+                writeBytes(out, ItemToString(*item));
+            }
+        }
+    }
+}
+
+static std::map<std::string, CannedResult>
+loadResults(const std::string &filename)
+{
+    std::ifstream in(filename);
+    assert(in.is_open());
+
+    std::map<std::string, CannedResult> out;
+    std::string query;
+    while (readBytes(in, &query)) {
+        CannedResult r;
+        size_t ncols, nrows;
+        in >> r.affected_rows >> r.insert_id >> ncols >> nrows;
+        for (size_t i = 0; i < ncols; ++i) {
+            int type;
+            std::string name;
+            in >> type;
+            in.get();
+            const bool read = readBytes(in, &name);
+            assert(read);
+            r.types.push_back(static_cast<enum_field_types>(type));
+            r.names.push_back(name);
+        }
+        for (size_t i = 0; i < nrows; ++i) {
+            std::vector<std::string> row(ncols);
+            std::vector<bool> nulls(ncols, false);
+            for (size_t j = 0; j < ncols; ++j) {
+                const std::streampos pos = in.tellg();
+                long long len;
+                in >> len;
+                if (-1 == len) {
+                    nulls[j] = true;
+                    continue;
+                }
+                in.seekg(pos);
+                const bool read = readBytes(in, &row[j]);
+                assert(read);
+            }
+            r.rows.push_back(row);
+            r.nulls.push_back(nulls);
+        }
+        assert(!in.fail());
+        out[query] = r;
+    }
+
+    return out;
+}
+
+// Builds the Items DBResult::unpack() would have.
+static std::unique_ptr<ResType>
+cannedResType(const CannedResult &r)
+{
+    std::vector<std::vector<Item *> > rows;
+    for (size_t i = 0; i < r.rows.size(); ++i) {
+        std::vector<Item *> row;
+        for (size_t j = 0; j < r.names.size(); ++j) {
+            const std::string &cell = r.rows[i][j];
+            if (r.nulls[i][j]) {
+                row.push_back(new Item_null());
+            } else if (isMySQLTypeNumeric(r.types[j])) {
+                row.push_back(new Item_int(static_cast<ulonglong>(
+                                               valFromStr(cell))));
+            } else {
+                row.push_back(new Item_string(make_thd_string(cell),
+                                              cell.length(),
+                                              &my_charset_bin));
+            }
+        }
+        rows.push_back(row);
+    }
+
+    std::vector<std::string> names(r.names);
+    std::vector<enum_field_types> types(r.types);
+    return std::unique_ptr<ResType>(
+        new ResType(true, r.affected_rows, r.insert_id, std::move(names),
+                    std::move(types), std::move(rows)));
+}
+
+/*
+ * Sessions
+ */
+
+// Per phase histograms of one session; merged when the run is over.
+class PhaseHistograms : public PhaseSink {
+public:
+    PhaseHistograms() : phases(phase_count) {}
+
+    void record(Phase p, unsigned int detail, uint64_t nsec) {
+        phases[static_cast<unsigned int>(p)].add(nsec);
+    }
+    void merge(const PhaseHistograms &other) {
+        for (unsigned int i = 0; i < phase_count; ++i) {
+            phases[i].merge(other.phases[i]);
+        }
+        statements.merge(other.statements);
+    }
+
+    std::vector<LatencyHistogram> phases;
+    LatencyHistogram statements;
+};
+
+struct ReplayState {
+    SharedProxyState &shared;
+    const ConnectionInfo ci;
+    const std::string dbname;
+
+    // > the rewriter keeps process wide state (ie, DeferredOnions) and
+    //   expects one query at a time, as in mysql-proxy
+    std::mutex proxy;
+
+    std::unique_ptr<std::ofstream> save;
+    std::map<std::string, CannedResult> canned;
+    std::atomic<uint64_t> canned_hits;
+    std::atomic<uint64_t> failed;
+
+    ReplayState(SharedProxyState &shared, const ConnectionInfo &ci,
+                const std::string &dbname)
+        : shared(shared), ci(ci), dbname(dbname), canned_hits(0),
+          failed(0) {}
+};
+
+class Session {
+public:
+    Session(ReplayState &rs)
+        : rs(rs), ps(rs.shared),
+          conn(new Connect(rs.ci.server, rs.ci.user, rs.ci.passwd,
+                           rs.ci.port)),
+          dbname(rs.dbname)
+    {
+        // > without a setup trace the database may not exist yet
+        conn->execute("USE `" + dbname + "`;");
+    }
+
+    // Mirrors executeQuery(...).
+    bool run(const std::string &query);
+
+    PhaseHistograms histograms;
+
+private:
+    ReplayState &rs;
+    ProxyState ps;
+    const std::unique_ptr<Connect> conn;
+    std::string dbname;
+
+    std::unique_ptr<ResType> backend(const std::string &q,
+                                     std::unique_lock<std::mutex> *lock);
+};
+
+std::unique_ptr<ResType>
+Session::backend(const std::string &q, std::unique_lock<std::mutex> *lock)
+{
+    const auto &it = rs.canned.find(q);
+    if (rs.canned.end() != it) {
+        ++rs.canned_hits;
+        return cannedResType(it->second);
+    }
+
+    const TraceSpan span("query", "query", q);
+    std::unique_ptr<DBResult> dbres;
+    bool ok;
+    {
+        const PhaseTimer t(Phase::BACKEND);
+        lock->unlock();
+        ok = conn->execute(q, &dbres);
+        lock->lock();
+    }
+    if (false == ok || !dbres) {
+        return std::unique_ptr<ResType>(new ResType(false, 0, 0));
+    }
+
+    std::unique_ptr<ResType> res(new ResType(dbres->unpack()));
+    if (rs.save && false == res->names.empty()) {
+        saveResult(*rs.save, q, *res);
+    }
+    return res;
+}
+
+bool
+Session::run(const std::string &query)
+{
+    // The traces record COM_INIT_DB as a bare database name.
+    std::string q = query;
+    if (std::string::npos == q.find_first_of(" \t\n")) {
+        q = "USE " + q;
+    }
+    if (0 == toLowerCase(q).compare(0, 4, "use ")) {
+        dbname = q.substr(4);
+        dbname.erase(std::remove(dbname.begin(), dbname.end(), '`'),
+                     dbname.end());
+    }
+
+    std::unique_lock<std::mutex> lock(rs.proxy);
+    const uint64_t start = PhaseTimer::now();
+    thread_ps = &ps;
+    ps.safeCreateEmbeddedTHD();
+
+    const std::unique_ptr<QueryTrace> trace(QueryTrace::sample(q));
+    const QueryTrace::Scope trace_scope(trace.get());
+    bool ok = false;
+    try {
+        const std::shared_ptr<const SchemaInfo> &schema =
+            ps.getSchemaInfo();
+        const QueryRewrite qr =
+            Rewriter::rewrite(q, *schema.get(), dbname, ps);
+        const NextParams nparams(ps, dbname, q);
+
+        std::unique_ptr<ResType> res(new ResType(true, 0, 0));
+        while (true) {
+            const auto &new_results = qr.executor->next(*res, nparams);
+            const std::unique_ptr<AbstractAnything>
+                output(new_results.second);
+            const auto type = new_results.first;
+            if (AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN
+                == type) {
+                res = this->backend(
+                    output->extract<std::pair<bool, std::string> >().second,
+                    &lock);
+                continue;
+            } else if (AbstractQueryExecutor::ResultType::QUERY_USE_RESULTS
+                       == type) {
+                ok = this->backend(output->extract<std::string>(),
+                                   &lock)->ok;
+            } else {
+                assert(AbstractQueryExecutor::ResultType::RESULTS == type);
+                ok = output->extract<ResType>().ok;
+            }
+            break;
+        }
+    } catch (const ErrorPacketException &e) {
+        std::cerr << "failed: " << q << "\n  " << e.getMessage() << "\n";
+    } catch (const AbstractException &e) {
+        std::cerr << "failed: " << q << "\n  " << e.to_string() << "\n";
+    } catch (const CryptDBError &e) {
+        std::cerr << "failed: " << q << "\n  " << e.msg << "\n";
+    }
+
+    histograms.statements.add(PhaseTimer::now() - start);
+    if (!ok) {
+        ++rs.failed;
+    }
+    return ok;
+}
+
+/*
+ * Report
+ */
+
+static void
+printRow(std::ostream &out, const std::string &name,
+         const LatencyHistogram &h)
+{
+    const double usec = 1000.0;
+    out << std::left << std::setw(14) << name << std::right
+        << std::setw(10) << h.count() << std::fixed << std::setprecision(1)
+        << std::setw(12) << (h.count() ? h.total() / usec / h.count() : 0)
+        << std::setw(12) << h.percentile(50) / usec
+        << std::setw(12) << h.percentile(90) / usec
+        << std::setw(12) << h.percentile(99) / usec
+        << std::setw(12) << h.maximum() / usec
+        << std::setw(14) << h.total() / usec / 1000.0 << "\n";
+}
+
+static void
+report(std::ostream &out, const PhaseHistograms &all, unsigned int sessions,
+       uint64_t wall_nsec, const ReplayState &rs)
+{
+    out << std::left << std::setw(14) << "phase" << std::right
+        << std::setw(10) << "count" << std::setw(12) << "mean us"
+        << std::setw(12) << "p50 us" << std::setw(12) << "p90 us"
+        << std::setw(12) << "p99 us" << std::setw(12) << "max us"
+        << std::setw(14) << "total ms" << "\n";
+    for (unsigned int i = 0; i < phase_count; ++i) {
+        printRow(out, phaseName(static_cast<Phase>(i)), all.phases[i]);
+    }
+    printRow(out, "statement", all.statements);
+
+    const uint64_t n = all.statements.count();
+    out << "\n" << n << " statements (" << rs.failed << " failed) in "
+        << std::fixed << std::setprecision(2) << wall_nsec / 1e9
+        << " s by " << sessions << " sessions: "
+        << std::setprecision(1) << n * 1e9 / wall_nsec
+        << " statements/s\n";
+    if (false == rs.canned.empty()) {
+        out << rs.canned_hits << " backend queries answered from canned"
+            << " results\n";
+    }
+}
+
+// One line per phase, for plotting.
+static void
+writeHistograms(std::ostream &out, const PhaseHistograms &all)
+{
+    auto line = [&out](const std::string &name, const LatencyHistogram &h) {
+        out << "{\"phase\": \"" << name << "\", \"buckets\": [";
+        bool first = true;
+        for (const auto &it : h.nonEmpty()) {
+            out << (first ? "" : ", ") << "[" << it.first << ", "
+                << it.second << "]";
+            first = false;
+        }
+        out << "]}\n";
+    };
+
+    for (unsigned int i = 0; i < phase_count; ++i) {
+        line(phaseName(static_cast<Phase>(i)), all.phases[i]);
+    }
+    line("statement", all.statements);
+}
+
+int main(int argc, char **argv)
+{
+    int c, optind = 0;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"username", required_argument, 0, 'u'},
+        {"password", required_argument, 0, 'p'},
+        {"dbname", required_argument, 0, 'd'},
+        {"file", required_argument, 0, 'f'},
+        {"setup", required_argument, 0, 's'},
+        {"sessions", required_argument, 0, 'j'},
+        {"repeat", required_argument, 0, 'n'},
+        {"save", required_argument, 0, 'w'},
+        {"canned", required_argument, 0, 'r'},
+        {"output", required_argument, 0, 'o'},
+        {"key", required_argument, 0, 'k'},
+        {"embedded", required_argument, 0, 'e'},
+        {"trace", required_argument, 0, 't'},
+        {"sample", required_argument, 0, 'm'},
+        {NULL, 0, 0, 0},
+    };
+
+    std::string username("");
+    std::string password("");
+    std::string dbname("");
+    std::string filename("");
+    std::string setup("");
+    unsigned int sessions = 1;
+    unsigned int repeat = 1;
+    std::string save("");
+    std::string canned("");
+    std::string output("");
+    std::string master_key("2392834");
+    std::string embed_dir("/var/lib/shadow-mysql");
+    std::string trace_file("");
+    unsigned int sample = 1;
+
+    while(1)
+    {
+        c = getopt_long(argc, argv, "hu:p:d:f:s:j:n:w:r:o:k:e:t:m:",
+                        long_options, &optind);
+        if(c == -1)
+            break;
+
+        switch(c)
+        {
+            case 'h':
+                help(argv[0]);
+                exit(0);
+            case 'u':
+                username = optarg;
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            case 'd':
+                dbname = optarg;
+                break;
+            case 'f':
+                filename = optarg;
+                break;
+            case 's':
+                setup = optarg;
+                break;
+            case 'j':
+                sessions = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                repeat = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                save = optarg;
+                break;
+            case 'r':
+                canned = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'k':
+                master_key = optarg;
+                break;
+            case 'e':
+                embed_dir = optarg;
+                break;
+            case 't':
+                trace_file = optarg;
+                break;
+            case 'm':
+                sample = strtoul(optarg, NULL, 10);
+                break;
+            case '?':
+                break;
+            default:
+                break;
+        }
+    }
+
+    assert(username != "");
+    assert(password != "");
+    assert(dbname != "");
+    assert(filename != "");
+    assert(sessions > 0);
+
+    const std::vector<std::string> &workload = readTrace(filename);
+
+    ConnectionInfo ci("localhost", username, password);
+    SharedProxyState shared_ps(ci, embed_dir, master_key,
+                               determineSecurityRating());
+    ReplayState rs(shared_ps, ci, dbname);
+    if (save != "") {
+        rs.save.reset(new std::ofstream(save));
+        assert(rs.save->is_open());
+    }
+    if (canned != "") {
+        rs.canned = loadResults(canned);
+    }
+
+    if (trace_file != "") {
+        const bool b = QueryTrace::configure(trace_file, sample);
+        assert(b);
+    }
+
+    if (setup != "") {
+        ProxyState ps(shared_ps);
+        std::string db = dbname;
+        for (const auto &it : readTrace(setup)) {
+            if (std::string::npos == it.find_first_of(" \t\n")) {
+                db = it;
+                continue;
+            }
+            if (false == executeQuery(ps, it, db)) {
+                std::cerr << "setup failed: " << it << "\n";
+            }
+        }
+    }
+
+    // > each session lives in its thread, the embedded THDs are per
+    //   thread
+    std::vector<std::unique_ptr<Session> > all_sessions(sessions);
+    std::atomic<unsigned int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < sessions; ++i) {
+        threads.push_back(std::thread([&, i]() {
+            assert(0 == mysql_thread_init());
+            {
+                const std::lock_guard<std::mutex> lock(rs.proxy);
+                all_sessions[i].reset(new Session(rs));
+            }
+            Session *const s = all_sessions[i].get();
+
+            ++ready;
+            while (!go) {
+                std::this_thread::yield();
+            }
+
+            PhaseTimer::setSink(&s->histograms);
+            for (unsigned int r = 0; r < repeat; ++r) {
+                for (const auto &q : workload) {
+                    s->run(q);
+                }
+            }
+            PhaseTimer::setSink(NULL);
+        }));
+    }
+    while (ready < sessions) {
+        std::this_thread::yield();
+    }
+
+    const uint64_t start = PhaseTimer::now();
+    go = true;
+    for (auto &it : threads) {
+        it.join();
+    }
+    const uint64_t wall = PhaseTimer::now() - start;
+
+    PhaseHistograms all;
+    for (const auto &it : all_sessions) {
+        all.merge(it->histograms);
+    }
+    report(std::cout, all, sessions, wall, rs);
+    if (output != "") {
+        std::ofstream out(output);
+        assert(out.is_open());
+        writeHistograms(out, all);
+    }
+
+    return 0;
+}
@@ -7,6 +7,8 @@
 #include <climits>
 
 #include <crypto/BasicCrypto.hh>
+#include <crypto/aes.hh>
+#include <crypto/ffx.hh>
 #include <util/ctr.hh>
 #include <util/util.hh>
 #include <util/cryptdb_log.hh>
@@ -321,6 +323,473 @@ decrypt_AES_CMC(const string &ctext, const AES_KEY * deckey, bool dopad)
 }
 
 
+//**************** Buffer-based AES (EVP) ****************/
+
+static EVP_CIPHER_CTX *
+newAESContext(const EVP_CIPHER *const cipher, const string &key, int enc)
+{
+    if (key.size() != AES_KEY_BYTES) {
+        throw CryptoError("AES key is the wrong size!");
+    }
+
+    EVP_CIPHER_CTX *const ctx = EVP_CIPHER_CTX_new();
+    throw_c(ctx);
+    if (1 != EVP_CipherInit_ex(ctx, cipher, NULL,
+                               (const uint8_t *) key.data(), NULL, enc)
+        || 1 != EVP_CIPHER_CTX_set_padding(ctx, 0)) {
+        EVP_CIPHER_CTX_free(ctx);
+        throw CryptoError("failed to initialize AES context");
+    }
+
+    return ctx;
+}
+
+// the key schedule stays in ctx; only the IV is reset for each call
+static void
+runAESContext(EVP_CIPHER_CTX *const ctx, const uint8_t *const ivec,
+              const uint8_t *const in, uint8_t *const out, size_t len)
+{
+    throw_c((len % AES_BLOCK_BYTES) == 0 && len <= INT_MAX);
+    if (0 == len) {
+        return;
+    }
+
+    int outl = 0;
+    throw_c(1 == EVP_CipherInit_ex(ctx, NULL, NULL, NULL, ivec, -1));
+    throw_c(1 == EVP_CipherUpdate(ctx, out, &outl, in,
+                                  static_cast<int>(len)));
+    throw_c(static_cast<size_t>(outl) == len);
+}
+
+AES_EVP::AES_EVP(const string &key)
+    : cbc_enc(newAESContext(EVP_aes_128_cbc(), key, 1)),
+      cbc_dec(newAESContext(EVP_aes_128_cbc(), key, 0)),
+      ecb_enc(newAESContext(EVP_aes_128_ecb(), key, 1)),
+      ecb_dec(newAESContext(EVP_aes_128_ecb(), key, 0))
+{}
+
+AES_EVP::~AES_EVP()
+{
+    EVP_CIPHER_CTX_free(cbc_enc);
+    EVP_CIPHER_CTX_free(cbc_dec);
+    EVP_CIPHER_CTX_free(ecb_enc);
+    EVP_CIPHER_CTX_free(ecb_dec);
+}
+
+void
+AES_EVP::cbc_encrypt(const uint8_t *in, uint8_t *out, size_t len,
+                     const uint8_t *ivec) const
+{
+    runAESContext(cbc_enc, ivec, in, out, len);
+}
+
+void
+AES_EVP::cbc_decrypt(const uint8_t *in, uint8_t *out, size_t len,
+                     const uint8_t *ivec) const
+{
+    runAESContext(cbc_dec, ivec, in, out, len);
+}
+
+void
+AES_EVP::ecb_encrypt(const uint8_t *in, uint8_t *out, size_t len) const
+{
+    runAESContext(ecb_enc, NULL, in, out, len);
+}
+
+void
+AES_EVP::ecb_decrypt(const uint8_t *in, uint8_t *out, size_t len) const
+{
+    runAESContext(ecb_dec, NULL, in, out, len);
+}
+
+// same IV as getIVec("0"), which the CMC functions above use
+static const uint8_t cmc_ivec[AES_BLOCK_BYTES] = {'0'};
+
+static void
+fillIVec(const string &salt, uint8_t *const ivec)
+{
+    memset(ivec, 0, AES_BLOCK_BYTES);
+    memcpy(ivec, salt.data(), min(salt.length(), (size_t) AES_BLOCK_BYTES));
+}
+
+size_t
+AES_CBC_len(size_t len, bool dopad)
+{
+    if (dopad) {
+        return (len / AES_BLOCK_BYTES + 1) * AES_BLOCK_BYTES;
+    }
+
+    throw_c((len % AES_BLOCK_BYTES) == 0);
+    return len;
+}
+
+// copies ptext into out (which may alias it) and pads it the same way
+// pad() does; returns the padded length
+static size_t
+padInto(const void *const ptext, size_t len, uint8_t *const out, bool dopad)
+{
+    const size_t padded = AES_CBC_len(len, dopad);
+    memmove(out, ptext, len);
+    if (dopad) {
+        memset(out + len, 0, padded - len);
+        out[padded - 1] = static_cast<uint8_t>(padded - len);
+    }
+
+    return padded;
+}
+
+static size_t
+unpaddedLen(const uint8_t *const data, size_t len)
+{
+    throw_c((len > 0) && ((len % AES_BLOCK_BYTES) == 0));
+    const size_t pad_count = data[len - 1];
+    if (false == ((pad_count > 0) && (pad_count <= AES_BLOCK_BYTES))) {
+        throw CryptoError("AES padding is wrong size!");
+    }
+
+    return len - pad_count;
+}
+
+static void
+reverseBlocks(uint8_t *const buf, size_t len)
+{
+    const size_t noBlocks = len / AES_BLOCK_BYTES;
+    throw_c(len == noBlocks * AES_BLOCK_BYTES);
+
+    for (size_t i = 0, j = noBlocks; i + 1 < j; ++i, --j) {
+        swap_ranges(buf + i * AES_BLOCK_BYTES,
+                    buf + (i + 1) * AES_BLOCK_BYTES,
+                    buf + (j - 1) * AES_BLOCK_BYTES);
+    }
+}
+
+size_t
+encrypt_AES_CBC(const void *ptext, size_t len, const AES_EVP &aes,
+                const string &salt, void *ctext, bool dopad)
+{
+    uint8_t ivec[AES_BLOCK_BYTES];
+    fillIVec(salt, ivec);
+
+    uint8_t *const out = static_cast<uint8_t *>(ctext);
+    const size_t padded = padInto(ptext, len, out, dopad);
+    aes.cbc_encrypt(out, out, padded, ivec);
+
+    return padded;
+}
+
+size_t
+decrypt_AES_CBC(const void *ctext, size_t len, const AES_EVP &aes,
+                const string &salt, void *ptext, bool dounpad)
+{
+    throw_c((len > 0) && ((len % AES_BLOCK_BYTES) == 0));
+
+    uint8_t ivec[AES_BLOCK_BYTES];
+    fillIVec(salt, ivec);
+
+    uint8_t *const out = static_cast<uint8_t *>(ptext);
+    aes.cbc_decrypt(static_cast<const uint8_t *>(ctext), out, len, ivec);
+
+    return dounpad ? unpaddedLen(out, len) : len;
+}
+
+size_t
+encrypt_AES_CMC(const void *ptext, size_t len, const AES_EVP &aes,
+                void *ctext, bool dopad)
+{
+    uint8_t *const out = static_cast<uint8_t *>(ctext);
+    const size_t padded = padInto(ptext, len, out, dopad);
+
+    aes.cbc_encrypt(out, out, padded, cmc_ivec);
+    reverseBlocks(out, padded);
+    aes.cbc_encrypt(out, out, padded, cmc_ivec);
+
+    return padded;
+}
+
+size_t
+decrypt_AES_CMC(const void *ctext, size_t len, const AES_EVP &aes,
+                void *ptext, bool dounpad)
+{
+    throw_c((len > 0) && ((len % AES_BLOCK_BYTES) == 0));
+
+    uint8_t *const out = static_cast<uint8_t *>(ptext);
+    aes.cbc_decrypt(static_cast<const uint8_t *>(ctext), out, len,
+                    cmc_ivec);
+    reverseBlocks(out, len);
+    aes.cbc_decrypt(out, out, len, cmc_ivec);
+
+    return dounpad ? unpaddedLen(out, len) : len;
+}
+
+string
+encrypt_AES_CBC(const string &ptext, const AES_EVP &aes, const string &salt,
+                bool dopad)
+{
+    string ctext(AES_CBC_len(ptext.size(), dopad), '\0');
+    encrypt_AES_CBC(ptext.data(), ptext.size(), aes, salt, &ctext[0],
+                    dopad);
+    return ctext;
+}
+
+string
+decrypt_AES_CBC(const string &ctext, const AES_EVP &aes, const string &salt,
+                bool dounpad)
+{
+    string ptext(ctext.size(), '\0');
+    ptext.resize(decrypt_AES_CBC(ctext.data(), ctext.size(), aes, salt,
+                                 &ptext[0], dounpad));
+    return ptext;
+}
+
+string
+encrypt_AES_CMC(const string &ptext, const AES_EVP &aes, bool dopad)
+{
+    string ctext(AES_CBC_len(ptext.size(), dopad), '\0');
+    encrypt_AES_CMC(ptext.data(), ptext.size(), aes, &ctext[0], dopad);
+    return ctext;
+}
+
+string
+decrypt_AES_CMC(const string &ctext, const AES_EVP &aes, bool dounpad)
+{
+    string ptext(ctext.size(), '\0');
+    ptext.resize(decrypt_AES_CMC(ctext.data(), ctext.size(), aes,
+                                 &ptext[0], dounpad));
+    return ptext;
+}
+
+/*
+ * CBC encryption is serial within a value, so a lone short value leaves
+ * the AES pipeline mostly idle. Here round i gathers block i of every
+ * value (xored with its chaining block) into one lane and encrypts the
+ * whole lane with a single ECB call.
+ */
+static void
+cbcEncryptLanes(const AES_EVP &aes, const vector<string *> &bufs,
+                const vector<const uint8_t *> &ivecs)
+{
+    assert(bufs.size() == ivecs.size());
+
+    size_t max_len = 0;
+    for (auto it : bufs) {
+        max_len = max(max_len, it->size());
+    }
+
+    vector<uint8_t> lane(bufs.size() * AES_BLOCK_BYTES);
+    vector<uint8_t *> live;
+    live.reserve(bufs.size());
+    for (size_t off = 0; off < max_len; off += AES_BLOCK_BYTES) {
+        live.clear();
+        for (size_t j = 0; j < bufs.size(); ++j) {
+            if (bufs[j]->size() <= off) {
+                continue;
+            }
+
+            uint8_t *const cur = (uint8_t *) &(*bufs[j])[off];
+            const uint8_t *const prev =
+                0 == off ? ivecs[j] : cur - AES_BLOCK_BYTES;
+            uint8_t *const slot = &lane[live.size() * AES_BLOCK_BYTES];
+            for (size_t k = 0; k < AES_BLOCK_BYTES; ++k) {
+                slot[k] = cur[k] ^ prev[k];
+            }
+            live.push_back(cur);
+        }
+
+        aes.ecb_encrypt(&lane[0], &lane[0], live.size() * AES_BLOCK_BYTES);
+        for (size_t j = 0; j < live.size(); ++j) {
+            memcpy(live[j], &lane[j * AES_BLOCK_BYTES], AES_BLOCK_BYTES);
+        }
+    }
+}
+
+/*
+ * CBC decryption has no chaining dependency, so every block of every
+ * value goes through one ECB call; the xor with the previous ciphertext
+ * block is done afterwards, back to front so it can be done in place.
+ */
+static void
+cbcDecryptLanes(const AES_EVP &aes, const vector<string *> &bufs,
+                const vector<const uint8_t *> &ivecs)
+{
+    assert(bufs.size() == ivecs.size());
+
+    if (bufs.empty()) {
+        return;
+    }
+
+    size_t total = 0;
+    for (auto it : bufs) {
+        throw_c((it->size() > 0) && ((it->size() % AES_BLOCK_BYTES) == 0));
+        total += it->size();
+    }
+
+    vector<uint8_t> joined(total);
+    size_t pos = 0;
+    for (auto it : bufs) {
+        memcpy(&joined[pos], it->data(), it->size());
+        pos += it->size();
+    }
+    aes.ecb_decrypt(&joined[0], &joined[0], total);
+
+    pos = 0;
+    for (size_t j = 0; j < bufs.size(); ++j) {
+        uint8_t *const buf = (uint8_t *) &(*bufs[j])[0];
+        const size_t len = bufs[j]->size();
+        for (size_t off = len; off != 0; off -= AES_BLOCK_BYTES) {
+            const size_t cur = off - AES_BLOCK_BYTES;
+            const uint8_t *const prev =
+                0 == cur ? ivecs[j] : buf + cur - AES_BLOCK_BYTES;
+            for (size_t k = 0; k < AES_BLOCK_BYTES; ++k) {
+                buf[cur + k] = joined[pos + cur + k] ^ prev[k];
+            }
+        }
+        pos += len;
+    }
+}
+
+static vector<string>
+padAll(const vector<string> &ptexts, bool dopad,
+       vector<string *> *const bufs)
+{
+    vector<string> out(ptexts.size());
+    bufs->reserve(ptexts.size());
+    for (size_t i = 0; i < ptexts.size(); ++i) {
+        out[i].resize(AES_CBC_len(ptexts[i].size(), dopad));
+        padInto(ptexts[i].data(), ptexts[i].size(), (uint8_t *) &out[i][0],
+                dopad);
+        bufs->push_back(&out[i]);
+    }
+
+    return out;
+}
+
+static void
+unpadAll(vector<string> *const ptexts, bool dounpad)
+{
+    if (dounpad) {
+        for (auto &it : *ptexts) {
+            it.resize(unpaddedLen((const uint8_t *) it.data(), it.size()));
+        }
+    }
+}
+
+vector<string>
+encrypt_AES_CBC_batch(const vector<string> &ptexts, const AES_EVP &aes,
+                      const vector<string> &salts, bool dopad)
+{
+    throw_c(ptexts.size() == salts.size());
+
+    vector<string *> bufs;
+    vector<string> ctexts = padAll(ptexts, dopad, &bufs);
+
+    vector<uint8_t> ivec_store(salts.size() * AES_BLOCK_BYTES);
+    vector<const uint8_t *> ivecs;
+    for (size_t i = 0; i < salts.size(); ++i) {
+        fillIVec(salts[i], &ivec_store[i * AES_BLOCK_BYTES]);
+        ivecs.push_back(&ivec_store[i * AES_BLOCK_BYTES]);
+    }
+
+    cbcEncryptLanes(aes, bufs, ivecs);
+    return ctexts;
+}
+
+vector<string>
+decrypt_AES_CBC_batch(const vector<string> &ctexts, const AES_EVP &aes,
+                      const vector<string> &salts, bool dounpad)
+{
+    throw_c(ctexts.size() == salts.size());
+
+    vector<string> ptexts(ctexts);
+    vector<string *> bufs;
+    vector<uint8_t> ivec_store(salts.size() * AES_BLOCK_BYTES);
+    vector<const uint8_t *> ivecs;
+    for (size_t i = 0; i < salts.size(); ++i) {
+        fillIVec(salts[i], &ivec_store[i * AES_BLOCK_BYTES]);
+        ivecs.push_back(&ivec_store[i * AES_BLOCK_BYTES]);
+        bufs.push_back(&ptexts[i]);
+    }
+
+    cbcDecryptLanes(aes, bufs, ivecs);
+    unpadAll(&ptexts, dounpad);
+    return ptexts;
+}
+
+vector<string>
+encrypt_AES_CMC_batch(const vector<string> &ptexts, const AES_EVP &aes,
+                      bool dopad)
+{
+    vector<string *> bufs;
+    vector<string> ctexts = padAll(ptexts, dopad, &bufs);
+    const vector<const uint8_t *> ivecs(bufs.size(), cmc_ivec);
+
+    cbcEncryptLanes(aes, bufs, ivecs);
+    for (auto it : bufs) {
+        reverseBlocks((uint8_t *) &(*it)[0], it->size());
+    }
+    cbcEncryptLanes(aes, bufs, ivecs);
+
+    return ctexts;
+}
+
+vector<string>
+decrypt_AES_CMC_batch(const vector<string> &ctexts, const AES_EVP &aes,
+                      bool dounpad)
+{
+    vector<string> ptexts(ctexts);
+    vector<string *> bufs;
+    for (auto &it : ptexts) {
+        bufs.push_back(&it);
+    }
+    const vector<const uint8_t *> ivecs(bufs.size(), cmc_ivec);
+
+    cbcDecryptLanes(aes, bufs, ivecs);
+    for (auto it : bufs) {
+        reverseBlocks((uint8_t *) &(*it)[0], it->size());
+    }
+    cbcDecryptLanes(aes, bufs, ivecs);
+
+    unpadAll(&ptexts, dounpad);
+    return ptexts;
+}
+
+
+//**************** Format preserving (FFX) ****************//
+
+// > the halves of an FFX[2] block are at most 64 bits each
+static string
+ffx_crypt(const string &in, const AES &key, bool encrypt)
+{
+    throw_c(in.size() <= FFX_MAX_BYTES);
+    if (in.empty()) {
+        return in;
+    }
+
+    const ffx2<AES> f(&key, in.size() * 8, vector<uint8_t>());
+    string out(in.size(), '\0');
+    const uint8_t *const src = (const uint8_t *) in.data();
+    uint8_t *const dst = (uint8_t *) &out[0];
+    if (encrypt) {
+        f.encrypt(src, dst);
+    } else {
+        f.decrypt(src, dst);
+    }
+
+    return out;
+}
+
+string
+encrypt_FFX(const string &ptext, const AES &key)
+{
+    return ffx_crypt(ptext, key, true);
+}
+
+string
+decrypt_FFX(const string &ctext, const AES &key)
+{
+    return ffx_crypt(ctext, key, false);
+}
+
+
 //**************** Public Key Cryptosystem (PKCS)
 // ****************************************/
 
@@ -67,6 +67,116 @@ std::string
 decrypt_AES_CMC(const std::string &ctext, const AES_KEY * deckey, bool dopad = true);
 
 
+//**** Buffer-based AES (EVP) *****//
+
+/*
+ * AES-128 keyed once through EVP, so OpenSSL can use AES-NI. All
+ * operations write into caller buffers and may work in place (in == out).
+ * Lengths must be multiples of blocksize.
+ *
+ * Not thread safe: the cipher contexts are reused between calls.
+ */
+class AES_EVP {
+public:
+    explicit AES_EVP(const std::string &key);
+    ~AES_EVP();
+
+    void cbc_encrypt(const uint8_t *in, uint8_t *out, size_t len,
+                     const uint8_t *ivec) const;
+    void cbc_decrypt(const uint8_t *in, uint8_t *out, size_t len,
+                     const uint8_t *ivec) const;
+    void ecb_encrypt(const uint8_t *in, uint8_t *out, size_t len) const;
+    void ecb_decrypt(const uint8_t *in, uint8_t *out, size_t len) const;
+
+    static const size_t blocksize = 16;
+
+private:
+    EVP_CIPHER_CTX *const cbc_enc;
+    EVP_CIPHER_CTX *const cbc_dec;
+    EVP_CIPHER_CTX *const ecb_enc;
+    EVP_CIPHER_CTX *const ecb_dec;
+
+    AES_EVP(const AES_EVP &) = delete;
+    AES_EVP &operator=(const AES_EVP &) = delete;
+};
+
+// length of the CBC/CMC ciphertext for a plaintext of len bytes
+size_t AES_CBC_len(size_t len, bool dopad = true);
+
+// ctext must hold AES_CBC_len(len, dopad) bytes; returns the bytes written
+size_t
+encrypt_AES_CBC(const void *ptext, size_t len, const AES_EVP &aes,
+                const std::string &salt, void *ctext, bool dopad = true);
+
+// ptext must hold len bytes; returns the plaintext length
+size_t
+decrypt_AES_CBC(const void *ctext, size_t len, const AES_EVP &aes,
+                const std::string &salt, void *ptext, bool dounpad = true);
+
+size_t
+encrypt_AES_CMC(const void *ptext, size_t len, const AES_EVP &aes,
+                void *ctext, bool dopad = true);
+
+size_t
+decrypt_AES_CMC(const void *ctext, size_t len, const AES_EVP &aes,
+                void *ptext, bool dounpad = true);
+
+std::string
+encrypt_AES_CBC(const std::string &ptext, const AES_EVP &aes,
+                const std::string &salt, bool dopad = true);
+
+std::string
+decrypt_AES_CBC(const std::string &ctext, const AES_EVP &aes,
+                const std::string &salt, bool dounpad = true);
+
+std::string
+encrypt_AES_CMC(const std::string &ptext, const AES_EVP &aes,
+                bool dopad = true);
+
+std::string
+decrypt_AES_CMC(const std::string &ctext, const AES_EVP &aes,
+                bool dounpad = true);
+
+// Batch versions for many independent (short) values. The CBC chains of
+// all values are advanced side by side so each cipher call gets a full
+// lane of independent blocks to pipeline.
+std::vector<std::string>
+encrypt_AES_CBC_batch(const std::vector<std::string> &ptexts,
+                      const AES_EVP &aes,
+                      const std::vector<std::string> &salts,
+                      bool dopad = true);
+
+std::vector<std::string>
+decrypt_AES_CBC_batch(const std::vector<std::string> &ctexts,
+                      const AES_EVP &aes,
+                      const std::vector<std::string> &salts,
+                      bool dounpad = true);
+
+std::vector<std::string>
+encrypt_AES_CMC_batch(const std::vector<std::string> &ptexts,
+                      const AES_EVP &aes, bool dopad = true);
+
+std::vector<std::string>
+decrypt_AES_CMC_batch(const std::vector<std::string> &ctexts,
+                      const AES_EVP &aes, bool dounpad = true);
+
+
+//**** Format preserving (FFX) *****//
+
+class AES;
+
+// FFX[2] (crypto/ffx.hh) over the bits of a string of at most
+// FFX_MAX_BYTES bytes; the ciphertext is exactly as long as the
+// plaintext. Each length is a permutation of its own.
+const size_t FFX_MAX_BYTES = 16;
+
+std::string
+encrypt_FFX(const std::string &ptext, const AES &key);
+
+std::string
+decrypt_FFX(const std::string &ctext, const AES &key);
+
+
 //**** Public Key Cryptosystem (PKCS) *****//
 
 typedef RSA PKCS;
@@ -363,3 +363,106 @@ SWP::searchExists(const Token & token, const list<string> & ciphs)
     return false;
 }
 
+bool
+SWP::searchExists(const Token & token, const char * ciphs, size_t len)
+{
+    throw_c(len % SWPCiphSize == 0, "searchExists receives invalid input");
+
+    for (size_t i = 0; i < len; i += SWPCiphSize) {
+        if (SWPsearch(token, string(ciphs + i, SWPCiphSize))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**************************** Bloom filter ****************/
+
+static_assert(SWPBloomHashes * SWPBloomPosBytes <= AES_BLOCK_SIZE,
+              "the bit positions are bytes of one PRP output");
+
+size_t
+SWP::bloomBytes(size_t nwords)
+{
+    return (nwords * SWPBloomBitsPerWord + 7) / 8;
+}
+
+string
+SWP::bloomMask(const string & key, const string & word)
+{
+    string ciph, wordKey;
+    SWPHalfEncrypt(key, word, ciph, wordKey);
+
+    // > not wordKey, which the server learns from each token
+    const string h = PRP(key, ciph);
+
+    return h.substr(0, SWPBloomHashes * SWPBloomPosBytes);
+}
+
+// The bit of a filter of nbits bits that the i-th position of mask
+// selects.
+static size_t
+bloomBit(const string & mask, unsigned int i, size_t nbits)
+{
+    uint32_t pos = 0;
+    for (unsigned int j = 0; j < SWPBloomPosBytes; j++) {
+        pos = (pos << 8) | static_cast<uint8_t>(mask[i * SWPBloomPosBytes
+                                                     + j]);
+    }
+
+    return pos % nbits;
+}
+
+string
+SWP::bloom(const string & key, const list<string> & words)
+{
+    const size_t nbytes = bloomBytes(words.size());
+    assert(nbytes <= 0xFFFFFFFF);
+
+    string filter(SWPBloomLenBytes + nbytes, 0);
+    for (unsigned int i = 0; i < SWPBloomLenBytes; i++) {
+        filter[i] = (nbytes >> (8 * (SWPBloomLenBytes - 1 - i))) & 0xFF;
+    }
+    for (const auto &it : words) {
+        const string mask = bloomMask(key, it);
+        for (unsigned int i = 0; i < SWPBloomHashes; i++) {
+            const size_t bit = bloomBit(mask, i, nbytes * 8);
+            filter[SWPBloomLenBytes + bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    return filter;
+}
+
+bool
+SWP::bloomMatch(const char * row, size_t len, const string & mask,
+                size_t * const filter_len)
+{
+    if (len < SWPBloomLenBytes) {
+        return false;
+    }
+    size_t nbytes = 0;
+    for (unsigned int i = 0; i < SWPBloomLenBytes; i++) {
+        nbytes = (nbytes << 8) | static_cast<uint8_t>(row[i]);
+    }
+    if (len - SWPBloomLenBytes < nbytes) {
+        return false;
+    }
+    *filter_len = SWPBloomLenBytes + nbytes;
+
+    // > a row without words holds none
+    if (0 == nbytes) {
+        return false;
+    }
+
+    const char * const filter = row + SWPBloomLenBytes;
+    for (unsigned int i = 0; i < SWPBloomHashes; i++) {
+        const size_t bit = bloomBit(mask, i, nbytes * 8);
+        if (0 == (filter[bit / 8] & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
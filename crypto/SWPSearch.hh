@@ -30,6 +30,12 @@ const unsigned int SWPm = 4; //the rate of false positives when searching is
                              // 1/2^{m*8}
 const unsigned int SWP_SALT_LEN = 8; //the size of salt in bytes
 const unsigned int SWPr = SWPCiphSize - SWPm;
+const unsigned int SWPBloomBitsPerWord = 16; //the keyed Bloom filter of a
+                                             // row's words grows with them;
+                                             // ~1/400 false positives
+const unsigned int SWPBloomHashes = 4; //bits per word
+const unsigned int SWPBloomPosBytes = 4; //PRP bytes per bit position
+const unsigned int SWPBloomLenBytes = 4; //the filter's length, ahead of it
 
 typedef struct Token {
     std::string ciph;
@@ -75,6 +81,34 @@ class SWP {
                                        const std::list<std::string> & ciphs);
     static bool searchExists(const Token & token, const std::list<std::string> & ciphs);
 
+    /*
+     * As above, on ciphertexts that are concatenated, as the UDF sees
+     * them.
+     */
+    static bool searchExists(const Token & token, const char * ciphs,
+                             size_t len);
+
+    /*
+     * Keyed Bloom filter of the words, SWPBloomBitsPerWord bits for each
+     * and prefixed by its length in bytes. A row whose filter lacks a
+     * bit of the word's mask does not contain the word, so a search can
+     * skip it without computing a single PRP.
+     */
+    static std::string bloom(const std::string & key,
+                             const std::list<std::string> & words);
+    // Bytes of the filter of nwords words, without its length.
+    static size_t bloomBytes(size_t nwords);
+    // The word's bit positions, before the size of a row's filter
+    // reduces them.
+    static std::string bloomMask(const std::string & key,
+                                 const std::string & word);
+    // Whether the filter at the front of row may hold the word; sets
+    // *filter_len to the bytes the filter and its length take. False for
+    // a row too short to hold them.
+    static bool bloomMatch(const char * row, size_t len,
+                           const std::string & mask,
+                           size_t * const filter_len);
+
     static const bool canDecrypt = (SWPCiphSize % AES_BLOCK_SIZE == 0);
 
     /** PRP **/
@@ -3,6 +3,7 @@
 #include <crypto/online_ope.hh>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 #include <sstream>
 
@@ -109,9 +110,41 @@ build_tree(uint64_t n, tree_node<EncT> * x) {
     return s;
 }
 
+/*
+ * In-order (enc_val, ciphertext) of the subtree at n, whose path is v.
+ */
+template<class EncT>
+static void
+collect_paths(tree_node<EncT> * n, uint64_t v, uint64_t nbits,
+	      std::vector<std::pair<EncT, uint64_t> > * out)
+{
+    if (!n) {
+	return;
+    }
+    collect_paths(n->left, v<<1, nbits+1, out);
+    out->push_back(std::make_pair(n->enc_val,
+				  nbits <= 63 ? ope_path_ct(v, nbits) : 0));
+    collect_paths(n->right, (v<<1) | 1, nbits+1, out);
+}
+
+template<class EncT>
+static tree_node<EncT> *
+balanced_tree(const std::vector<EncT> & in_order, size_t lo, size_t hi)
+{
+    if (lo == hi) {
+	return NULL;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    tree_node<EncT> * n = new tree_node<EncT>(in_order[mid]);
+    n->left = balanced_tree(in_order, lo, mid);
+    n->right = balanced_tree(in_order, mid + 1, hi);
+    return n;
+}
+
 template<class EncT>
 void
-ope_server<EncT>::relabel(tree_node<EncT> * parent, bool isLeft, uint64_t size) {
+ope_server<EncT>::relabel(tree_node<EncT> * parent, bool isLeft, uint64_t size,
+			  uint64_t v, uint64_t nbits) {
 
     tree_node<EncT> * scapegoat;
     if (parent == NULL) {
@@ -120,6 +153,18 @@ ope_server<EncT>::relabel(tree_node<EncT> * parent, bool isLeft, uint64_t size)
 	scapegoat = (isLeft == 1) ? parent->left : parent->right;
     }
 
+    // the scapegoat is on the path to the node just inserted
+    uint64_t depth = 0;
+    uint64_t prefix = 0;
+    std::vector<std::pair<EncT, uint64_t> > before;
+    if (track) {
+	for (tree_node<EncT> * n = root; n != scapegoat; depth++) {
+	    n = (v&(1ULL<<(nbits-depth-1))) ? n->right : n->left;
+	}
+	prefix = depth ? v>>(nbits-depth) : 0;
+	collect_paths(scapegoat, prefix, depth, &before);
+    }
+
     tree_node<EncT> * w = new tree_node<EncT>(0);
     tree_node<EncT> * z = flatten(scapegoat, w);
 
@@ -138,6 +183,22 @@ ope_server<EncT>::relabel(tree_node<EncT> * parent, bool isLeft, uint64_t size)
 
     w->left = 0;    /* Something seems fishy here */
     delete w;
+
+    if (track) {
+	// a relabel keeps the in-order sequence, so the nodes line up
+	std::vector<std::pair<EncT, uint64_t> > after;
+	collect_paths(parent ? (isLeft ? parent->left : parent->right) : root,
+		      prefix, depth, &after);
+	throw_c(after.size() == before.size());
+	for (size_t i = 0; i < after.size(); i++) {
+	    throw_c(after[i].first == before[i].first);
+	    if (after[i].second != before[i].second) {
+		relabels.push_back(relabeled{after[i].first,
+					     before[i].second,
+					     after[i].second});
+	    }
+	}
+    }
 }
 
 ////////////////////////////////////////////////////
@@ -158,7 +219,7 @@ ope_server<EncT>::tree_insert(tree_node<EncT> **np, uint64_t v,
 	    bool isLeft;
 	    uint64_t subtree_size;
 	    tree_node<EncT> * parent = node_to_balance(v, pathlen, isLeft, subtree_size);
-     	    relabel(parent, isLeft, subtree_size);
+     	    relabel(parent, isLeft, subtree_size, v, pathlen);
 	} else {
 
 	}
@@ -294,12 +355,72 @@ ope_server<EncT>::insert(uint64_t v, uint64_t nbits, const EncT &encval)
 
 }
 
+template<class EncT>
+std::vector<typename ope_server<EncT>::relabeled>
+ope_server<EncT>::take_relabeled()
+{
+    std::vector<relabeled> out;
+    out.swap(relabels);
+    return out;
+}
+
+template<class EncT>
+void
+ope_server<EncT>::rebuild(const std::vector<EncT> &in_order)
+{
+    if (root)
+        delete root;
+
+    root = balanced_tree(in_order, 0, in_order.size());
+    num_nodes = in_order.size();
+    relabels.clear();
+}
+
+template<class EncT>
+bool
+ope_server<EncT>::restore(const std::vector<std::pair<uint64_t, EncT> > &nodes)
+{
+    if (root)
+        delete root;
+    root = NULL;
+    num_nodes = 0;
+    relabels.clear();
+
+    // parents first
+    std::vector<std::pair<uint64_t, size_t> > by_depth;
+    for (size_t i = 0; i < nodes.size(); i++) {
+	uint64_t nbits;
+	ope_ct_path(nodes[i].first, &nbits);
+	by_depth.push_back(std::make_pair(nbits, i));
+    }
+    std::sort(by_depth.begin(), by_depth.end());
+
+    for (const auto &it : by_depth) {
+	uint64_t nbits;
+	uint64_t v = ope_ct_path(nodes[it.second].first, &nbits);
+	tree_node<EncT> **np = &root;
+	for (; nbits > 0 && *np; nbits--)
+	    np = (v&(1ULL<<(nbits-1))) ? &(*np)->right : &(*np)->left;
+	if (nbits > 0 || *np) {
+	    delete root;
+	    root = NULL;
+	    num_nodes = 0;
+	    return false;
+	}
+	*np = new tree_node<EncT>(nodes[it.second].second);
+	num_nodes++;
+    }
+
+    return true;
+}
+
 template<class EncT>
 ope_server<EncT>::ope_server()
 {
     root = NULL;
     max_height = 0;
     num_nodes = 0;
+    track = false;
 }
 
 template<class EncT>
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <iostream>
+#include <vector>
+#include <map>
 
 #include <crypto/blowfish.hh>
 #include <util/errstream.hh>
@@ -28,6 +30,23 @@ ffsl(uint64_t mask)
 	return (bit);
 }
 
+// the ciphertext of the node at path v, nbits long: the path, then a 1
+static inline uint64_t
+ope_path_ct(uint64_t v, uint64_t nbits)
+{
+    throw_c(nbits <= 63);
+    return (nbits ? v<<(64-nbits) : 0) | (1ULL<<(63-nbits));
+}
+
+// the inverse of ope_path_ct: the path of ct, and its length in nbits
+static inline uint64_t
+ope_ct_path(uint64_t ct, uint64_t * nbits)
+{
+    throw_c(ct != 0);
+    *nbits = 64 - ffsl(ct);
+    return *nbits ? ct>>(64-*nbits) : 0;
+}
+
 
 template<class EncT>
 class ope_server {
@@ -35,6 +54,26 @@ class ope_server {
     EncT lookup(uint64_t v, uint64_t nbits) const;
     void insert(uint64_t v, uint64_t nbits, const EncT &encval);
 
+    // a node that a relabel moved, by its ciphertext before and after;
+    // 0 for a path too long to have been a ciphertext
+    struct relabeled {
+        EncT enc_val;
+        uint64_t from;
+        uint64_t to;
+    };
+    // relabels are only recorded when tracked; take_relabeled() hands
+    // over the ones since the last call
+    void track_relabels(bool on) { track = on; }
+    std::vector<relabeled> take_relabeled();
+
+    // replaces the tree with a balanced one holding in_order, which is
+    // sorted by plaintext
+    void rebuild(const std::vector<EncT> &in_order);
+    // replaces the tree with nodes at the paths of the given
+    // (ciphertext, enc_val) pairs; false, and an empty tree, unless the
+    // parent of every node is among them and no two share a path
+    bool restore(const std::vector<std::pair<uint64_t, EncT> > &nodes);
+
     ope_server();
     ~ope_server();
 
@@ -47,7 +86,9 @@ class ope_server {
 
     //relabels the tree rooted at the node whose parent is "parent"
     // size indicates the size of the subtree of the node rooted at parent
-    void relabel(tree_node<EncT> * parent, bool isLeft, uint64_t size);
+    // v, nbits: path of the node just inserted, which is in that subtree
+    void relabel(tree_node<EncT> * parent, bool isLeft, uint64_t size,
+                 uint64_t v, uint64_t nbits);
     //decides whether we trigger a relabel or not
     //receives the path length of a recently added node
     bool trigger(uint64_t path_len) const;
@@ -60,6 +101,9 @@ class ope_server {
     void update_tree_stats(uint64_t nbits);
     unsigned int num_nodes;
     unsigned int max_height;//height measured in no. of edges
+
+    bool track;
+    std::vector<relabeled> relabels;
 };
 
 template<class V, class BlockCipher>
@@ -103,8 +147,52 @@ class ope_client {
 	    return encrypt(pt);
         }
 
-        throw_c(nbits <= 63);
-        return (v<<(64-nbits)) | (1ULL<<(63-nbits));
+        return ope_path_ct(v, nbits);
+    }
+
+    // Restores the server's tree from what a column holds, as
+    // (ciphertext, plaintext) pairs, so that every value keeps its
+    // ciphertext; a node the column lost to a DELETE comes back with a
+    // made-up plaintext that sorts where the lost one did. False, and an
+    // empty tree, when the ciphertexts are not those of a search tree.
+    bool restore(const std::vector<std::pair<uint64_t, V> > &column) const {
+        // by ciphertext, which is in-order; false for a lost node
+        std::map<uint64_t, std::pair<bool, V> > nodes;
+        for (const auto &it : column) {
+            if (it.first == 0)
+                return clear();
+            auto r = nodes.insert(
+                std::make_pair(it.first, std::make_pair(true, it.second)));
+            if (!r.second && r.first->second.second != it.second)
+                return clear();
+        }
+
+        std::vector<uint64_t> cts;
+        for (const auto &it : nodes)
+            cts.push_back(it.first);
+        for (uint64_t ct : cts) {
+            uint64_t nbits;
+            uint64_t v = ope_ct_path(ct, &nbits);
+            for (uint64_t d = 0; d < nbits; d++)
+                nodes.insert(std::make_pair(ope_path_ct(v>>(nbits-d), d),
+                                            std::make_pair(false, V(0))));
+        }
+
+        // the lost nodes take the least plaintexts free after the node
+        // before them
+        std::vector<std::pair<uint64_t, V> > placed;
+        V next = 0;
+        bool full = false;
+        for (const auto &it : nodes) {
+            V pt = it.second.first ? it.second.second : next;
+            if (full || pt < next)
+                return clear();
+            placed.push_back(std::make_pair(it.first, block_encrypt(pt)));
+            next = pt + 1;
+            full = (next == 0);
+        }
+
+        return s->restore(placed);
     }
 
  private:
@@ -120,6 +208,11 @@ class ope_client {
         return ct;
     }
 
+    bool clear() const {
+        s->restore({});
+        return false;
+    }
+
     BlockCipher *b;
     ope_server<V> *s;
 };
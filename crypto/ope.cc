@@ -1,4 +1,5 @@
 #include <crypto/ope.hh>
+#include <algorithm>
 #include <crypto/prng.hh>
 #include <crypto/hgd.hh>
 #include <crypto/aes.hh>
@@ -18,18 +19,13 @@ domain_gap(const ZZ &ndomain, const ZZ &nrange, const ZZ &rgap, PRNG *prng)
     return HGD(rgap, ndomain, nrange-ndomain, prng);
 }
 
-template<class CB>
-ope_domain_range
-OPE::lazy_sample(const ZZ &d_lo, const ZZ &d_hi,
-                 const ZZ &r_lo, const ZZ &r_hi,
-                 CB go_low, blockrng<AES> *prng)
+void
+OPE::sample_gap(const ZZ &d_lo, const ZZ &d_hi,
+                const ZZ &r_lo, const ZZ &r_hi,
+                blockrng<AES> *prng, ZZ *dgap, ZZ *rgap)
 {
     ZZ ndomain = d_hi - d_lo + 1;
     ZZ nrange  = r_hi - r_lo + 1;
-    throw_c(nrange >= ndomain);
-
-    if (ndomain == 1)
-        return ope_domain_range(d_lo, r_lo, r_hi);
 
     /*
      * Deterministically reset the PRNG counter, regardless of
@@ -42,16 +38,32 @@ OPE::lazy_sample(const ZZ &d_lo, const ZZ &d_hi,
     v.resize(AES::blocksize);
     prng->set_ctr(v);
 
-    ZZ rgap = nrange/2;
-    ZZ dgap;
+    *rgap = nrange/2;
 
-    auto ci = dgap_cache.find(r_lo + rgap);
+    auto ci = dgap_cache.find(r_lo + *rgap);
     if (ci == dgap_cache.end()) {
-        dgap = domain_gap(ndomain, nrange, nrange / 2, prng);
-        dgap_cache[r_lo + rgap] = dgap;
+        *dgap = domain_gap(ndomain, nrange, nrange / 2, prng);
+        dgap_cache[r_lo + *rgap] = *dgap;
     } else {
-        dgap = ci->second;
+        *dgap = ci->second;
     }
+}
+
+template<class CB>
+ope_domain_range
+OPE::lazy_sample(const ZZ &d_lo, const ZZ &d_hi,
+                 const ZZ &r_lo, const ZZ &r_hi,
+                 CB go_low, blockrng<AES> *prng)
+{
+    ZZ ndomain = d_hi - d_lo + 1;
+    ZZ nrange  = r_hi - r_lo + 1;
+    throw_c(nrange >= ndomain);
+
+    if (ndomain == 1)
+        return ope_domain_range(d_lo, r_lo, r_hi);
+
+    ZZ dgap, rgap;
+    sample_gap(d_lo, d_hi, r_lo, r_hi, prng, &dgap, &rgap);
 
     if (go_low(d_lo + dgap, r_lo + rgap))
         return lazy_sample(d_lo, d_lo + dgap - 1, r_lo, r_lo + rgap - 1, go_low, prng);
@@ -70,12 +82,61 @@ OPE::search(CB go_low)
                        go_low, &r);
 }
 
-ZZ
-OPE::encrypt(const ZZ &ptext)
+/*
+ * The values that go low at a node are a prefix of the sorted batch, so
+ * the batch splits in two and each half carries on down its own side.
+ */
+template<class CB>
+void
+OPE::lazy_sample_batch(const ZZ &d_lo, const ZZ &d_hi,
+                       const ZZ &r_lo, const ZZ &r_hi,
+                       vector<ZZ>::const_iterator begin,
+                       vector<ZZ>::const_iterator end,
+                       CB go_low, blockrng<AES> *prng,
+                       vector<ope_domain_range> *out)
 {
-    ope_domain_range dr =
-        search([&ptext](const ZZ &d, const ZZ &) { return ptext < d; });
+    if (begin == end)
+        return;
+
+    ZZ ndomain = d_hi - d_lo + 1;
+    ZZ nrange  = r_hi - r_lo + 1;
+    throw_c(nrange >= ndomain);
 
+    if (ndomain == 1) {
+        out->insert(out->end(), end - begin,
+                    ope_domain_range(d_lo, r_lo, r_hi));
+        return;
+    }
+
+    ZZ dgap, rgap;
+    sample_gap(d_lo, d_hi, r_lo, r_hi, prng, &dgap, &rgap);
+
+    const ZZ d = d_lo + dgap;
+    const ZZ r = r_lo + rgap;
+    auto mid = partition_point(begin, end,
+                               [&](const ZZ &x) { return go_low(x, d, r); });
+    lazy_sample_batch(d_lo, d - 1, r_lo, r - 1, begin, mid, go_low, prng,
+                      out);
+    lazy_sample_batch(d, d_hi, r, r_hi, mid, end, go_low, prng, out);
+}
+
+template<class CB>
+vector<ope_domain_range>
+OPE::search_batch(const vector<ZZ> &sorted, CB go_low)
+{
+    blockrng<AES> r(aesk);
+
+    vector<ope_domain_range> out;
+    out.reserve(sorted.size());
+    lazy_sample_batch(to_ZZ(0), to_ZZ(1) << pbits,
+                      to_ZZ(0), to_ZZ(1) << cbits,
+                      sorted.begin(), sorted.end(), go_low, &r, &out);
+    return out;
+}
+
+ZZ
+OPE::encrypt_in(const ope_domain_range &dr, const ZZ &ptext)
+{
     auto v = sha256::hash(StringFromZZ(ptext));
     v.resize(16);
 
@@ -86,6 +147,14 @@ OPE::encrypt(const ZZ &ptext)
     return dr.r_lo + aesrand.rand_zz_mod(nrange);
 }
 
+ZZ
+OPE::encrypt(const ZZ &ptext)
+{
+    ope_domain_range dr =
+        search([&ptext](const ZZ &d, const ZZ &) { return ptext < d; });
+    return encrypt_in(dr, ptext);
+}
+
 ZZ
 OPE::decrypt(const ZZ &ctext)
 {
@@ -93,3 +162,48 @@ OPE::decrypt(const ZZ &ctext)
         search([&ctext](const ZZ &, const ZZ &r) { return ctext < r; });
     return dr.d;
 }
+
+static vector<ZZ>
+sorted_unique(const vector<ZZ> &v)
+{
+    vector<ZZ> s(v);
+    sort(s.begin(), s.end());
+    s.erase(unique(s.begin(), s.end()), s.end());
+    return s;
+}
+
+static size_t
+sorted_index(const vector<ZZ> &sorted, const ZZ &x)
+{
+    return lower_bound(sorted.begin(), sorted.end(), x) - sorted.begin();
+}
+
+vector<ZZ>
+OPE::encrypt(const vector<ZZ> &ptexts)
+{
+    const vector<ZZ> &sorted = sorted_unique(ptexts);
+    const vector<ope_domain_range> &drs =
+        search_batch(sorted, [](const ZZ &p, const ZZ &d, const ZZ &)
+                             { return p < d; });
+
+    vector<ZZ> out;
+    out.reserve(ptexts.size());
+    for (const ZZ &p: ptexts)
+        out.push_back(encrypt_in(drs[sorted_index(sorted, p)], p));
+    return out;
+}
+
+vector<ZZ>
+OPE::decrypt(const vector<ZZ> &ctexts)
+{
+    const vector<ZZ> &sorted = sorted_unique(ctexts);
+    const vector<ope_domain_range> &drs =
+        search_batch(sorted, [](const ZZ &c, const ZZ &, const ZZ &r)
+                             { return c < r; });
+
+    vector<ZZ> out;
+    out.reserve(ctexts.size());
+    for (const ZZ &c: ctexts)
+        out.push_back(drs[sorted_index(sorted, c)].d);
+    return out;
+}
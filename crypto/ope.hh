@@ -2,6 +2,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <crypto/prng.hh>
 #include <crypto/aes.hh>
 #include <crypto/sha.hh>
@@ -24,6 +25,14 @@ class OPE {
     NTL::ZZ encrypt(const NTL::ZZ &ptext);
     NTL::ZZ decrypt(const NTL::ZZ &ctext);
 
+    /*
+     * A batch walks the tree once; each node is sampled a single time
+     * for every value that passes through it.  Results come back in the
+     * order of the input, which need not be sorted.
+     */
+    std::vector<NTL::ZZ> encrypt(const std::vector<NTL::ZZ> &ptexts);
+    std::vector<NTL::ZZ> decrypt(const std::vector<NTL::ZZ> &ctexts);
+
  private:
     static std::string aeskey(const std::string &key) {
         auto v = sha256::hash(key);
@@ -44,4 +53,22 @@ class OPE {
     ope_domain_range lazy_sample(const NTL::ZZ &d_lo, const NTL::ZZ &d_hi,
                                  const NTL::ZZ &r_lo, const NTL::ZZ &r_hi,
                                  CB go_low, blockrng<AES> *prng);
+
+    /* go_low(x, d, r) must hold for a prefix of the sorted values */
+    template<class CB>
+    std::vector<ope_domain_range>
+        search_batch(const std::vector<NTL::ZZ> &sorted, CB go_low);
+
+    template<class CB>
+    void lazy_sample_batch(const NTL::ZZ &d_lo, const NTL::ZZ &d_hi,
+                           const NTL::ZZ &r_lo, const NTL::ZZ &r_hi,
+                           std::vector<NTL::ZZ>::const_iterator begin,
+                           std::vector<NTL::ZZ>::const_iterator end,
+                           CB go_low, blockrng<AES> *prng,
+                           std::vector<ope_domain_range> *out);
+
+    void sample_gap(const NTL::ZZ &d_lo, const NTL::ZZ &d_hi,
+                    const NTL::ZZ &r_lo, const NTL::ZZ &r_hi,
+                    blockrng<AES> *prng, NTL::ZZ *dgap, NTL::ZZ *rgap);
+    NTL::ZZ encrypt_in(const ope_domain_range &dr, const NTL::ZZ &ptext);
 };
@@ -1,13 +1,122 @@
 #include <crypto/paillier.hh>
+#include <algorithm>
 #include <sstream>
 
 using namespace std;
 using namespace NTL;
 
+/*
+ * Conversions; both sides use little-endian bytes.
+ */
+
+static void
+mpz_from_string(mpz_ptr out, const string &s)
+{
+    mpz_import(out, s.length(), -1, 1, 0, 0, s.data());
+}
+
+static string
+string_from_mpz(mpz_srcptr x)
+{
+    string s((mpz_sizeinbase(x, 2) + 7) / 8, 0);
+    size_t count = 0;
+    mpz_export(&s[0], &count, -1, 1, 0, 0, x);
+    s.resize(count);
+    return s;
+}
+
+static void
+mpz_from_zz(mpz_ptr out, const ZZ &x)
+{
+    string s(NumBytes(x), 0);
+    BytesFromZZ(reinterpret_cast<uint8_t *>(&s[0]), x, s.length());
+    mpz_from_string(out, s);
+}
+
+static ZZ
+zz_from_mpz(mpz_srcptr x)
+{
+    const string &s = string_from_mpz(x);
+    return ZZFromBytes(reinterpret_cast<const uint8_t *>(s.data()),
+                       s.length());
+}
+
+/*
+ * Fixed-base exponentiation
+ */
+
+fixed_base::fixed_base(mpz_srcptr base, mpz_srcptr modulus, uint maxbits,
+                       uint w)
+    : w(w), maxbits(maxbits), ndigits((maxbits + w - 1) / w),
+      table(ndigits * ((1 << w) - 1))
+{
+    throw_c(w > 0 && GMP_NUMB_BITS % w == 0);
+
+    mpz_set(m, modulus);
+    mpz_mod(g, base, m);
+
+    const uint row = (1 << w) - 1;
+    gmpz b(g);
+    for (uint i = 0; i < ndigits; i++) {
+        gmpz *const t = &table[i * row];
+        mpz_set(t[0], b);
+        for (uint j = 1; j < row; j++) {
+            mpz_mul(t[j], t[j - 1], b);
+            mpz_mod(t[j], t[j], m);
+        }
+
+        /* b^(2^w) for the next digit */
+        mpz_mul(b, t[row - 1], b);
+        mpz_mod(b, b, m);
+    }
+}
+
+void
+fixed_base::powm(mpz_ptr r, mpz_srcptr e) const
+{
+    if (mpz_sgn(e) < 0 || mpz_sizeinbase(e, 2) > maxbits) {
+        mpz_powm(r, g, e, m);
+        return;
+    }
+
+    const uint row = (1 << w) - 1;
+    bool first = true;
+    for (uint i = 0; i < ndigits; i++) {
+        const uint bit = i * w;
+        const mp_limb_t digit =
+            (mpz_getlimbn(e, bit / GMP_NUMB_BITS) >> (bit % GMP_NUMB_BITS))
+            & row;
+        if (0 == digit)
+            continue;
+
+        const gmpz &t = table[i * row + digit - 1];
+        if (first) {
+            mpz_set(r, t);
+            first = false;
+        } else {
+            mpz_mul(r, r, t);
+            mpz_mod(r, r, m);
+        }
+    }
+
+    if (first)
+        mpz_set_ui(r, 1);
+}
+
 /*
  * Public-key operations
  */
 
+/* one per thread: urandom reads through an unlocked ifstream and the
+   layers share their Paillier between the proxy, import and bench
+   threads */
+static urandom &
+rng()
+{
+    static thread_local urandom u;
+    return u;
+}
+
 Paillier::Paillier() : nbits(0) {
 }
 
@@ -16,6 +125,35 @@ Paillier::Paillier(const vector<ZZ> &pk)
       nbits(NumBits(n)), n2(n*n)
 {
     throw_c(pk.size() == 2);
+
+    mpz_from_zz(n_z, n);
+    mpz_from_zz(g_z, g);
+    mpz_mul(n2_z, n_z, n_z);
+    mpz_set(rmod_z, n_z);
+}
+
+void
+Paillier::precompute()
+{
+    if (gtab)
+        return;
+
+    gmpz h;
+    mpz_powm(h, g_z, n_z, n2_z);
+
+    /* plaintexts are usually 64-bit integers */
+    gtab = std::make_shared<fixed_base>(g_z, n2_z, 64);
+    htab = std::make_shared<fixed_base>(h, n2_z,
+                                        mpz_sizeinbase(rmod_z, 2));
+}
+
+void
+Paillier::blinding(mpz_ptr rn)
+{
+    gmpz r;
+    mpz_from_string(r, rng().rand_string(mpz_sizeinbase(rmod_z, 2) / 8 + 8));
+    mpz_mod(r, r, rmod_z);
+    htab->powm(rn, r);
 }
 
 void
@@ -26,26 +164,66 @@ Paillier::rand_gen(size_t niter, size_t nmax)
     else
         niter = min(niter, nmax - rqueue.size());
 
+    precompute();
     for (uint i = 0; i < niter; i++) {
-        ZZ r = RandomLen_ZZ(nbits) % n;
-        ZZ rn = PowerMod(g, n*r, n2);
+        gmpz rn;
+        blinding(rn);
         rqueue.push_back(rn);
     }
 }
 
-ZZ
-Paillier::encrypt(const ZZ &plaintext)
+void
+Paillier::encrypt_z(mpz_ptr c, mpz_srcptr plaintext)
 {
+    precompute();
+
+    gmpz rn;
     auto i = rqueue.begin();
     if (i != rqueue.end()) {
-        ZZ rn = *i;
+        mpz_swap(rn, *i);
         rqueue.pop_front();
-
-        return (PowerMod(g, plaintext, n2) * rn) % n2;
     } else {
-        ZZ r = RandomLen_ZZ(nbits) % n;
-        return PowerMod(g, plaintext + n*r, n2);
+        blinding(rn);
     }
+
+    const fixed_base &base =
+        ptab && mpz_sizeinbase(plaintext, 2) > 64 ? *ptab : *gtab;
+    base.powm(c, plaintext);
+    mpz_mul(c, c, rn);
+    mpz_mod(c, c, n2_z);
+}
+
+ZZ
+Paillier::encrypt(const ZZ &plaintext)
+{
+    gmpz m, c;
+    mpz_from_zz(m, plaintext);
+    encrypt_z(c, m);
+    return zz_from_mpz(c);
+}
+
+string
+Paillier::encrypt_u64(uint64_t plaintext)
+{
+    gmpz m, c;
+    mpz_import(m, 1, -1, sizeof(plaintext), 0, 0, &plaintext);
+    encrypt_z(c, m);
+    return string_from_mpz(c);
+}
+
+string
+Paillier::encrypt_pack_u64(const vector<uint64_t> &slots)
+{
+    throw_c(slots.size() <= slots_u64());
+
+    /* packed plaintexts run to nbits; their g table is built on demand */
+    if (!ptab)
+        ptab = std::make_shared<fixed_base>(g_z, n2_z, nbits);
+
+    gmpz m, c;
+    mpz_import(m, slots.size(), -1, sizeof(uint64_t), 0, 0, slots.data());
+    encrypt_z(c, m);
+    return string_from_mpz(c);
 }
 
 ZZ
@@ -72,31 +250,54 @@ L(const ZZ &u, const ZZ &n)
 }
 
 static inline ZZ
-Lfast(const ZZ &u, const ZZ &ninv, const ZZ &two_n, const ZZ &n)
+LCM(const ZZ &a, const ZZ &b)
 {
-    return (((u - 1) * ninv) % two_n) % n;
+    return (a * b) / GCD(a, b);
 }
 
-static inline ZZ
-LCM(const ZZ &a, const ZZ &b)
+/* L(c^e mod p^2) * h mod p */
+static void
+decrypt_half(mpz_ptr out, mpz_srcptr c, mpz_srcptr p, mpz_srcptr p2,
+             mpz_srcptr e, mpz_srcptr h)
 {
-    return (a * b) / GCD(a, b);
+    mpz_mod(out, c, p2);
+    mpz_powm(out, out, e, p2);
+    mpz_sub_ui(out, out, 1);
+    mpz_divexact(out, out, p);
+    mpz_mul(out, out, h);
+    mpz_mod(out, out, p);
 }
 
 Paillier_priv::Paillier_priv(const vector<ZZ> &sk)
     : Paillier({sk[0]*sk[1], sk[2]}), p(sk[0]), q(sk[1]), a(sk[3]),
-      fast(a != 0),
-      p2(p * p), q2(q * q),
-      two_p(power(to_ZZ(2), NumBits(p))),
-      two_q(power(to_ZZ(2), NumBits(q))),
-      pinv(InvMod(p, two_p)),
-      qinv(InvMod(q, two_q)),
-      hp(InvMod(Lfast(PowerMod(g % p2, fast ? a : (p-1), p2),
-                      pinv, two_p, p), p)),
-      hq(InvMod(Lfast(PowerMod(g % q2, fast ? a : (q-1), q2),
-                      qinv, two_q, q), q))
+      fast(a != 0)
 {
     throw_c(sk.size() == 4);
+
+    mpz_from_zz(p_z, p);
+    mpz_from_zz(q_z, q);
+    mpz_mul(p2_z, p_z, p_z);
+    mpz_mul(q2_z, q_z, q_z);
+
+    if (fast) {
+        mpz_from_zz(ep_z, a);
+        mpz_set(eq_z, ep_z);
+        /* h = g^n has order a */
+        mpz_set(rmod_z, ep_z);
+    } else {
+        mpz_sub_ui(ep_z, p_z, 1);
+        mpz_sub_ui(eq_z, q_z, 1);
+    }
+
+    /* hp = L(g^e mod p^2)^-1 mod p, likewise for q */
+    gmpz one;
+    mpz_set_ui(one, 1);
+    decrypt_half(hp_z, g_z, p_z, p2_z, ep_z, one);
+    throw_c(mpz_invert(hp_z, hp_z, p_z));
+    decrypt_half(hq_z, g_z, q_z, q2_z, eq_z, one);
+    throw_c(mpz_invert(hq_z, hq_z, q_z));
+
+    throw_c(mpz_invert(pinv_z, p_z, q_z));
 }
 
 std::vector<NTL::ZZ>
@@ -143,18 +344,56 @@ Paillier_priv::keygen(PRNG *rng, uint nbits, uint abits)
     return { p, q, g, a };
 }
 
+void
+Paillier_priv::decrypt_z(mpz_ptr plaintext, mpz_srcptr ciphertext) const
+{
+    gmpz mp, mq;
+    decrypt_half(mp, ciphertext, p_z, p2_z, ep_z, hp_z);
+    decrypt_half(mq, ciphertext, q_z, q2_z, eq_z, hq_z);
+
+    /* m = mp + p * ((mq - mp) * p^-1 mod q) */
+    mpz_sub(mq, mq, mp);
+    mpz_mul(mq, mq, pinv_z);
+    mpz_mod(mq, mq, q_z);
+    mpz_mul(plaintext, mq, p_z);
+    mpz_add(plaintext, plaintext, mp);
+}
+
 ZZ
 Paillier_priv::decrypt(const ZZ &ciphertext) const
 {
-    ZZ mp = (Lfast(PowerMod(ciphertext % p2, fast ? a : (p-1), p2),
-                   pinv, two_p, p) * hp) % p;
-    ZZ mq = (Lfast(PowerMod(ciphertext % q2, fast ? a : (q-1), q2),
-                   qinv, two_q, q) * hq) % q;
+    gmpz c, m;
+    mpz_from_zz(c, ciphertext);
+    decrypt_z(m, c);
+    return zz_from_mpz(m);
+}
 
-    ZZ m, pq;
-    pq = 1;
-    CRT(m, pq, mp, p);
-    CRT(m, pq, mq, q);
+bool
+Paillier_priv::decrypt_u64(const string &ciphertext,
+                           uint64_t *const plaintext) const
+{
+    gmpz c, m;
+    mpz_from_string(c, ciphertext);
+    decrypt_z(m, c);
+    if (mpz_sizeinbase(m, 2) > 64)
+        return false;
+
+    *plaintext = 0;
+    mpz_export(plaintext, NULL, -1, sizeof(*plaintext), 0, 0, m);
+    return true;
+}
+
+bool
+Paillier_priv::decrypt_pack_u64(const string &ciphertext,
+                                vector<uint64_t> *const slots) const
+{
+    gmpz c, m;
+    mpz_from_string(c, ciphertext);
+    decrypt_z(m, c);
+    if (mpz_sizeinbase(m, 2) > 64 * slots->size())
+        return false;
 
-    return m;
+    std::fill(slots->begin(), slots->end(), 0);
+    mpz_export(slots->data(), NULL, -1, sizeof(uint64_t), 0, 0, m);
+    return true;
 }
@@ -2,6 +2,9 @@
 
 #include <list>
 #include <vector>
+#include <memory>
+#include <string>
+#include <gmp.h>
 #include <NTL/ZZ.h>
 #include <crypto/prng.hh>
 
@@ -9,6 +12,44 @@
 const unsigned int Paillier_len_bytes = PAILLIER_LEN_BYTES;
 const unsigned int Paillier_len_bits = Paillier_len_bytes * 8;
 
+/*
+ * An mpz_t that cleans up after itself; converts to mpz_ptr so it can
+ * be handed to the mpz_* functions as is.
+ */
+class gmpz {
+ public:
+    gmpz() { mpz_init(v); }
+    gmpz(const gmpz &o) { mpz_init_set(v, o.v); }
+    ~gmpz() { mpz_clear(v); }
+    gmpz &operator=(const gmpz &o) { mpz_set(v, o.v); return *this; }
+
+    operator mpz_ptr() { return v; }
+    operator mpz_srcptr() const { return v; }
+
+ private:
+    mpz_t v;
+};
+
+/*
+ * g^e mod m for a g that does not change.  The table holds
+ * g^(j * 2^(w*i)) for every w-bit digit j at every digit position i, so
+ * an exponent of up to maxbits bits costs one multiplication per
+ * non-zero digit and no squarings.  Longer exponents use mpz_powm.
+ */
+class fixed_base {
+ public:
+    fixed_base(mpz_srcptr g, mpz_srcptr m, uint maxbits, uint w = 4);
+
+    void powm(mpz_ptr r, mpz_srcptr e) const;
+
+ private:
+    const uint w;
+    const uint maxbits;
+    const uint ndigits;
+    gmpz g, m;
+    std::vector<gmpz> table;    /* ndigits rows of 2^w - 1 */
+};
+
 
 class Paillier {
  public:
@@ -21,6 +62,20 @@ class Paillier {
     NTL::ZZ add(const NTL::ZZ &c0, const NTL::ZZ &c1) const;
     NTL::ZZ mul(const NTL::ZZ &ciphertext, const NTL::ZZ &constval) const;
 
+    /*
+     * Skips NTL altogether; the ciphertext is the little-endian byte
+     * string StringFromZZ() would give.
+     */
+    std::string encrypt_u64(uint64_t plaintext);
+
+    /*
+     * One uint64_t per 64-bit slot, slot 0 in the low bits.  Multiplying
+     * such ciphertexts sums every slot at once, so long as no slot ever
+     * carries into the next one.
+     */
+    uint slots_u64() const { return (nbits - 1) / 64; }
+    std::string encrypt_pack_u64(const std::vector<uint64_t> &slots);
+
     void rand_gen(size_t niter = 100, size_t nmax = 1000);
 
     /*
@@ -101,8 +156,25 @@ class Paillier {
     const uint nbits;
     const NTL::ZZ n2;
 
-    /* Pre-computed randomness */
-    std::list<NTL::ZZ> rqueue;
+    /*
+     * Encryption is g^m * h^r mod n^2 with h = g^n, done on GMP with a
+     * fixed-base table for g and one for h, built on first use.  Only
+     * r mod the order of h matters, so the private key draws a shorter
+     * r (see Paillier_priv).
+     */
+    gmpz n_z, n2_z, g_z;
+    gmpz rmod_z;
+    std::shared_ptr<const fixed_base> gtab, htab;
+    std::shared_ptr<const fixed_base> ptab;     /* g for packed plaintexts */
+
+    /* Pre-computed randomness, h^r */
+    std::list<gmpz> rqueue;
+
+    void encrypt_z(mpz_ptr c, mpz_srcptr plaintext);
+
+ private:
+    void precompute();
+    void blinding(mpz_ptr rn);
 };
 
 class Paillier_priv : public Paillier {
@@ -112,6 +184,12 @@ class Paillier_priv : public Paillier {
     std::vector<NTL::ZZ> privkey() const { return { p, q, g, a }; }
 
     NTL::ZZ decrypt(const NTL::ZZ &ciphertext) const;
+    /* false if the plaintext does not fit in 64 bits */
+    bool decrypt_u64(const std::string &ciphertext,
+                     uint64_t *const plaintext) const;
+    /* false if the plaintext does not fit in slots->size() slots */
+    bool decrypt_pack_u64(const std::string &ciphertext,
+                          std::vector<uint64_t> *const slots) const;
 
     static std::vector<NTL::ZZ> keygen(PRNG*, uint nbits = 1024, uint abits = 256);
 
@@ -142,8 +220,16 @@ class Paillier_priv : public Paillier {
 
     /* Cached values */
     const bool fast;
-    const NTL::ZZ p2, q2;
-    const NTL::ZZ two_p, two_q;
-    const NTL::ZZ pinv, qinv;
-    const NTL::ZZ hp, hq;
+
+    /*
+     * Decryption works mod p^2 and q^2 and recombines with CRT; the
+     * exponent is a in fast mode, else p-1 (q-1).  mpz_powm does the
+     * exponentiations in Montgomery form.
+     */
+    gmpz p_z, q_z, p2_z, q2_z;
+    gmpz ep_z, eq_z;
+    gmpz hp_z, hq_z;    /* L(g^e mod p^2)^-1 mod p */
+    gmpz pinv_z;        /* p^-1 mod q */
+
+    void decrypt_z(mpz_ptr plaintext, mpz_srcptr ciphertext) const;
 };
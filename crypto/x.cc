@@ -1,5 +1,8 @@
 #include <vector>
 #include <iomanip>
+#include <memory>
+#include <map>
+#include <algorithm>
 #include <crypto/cbc.hh>
 #include <crypto/cmc.hh>
 #include <crypto/prng.hh>
@@ -14,6 +17,7 @@
 #include <crypto/bn.hh>
 #include <crypto/ecjoin.hh>
 #include <crypto/search.hh>
+#include <crypto/SWPSearch.hh>
 #include <crypto/skip32.hh>
 #include <crypto/cbcmac.hh>
 #include <crypto/ffx.hh>
@@ -21,6 +25,7 @@
 #include <crypto/padding.hh>
 #include <crypto/mont.hh>
 #include <crypto/gfe.hh>
+#include <crypto/BasicCrypto.hh>
 #include <util/timer.hh>
 #include <NTL/ZZ.h>
 #include <NTL/RR.h>
@@ -120,6 +125,41 @@ test_ope(int pbits, int cbits)
                                                        : NumBits(to_ZZ(1/maxerr))) << endl;
 }
 
+// A batch gives what one value at a time does; each gets a fresh OPE
+// so neither run benefits from the other's gap cache.
+static void
+test_ope_batch(int pbits, int cbits)
+{
+    urandom u;
+    enum { nvals = 256 };
+
+    /* a clustered range, as a range scan or an ORDER BY returns */
+    const ZZ base = u.rand_zz_mod(to_ZZ(1) << (pbits - 1));
+    std::vector<ZZ> pts;
+    for (uint i = 0; i < nvals; i++)
+        pts.push_back(base + u.rand_zz_mod(to_ZZ(1) << 16));
+
+    timer t;
+    OPE one("hello world", pbits, cbits);
+    std::vector<ZZ> cts;
+    for (const ZZ &pt: pts)
+        cts.push_back(one.encrypt(pt));
+    const double one_usec = t.lap();
+
+    OPE batch("hello world", pbits, cbits);
+    throw_c(batch.encrypt(pts) == cts);
+    const double batch_usec = t.lap();
+
+    OPE dec("hello world", pbits, cbits);
+    throw_c(dec.decrypt(cts) == pts);
+
+    cout << "--- ope batch: " << pbits << "-bit plaintext, "
+         << cbits << "-bit ciphertext" << endl
+         << "  encrypt " << nvals << ": " << one_usec / nvals
+         << " usec one at a time, " << batch_usec / nvals
+         << " usec batched" << endl;
+}
+
 static void
 test_hgd()
 {
@@ -182,6 +222,105 @@ test_paillier()
     }
 }
 
+// The GMP engine against textbook Paillier computed with NTL.
+static void
+test_paillier_gmp()
+{
+    urandom u;
+    for (uint abits: {256, 0}) {
+        auto sk = Paillier_priv::keygen(&u, 1024, abits);
+        Paillier_priv pp(sk);
+
+        const ZZ &p = sk[0], &q = sk[1], &g = sk[2];
+        const ZZ n = p * q;
+        const ZZ n2 = n * n;
+        const ZZ lambda = (p - 1) * (q - 1) / GCD(p - 1, q - 1);
+        const ZZ mu = InvMod(((PowerMod(g, lambda, n2) - 1) / n) % n, n);
+
+        timer t;
+        double gmp_usec = 0, ntl_usec = 0;
+        for (int i = 0; i < 100; i++) {
+            const uint64_t v = u.rand<uint64_t>();
+            const ZZ zv = (to_ZZ((long) (v >> 32)) << 32)
+                          + to_ZZ((long) (v & 0xffffffff));
+
+            t.lap();
+            const std::string ct = pp.encrypt_u64(v);
+            gmp_usec += t.lap();
+            const ZZ c = ZZFromBytes((const uint8_t *) ct.data(), ct.size());
+            throw_c((((PowerMod(c, lambda, n2) - 1) / n) * mu) % n == zv);
+
+            const ZZ r = RandomBnd(n);
+            t.lap();
+            const ZZ c2 = PowerMod(g, zv + n * r, n2);
+            ntl_usec += t.lap();
+            std::string ct2(NumBytes(c2), 0);
+            BytesFromZZ((uint8_t *) &ct2[0], c2, ct2.size());
+
+            uint64_t dec = 0;
+            throw_c(pp.decrypt_u64(ct2, &dec) && dec == v);
+            throw_c(pp.decrypt(c2) == zv);
+            throw_c(pp.decrypt(pp.encrypt(zv)) == zv);
+        }
+
+        const ZZ big = pp.encrypt(to_ZZ(1) << 64);
+        std::string bigct(NumBytes(big), 0);
+        BytesFromZZ((uint8_t *) &bigct[0], big, bigct.size());
+        uint64_t dec;
+        throw_c(!pp.decrypt_u64(bigct, &dec));
+
+        cout << "paillier encrypt (abits " << abits << "): gmp "
+             << gmp_usec / 100 << " usec, ntl " << ntl_usec / 100
+             << " usec" << endl;
+    }
+}
+
+// Row packs as the packed AGG onion stores them: one ciphertext per row,
+// one slot per column; the product of the rows holds the column sums.
+static void
+test_paillier_pack_u64()
+{
+    urandom u;
+    Paillier_priv pp(Paillier_priv::keygen(&u));
+
+    const uint nslots = pp.slots_u64();
+    cout << "paillier 64-bit slots: " << nslots << endl;
+
+    std::vector<uint64_t> sums(nslots, 0);
+    ZZ agg = to_ZZ(1);
+    timer t;
+    double enc_usec = 0;
+    for (uint row = 0; row < 100; row++) {
+        std::vector<uint64_t> slots;
+        for (uint i = 0; i < nslots; i++) {
+            slots.push_back(u.rand<uint32_t>());
+            sums[i] += slots[i];
+        }
+
+        t.lap();
+        const std::string ct = pp.encrypt_pack_u64(slots);
+        enc_usec += t.lap();
+
+        std::vector<uint64_t> dec(nslots);
+        throw_c(pp.decrypt_pack_u64(ct, &dec) && dec == slots);
+
+        agg = pp.add(agg, ZZFromBytes((const uint8_t *) ct.data(),
+                                      ct.size()));
+    }
+
+    std::string aggct(NumBytes(agg), 0);
+    BytesFromZZ((uint8_t *) &aggct[0], agg, aggct.size());
+    std::vector<uint64_t> dec(nslots);
+    throw_c(pp.decrypt_pack_u64(aggct, &dec) && dec == sums);
+
+    /* the top slot does not fit in fewer slots */
+    std::vector<uint64_t> fewer(nslots - 1);
+    throw_c(!pp.decrypt_pack_u64(aggct, &fewer));
+
+    cout << "paillier encrypt " << nslots << "-slot pack: "
+         << enc_usec / 100 << " usec" << endl;
+}
+
 static void
 test_paillier_packing()
 {
@@ -334,6 +473,74 @@ test_search()
     throw_c(s.match(cl, s.wordkey("world")));
 }
 
+static void
+test_swp_bloom(uint nrows)
+{
+    urandom u;
+    const std::string key = u.rand_string(16);
+
+    // rows of up to a hundred words, as Search::encrypt stores them; the
+    // filter grows with them
+    std::vector<std::string> rows;
+    std::vector<std::list<std::string> > words(nrows);
+    for (uint i = 0; i < nrows; i++) {
+        const uint nwords = i % 101;
+        for (uint j = 0; j < nwords; j++) {
+            words[i].push_back("w" + std::to_string(u.rand<uint32_t>()
+                                                    % (nrows * 10)));
+        }
+        const std::unique_ptr<std::list<std::string> >
+            l(SWP::encrypt(key, words[i]));
+        std::string row = SWP::bloom(key, words[i]);
+        for (const auto &it : *l)
+            row += it;
+        rows.push_back(row);
+    }
+
+    const std::string word = "w" + std::to_string(u.rand<uint32_t>()
+                                                  % (nrows * 10));
+    const Token t = SWP::token(key, word);
+    const std::string mask = SWP::bloomMask(key, word);
+
+    uint matches = 0, candidates = 0;
+    timer tm;
+    for (uint i = 0; i < nrows; i++) {
+        const size_t filter_len =
+            SWPBloomLenBytes + SWP::bloomBytes(words[i].size());
+        throw_c(rows[i].length() >= filter_len);
+        const bool found =
+            SWP::searchExists(t, rows[i].data() + filter_len,
+                              rows[i].length() - filter_len);
+        const bool expected =
+            words[i].end() != std::find(words[i].begin(), words[i].end(),
+                                        word);
+        throw_c(found == expected);
+        matches += found;
+    }
+    const uint64_t swp_usec = tm.lap();
+
+    for (uint i = 0; i < nrows; i++) {
+        size_t filter_len;
+        if (!SWP::bloomMatch(rows[i].data(), rows[i].length(), mask,
+                             &filter_len))
+            continue;
+        candidates++;
+        const bool found =
+            SWP::searchExists(t, rows[i].data() + filter_len,
+                              rows[i].length() - filter_len);
+        matches -= found;
+    }
+    const uint64_t bloom_usec = tm.lap();
+
+    // no row that has the word is filtered out
+    throw_c(0 == matches);
+    throw_c(candidates <= nrows / 50 + 10);
+
+    cout << "swp search " << nrows << " rows: " << swp_usec << " usec, "
+         << "with bloom filter " << bloom_usec << " usec ("
+         << candidates << " candidates)\n";
+}
+
 static void
 test_skip32(void)
 {
@@ -436,6 +643,33 @@ test_ffx()
     }
 }
 
+// DET_ffx: every length up to FFX_MAX_BYTES keeps its length and comes
+// back; equal values encrypt alike.
+static void
+test_ffx_strings()
+{
+    urandom u;
+    AES key(u.rand_string(16));
+
+    for (size_t len = 0; len <= FFX_MAX_BYTES; len++) {
+        for (int i = 0; i < 100; i++) {
+            const std::string pt = u.rand_string(len);
+            const std::string ct = encrypt_FFX(pt, key);
+            throw_c(ct.size() == pt.size());
+            throw_c(ct == encrypt_FFX(pt, key));
+            throw_c(decrypt_FFX(ct, key) == pt);
+        }
+    }
+
+    bool threw = false;
+    try {
+        encrypt_FFX(u.rand_string(FFX_MAX_BYTES + 1), key);
+    } catch (const CryptoError &e) {
+        threw = true;
+    }
+    throw_c(threw);
+}
+
 static void
 test_online_ope()
 {
@@ -509,6 +743,114 @@ test_online_ope_rebalance()
     cerr << "test online ope rebalance OK \n";
 }
 
+static void
+test_online_ope_relabel()
+{
+    urandom u;
+    blowfish bf(u.rand_string(128));
+
+    ope_server<uint64_t> ope_serv;
+    ope_serv.track_relabels(true);
+    ope_client<uint64_t, blowfish> ope_clnt(&bf, &ope_serv);
+
+    /* what a column holds, kept up to date with the relabels */
+    std::map<uint64_t, uint64_t> column;
+    for (uint i = 0; i < 2000; i++) {
+        /* mostly appends, as timestamps */
+        uint64_t pt = (i % 8) ? i * 16 : u.rand<uint64_t>() % (i * 16 + 1);
+        uint64_t ct = ope_clnt.encrypt(pt);
+
+        for (const auto &r: ope_serv.take_relabeled()) {
+            auto it = column.find(bf.decrypt(r.enc_val));
+            if (it == column.end())
+                continue;
+            throw_c(it->second == r.from);
+            it->second = r.to;
+        }
+        column[pt] = ct;
+    }
+
+    uint64_t prev = 0;
+    for (const auto &it: column) {
+        throw_c(ope_clnt.encrypt(it.first) == it.second);
+        throw_c(it.second > prev);
+        prev = it.second;
+    }
+
+    /* the ciphertexts restore the very same tree, with rows deleted */
+    std::vector<std::pair<uint64_t, uint64_t> > rows;
+    for (const auto &it: column)
+        if (u.rand<uint8_t>() % 4)
+            rows.push_back(std::make_pair(it.second, it.first));
+    ope_server<uint64_t> restored;
+    restored.track_relabels(true);
+    ope_client<uint64_t, blowfish> restored_clnt(&bf, &restored);
+    throw_c(restored_clnt.restore(rows));
+    for (const auto &it: rows)
+        throw_c(restored_clnt.encrypt(it.second) == it.first);
+    throw_c(restored.take_relabeled().empty());
+
+    /* but not two values on one path */
+    rows.push_back(std::make_pair(rows[0].first, rows[0].second + 1));
+    throw_c(!restored_clnt.restore(rows));
+
+    /* the values alone are enough to rebuild the tree */
+    std::vector<uint64_t> in_order;
+    for (const auto &it: column)
+        in_order.push_back(bf.encrypt(it.first));
+    ope_serv.rebuild(in_order);
+
+    prev = 0;
+    for (const auto &it: column) {
+        uint64_t ct = ope_clnt.encrypt(it.first);
+        throw_c(ct > prev && ope_clnt.decrypt(ct) == it.first);
+        prev = ct;
+    }
+    throw_c(ope_serv.take_relabeled().empty());
+
+    cerr << "test online ope relabel OK \n";
+}
+
+static void
+test_mope_vs_ope(uint n)
+{
+    urandom u;
+    std::vector<uint64_t> pts;
+    for (uint i = 0; i < n; i++)
+        pts.push_back(u.rand<uint32_t>());
+
+    blowfish bf(u.rand_string(16));
+    ope_server<uint64_t> ope_serv;
+    ope_serv.track_relabels(true);
+    ope_client<uint64_t, blowfish> ope_clnt(&bf, &ope_serv);
+
+    timer t;
+    uint64_t moved = 0;
+    for (uint64_t pt: pts) {
+        ope_clnt.encrypt(pt);
+        moved += ope_serv.take_relabeled().size();
+    }
+    const double mope_insert = t.lap();
+    for (uint64_t pt: pts)
+        ope_clnt.encrypt(pt);
+    const double mope_lookup = t.lap();
+
+    OPE ope("hello world", 32, 64);
+    for (uint64_t pt: pts)
+        ope.encrypt(to_ZZ((long) pt));
+    const double ope_insert = t.lap();
+    for (uint64_t pt: pts)
+        ope.encrypt(to_ZZ((long) pt));
+    const double ope_lookup = t.lap();
+
+    cout << "--- mope vs ope: " << n << " 32-bit values" << endl
+         << "  mope: " << mope_insert / n << " usec insert, "
+         << mope_lookup / n << " usec lookup, "
+         << (double) moved / n << " ciphertexts moved per insert" << endl
+         << "  ope:  " << ope_insert / n << " usec first, "
+         << ope_lookup / n << " usec again" << endl;
+}
+
 static void
 test_padding()
 {
@@ -527,6 +869,103 @@ test_padding()
     cout << "test padding ok\n";
 }
 
+static void
+test_aes_evp()
+{
+    urandom u;
+    const string key = u.rand_string(16);
+    const AES_EVP aes(key);
+    const std::unique_ptr<AES_KEY> enckey(get_AES_enc_key(key));
+    const std::unique_ptr<AES_KEY> deckey(get_AES_dec_key(key));
+
+    vector<string> ptexts, salts;
+    for (int i = 0; i < 1000; i++) {
+        ptexts.push_back(u.rand_string(u.rand<size_t>() % 100));
+        salts.push_back(u.rand_string(8));
+    }
+
+    // must match the AES_KEY versions byte for byte
+    for (size_t i = 0; i < ptexts.size(); i++) {
+        auto cbc = encrypt_AES_CBC(ptexts[i], aes, salts[i]);
+        throw_c(cbc == encrypt_AES_CBC(ptexts[i], enckey.get(), salts[i]));
+        throw_c(ptexts[i] == decrypt_AES_CBC(cbc, aes, salts[i]));
+
+        auto cmc = encrypt_AES_CMC(ptexts[i], aes);
+        throw_c(cmc == encrypt_AES_CMC(ptexts[i], enckey.get()));
+        throw_c(ptexts[i] == decrypt_AES_CMC(cmc, aes));
+        throw_c(ptexts[i] == decrypt_AES_CMC(cmc, deckey.get()));
+    }
+
+    auto cbcs = encrypt_AES_CBC_batch(ptexts, aes, salts);
+    auto cmcs = encrypt_AES_CMC_batch(ptexts, aes);
+    for (size_t i = 0; i < ptexts.size(); i++) {
+        throw_c(cbcs[i] == encrypt_AES_CBC(ptexts[i], aes, salts[i]));
+        throw_c(cmcs[i] == encrypt_AES_CMC(ptexts[i], aes));
+    }
+    throw_c(ptexts == decrypt_AES_CBC_batch(cbcs, aes, salts));
+    throw_c(ptexts == decrypt_AES_CMC_batch(cmcs, aes));
+
+    // in place
+    string buf = ptexts[0];
+    buf.resize(AES_CBC_len(buf.size()));
+    size_t len = encrypt_AES_CMC(&buf[0], ptexts[0].size(), aes, &buf[0]);
+    throw_c(string(buf.data(), len) == cmcs[0]);
+    len = decrypt_AES_CMC(&buf[0], len, aes, &buf[0]);
+    throw_c(string(buf.data(), len) == ptexts[0]);
+
+    enum { nperf = 100000 };
+    vector<string> perf_pt(nperf, u.rand_string(12));
+    timer single;
+    for (auto &p: perf_pt)
+        encrypt_AES_CMC(p, aes);
+    auto single_t = single.lap();
+
+    timer batch;
+    encrypt_AES_CMC_batch(perf_pt, aes);
+    auto batch_t = batch.lap();
+
+    cout << "aes-evp cmc: single " << single_t * 1000 / nperf
+         << " ns/value, batch " << batch_t * 1000 / nperf
+         << " ns/value" << endl;
+}
+
+static void
+test_blowfish_batch()
+{
+    urandom u;
+    blowfish bf(u.rand_string(16));
+
+    for (size_t n = 0; n < 40; n++) {
+        auto pt = u.rand_vec<uint64_t>(n);
+        vector<uint64_t> ct(n), pt2(n);
+        bf.encrypt(pt.data(), ct.data(), n);
+        for (size_t i = 0; i < n; i++)
+            throw_c(ct[i] == bf.encrypt(pt[i]));
+        bf.decrypt(ct.data(), pt2.data(), n);
+        throw_c(pt == pt2);
+
+        // in place
+        bf.encrypt(pt2.data(), pt2.data(), n);
+        throw_c(pt2 == ct);
+    }
+
+    enum { nperf = 100000 };
+    auto perf_pt = u.rand_vec<uint64_t>(nperf);
+    vector<uint64_t> perf_ct(nperf);
+    timer single;
+    for (size_t i = 0; i < nperf; i++)
+        perf_ct[i] = bf.encrypt(perf_pt[i]);
+    auto single_t = single.lap();
+
+    timer batch;
+    bf.encrypt(perf_pt.data(), perf_ct.data(), nperf);
+    auto batch_t = batch.lap();
+
+    cout << "blowfish: single " << single_t * 1000 / nperf
+         << " ns/block, batch " << batch_t * 1000 / nperf
+         << " ns/block" << endl;
+}
+
 template<typename T>
 static void
 test_gfe(size_t q)
@@ -612,15 +1051,23 @@ main(int ac, char **av)
     test_gfe<uint64_t>(3);
 
     test_padding();
+    test_aes_evp();
+    test_blowfish_batch();
     test_bn();
     test_ecjoin();
     test_search();
+    test_swp_bloom(10000);
     test_paillier();
+    test_paillier_gmp();
     test_paillier_packing();
+    test_paillier_pack_u64();
     test_montgomery();
     test_skip32();
     test_online_ope();
+    test_online_ope_relabel();
+    test_mope_vs_ope(1000);
     test_ffx();
+    test_ffx_strings();
 
     AES aes128(u.rand_string(16));
     test_block_cipher(&aes128, &u, "aes-128");
@@ -655,4 +1102,7 @@ main(int ac, char **av)
     for (int pbits = 32; pbits <= 128; pbits += 32)
         for (int cbits = pbits; cbits <= pbits + 128; cbits += 32)
             test_ope(pbits, cbits);
+
+    test_ope_batch(32, 64);
+    test_ope_batch(64, 128);
 }
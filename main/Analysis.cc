@@ -4,6 +4,7 @@
 #include <main/metadata_tables.hh>
 #include <main/macro_util.hh>
 #include <main/stored_procedures.hh>
+#include <main/phase.hh>
 #include <util/util.hh>
 
 // FIXME: Wrong interfaces.
@@ -61,10 +62,8 @@ EncSet::intersect(const EncSet & es2) const
                 //    we will do computation client side if necessary.
                 const OnionMeta * const om = fm->getOnionMeta(o);
                 const OnionMeta * const om2 = fm2->getOnionMeta(o);
-                // HACK: To determine if the keys are the same.
                 if ((om->hasEncLayer(sl) && om2->hasEncLayer(sl)
-                     && om->getLayer(sl)->doSerialize() ==
-                        om2->getLayer(sl)->doSerialize())) {
+                     && om->getLayer(sl)->sameKey(*om2->getLayer(sl)))) {
                     m[o] = LevelFieldPair(sl, fm);
                 }
             }
@@ -366,6 +365,13 @@ synchronizeDatabases(const std::unique_ptr<Connect> &conn,
     return true;
 }
 
+static std::string
+proxyPrefix()
+{
+    return getenv("CRYPTDB_NAME") ? getenv("CRYPTDB_NAME")
+                                  : "generic_prefix_";
+}
+
 SharedProxyState::SharedProxyState(ConnectionInfo ci,
                                    const std::string &embed_dir,
                                    const std::string &master_key,
@@ -377,7 +383,8 @@ SharedProxyState::SharedProxyState(ConnectionInfo ci,
                                                    // list.
       conn(new Connect(ci.server, ci.user, ci.passwd, ci.port)),
       default_sec_rating(default_sec_rating),
-      cache(std::move(SchemaCache()))
+      cache(SchemaCache(embed_dir + "/" + proxyPrefix()
+                        + "schema.snapshot"))
 {
     // make sure the server was not started in SQL_SAFE_UPDATES mode
     // > it might not even be possible to start the server in this mode;
@@ -397,9 +404,7 @@ SharedProxyState::SharedProxyState(ConnectionInfo ci,
         init_e_conn(Connect::getEmbedded(embed_dir));
     assert(conn && init_e_conn);
 
-    const std::string prefix = 
-        getenv("CRYPTDB_NAME") ? getenv("CRYPTDB_NAME")
-                               : "generic_prefix_";
+    const std::string prefix = proxyPrefix();
     assert(MetaData::initialize(conn, init_e_conn, prefix));
 
     TEST_TextMessageError(synchronizeDatabases(conn, init_e_conn),
@@ -483,7 +488,42 @@ void ProxyState::dumpTHDs()
     assert(0 == thds.size());
 }
 
-std::string Delta::tableNameFromType(TableType table_type) const
+bool OnionUsage::recording = false;
+std::map<OnionUsage::FieldKey, OnionLevelMap> OnionUsage::usage;
+
+void
+OnionUsage::record(const std::string &db, const std::string &table,
+                   const std::string &field, onion o, SECLEVEL l)
+{
+    if (false == recording) {
+        return;
+    }
+
+    OnionLevelMap &levels = usage[FieldKey(db, table, field)];
+    const auto &it = levels.find(o);
+    if (levels.end() == it || l < it->second) {
+        levels[o] = l;
+    }
+}
+
+pthread_mutex_t DeferredOnions::lock = PTHREAD_MUTEX_INITIALIZER;
+std::map<std::string, std::pair<uint64_t, uint64_t> >
+    DeferredOnions::watermarks;
+
+std::pair<uint64_t, uint64_t> &
+DeferredOnions::watermark(const std::string &anon_onion)
+{
+    auto it = watermarks.find(anon_onion);
+    if (watermarks.end() == it) {
+        // we do not know what the onion holds
+        it = watermarks.insert(
+                std::make_pair(anon_onion, std::make_pair(1, 0))).first;
+    }
+
+    return it->second;
+}
+
+std::string Delta::tableNameFromType(TableType table_type)
 {
     switch (table_type) {
         case REGULAR_TABLE: {
@@ -502,142 +542,255 @@ std::string Delta::tableNameFromType(TableType table_type) const
 // > the hackery around BLEEDING v REGULAR ensures that both tables use the
 //   same ID for equivalent objects regardless of differences between
 //   auto_increment on the BLEEDING and REGULAR tables
-bool CreateDelta::apply(const std::unique_ptr<Connect> &e_conn,
-                        TableType table_type)
+bool CreateDelta::apply(DeltaBatch *const batch, TableType table_type)
 {
     if (BLEEDING_TABLE == table_type) {
         assert(0 == id_cache.size());
+        assert(0 == staged.size());
     }
 
-    const std::string &table_name = tableNameFromType(table_type);
     std::function<bool(const DBMeta &, const DBMeta &,
-                       const AbstractMetaKey &,
-                       const unsigned int)> helper =
-        [this, &e_conn, &helper, &table_type, &table_name]
+                       const AbstractMetaKey &, unsigned int, size_t)>
+        helper =
+        [this, batch, &helper, &table_type]
         (const DBMeta &object, const DBMeta &parent,
-         const AbstractMetaKey &k, const int parent_id)
+         const AbstractMetaKey &k, unsigned int parent_id,
+         size_t parent_row)
     {
         const std::string &child_serial = object.serialize(parent);
         assert(0 == object.getDatabaseID());
 
-        const std::string &serial_key = k.getSerial();
-        const std::string &esc_serial_key =
-            escapeString(e_conn, serial_key);
-
-        // ------------------------
-        //    Build the queries.
-        // ------------------------
-
-        // On CREATE, the database generates a unique ID for us.
-        const std::string &esc_child_serial =
-            escapeString(e_conn, child_serial);
-
-        AssignOnce<unsigned int> old_object_id;
+        AssignOnce<unsigned int> object_id;
         if (BLEEDING_TABLE == table_type) {
-            old_object_id = 0;          // forces the DB to assign an ID
+            object_id = 0;          // forces the DB to assign an ID
         } else {
             assert(REGULAR_TABLE == table_type);
             auto const &cached = this->id_cache.find(&object);
             assert(cached != this->id_cache.end());
-            old_object_id = cached->second;
+            object_id = cached->second;
         }
 
-        const std::string &query =
-            " INSERT INTO " + table_name + 
-            "    (serial_object, serial_key, parent_id, id) VALUES (" 
-            " '" + esc_child_serial + "',"
-            " '" + esc_serial_key + "',"
-            " " + std::to_string(parent_id) + ","
-            " " + std::to_string(old_object_id.get()) + ");";
-        RETURN_FALSE_IF_FALSE(e_conn->execute(query));
-
-        const unsigned int object_id = e_conn->last_insert_id();
-
+        const size_t row =
+            batch->create(child_serial, k.getSerial(), parent_id,
+                          parent_row, object_id.get());
         if (BLEEDING_TABLE == table_type) {
-            assert(this->id_cache.find(&object) == this->id_cache.end());
-            this->id_cache[&object] = object_id;
-        } else {
-            assert(REGULAR_TABLE == table_type);
-            // should only be used one time
-            this->id_cache.erase(&object);
+            assert(this->staged.find(&object) == this->staged.end());
+            this->staged[&object] = row;
         }
 
+        // > the children of a new BLEEDING object learn its ID when the
+        //   batch is written
+        const unsigned int id = object_id.get();
+        const size_t child_parent_row =
+            BLEEDING_TABLE == table_type ? row : DeltaBatch::no_row;
         std::function<bool(const DBMeta &)> localCreateHandler =
-            [&object, object_id, &helper]
+            [&object, id, child_parent_row, &helper]
                 (const DBMeta &child)
             {
-                return helper(child, object, object.getKey(child), object_id);
+                return helper(child, object, object.getKey(child), id,
+                              child_parent_row);
             };
         return object.applyToChildren(localCreateHandler);
     };
 
-    const bool b =
-        helper(*meta.get(), parent_meta, key, parent_meta.getDatabaseID());
+    return helper(*meta.get(), parent_meta, key,
+                  parent_meta.getDatabaseID(), DeltaBatch::no_row);
+}
 
+void CreateDelta::applied(const DeltaBatch &batch, TableType table_type)
+{
     if (BLEEDING_TABLE == table_type) {
+        for (const auto &it : this->staged) {
+            this->id_cache[it.first] = batch.createdID(it.second);
+        }
+        this->staged.clear();
         assert(0 != this->id_cache.size());
     } else {
         assert(REGULAR_TABLE == table_type);
-        assert(0 == this->id_cache.size());
+        // the ids are only used one time
+        this->id_cache.clear();
     }
-
-    return b;
 }
 
 // FIXME: used incorrectly, as we should be doing copy construction
 // on the original object; not modifying it in place
-bool ReplaceDelta::apply(const std::unique_ptr<Connect> &e_conn,
-                         TableType table_type)
+bool ReplaceDelta::apply(DeltaBatch *const batch, TableType table_type)
+{
+    batch->replace(meta.getDatabaseID(), meta.serialize(parent_meta),
+                   key.getSerial());
+
+    return true;
+}
+
+bool DeleteDelta::apply(DeltaBatch *const batch, TableType table_type)
 {
-    const std::string table_name = tableNameFromType(table_type);
+    std::function<bool(const DBMeta &)> helper =
+        [batch, &helper](const DBMeta &object)
+    {
+        batch->remove(object.getDatabaseID());
+
+        return object.applyToChildren(helper);
+    };
 
-    const unsigned int child_id = meta.getDatabaseID();
+    return helper(meta);
+}
 
-    const std::string child_serial = meta.serialize(parent_meta);
-    const std::string esc_child_serial =
-        escapeString(e_conn, child_serial);
-    const std::string serial_key = key.getSerial();
-    const std::string esc_serial_key = escapeString(e_conn, serial_key);
+size_t
+DeltaBatch::create(const std::string &serial_object,
+                   const std::string &serial_key, unsigned int parent_id,
+                   size_t parent_row, unsigned int id)
+{
+    assert(no_row == parent_row || parent_row < this->created.size());
+    this->created.push_back(
+        Created{serial_object, serial_key, parent_id, parent_row, id});
 
-    const std::string query =
-        " UPDATE " + table_name +
-        "    SET serial_object = '" + esc_child_serial + "', "
-        "        serial_key = '" + esc_serial_key + "'"
-        "  WHERE id = " + std::to_string(child_id) + ";";
-    RETURN_FALSE_IF_FALSE(e_conn->execute(query));
+    return this->created.size() - 1;
+}
+
+void
+DeltaBatch::replace(unsigned int id, const std::string &serial_object,
+                    const std::string &serial_key)
+{
+    this->replaced[id] = std::make_pair(serial_object, serial_key);
+}
+
+void
+DeltaBatch::remove(unsigned int id)
+{
+    this->removed.push_back(id);
+}
+
+// > InnoDB gives the rows of a multi-row INSERT consecutive ids unless
+//   innodb_autoinc_lock_mode is 2
+static bool
+consecutiveIDs(const std::unique_ptr<Connect> &e_conn)
+{
+    static const bool consecutive =
+        [&e_conn] ()
+        {
+            std::unique_ptr<DBResult> dbres;
+            if (false == e_conn->execute(
+                    "SELECT @@innodb_autoinc_lock_mode,"
+                    "       @@auto_increment_increment;", &dbres)) {
+                return false;
+            }
+            const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+            const unsigned long *const l = mysql_fetch_lengths(dbres->n);
+            return NULL != row && NULL != row[0] && NULL != row[1]
+                && "2" != std::string(row[0], l[0])
+                && "1" == std::string(row[1], l[1]);
+        }();
+
+    return consecutive;
+}
+
+// Writes 'rows', whose parents are written.
+bool
+DeltaBatch::insert(const std::unique_ptr<Connect> &e_conn,
+                   const std::vector<size_t> &rows)
+{
+    std::vector<std::string> values;
+    bool assigned = false;
+    for (const size_t row : rows) {
+        const Created &c = this->created[row];
+        const unsigned int parent_id =
+            no_row == c.parent_row ? c.parent_id
+                                   : this->created_ids[c.parent_row];
+        assigned = assigned || 0 == c.id;
+        values.push_back(
+            " ('" + escapeString(e_conn, c.serial_object) + "',"
+            "  '" + escapeString(e_conn, c.serial_key) + "',"
+            "  " + std::to_string(parent_id) + ","
+            "  " + (0 == c.id ? "NULL" : std::to_string(c.id)) + ")");
+    }
+
+    const std::string &insert =
+        " INSERT INTO " + this->table_name +
+        "    (serial_object, serial_key, parent_id, id) VALUES";
+    if (assigned && false == consecutiveIDs(e_conn)) {
+        for (size_t i = 0; i < rows.size(); ++i) {
+            RFIF(e_conn->execute(insert + values[i] + ";"));
+            this->created_ids[rows[i]] =
+                0 == this->created[rows[i]].id ? e_conn->last_insert_id()
+                                               : this->created[rows[i]].id;
+        }
+
+        return true;
+    }
+
+    std::string all_values;
+    for (const auto &it : values) {
+        all_values += (all_values.empty() ? "" : ",") + it;
+    }
+    RFIF(e_conn->execute(insert + all_values + ";"));
+
+    // > the first id the database assigned
+    const unsigned int first = assigned ? e_conn->last_insert_id() : 0;
+    unsigned int next = first;
+    for (const size_t row : rows) {
+        const Created &c = this->created[row];
+        this->created_ids[row] = 0 == c.id ? next++ : c.id;
+    }
 
     return true;
 }
 
-bool DeleteDelta::apply(const std::unique_ptr<Connect> &e_conn,
-                        TableType table_type)
+bool
+DeltaBatch::flush(const std::unique_ptr<Connect> &e_conn)
 {
-    const std::string table_name = tableNameFromType(table_type);
-    Connect * const e_c = e_conn.get();
-    std::function<bool(const DBMeta &, const DBMeta &)> helper =
-        [&e_c, &helper, table_name](const DBMeta &object,
-                                    const DBMeta &parent)
-    {
-        const unsigned int object_id = object.getDatabaseID();
-        const unsigned int parent_id = parent.getDatabaseID();
-
-        const std::string query =
-            " DELETE " + table_name + " "
-            "   FROM " + table_name +
-            "  WHERE " + table_name + ".id" +
-            "      = "     + std::to_string(object_id) +
-            "    AND " + table_name + ".parent_id" +
-            "      = "     + std::to_string(parent_id) + ";";
-        RETURN_FALSE_IF_FALSE(e_c->execute(query));
-
-        std::function<bool(const DBMeta &)> localDestroyHandler =
-            [&object, &helper] (const DBMeta &child) {
-                return helper(child, object);
-            };
-        return object.applyToChildren(localDestroyHandler);
-    };
+    if (false == this->replaced.empty()) {
+        std::string objects, keys, ids;
+        for (const auto &it : this->replaced) {
+            const std::string &id = std::to_string(it.first);
+            objects += " WHEN " + id + " THEN '"
+                       + escapeString(e_conn, it.second.first) + "'";
+            keys += " WHEN " + id + " THEN '"
+                    + escapeString(e_conn, it.second.second) + "'";
+            ids += (ids.empty() ? "" : ", ") + id;
+        }
 
-    return helper(meta, parent_meta);
+        const std::string &query =
+            " UPDATE " + this->table_name +
+            "    SET serial_object = CASE id" + objects + " END,"
+            "        serial_key = CASE id" + keys + " END"
+            "  WHERE id IN (" + ids + ");";
+        RFIF(e_conn->execute(query));
+    }
+
+    if (false == this->removed.empty()) {
+        std::string ids;
+        for (const auto &it : this->removed) {
+            ids += (ids.empty() ? "" : ", ") + std::to_string(it);
+        }
+
+        const std::string &query =
+            " DELETE FROM " + this->table_name +
+            "  WHERE id IN (" + ids + ");";
+        RFIF(e_conn->execute(query));
+    }
+
+    // a level of the new objects at a time, as the rows of a level need
+    // the ids of their parents
+    // > a row is staged after its parent
+    this->created_ids.assign(this->created.size(), 0);
+    std::vector<unsigned int> level(this->created.size(), 0);
+    unsigned int depth = 0;
+    for (size_t i = 0; i < this->created.size(); ++i) {
+        const size_t parent_row = this->created[i].parent_row;
+        level[i] = no_row == parent_row ? 0 : level[parent_row] + 1;
+        depth = std::max(depth, level[i] + 1);
+    }
+    for (unsigned int d = 0; d < depth; ++d) {
+        std::vector<size_t> rows;
+        for (size_t i = 0; i < this->created.size(); ++i) {
+            if (d == level[i]) {
+                rows.push_back(i);
+            }
+        }
+        RFIF(this->insert(e_conn, rows));
+    }
+
+    return true;
 }
 
 bool
@@ -645,8 +798,13 @@ writeDeltas(const std::unique_ptr<Connect> &e_conn,
             const std::vector<std::unique_ptr<Delta> > &deltas,
             Delta::TableType table_type)
 {
+    DeltaBatch batch(table_type);
+    for (const auto &it : deltas) {
+        RFIF(it->apply(&batch, table_type));
+    }
+    RFIF(batch.flush(e_conn));
     for (const auto &it : deltas) {
-        RFIF(it->apply(e_conn, table_type));
+        it->applied(batch, table_type);
     }
 
     return true;
@@ -789,7 +947,7 @@ FieldMeta &Analysis::getFieldMeta(const std::string &db,
                                   const std::string &field) const
 {
     FieldMeta * const fm =
-        this->getTableMeta(db, table).getChild(IdentityMetaKey(field));
+        this->getTableMeta(db, table).findChild(field, true);
     TEST_IdentifierNotFound(fm, field);
 
     return *fm;
@@ -798,7 +956,7 @@ FieldMeta &Analysis::getFieldMeta(const std::string &db,
 FieldMeta &Analysis::getFieldMeta(const TableMeta &tm,
                                   const std::string &field) const
 {
-    FieldMeta *const fm = tm.getChild(IdentityMetaKey(field));
+    FieldMeta *const fm = tm.findChild(field, true);
     TEST_IdentifierNotFound(fm, field);
 
     return *fm;
@@ -810,7 +968,7 @@ TableMeta &Analysis::getTableMeta(const std::string &db,
     const DatabaseMeta &dm = this->getDatabaseMeta(db);
 
     TableMeta *const tm =
-        dm.getChild(IdentityMetaKey(unAliasTable(db, table)));
+        dm.findChild(unAliasTable(db, table));
     TEST_IdentifierNotFound(tm, table);
 
     return *tm;
@@ -819,7 +977,7 @@ TableMeta &Analysis::getTableMeta(const std::string &db,
 DatabaseMeta &
 Analysis::getDatabaseMeta(const std::string &db) const
 {
-    DatabaseMeta *const dm = this->schema.getChild(IdentityMetaKey(db));
+    DatabaseMeta *const dm = this->schema.findChild(db);
     TEST_DatabaseNotFound(dm, db);
 
     return *dm;
@@ -835,13 +993,13 @@ bool Analysis::nonAliasTableMetaExists(const std::string &db,
                                        const std::string &table) const
 {
     const DatabaseMeta &dm = this->getDatabaseMeta(db);
-    return dm.childExists(IdentityMetaKey(table));
+    return NULL != dm.findChild(table);
 }
 
 bool
 Analysis::databaseMetaExists(const std::string &db) const
 {
-    return this->schema.childExists(IdentityMetaKey(db));
+    return NULL != this->schema.findChild(db);
 }
 
 std::string Analysis::getAnonTableName(const std::string &db,
@@ -866,7 +1024,7 @@ Analysis::translateNonAliasPlainToAnonTableName(const std::string &db,
     const
 {
     TableMeta *const tm =
-        this->getDatabaseMeta(db).getChild(IdentityMetaKey(table));
+        this->getDatabaseMeta(db).findChild(table);
     TEST_IdentifierNotFound(tm, table);
 
     return tm->getAnonTableName();
@@ -951,6 +1109,7 @@ RewritePlanWithAnalysis::RewritePlanWithAnalysis(const EncSet &es_out,
 std::string
 lexToQuery(const LEX &lex)
 {
+    const PhaseTimer t(Phase::STRINGIFY);
     std::ostringstream o;
     o << const_cast<LEX &>(lex);
     return o.str();
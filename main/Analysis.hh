@@ -1,8 +1,11 @@
 #pragma once
 
 #include <algorithm>
+#include <map>
+#include <tuple>
 #include <util/onions.hh>
 #include <util/cryptdb_log.hh>
+#include <util/scoped_lock.hh>
 #include <main/schema.hh>
 #include <main/rewrite_ds.hh>
 #include <parser/embedmysql.hh>
@@ -36,6 +39,10 @@ private:
 
 typedef struct ReturnMeta {
     std::map<int, ReturnField> rfmeta;
+    // Fields with no column of their own, by their place among the
+    // fields returned, with the column they read: the SUMs over a packed
+    // AGG onion after the first, whose slots are in the first's result.
+    std::map<unsigned int, std::pair<int, ReturnField> > shared;
     std::string stringify();
 } ReturnMeta;
 
@@ -52,6 +59,18 @@ public:
     const SECLEVEL tolevel;
 };
 
+// The query reads a deferred onion that has values left to backfill.
+class DeferredOnionExcept {
+public:
+    DeferredOnionExcept(const std::string &table, const FieldMeta &fm,
+                        onion o)
+        : table(table), fm(fm), o(o) {}
+
+    const std::string table;
+    const FieldMeta &fm;
+    const onion o;
+};
+
 // TODO: Maybe we want a database name argument/member.
 typedef class ConnectionInfo {
 public:
@@ -99,7 +118,7 @@ private:
 
 class ProxyState {
 public:
-    ProxyState(SharedProxyState &shared)
+    ProxyState(const SharedProxyState &shared)
         : shared(shared),
           e_conn(Connect::getEmbedded(shared.embed_dir)) {}
     ~ProxyState();
@@ -110,7 +129,11 @@ public:
     const std::unique_ptr<Connect> &getEConn() const;
     void safeCreateEmbeddedTHD();
     void dumpTHDs();
+    // Frees the THDs of finished queries; the next query must create one.
+    void releaseTHDs() {thds.clear();}
     const SchemaCache &getSchemaCache() const {return shared.cache;}
+    // > a worker thread builds a ProxyState of its own from this
+    const SharedProxyState &getShared() const {return shared;}
     std::shared_ptr<const SchemaInfo> getSchemaInfo() const
         {return shared.cache.getSchema(this->getConn(), this->getEConn());}
 
@@ -122,6 +145,69 @@ private:
 
 extern __thread ProxyState *thread_ps;
 
+// Records the lowest level each onion of a column was rewritten against;
+// offline tools (ie, cryptdblearn) replay a trace with recording enabled
+// to learn which onions a workload actually needs.
+// > not thread safe, it is disabled unless a tool turns it on.
+class OnionUsage {
+public:
+    // (database, table, field)
+    typedef std::tuple<std::string, std::string, std::string> FieldKey;
+
+    static void enable(bool on) {recording = on;}
+    static void record(const std::string &db, const std::string &table,
+                       const std::string &field, onion o, SECLEVEL l);
+    static const std::map<FieldKey, OnionLevelMap> &get() {return usage;}
+    static void clear() {usage.clear();}
+
+private:
+    static bool recording;
+    static std::map<FieldKey, OnionLevelMap> usage;
+};
+
+// INSERT leaves a deferred onion NULL and a backfill encrypts the value
+// into it later. The watermark of each onion counts the values deferred
+// so far and the count when the last complete backfill began; a query
+// must not read the onion while the former is ahead.
+// > the proxy forgets its watermarks when it restarts, so they start out
+//   behind.
+// > cryptdbimport rewrites INSERTs on several threads, so the watermarks
+//   take a lock.
+class DeferredOnions {
+public:
+    static void deferred(const std::string &anon_onion)
+    {
+        scoped_lock l(&lock);
+        ++watermark(anon_onion).first;
+    }
+    static uint64_t mark(const std::string &anon_onion)
+    {
+        scoped_lock l(&lock);
+        return watermark(anon_onion).first;
+    }
+    static bool behind(const std::string &anon_onion)
+    {
+        scoped_lock l(&lock);
+        const auto &w = watermark(anon_onion);
+        return w.second < w.first;
+    }
+    static void filled(const std::string &anon_onion, uint64_t mark)
+    {
+        scoped_lock l(&lock);
+        auto &w = watermark(anon_onion);
+        w.second = std::max(w.second, mark);
+    }
+
+private:
+    static pthread_mutex_t lock;
+    static std::map<std::string, std::pair<uint64_t, uint64_t> > watermarks;
+
+    static std::pair<uint64_t, uint64_t> &
+    watermark(const std::string &anon_onion);
+};
+
+class DeltaBatch;
+
 // For REPLACE and DELETE we are duplicating the MetaKey information.
 class Delta {
 public:
@@ -131,16 +217,17 @@ public:
     virtual ~Delta() {}
 
     /*
-     * Take the update action against the database. Contains high level
-     * serialization semantics.
+     * Stage the update action against the database in 'batch'. Contains
+     * high level serialization semantics.
      */
-    virtual bool apply(const std::unique_ptr<Connect> &e_conn,
-                       TableType table_type) = 0;
+    virtual bool apply(DeltaBatch *const batch, TableType table_type) = 0;
+    // Called once the batch is written.
+    virtual void applied(const DeltaBatch &batch, TableType table_type) {}
+
+    static std::string tableNameFromType(TableType table_type);
 
 protected:
     const DBMeta &parent_meta;
-
-    std::string tableNameFromType(TableType table_type) const;
 };
 
 // CreateDelta calls must provide the key.  meta and
@@ -164,12 +251,14 @@ public:
                 IdentityMetaKey key)
         : AbstractCreateDelta(parent_meta, key), meta(std::move(meta)) {}
 
-    bool apply(const std::unique_ptr<Connect> &e_conn,
-               TableType table_type);
+    bool apply(DeltaBatch *const batch, TableType table_type);
+    void applied(const DeltaBatch &batch, TableType table_type);
 
 private:
     const std::unique_ptr<DBMeta> meta;
     std::map<const DBMeta *, unsigned int> id_cache;
+    // the batch rows of the objects, until the BLEEDING batch is written
+    std::map<const DBMeta *, size_t> staged;
 };
 
 class DerivedKeyDelta : public Delta {
@@ -190,8 +279,7 @@ public:
     ReplaceDelta(const DBMeta &meta, const DBMeta &parent_meta)
         : DerivedKeyDelta(meta, parent_meta) {}
 
-    bool apply(const std::unique_ptr<Connect> &e_conn,
-               TableType table_type);
+    bool apply(DeltaBatch *const batch, TableType table_type);
 };
 
 class DeleteDelta : public DerivedKeyDelta {
@@ -199,8 +287,50 @@ public:
     DeleteDelta(const DBMeta &meta, const DBMeta &parent_meta)
         : DerivedKeyDelta(meta, parent_meta) {}
 
-    bool apply(const std::unique_ptr<Connect> &e_conn,
-               TableType table_type);
+    bool apply(DeltaBatch *const batch, TableType table_type);
+};
+
+// The rows a set of deltas writes to one of the meta tables. flush()
+// writes them with a statement for the replaced objects, one for the
+// removed ones and one INSERT per level of new objects; rather than a
+// statement per object.
+class DeltaBatch {
+public:
+    static const size_t no_row = static_cast<size_t>(-1);
+
+    explicit DeltaBatch(Delta::TableType table_type)
+        : table_name(Delta::tableNameFromType(table_type)) {}
+
+    // a new object under 'parent_id', or under the object staged as
+    // 'parent_row'; an 'id' of 0 has the database assign one
+    size_t create(const std::string &serial_object,
+                  const std::string &serial_key, unsigned int parent_id,
+                  size_t parent_row, unsigned int id);
+    void replace(unsigned int id, const std::string &serial_object,
+                 const std::string &serial_key);
+    void remove(unsigned int id);
+    bool flush(const std::unique_ptr<Connect> &e_conn);
+    // valid once flush() succeeds
+    unsigned int createdID(size_t row) const {return created_ids.at(row);}
+
+private:
+    struct Created {
+        std::string serial_object;
+        std::string serial_key;
+        unsigned int parent_id;
+        size_t parent_row;
+        unsigned int id;
+    };
+
+    const std::string table_name;
+    std::vector<Created> created;
+    std::vector<unsigned int> created_ids;
+    // > the last replacement of an object wins, as if they ran in order
+    std::map<unsigned int, std::pair<std::string, std::string> > replaced;
+    std::vector<unsigned int> removed;
+
+    bool insert(const std::unique_ptr<Connect> &e_conn,
+                const std::vector<size_t> &rows);
 };
 
 class Rewriter;
@@ -282,6 +412,9 @@ public:
     std::map<std::string, std::map<const std::string, const std::string>>
         table_aliases;
     std::map<const Item_field *, std::pair<Item_field *, OLK>> item_cache;
+    // the column of each SUM over a packed AGG onion in the projection,
+    // by the rewritten SUM; see rewrite_proj(...)
+    std::map<std::string, int> packed_sums;
 
     // information for decrypting results
     ReturnMeta rmeta;
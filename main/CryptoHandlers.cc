@@ -5,14 +5,19 @@
 #include <parser/mysql_type_metadata.hh>
 #include <crypto/ope.hh>
 #include <crypto/BasicCrypto.hh>
+#include <crypto/aes.hh>
 #include <crypto/SWPSearch.hh>
 #include <crypto/arc4.hh>
+#include <crypto/hmac.hh>
+#include <crypto/sha.hh>
+#include <crypto/online_ope.hh>
 #include <util/util.hh>
 #include <util/cryptdb_log.hh>
 #include <util/zz.hh>
 
 #include <cmath>
 #include <memory>
+#include <mutex>
 
 #define LEXSTRING(cstr) { (char*) cstr, sizeof(cstr) }
 #define BITS_PER_BYTE 8
@@ -50,10 +55,10 @@ using namespace NTL;
          - RND layers: RND_int for blowfish, RND_str for AES
 
     -DETFactory: outputs a DET layer
-         - DET layers: DET_int, DET_str
+         - DET layers: DET_int, DET_str, DET_ffx
 
     -OPEFactory: outputs a OPE layer
-         - OPE layers: OPE_int, OPE_str, OPE_dec
+         - OPE layers: OPE_int, OPE_str, OPE_dec, MOPE_int
 
     -HOMFactory: outputs a HOM layer
          - HOM layers: HOM (for integers), HOM_dec (for decimals)
@@ -207,6 +212,11 @@ EncLayerFactory::deserializeLayer(unsigned int id,
             return OPEFactory::deserialize(id, li);
 
         case SECLEVEL::HOM:
+            // > the members of a pack must agree on the key, so
+            //   HOM_pack keys on its seed rather than the whole serial
+            if ("HOM_pack" == li.name) {
+                return HOMFactory::deserialize(id, li);
+            }
             return std::unique_ptr<EncLayer>(new HOM(id, serial));
 
         case SECLEVEL::SEARCH:
@@ -220,6 +230,31 @@ EncLayerFactory::deserializeLayer(unsigned int id,
     FAIL_TextMessageError("unknown or unimplemented security level");
 }
 
+void
+EncLayer::sealKey()
+{
+    this->key_serial = this->doSerialize();
+
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char c : this->key_serial) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    this->key_fingerprint = h;
+    this->key_sealed = true;
+}
+
+bool
+EncLayer::sameKey(const EncLayer &other) const
+{
+    if (false == this->key_sealed || false == other.key_sealed) {
+        return this->doSerialize() == other.doSerialize();
+    }
+
+    return this->key_fingerprint == other.key_fingerprint
+        && this->key_serial == other.key_serial;
+}
+
 /*
 string
 EncLayerFactory::serializeLayer(EncLayer * el, DBMeta *parent) {
@@ -425,6 +460,12 @@ public:
 
     Item *encrypt(const Item &ptext, uint64_t IV) const;
     Item *decrypt(const Item &ctext, uint64_t IV) const;
+    std::vector<Item *>
+        encryptBatch(const std::vector<const Item *> &ptexts,
+                     const std::vector<uint64_t> &IVs) const;
+    std::vector<Item *>
+        decryptBatch(const std::vector<const Item *> &ctexts,
+                     const std::vector<uint64_t> &IVs) const;
     Item * decryptUDF(Item * const col, Item * const ivcol) const;
 
 private:
@@ -455,11 +496,46 @@ private:
     const std::string rawkey;
     static const int key_bytes = 16;
     static const bool do_pad   = true;
-    const std::unique_ptr<const AES_KEY> enckey;
-    const std::unique_ptr<const AES_KEY> deckey;
+    const std::unique_ptr<const AES_EVP> aes;
 
 };
 
+static std::vector<uint64_t>
+intItemValues(const std::vector<const Item *> &items)
+{
+    std::vector<uint64_t> values;
+    values.reserve(items.size());
+    for (auto it : items) {
+        values.push_back(static_cast<const Item_int *>(it)->value);
+    }
+    return values;
+}
+
+static std::vector<Item *>
+makeIntItems(const std::vector<uint64_t> &values)
+{
+    std::vector<Item *> items;
+    items.reserve(values.size());
+    for (auto it : values) {
+        items.push_back(new (current_thd->mem_root)
+                            Item_int(static_cast<ulonglong>(it)));
+    }
+    return items;
+}
+
+// AES layers write their output directly into statement memory; one
+// extra byte for the NUL that make_thd_string would have added.
+static char *
+alloc_thd_buffer(size_t len)
+{
+    THD *const thd = current_thd;
+    assert(thd);
+    char *const buf = static_cast<char *>(thd->alloc(len + 1));
+    TEST_TextMessageError(NULL != buf,
+                          "failed to allocate statement memory");
+    return buf;
+}
+
 static unsigned long long
 strtoul_(const std::string &s)
 {
@@ -546,6 +622,38 @@ RND_int::decrypt(const Item &ctext, uint64_t IV) const
                Item_int(static_cast<ulonglong>(p));
 }
 
+std::vector<Item *>
+RND_int::encryptBatch(const std::vector<const Item *> &ptexts,
+                      const std::vector<uint64_t> &IVs) const
+{
+    assert(ptexts.size() == IVs.size());
+    std::vector<uint64_t> blocks(ptexts.size());
+    for (size_t i = 0; i < ptexts.size(); ++i) {
+        const uint64_t p = RiboldMYSQL::val_uint(*ptexts[i]);
+        cinteger.checkValue(p);
+        blocks[i] = p ^ IVs[i];
+    }
+    bf.encrypt(blocks.data(), blocks.data(), blocks.size());
+    LOG(encl) << "RND_int encrypt batch of " << blocks.size();
+
+    return makeIntItems(blocks);
+}
+
+std::vector<Item *>
+RND_int::decryptBatch(const std::vector<const Item *> &ctexts,
+                      const std::vector<uint64_t> &IVs) const
+{
+    assert(ctexts.size() == IVs.size());
+    std::vector<uint64_t> blocks = intItemValues(ctexts);
+    bf.decrypt(blocks.data(), blocks.data(), blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        blocks[i] ^= IVs[i];
+    }
+    LOG(encl) << "RND_int decrypt batch of " << blocks.size();
+
+    return makeIntItems(blocks);
+}
+
 static udf_func u_decRNDInt = {
     LEXSTRING("cryptdb_decrypt_int_sem"),
     INT_RESULT,
@@ -587,12 +695,11 @@ RND_int::decryptUDF(Item * const col, Item * const ivcol) const
 
 RND_str::RND_str(const Create_field &f, const std::string &seed_key)
     : EncLayer(), rawkey(prng_expand(seed_key, key_bytes)),
-      enckey(get_AES_enc_key(rawkey)), deckey(get_AES_dec_key(rawkey))
+      aes(new AES_EVP(rawkey))
 {}
 
 RND_str::RND_str(unsigned int id, const std::string &serial)
-    : EncLayer(id), rawkey(serial), enckey(get_AES_enc_key(rawkey)),
-      deckey(get_AES_dec_key(rawkey))
+    : EncLayer(id), rawkey(serial), aes(new AES_EVP(rawkey))
 {}
 
 
@@ -608,31 +715,36 @@ RND_str::newCreateField(const Create_field &cf,
 Item *
 RND_str::encrypt(const Item &ptext, uint64_t IV) const
 {
-    const std::string &enc =
-        encrypt_AES_CBC(ItemToString(ptext), enckey.get(),
-                        BytesFromInt(IV, SALT_LEN_BYTES), do_pad);
+    const std::string &plain = ItemToString(ptext);
+    char *const enc = alloc_thd_buffer(AES_CBC_len(plain.length(), do_pad));
+    const size_t enc_len =
+        encrypt_AES_CBC(plain.data(), plain.length(), *aes.get(),
+                        BytesFromInt(IV, SALT_LEN_BYTES), enc, do_pad);
+    enc[enc_len] = '\0';
 
-    LOG(encl) << "RND_str encrypt " << ItemToString(ptext) << " IV "
-              << IV << "--->" << "len of enc " << enc.length()
-              << " enc " << enc;
+    LOG(encl) << "RND_str encrypt " << plain << " IV "
+              << IV << "--->" << "len of enc " << enc_len
+              << " enc " << std::string(enc, enc_len);
 
-    return new (current_thd->mem_root) Item_string(make_thd_string(enc),
-                                                   enc.length(),
+    return new (current_thd->mem_root) Item_string(enc, enc_len,
                                                    &my_charset_bin);
 }
 
 Item *
 RND_str::decrypt(const Item &ctext, uint64_t IV) const
 {
-    const std::string &dec =
-        decrypt_AES_CBC(ItemToString(ctext), deckey.get(),
-                        BytesFromInt(IV, SALT_LEN_BYTES), do_pad);
-    LOG(encl) << "RND_str decrypt " << ItemToString(ctext) << " IV "
-              << IV << "-->" << "len of dec " << dec.length()
-              << " dec: " << dec;
+    const std::string &enc = ItemToString(ctext);
+    char *const dec = alloc_thd_buffer(enc.length());
+    const size_t dec_len =
+        decrypt_AES_CBC(enc.data(), enc.length(), *aes.get(),
+                        BytesFromInt(IV, SALT_LEN_BYTES), dec, do_pad);
+    dec[dec_len] = '\0';
+
+    LOG(encl) << "RND_str decrypt " << enc << " IV "
+              << IV << "-->" << "len of dec " << dec_len
+              << " dec: " << std::string(dec, dec_len);
 
-    return new (current_thd->mem_root) Item_string(make_thd_string(dec),
-                                                   dec.length(),
+    return new (current_thd->mem_root) Item_string(dec, dec_len,
                                                    &my_charset_bin);
 }
 
@@ -690,6 +802,12 @@ public:
     // FIXME: final
     Item *encrypt(const Item &ptext, uint64_t IV) const;
     Item *decrypt(const Item &ctext, uint64_t IV) const;
+    std::vector<Item *>
+        encryptBatch(const std::vector<const Item *> &ptexts,
+                     const std::vector<uint64_t> &IVs) const;
+    std::vector<Item *>
+        decryptBatch(const std::vector<const Item *> &ctexts,
+                     const std::vector<uint64_t> &IVs) const;
     Item *decryptUDF(Item *const col, Item *const ivcol = NULL) const;
 
 protected:
@@ -795,11 +913,37 @@ protected:
     const std::string rawkey;
     static const int key_bytes = 16;
     static const bool do_pad   = true;
-    const std::unique_ptr<const AES_KEY> enckey;
-    const std::unique_ptr<const AES_KEY> deckey;
+    const std::unique_ptr<const AES_EVP> aes;
 
 };
 
+// DET for short strings under FFX; a ciphertext is as long as its
+// plaintext, so the column, and any index on it, is no wider than the
+// plaintext column. See ffxColumn(...).
+class DET_ffx : public EncLayer {
+public:
+    DET_ffx(const Create_field &cf, const std::string &seed_key);
+
+    // serialize and deserialize
+    std::string doSerialize() const {return rawkey;}
+    DET_ffx(unsigned int id, const std::string &serial);
+
+    virtual SECLEVEL level() const {return SECLEVEL::DET;}
+    std::string name() const {return "DET_ffx";}
+    Create_field *newCreateField(const Create_field &cf,
+                                 const std::string &anonname = "")
+        const;
+
+    Item *encrypt(const Item &ptext, uint64_t IV) const;
+    Item *decrypt(const Item &ctext, uint64_t IV) const;
+    Item *decryptUDF(Item *const col, Item *const ivcol = NULL) const;
+
+protected:
+    const std::string rawkey;
+    static const int key_bytes = 16;
+    const std::unique_ptr<const AES> aes;
+};
+
 
 std::unique_ptr<EncLayer>
 DETFactory::create(const Create_field &cf, const std::string &key)
@@ -826,6 +970,8 @@ DETFactory::deserialize(unsigned int id, const SerialLayer &sl)
         FAIL_TextMessageError("decimal support broken");
     } else if ("DET_str" == sl.name) {
         return std::unique_ptr<EncLayer>(new DET_str(id, sl.layer_info));
+    } else if ("DET_ffx" == sl.name) {
+        return std::unique_ptr<EncLayer>(new DET_ffx(id, sl.layer_info));
     } else {
         FAIL_TextMessageError("Unknown type for DET deserialization!");
     }
@@ -878,6 +1024,32 @@ DET_abstract_integer::decrypt(const Item &ctext, uint64_t IV) const
     return new (current_thd->mem_root) Item_int(retdec);
 }
 
+std::vector<Item *>
+DET_abstract_integer::encryptBatch(const std::vector<const Item *> &ptexts,
+                                   const std::vector<uint64_t> &IVs) const
+{
+    std::vector<uint64_t> blocks(ptexts.size());
+    for (size_t i = 0; i < ptexts.size(); ++i) {
+        blocks[i] = RiboldMYSQL::val_uint(*ptexts[i]);
+        getCInteger_().checkValue(blocks[i]);
+    }
+    getBlowfish_().encrypt(blocks.data(), blocks.data(), blocks.size());
+    LOG(encl) << "DET_int enc batch of " << blocks.size();
+
+    return makeIntItems(blocks);
+}
+
+std::vector<Item *>
+DET_abstract_integer::decryptBatch(const std::vector<const Item *> &ctexts,
+                                   const std::vector<uint64_t> &IVs) const
+{
+    std::vector<uint64_t> blocks = intItemValues(ctexts);
+    getBlowfish_().decrypt(blocks.data(), blocks.data(), blocks.size());
+    LOG(encl) << "DET_int dec batch of " << blocks.size();
+
+    return makeIntItems(blocks);
+}
+
 Item *
 DET_abstract_integer::decryptUDF(Item *const col, Item *const ivcol)
     const
@@ -974,13 +1146,11 @@ DET_dec::DET_dec(unsigned int id, const std::string &serial)
 */
 
 DET_str::DET_str(const Create_field &f, const std::string &seed_key)
-    : rawkey(prng_expand(seed_key, key_bytes)),
-      enckey(get_AES_enc_key(rawkey)), deckey(get_AES_dec_key(rawkey))
+    : rawkey(prng_expand(seed_key, key_bytes)), aes(new AES_EVP(rawkey))
 {}
 
 DET_str::DET_str(unsigned int id, const std::string &serial)
-    : EncLayer(id), rawkey(serial), enckey(get_AES_enc_key(rawkey)),
-    deckey(get_AES_dec_key(rawkey))
+    : EncLayer(id), rawkey(serial), aes(new AES_EVP(rawkey))
 {}
 
 
@@ -997,12 +1167,16 @@ Item *
 DET_str::encrypt(const Item &ptext, uint64_t IV) const
 {
     const std::string plain = ItemToString(ptext);
-    const std::string enc = encrypt_AES_CMC(plain, enckey.get(), do_pad);
+    char *const enc = alloc_thd_buffer(AES_CBC_len(plain.length(), do_pad));
+    const size_t enc_len =
+        encrypt_AES_CMC(plain.data(), plain.length(), *aes.get(), enc,
+                        do_pad);
+    enc[enc_len] = '\0';
     LOG(encl) << " DET_str encrypt " << plain  << " IV " << IV << " ---> "
-              << " enc len " << enc.length() << " enc " << enc;
+              << " enc len " << enc_len << " enc "
+              << std::string(enc, enc_len);
 
-    return new (current_thd->mem_root) Item_string(make_thd_string(enc),
-                                                   enc.length(),
+    return new (current_thd->mem_root) Item_string(enc, enc_len,
                                                    &my_charset_bin);
 }
 
@@ -1010,13 +1184,16 @@ Item *
 DET_str::decrypt(const Item &ctext, uint64_t IV) const
 {
     const std::string enc = ItemToString(ctext);
-    const std::string dec = decrypt_AES_CMC(enc, deckey.get(), do_pad);
+    char *const dec = alloc_thd_buffer(enc.length());
+    const size_t dec_len =
+        decrypt_AES_CMC(enc.data(), enc.length(), *aes.get(), dec, do_pad);
+    dec[dec_len] = '\0';
     LOG(encl) << " DET_str decrypt enc len " << enc.length()
               << " enc " << enc << " IV " << IV << " ---> "
-              << " dec len " << dec.length() << " dec " << dec;
+              << " dec len " << dec_len << " dec "
+              << std::string(dec, dec_len);
 
-    return new (current_thd->mem_root) Item_string(make_thd_string(dec),
-                                                   dec.length(),
+    return new (current_thd->mem_root) Item_string(dec, dec_len,
                                                    &my_charset_bin);
 }
 
@@ -1046,6 +1223,75 @@ DET_str::decryptUDF(Item * const col, Item * const ivcol) const
 
 }
 
+DET_ffx::DET_ffx(const Create_field &f, const std::string &seed_key)
+    : rawkey(prng_expand(seed_key, key_bytes)), aes(new AES(rawkey))
+{}
+
+DET_ffx::DET_ffx(unsigned int id, const std::string &serial)
+    : EncLayer(id), rawkey(serial), aes(new AES(rawkey))
+{}
+
+// > VARBINARY rather than BINARY; BINARY would pad the shorter values
+//   and they would no longer decrypt
+Create_field *
+DET_ffx::newCreateField(const Create_field &cf,
+                        const std::string &anonname) const
+{
+    return arrayCreateFieldHelper(cf, EncLayerFactory::ffxBytes(cf),
+                                  MYSQL_TYPE_VARCHAR, anonname,
+                                  &my_charset_bin);
+}
+
+Item *
+DET_ffx::encrypt(const Item &ptext, uint64_t IV) const
+{
+    const std::string plain = ItemToString(ptext);
+    TEST_TextMessageError(plain.length() <= FFX_MAX_BYTES,
+                          "value is too long for " + this->name());
+    const std::string enc = encrypt_FFX(plain, *aes.get());
+    LOG(encl) << " DET_ffx encrypt " << plain << " IV " << IV << " ---> "
+              << " enc len " << enc.length() << " enc " << enc;
+
+    return new (current_thd->mem_root)
+        Item_string(make_thd_string(enc), enc.length(), &my_charset_bin);
+}
+
+Item *
+DET_ffx::decrypt(const Item &ctext, uint64_t IV) const
+{
+    const std::string enc = ItemToString(ctext);
+    const std::string dec = decrypt_FFX(enc, *aes.get());
+    LOG(encl) << " DET_ffx decrypt enc len " << enc.length()
+              << " enc " << enc << " IV " << IV << " ---> "
+              << " dec len " << dec.length() << " dec " << dec;
+
+    return new (current_thd->mem_root)
+        Item_string(make_thd_string(dec), dec.length(), &my_charset_bin);
+}
+
+static udf_func u_decDETFFX = {
+    LEXSTRING("cryptdb_decrypt_text_ffx"),
+    STRING_RESULT,
+    UDFTYPE_FUNCTION,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0L,
+};
+
+Item *
+DET_ffx::decryptUDF(Item *const col, Item *const ivcol) const
+{
+    List<Item> l;
+    l.push_back(col);
+    l.push_back(get_key_item(rawkey));
+    return new (current_thd->mem_root) Item_func_udf_str(&u_decDETFFX, l);
+}
+
 /*************** DETJOIN *********************/
 
 
@@ -1089,6 +1335,19 @@ public:
     std::string name() const {return "DETJOIN_str";}
 };
 
+class DETJOIN_ffx : public DET_ffx {
+public:
+    DETJOIN_ffx(const Create_field &cf, const std::string &seed_key)
+        : DET_ffx(cf, seed_key) {}
+
+    // serialize from parent; unserialize:
+    DETJOIN_ffx(unsigned int id, const std::string &serial)
+        : DET_ffx(id, serial) {}
+
+    SECLEVEL level() const {return SECLEVEL::DETJOIN;}
+    std::string name() const {return "DETJOIN_ffx";}
+};
+
 /*
 class DETJOIN_dec : public DET_abstract_decimal {
     //TODO
@@ -1133,11 +1392,49 @@ DETJOINFactory::deserialize(unsigned int id, const SerialLayer &sl)
     } else if ("DETJOIN_str" == sl.name) {
         return std::unique_ptr<EncLayer>(new DETJOIN_str(id,
                                                          sl.layer_info));
+    } else if ("DETJOIN_ffx" == sl.name) {
+        return std::unique_ptr<EncLayer>(new DETJOIN_ffx(id,
+                                                         sl.layer_info));
     } else {
         FAIL_TextMessageError("DETJOINFactory does not recognize type!");
     }
 }
 
+std::unique_ptr<EncLayer>
+EncLayerFactory::ffxLayer(SECLEVEL sl, const Create_field &cf,
+                          const std::string &key)
+{
+    switch (sl) {
+        case SECLEVEL::DET:
+            return std::unique_ptr<EncLayer>(new DET_ffx(cf, key));
+        case SECLEVEL::DETJOIN:
+            return std::unique_ptr<EncLayer>(new DETJOIN_ffx(cf, key));
+        default:{}
+    }
+    FAIL_TextMessageError("FFX only has DET and DETJOIN layers");
+}
+
+bool
+EncLayerFactory::isFFX(const EncLayer &layer)
+{
+    return "DET_ffx" == layer.name() || "DETJOIN_ffx" == layer.name();
+}
+
+// > a column that names no CHARACTER SET takes its table's, which the
+//   Create_field does not carry; so assume the widest, 4 bytes for
+//   utf8mb4 and utf32
+// > the VARBINARY of an FFX layer is sized in bytes already
+unsigned long
+EncLayerFactory::ffxBytes(const Create_field &cf)
+{
+    if (&my_charset_bin == cf.charset) {
+        return cf.length;
+    }
+
+    const unsigned long mbmaxlen = cf.charset ? cf.charset->mbmaxlen : 4;
+    return cf.char_length * mbmaxlen;
+}
+
 
 
 /**************** OPE **************************/
@@ -1165,7 +1462,19 @@ public:
     Item *encrypt(const Item &p, uint64_t IV) const;
     Item *decrypt(const Item &c, uint64_t IV) const;
 
+    // one walk down the OPE tree for the whole column
+    std::vector<Item *>
+        encryptBatch(const std::vector<const Item *> &ptexts,
+                     const std::vector<uint64_t> &IVs) const;
+    std::vector<Item *>
+        decryptBatch(const std::vector<const Item *> &ctexts,
+                     const std::vector<uint64_t> &IVs) const;
+
 private:
+    ZZ plainZZ(const Item &ptext) const;
+    Item *cipherItem(const ZZ &enc) const;
+    ZZ cipherZZ(const Item &ctext) const;
+
     const CryptedInteger cinteger;
     static const size_t key_bytes = 16;
     const size_t plain_size;
@@ -1191,7 +1500,13 @@ public:
     Item *decrypt(const Item &c, uint64_t IV) const
         __attribute__((noreturn));
 
+    std::vector<Item *>
+        encryptBatch(const std::vector<const Item *> &ptexts,
+                     const std::vector<uint64_t> &IVs) const;
+
 private:
+    uint32_t plainValue(const Item &ptext) const;
+
     const std::string key;
     // HACK.
     mutable OPE ope;
@@ -1243,6 +1558,8 @@ OPEFactory::deserialize(unsigned int id, const SerialLayer &sl)
         return OPE_int::deserialize(id, sl.layer_info);
     } else if (sl.name == "OPE_str") {
         return std::unique_ptr<EncLayer>(new OPE_str(id, sl.layer_info));
+    } else if (sl.name == "MOPE_int") {
+        return std::unique_ptr<EncLayer>(new MOPE_int(id, sl.layer_info));
     } else {
         FAIL_TextMessageError("decimal support broken");
     }
@@ -1410,17 +1727,19 @@ reverse(const std::string &s)
     return std::string(s.rbegin(), s.rend());
 }
 
-Item *
-OPE_int::encrypt(const Item &ptext, uint64_t IV) const
+ZZ
+OPE_int::plainZZ(const Item &ptext) const
 {
     const uint64_t pval = RiboldMYSQL::val_uint(ptext);
     cinteger.checkValue(pval);
+    return ZZFromUint64(pval);
+}
 
-    LOG(encl) << "OPE_int encrypt " << pval << " IV " << IV << std::endl;
-
+Item *
+OPE_int::cipherItem(const ZZ &enc) const
+{
     if (MYSQL_TYPE_VARCHAR != this->cinteger.getFieldType()) {
-        const ulonglong enc = uint64FromZZ(ope.encrypt(ZZFromUint64(pval)));
-        return new Item_int(enc);
+        return new Item_int(static_cast<ulonglong>(uint64FromZZ(enc)));
     }
 
     // > the result of the encryption could be larger than 64 bits so
@@ -1430,8 +1749,7 @@ OPE_int::encrypt(const Item &ptext, uint64_t IV) const
     // > leading zeros must be added because not all numbers will span the
     //   allotted bytes and we don't want mysql to do a misaligned comparison
     const std::string &enc_string =
-        leadingZeros(reverse(StringFromZZ(ope.encrypt(ZZFromUint64(pval)))),
-                     this->ciph_size);
+        leadingZeros(reverse(StringFromZZ(enc)), this->ciph_size);
 
 
     return new Item_string(make_thd_string(enc_string),
@@ -1439,21 +1757,76 @@ OPE_int::encrypt(const Item &ptext, uint64_t IV) const
                            &my_charset_bin);
 }
 
+ZZ
+OPE_int::cipherZZ(const Item &ctext) const
+{
+    if (MYSQL_TYPE_VARCHAR != this->cinteger.getFieldType()) {
+        return ZZFromUint64(RiboldMYSQL::val_uint(ctext));
+    }
+
+    // undo the reversal from encryption
+    return ZZFromString(reverse(ItemToString(ctext)));
+}
+
+Item *
+OPE_int::encrypt(const Item &ptext, uint64_t IV) const
+{
+    const ZZ &pval = plainZZ(ptext);
+
+    LOG(encl) << "OPE_int encrypt " << pval << " IV " << IV << std::endl;
+
+    return cipherItem(ope.encrypt(pval));
+}
+
 Item *
 OPE_int::decrypt(const Item &ctext, uint64_t IV) const
 {
     LOG(encl) << "OPE_int decrypt " << ItemToString(ctext) << " IV " << IV
               << std::endl;
 
-    if (MYSQL_TYPE_VARCHAR != this->cinteger.getFieldType()) {
-        const ulonglong cval = RiboldMYSQL::val_uint(ctext);
-        return new Item_int(static_cast<ulonglong>(uint64FromZZ(ope.decrypt(ZZFromUint64(cval)))));
+    return new Item_int(static_cast<ulonglong>(
+                            uint64FromZZ(ope.decrypt(cipherZZ(ctext)))));
+}
+
+std::vector<Item *>
+OPE_int::encryptBatch(const std::vector<const Item *> &ptexts,
+                      const std::vector<uint64_t> &IVs) const
+{
+    assert(ptexts.size() == IVs.size());
+    std::vector<ZZ> pvals;
+    pvals.reserve(ptexts.size());
+    for (auto it : ptexts) {
+        pvals.push_back(plainZZ(*it));
     }
 
-    // undo the reversal from encryption
-    return new Item_int(static_cast<ulonglong>(uint64FromZZ(ope.decrypt(ZZFromString(reverse(ItemToString(ctext)))))));
+    LOG(encl) << "OPE_int encrypt batch of " << pvals.size();
+    std::vector<Item *> out;
+    out.reserve(pvals.size());
+    for (const auto &it : ope.encrypt(pvals)) {
+        out.push_back(cipherItem(it));
+    }
+    return out;
 }
 
+std::vector<Item *>
+OPE_int::decryptBatch(const std::vector<const Item *> &ctexts,
+                      const std::vector<uint64_t> &IVs) const
+{
+    assert(ctexts.size() == IVs.size());
+    std::vector<ZZ> cvals;
+    cvals.reserve(ctexts.size());
+    for (auto it : ctexts) {
+        cvals.push_back(cipherZZ(*it));
+    }
+
+    LOG(encl) << "OPE_int decrypt batch of " << cvals.size();
+    std::vector<Item *> out;
+    out.reserve(cvals.size());
+    for (const auto &it : ope.decrypt(cvals)) {
+        out.push_back(new Item_int(static_cast<ulonglong>(uint64FromZZ(it))));
+    }
+    return out;
+}
 
 OPE_str::OPE_str(const Create_field &f, const std::string &seed_key)
     : key(prng_expand(seed_key, key_bytes)),
@@ -1484,8 +1857,8 @@ OPE_str::newCreateField(const Create_field &cf,
  * |         1 |         1 |         1 |         1 |
  * +-----------+-----------+-----------+-----------+
  */
-Item *
-OPE_str::encrypt(const Item &ptext, uint64_t IV) const
+uint32_t
+OPE_str::plainValue(const Item &ptext) const
 {
     std::string ps = toUpperCase(ItemToString(ptext));
     if (ps.size() < plain_size)
@@ -1497,18 +1870,259 @@ OPE_str::encrypt(const Item &ptext, uint64_t IV) const
         pv = pv * 256 + static_cast<int>(ps[i]);
     }
 
-    const ZZ enc = ope.encrypt(to_ZZ(pv));
+    return pv;
+}
+
+Item *
+OPE_str::encrypt(const Item &ptext, uint64_t IV) const
+{
+    const ZZ enc = ope.encrypt(to_ZZ(plainValue(ptext)));
 
     return new (current_thd->mem_root)
                Item_int(static_cast<ulonglong>(uint64FromZZ(enc)));
 }
 
+std::vector<Item *>
+OPE_str::encryptBatch(const std::vector<const Item *> &ptexts,
+                      const std::vector<uint64_t> &IVs) const
+{
+    assert(ptexts.size() == IVs.size());
+    std::vector<ZZ> pvals;
+    pvals.reserve(ptexts.size());
+    for (auto it : ptexts) {
+        pvals.push_back(to_ZZ(plainValue(*it)));
+    }
+
+    std::vector<Item *> out;
+    out.reserve(pvals.size());
+    for (const auto &it : ope.encrypt(pvals)) {
+        out.push_back(new (current_thd->mem_root)
+                        Item_int(static_cast<ulonglong>(uint64FromZZ(it))));
+    }
+    return out;
+}
+
 Item *
 OPE_str::decrypt(const Item &ctext, uint64_t IV) const
 {
     thrower() << "cannot decrypt string from OPE";
 }
 
+/**************** mOPE *************************/
+
+MOPE_int::MOPE_int(const Create_field &f, const std::string &seed_key)
+    : key(prng_expand(seed_key, key_bytes)), bf(key),
+      server(new ope_server<uint64_t>()), is_loaded(false)
+{
+    server->track_relabels(true);
+}
+
+MOPE_int::MOPE_int(unsigned int id, const std::string &serial)
+    : EncLayer(id), key(serial), bf(key),
+      server(new ope_server<uint64_t>()), is_loaded(false)
+{
+    server->track_relabels(true);
+}
+
+MOPE_int::~MOPE_int()
+{
+    relabeled(this, false);
+}
+
+static std::mutex mope_relabeled_lock;
+static std::set<const MOPE_int *> mope_relabeled;
+
+void
+MOPE_int::relabeled(const MOPE_int *layer, bool moved)
+{
+    const std::lock_guard<std::mutex> lock(mope_relabeled_lock);
+    if (moved) {
+        mope_relabeled.insert(layer);
+    } else {
+        mope_relabeled.erase(layer);
+    }
+}
+
+const MOPE_int *
+MOPE_int::anyRelabeled()
+{
+    const std::lock_guard<std::mutex> lock(mope_relabeled_lock);
+    return mope_relabeled.empty() ? NULL : *mope_relabeled.begin();
+}
+
+Create_field *
+MOPE_int::newCreateField(const Create_field &cf,
+                         const std::string &anonname) const
+{
+    return arrayCreateFieldHelper(cf, ciph_size, MYSQL_TYPE_VARCHAR,
+                                  anonname, &my_charset_bin);
+}
+
+// both halves big endian, so that MySQL orders the ciphertexts by path
+std::string
+MOPE_int::ciphertext(uint64_t path, uint64_t enc_val) const
+{
+    std::string out(ciph_size, 0);
+    for (unsigned int i = 0; i < 8; ++i) {
+        out[7 - i] = static_cast<char>(path >> (8 * i));
+        out[15 - i] = static_cast<char>(enc_val >> (8 * i));
+    }
+
+    return out;
+}
+
+// the value under blowfish, from the second half of a ciphertext
+static uint64_t
+mopeEncValue(const std::string &ctext)
+{
+    TEST_Text(16 == ctext.size(), "bad mOPE ciphertext");
+
+    uint64_t enc_val = 0;
+    for (unsigned int i = 8; i < 16; ++i) {
+        enc_val = (enc_val << 8) | static_cast<unsigned char>(ctext[i]);
+    }
+
+    return enc_val;
+}
+
+// the path in the tree, from the first half
+static uint64_t
+mopePath(const std::string &ctext)
+{
+    TEST_Text(16 == ctext.size(), "bad mOPE ciphertext");
+
+    uint64_t path = 0;
+    for (unsigned int i = 0; i < 8; ++i) {
+        path = (path << 8) | static_cast<unsigned char>(ctext[i]);
+    }
+
+    return path;
+}
+
+std::string
+MOPE_int::current(uint64_t value) const
+{
+    const uint64_t path =
+        ope_client<uint64_t, blowfish>(&bf, server.get()).encrypt(value);
+
+    for (const auto &it : server->take_relabeled()) {
+        // > a path that was too long to be a ciphertext is in no column
+        if (0 == it.from) {
+            continue;
+        }
+
+        const auto &m = this->moved.find(it.enc_val);
+        if (this->moved.end() == m) {
+            this->moved[it.enc_val] = std::make_pair(it.from, it.to);
+        } else {
+            m->second.second = it.to;
+        }
+        relabeled(this, true);
+    }
+
+    return this->ciphertext(path, bf.encrypt(value));
+}
+
+// > restoring the paths means a reload, which follows every schema
+//   change, moves nothing in the column
+// > the paths of a column that missed some moves, ie under RND, need
+//   not form a tree; the balanced one then moves most of the column
+void
+MOPE_int::load(const std::vector<std::string> &ctexts) const
+{
+    std::vector<std::pair<uint64_t, uint64_t> > column;
+    for (const auto &it : ctexts) {
+        column.push_back(std::make_pair(mopePath(it),
+                                        bf.decrypt(mopeEncValue(it))));
+    }
+
+    if (false == ope_client<uint64_t, blowfish>(&bf, server.get())
+                    .restore(column)) {
+        LOG(warn) << "mOPE column is not a search tree; rebalancing it";
+
+        std::vector<uint64_t> values;
+        for (const auto &it : column) {
+            values.push_back(it.second);
+        }
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()),
+                     values.end());
+
+        std::vector<uint64_t> in_order(values.size());
+        bf.encrypt(values.data(), in_order.data(), values.size());
+        server->rebuild(in_order);
+    }
+
+    this->moved.clear();
+    relabeled(this, false);
+    this->is_loaded = true;
+}
+
+std::vector<std::pair<std::string, std::string> >
+MOPE_int::takeMoved() const
+{
+    std::vector<std::pair<std::string, std::string> > out;
+    for (const auto &it : this->moved) {
+        // > a later rebalance put it back
+        if (it.second.first == it.second.second) {
+            continue;
+        }
+        out.push_back(std::make_pair(
+                        this->ciphertext(it.second.first, it.first),
+                        this->ciphertext(it.second.second, it.first)));
+    }
+
+    this->moved.clear();
+    relabeled(this, false);
+    return out;
+}
+
+Item *
+MOPE_int::encrypt(const Item &ptext, uint64_t IV) const
+{
+    if (false == this->is_loaded) {
+        throw MOPEExcept(*this);
+    }
+
+    const uint64_t pval = RiboldMYSQL::val_uint(ptext);
+    LOG(encl) << "MOPE_int encrypt " << pval << " IV " << IV << std::endl;
+
+    const std::string &enc = this->current(pval);
+    return new Item_string(make_thd_string(enc), enc.length(),
+                           &my_charset_bin);
+}
+
+Item *
+MOPE_int::decrypt(const Item &ctext, uint64_t IV) const
+{
+    const uint64_t pval = bf.decrypt(mopeEncValue(ItemToString(ctext)));
+    LOG(encl) << "MOPE_int decrypt " << pval << " IV " << IV << std::endl;
+
+    return new Item_int(static_cast<ulonglong>(pval));
+}
+
+std::vector<Item *>
+MOPE_int::decryptBatch(const std::vector<const Item *> &ctexts,
+                       const std::vector<uint64_t> &IVs) const
+{
+    assert(ctexts.size() == IVs.size());
+    std::vector<uint64_t> enc_vals;
+    enc_vals.reserve(ctexts.size());
+    for (auto it : ctexts) {
+        enc_vals.push_back(mopeEncValue(ItemToString(*it)));
+    }
+
+    std::vector<uint64_t> pvals(enc_vals.size());
+    bf.decrypt(enc_vals.data(), pvals.data(), enc_vals.size());
+
+    std::vector<Item *> out;
+    out.reserve(pvals.size());
+    for (auto it : pvals) {
+        out.push_back(new Item_int(static_cast<ulonglong>(it)));
+    }
+    return out;
+}
+
 
 /**************** HOM ***************************/
 
@@ -1558,27 +2172,15 @@ HOMFactory::deserialize(unsigned int id, const SerialLayer &serial)
     if (serial.name == "HOM_dec") {
         FAIL_TextMessageError("decimal support broken");
     }
+    if (serial.name == "HOM_pack") {
+        return std::unique_ptr<EncLayer>(new HOMPack(id, serial.layer_info));
+    }
     return std::unique_ptr<EncLayer>(new HOM(id, serial.layer_info));
 }
 
-static ZZ
-ItemIntToZZ(const Item &ptext)
-{
-    const ulonglong val = RiboldMYSQL::val_uint(ptext);
-    return ZZFromUint64(val);
-}
-
 static Item *
-ZZToItemInt(const ZZ &val)
+StrToItemStr(const std::string &str)
 {
-    const ulonglong v = uint64FromZZ(val);
-    return new (current_thd->mem_root) Item_int(v);
-}
-
-static Item *
-ZZToItemStr(const ZZ &val)
-{
-    const std::string &str = StringFromZZ(val);
     Item * const newit =
         new (current_thd->mem_root) Item_string(make_thd_string(str),
                                                 str.length(),
@@ -1588,10 +2190,10 @@ ZZToItemStr(const ZZ &val)
     return newit;
 }
 
-static ZZ
-ItemStrToZZ(const Item &i)
+static Item *
+ZZToItemStr(const ZZ &val)
 {
-    return ZZFromString(ItemToString(i));
+    return StrToItemStr(StringFromZZ(val));
 }
 
 /*
@@ -1702,6 +2304,37 @@ HOM::unwait() const
     waiting = false;
 }
 
+std::string
+HOM::expandedKey() const
+{
+    if (true == waiting) {
+        this->unwait();
+    }
+
+    std::string state;
+    for (const ZZ &it : sk->privkey()) {
+        state += serialize_string(StringFromZZ(it));
+    }
+
+    return state;
+}
+
+void
+HOM::restoreExpandedKey(const std::string &state)
+{
+    const std::vector<std::string> &serials = unserialize_string(state);
+    TEST_Text(4 == serials.size(), "bad HOM key state");
+
+    std::vector<ZZ> privkey;
+    for (const auto &it : serials) {
+        privkey.push_back(ZZFromString(it));
+    }
+
+    delete sk;
+    sk = new Paillier_priv(privkey);
+    waiting = false;
+}
+
 Item *
 HOM::encrypt(const Item &ptext, uint64_t IV) const
 {
@@ -1709,8 +2342,10 @@ HOM::encrypt(const Item &ptext, uint64_t IV) const
         this->unwait();
     }
 
-    const ZZ enc = sk->encrypt(ItemIntToZZ(ptext));
-    return ZZToItemStr(enc);
+    // ciphertexts are the bytes of StringFromZZ(...), with no NTL in
+    // between
+    const ulonglong val = RiboldMYSQL::val_uint(ptext);
+    return StrToItemStr(sk->encrypt_u64(val));
 }
 
 Item *
@@ -1720,12 +2355,11 @@ HOM::decrypt(const Item &ctext, uint64_t IV) const
         this->unwait();
     }
 
-    const ZZ enc = ItemStrToZZ(ctext);
-    const ZZ dec = sk->decrypt(enc);
-    LOG(encl) << "HOM ciph " << enc << "---->" << dec;
-    TEST_Text(NumBytes(dec) <= 8,
+    uint64_t dec;
+    TEST_Text(sk->decrypt_u64(ItemToString(ctext), &dec),
               "Summation produced an integer larger than 64 bits");
-    return ZZToItemInt(dec);
+    LOG(encl) << "HOM decrypt ---->" << dec;
+    return new (current_thd->mem_root) Item_int(static_cast<ulonglong>(dec));
 }
 
 static udf_func u_sum_a = {
@@ -1788,6 +2422,53 @@ HOM::~HOM() {
     delete sk;
 }
 
+HOMPack::HOMPack(const Create_field &f, const std::string &seed_key,
+                 unsigned int slot)
+    : HOM(f, seed_key), slot(slot)
+{
+    TEST_Text(slot < slots(), "no such slot in a packed AGG onion");
+}
+
+HOMPack::HOMPack(unsigned int id, const std::string &serial)
+    : HOM(id, serial.substr(serial.find(' ') + 1)),
+      slot(atoi(serial.substr(0, serial.find(' ')).c_str()))
+{}
+
+Item *
+HOMPack::encrypt(const Item &ptext, uint64_t IV) const
+{
+    std::vector<uint64_t> values(slot + 1, 0);
+    values[slot] = RiboldMYSQL::val_uint(ptext);
+    return this->encryptPack(values);
+}
+
+Item *
+HOMPack::decrypt(const Item &ctext, uint64_t IV) const
+{
+    if (true == waiting) {
+        this->unwait();
+    }
+
+    // a slot that overflowed has carried into the next one, we can
+    // only catch the top slot doing so
+    std::vector<uint64_t> values(slots());
+    TEST_Text(sk->decrypt_pack_u64(ItemToString(ctext), &values),
+              "Summation overflowed a packed AGG onion");
+    LOG(encl) << "HOM_pack decrypt ---->" << values[slot];
+    return new (current_thd->mem_root)
+        Item_int(static_cast<ulonglong>(values[slot]));
+}
+
+Item *
+HOMPack::encryptPack(const std::vector<uint64_t> &values) const
+{
+    if (true == waiting) {
+        this->unwait();
+    }
+
+    return StrToItemStr(sk->encrypt_pack_u64(values));
+}
+
 /******* SEARCH **************************/
 
 Search::Search(const Create_field &f, const std::string &seed_key)
@@ -1802,8 +2483,11 @@ Create_field *
 Search::newCreateField(const Create_field &cf,
                        const std::string &anonname) const
 {
-    return arrayCreateFieldHelper(cf, cf.length, MYSQL_TYPE_BLOB,
-                                  anonname, &my_charset_bin);
+    // > a value holds at most a word for every two characters
+    const unsigned long bloom_len =
+        SWPBloomLenBytes + SWP::bloomBytes(cf.length / 2 + 1);
+    return arrayCreateFieldHelper(cf, cf.length + bloom_len,
+                                  MYSQL_TYPE_BLOB, anonname, &my_charset_bin);
 }
 
 
@@ -1881,7 +2565,9 @@ Search::encrypt(const Item &ptext, uint64_t IV) const
     const std::string plainstr = ItemToString(ptext);
     //TODO: remove string, string serves this purpose now..
     const std::list<std::string> * const tokens = tokenize(plainstr);
-    const std::string ciph = encryptSWP(key, *tokens);
+    // > the row's Bloom filter goes in front of its SWP words
+    const std::string ciph =
+        SWP::bloom(key, *tokens) + encryptSWP(key, *tokens);
 
     LOG(encl) << "SEARCH encrypt " << plainstr << " --> " << ciph;
 
@@ -1931,8 +2617,8 @@ Search::searchUDF(Item * const field, Item * const expr) const
     l.push_back(field);
 
     // Add token
-    const Token t =
-        token(key, std::string(searchstrip(ItemToString(*expr))));
+    const std::string word = toLowerCase(searchstrip(ItemToString(*expr)));
+    const Token t = token(key, word);
     Item_string * const t1 =
         new Item_string(newmem(t.ciph), t.ciph.length(),
                         &my_charset_bin);
@@ -1945,9 +2631,40 @@ Search::searchUDF(Item * const field, Item * const expr) const
     t2->name = NULL;
     l.push_back(t2);
 
+    // > rows whose filter lacks the word's bits are skipped before any
+    //   PRP is computed
+    const std::string mask = SWP::bloomMask(key, word);
+    Item_string * const t3 =
+        new Item_string(newmem(mask), mask.length(), &my_charset_bin);
+    t3->name = NULL;
+    l.push_back(t3);
+
     return new Item_func_udf_int(&u_search, l);
 }
 
+// > words are tokenized the way SWP sees them, so the index finds what
+//   the UDF would
+std::vector<std::string>
+Search::keywords(const Item &ptext) const
+{
+    const std::unique_ptr<std::list<std::string> >
+        words(tokenize(ItemToString(ptext)));
+
+    std::vector<std::string> out;
+    for (const auto &it : *words) {
+        out.push_back(keyword(it));
+    }
+
+    return out;
+}
+
+std::string
+Search::keyword(const std::string &word) const
+{
+    return hmac<sha256>::mac(toLowerCase(word), key).substr(0,
+                                                             keyword_bytes);
+}
+
 Create_field *
 PlainText::newCreateField(const Create_field &cf,
                           const std::string &anonname) const
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <map>
+#include <set>
 
 #include <util/util.hh>
 #include <crypto/prng.hh>
@@ -49,8 +51,9 @@ serial_pack(SECLEVEL l, const std::string &name,
 class EncLayer : public LeafDBMeta {
 public:
     virtual ~EncLayer() {}
-    EncLayer() : LeafDBMeta() {}
-    EncLayer(unsigned int id) : LeafDBMeta(id) {}
+    EncLayer() : LeafDBMeta(), key_fingerprint(0), key_sealed(false) {}
+    EncLayer(unsigned int id)
+        : LeafDBMeta(id), key_fingerprint(0), key_sealed(false) {}
 
     TYPENAME("encLayer")
 
@@ -65,6 +68,34 @@ public:
     virtual Item *encrypt(const Item &ptext, uint64_t IV) const = 0;
     virtual Item *decrypt(const Item &ctext, uint64_t IV) const = 0;
 
+    // encrypt/decrypt a whole column of values; layers with a multi-block
+    // cipher override these
+    virtual std::vector<Item *>
+        encryptBatch(const std::vector<const Item *> &ptexts,
+                     const std::vector<uint64_t> &IVs) const
+    {
+        assert(ptexts.size() == IVs.size());
+        std::vector<Item *> out;
+        out.reserve(ptexts.size());
+        for (size_t i = 0; i < ptexts.size(); ++i) {
+            out.push_back(this->encrypt(*ptexts[i], IVs[i]));
+        }
+        return out;
+    }
+
+    virtual std::vector<Item *>
+        decryptBatch(const std::vector<const Item *> &ctexts,
+                     const std::vector<uint64_t> &IVs) const
+    {
+        assert(ctexts.size() == IVs.size());
+        std::vector<Item *> out;
+        out.reserve(ctexts.size());
+        for (size_t i = 0; i < ctexts.size(); ++i) {
+            out.push_back(this->decrypt(*ctexts[i], IVs[i]));
+        }
+        return out;
+    }
+
     // returns the decryptUDF to remove the onion layer
     virtual Item *decryptUDF(Item * const col, Item * const ivcol = NULL)
         const
@@ -79,8 +110,24 @@ public:
                            this->doSerialize());
     }
 
+    // Caches doSerialize() and a fingerprint of it; OnionMeta seals each
+    // layer once it is built, as the key never changes afterwards.
+    void sealKey();
+    // Two layers share a key iff their doSerialize() agree.
+    bool sameKey(const EncLayer &other) const;
+
+    // What the layer derives from its key, for a snapshot of the schema
+    // to save it the derivation the next time; empty if that is cheap.
+    virtual std::string expandedKey() const {return "";}
+    virtual void restoreExpandedKey(const std::string &state) {}
+
 protected:
      friend class EncLayerFactory;
+
+private:
+    std::string key_serial;
+    uint64_t key_fingerprint;
+    bool key_sealed;
 };
 
 class HOM : public EncLayer {
@@ -106,17 +153,123 @@ public:
     Item *sumUDA(Item *const expr) const;
     Item *sumUDF(Item *const i1, Item *const i2) const;
 
+    // > the Paillier key, which takes seconds to generate from the seed
+    std::string expandedKey() const;
+    void restoreExpandedKey(const std::string &state);
+
 protected:
     std::string const seed_key;
     static const uint nbits = 1024;
     mutable Paillier_priv * sk;
 
-private:
     void unwait() const;
-
     mutable bool waiting;
 };
 
+// One slot of a packed AGG onion; the columns of a pack share a key and a
+// ciphertext per row, with each column's value in its own 64-bit slot.
+class HOMPack : public HOM {
+public:
+    HOMPack(const Create_field &cf, const std::string &seed_key,
+            unsigned int slot);
+
+    // serialize and deserialize
+    std::string doSerialize() const
+        {return std::to_string(slot) + " " + HOM::doSerialize();}
+    HOMPack(unsigned int id, const std::string &serial);
+
+    std::string name() const {return "HOM_pack";}
+
+    // @p in this column's slot and zero elsewhere; adds into a pack.
+    Item *encrypt(const Item &p, uint64_t IV) const;
+    Item *decrypt(const Item &c, uint64_t IV) const;
+
+    // The ciphertext of a whole row, @values in slot order.
+    Item *encryptPack(const std::vector<uint64_t> &values) const;
+
+    static unsigned int slots() {return (nbits - 1) / 64;}
+    unsigned int getSlot() const {return slot;}
+
+private:
+    const unsigned int slot;
+};
+
+template<class EncT> class ope_server;
+
+// Mutable order-preserving encoding (mOPE) of integers. The proxy keeps
+// the column's values in a search tree (see crypto/online_ope.hh) and a
+// value's ciphertext is its path in the tree followed by the value under
+// blowfish; ciphertexts compare in plaintext order, and the column holds
+// all we need to rebuild the tree.
+// > a rebalance moves a whole subtree and the ciphertexts of its values
+//   must move with it in the column; see MOPEExecutor.
+class MOPE_int : public EncLayer {
+public:
+    MOPE_int(const Create_field &cf, const std::string &seed_key);
+
+    // serialize and deserialize
+    std::string doSerialize() const {return key;}
+    MOPE_int(unsigned int id, const std::string &serial);
+    ~MOPE_int();
+
+    SECLEVEL level() const {return SECLEVEL::OPE;}
+    std::string name() const {return "MOPE_int";}
+    Create_field * newCreateField(const Create_field &cf,
+                                  const std::string &anonname = "")
+        const;
+
+    // throws MOPEExcept until the tree is loaded
+    Item *encrypt(const Item &p, uint64_t IV) const;
+    Item *decrypt(const Item &c, uint64_t IV) const;
+
+    // decryption never needs the tree
+    std::vector<Item *>
+        decryptBatch(const std::vector<const Item *> &ctexts,
+                     const std::vector<uint64_t> &IVs) const;
+
+    // The tree is built from the column's ciphertexts when the layer is
+    // first used; every value keeps its path, unless the paths are not
+    // those of a search tree and the tree is built balanced instead.
+    bool loaded() const {return is_loaded;}
+    void load(const std::vector<std::string> &ctexts) const;
+    // The column may not agree with the tree; rebuild it on next use.
+    void unload() const {is_loaded = false;}
+    // The ciphertext of @value as the tree is now; inserts @value when
+    // the tree does not have it.
+    std::string current(uint64_t value) const;
+    // (old, new) ciphertexts of the values that rebalances moved since
+    // the last call.
+    std::vector<std::pair<std::string, std::string> > takeMoved() const;
+
+    // A layer with moves that have not been taken, or NULL.
+    static const MOPE_int *anyRelabeled();
+
+private:
+    // > layers are built and dropped by the schema loads of every
+    //   thread, ie the import workers, so the set takes a lock.
+    static void relabeled(const MOPE_int *layer, bool moved);
+
+    static const size_t key_bytes = 16;
+    static const size_t ciph_size = 16;
+    std::string const key;
+    mutable blowfish bf;                  // HACK
+    const std::unique_ptr<ope_server<uint64_t> > server;
+    mutable bool is_loaded;
+    // by value under blowfish, the first and latest path of each
+    mutable std::map<uint64_t, std::pair<uint64_t, uint64_t> > moved;
+
+    std::string ciphertext(uint64_t path, uint64_t enc_val) const;
+};
+
+// The column of a MOPE_int layer must catch up with the layer's tree
+// before the query can be rewritten.
+class MOPEExcept {
+public:
+    explicit MOPEExcept(const MOPE_int &layer) : layer(layer) {}
+
+    const MOPE_int &layer;
+};
+
 class Search : public EncLayer {
 public:
     Search(const Create_field &cf, const std::string &seed_key);
@@ -138,6 +291,14 @@ public:
     //expr is the expression (e.g. a field) over which to sum
     Item * searchUDF(Item * const field, Item * const expr) const;
 
+    // Deterministic tokens of the words of a value and of a single
+    // search word; the keyword index of an oSWP onion maps the former
+    // to rows.
+    std::vector<std::string> keywords(const Item &ptext) const;
+    std::string keyword(const std::string &word) const;
+
+    static const uint keyword_bytes = 16;
+
 private:
     static const uint key_bytes = 16;
     std::string const key;
@@ -155,6 +316,16 @@ public:
     static std::unique_ptr<EncLayer>
         deserializeLayer(unsigned int id, const std::string &serial);
 
+    // The length preserving DET or DETJOIN layer of a short string
+    // column; see ffxColumn(...).
+    static std::unique_ptr<EncLayer>
+        ffxLayer(SECLEVEL sl, const Create_field &cf,
+                 const std::string &key);
+    static bool isFFX(const EncLayer &layer);
+    // The width of 'cf' in bytes, which is what FFX encrypts; CHAR(n)
+    // holds n characters.
+    static unsigned long ffxBytes(const Create_field &cf);
+
     // static std::string serializeLayer(EncLayer * el, DBMeta *parent);
 };
 
@@ -26,11 +26,11 @@ class AddColumnSubHandler : public AlterSubHandler {
             List_iterator<Create_field>(lex->alter_info.create_list);
         lex->alter_info.create_list =
             accumList<Create_field>(add_it,
-                [&a, &tm, &key_data] (List<Create_field> out_list,
-                                      Create_field *cf)
+                [&a, &tm, &key_data, &preamble] (List<Create_field> out_list,
+                                                 Create_field *cf)
             {
                     return createAndRewriteField(a, cf, &tm, false, key_data,
-                                                 out_list);
+                                                 preamble, out_list);
             });
 
         return lex;
@@ -81,9 +81,23 @@ class DropColumnSubHandler : public AlterSubHandler {
         for (const auto &om_it : fm.getChildren()) {
             Alter_drop * const new_adrop = adrop->clone(thd->mem_root);
             OnionMeta *const om = om_it.second.get();
+            // > the other fields of the pack still sum from its column
+            TEST_TextMessageError(NULL == om->getPacked(),
+                                  "can not drop " + fm.getFieldName()
+                                  + ", its AGG onion is packed with other"
+                                  " columns");
             new_adrop->name =
                 thd->strdup(om->getAnonOnionName().c_str());
             out_list.push_back(new_adrop);
+
+            // > and the shadow column of a rotation
+            if (om->getRotating()) {
+                Alter_drop * const shadow_adrop =
+                    adrop->clone(thd->mem_root);
+                shadow_adrop->name =
+                    thd->strdup(om->getNextOnionName().c_str());
+                out_list.push_back(shadow_adrop);
+            }
         }
 
         // Rewrite the salt column.
@@ -121,10 +135,11 @@ class AddIndexSubHandler : public AlterSubHandler {
         rewriteAndUpdate(Analysis &a, LEX *lex, const Preamble &preamble)
             const
     {
-        TableMeta const &tm =
-            a.getTableMeta(preamble.dbname, preamble.table);
+        TableMeta &tm = a.getTableMeta(preamble.dbname, preamble.table);
 
-        highLevelRewriteKey(tm, *lex, lex, a);
+        highLevelRewriteKey(tm, *lex, lex, preamble, a);
+        a.deltas.push_back(std::unique_ptr<Delta>(
+               new ReplaceDelta(tm, a.getDatabaseMeta(preamble.dbname))));
 
         return lex;
     }
@@ -135,8 +150,7 @@ class DropIndexSubHandler : public AlterSubHandler {
         rewriteAndUpdate(Analysis &a, LEX *lex, const Preamble &preamble)
             const
     {
-        TableMeta const &tm =
-            a.getTableMeta(preamble.dbname, preamble.table);
+        TableMeta &tm = a.getTableMeta(preamble.dbname, preamble.table);
 
         // Get the key drops.
         auto drop_it =
@@ -157,24 +171,30 @@ class DropIndexSubHandler : public AlterSubHandler {
                     (List<Alter_drop> out_list, Alter_drop *adrop)
                 {
                         List<Alter_drop> lst =
-                            this->rewrite(a, adrop, preamble.table);
+                            this->rewrite(a, tm, adrop, preamble.table);
                         out_list.concat(&lst); 
+                        tm.removeOnionIndex(adrop->name);
                         return out_list;
                 });
+        a.deltas.push_back(std::unique_ptr<Delta>(
+               new ReplaceDelta(tm, a.getDatabaseMeta(preamble.dbname))));
 
         return lex;
     }
 
-    List<Alter_drop> rewrite(const Analysis &a, Alter_drop *adrop,
+    List<Alter_drop> rewrite(const Analysis &a, const TableMeta &tm,
+                             Alter_drop *adrop,
                              const std::string &table) const
     {
         // Rewrite the Alter_drop data structure.
         List<Alter_drop> out_list;
-        const std::vector<onion> key_onions = getOnionIndexTypes();
+        const bool tracked = NULL != tm.getOnionIndex(adrop->name);
+        const std::vector<onion> key_onions =
+            getIndexOnions(tm, adrop->name);
         for (auto onion_it : key_onions) {
             const onion o = onion_it;
-            // HACK.
-            if (oPLAIN == o) {
+            // HACK: we don't know which onions an untracked index used.
+            if (false == tracked && oPLAIN == o) {
                 continue;
             }
             Alter_drop *const new_adrop =
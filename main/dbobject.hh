@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
 #include <functional>
 #include <memory>
 
@@ -31,13 +33,15 @@ protected:
         key_data(key_data), serial(serial) {}
 
 public:
+    typedef KeyType value_type;
+
     // Build MetaKey from 'actual' key value.
     MetaKey(KeyType key_data) {;}
     virtual ~MetaKey() = 0;
     bool operator <(const MetaKey<KeyType> &rhs) const;
     bool operator ==(const MetaKey<KeyType> &rhs) const;
 
-    KeyType getValue() const {return key_data;}
+    const KeyType &getValue() const {return key_data;}
     std::string getSerial() const {return serial;}
 };
 
@@ -104,6 +108,49 @@ private:
     }
 };
 
+// Hashing and equality for MappedDBMeta's child index.
+// > identifiers hash case-folded so that a case-insensitive lookup probes
+//   the same chain as an exact one.
+inline uint64_t
+metaKeyHash(const std::string &s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char c : s) {
+        h ^= static_cast<uint64_t>(tolower(c));
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+inline uint64_t
+metaKeyHash(unsigned int i)
+{
+    return static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ULL;
+}
+
+inline bool
+metaKeyEqual(const std::string &a, const std::string &b, bool fold_case)
+{
+    if (false == fold_case) {
+        return a == b;
+    }
+
+    return a.size() == b.size()
+        && std::equal(a.begin(), a.end(), b.begin(),
+                      [] (unsigned char x, unsigned char y)
+                      {
+                          return tolower(x) == tolower(y);
+                      });
+}
+
+template <typename KeyType>
+bool
+metaKeyEqual(const KeyType &a, const KeyType &b, bool fold_case)
+{
+    return a == b;
+}
+
 class DBObject {
     const unsigned int id;
 
@@ -124,6 +171,47 @@ public:
 
 class Connect;
 
+// Where the rows of the metadata table come from when a SchemaInfo is
+// loaded; the table itself or a snapshot of it (see MetaSnapshot).
+class MetaSource {
+public:
+    virtual ~MetaSource() {}
+
+    // calls 'fn' with the (serial_key, serial_object, id) of each child of
+    // 'parent_id'
+    virtual void
+        children(unsigned int parent_id,
+                 std::function<void(const std::string &,
+                                    const std::string &,
+                                    const std::string &)> fn) const = 0;
+    // the state an EncLayer derived from 'serial' when it was last
+    // loaded; empty if it must derive it again
+    virtual std::string
+        expandedKey(unsigned int id, const std::string &serial) const = 0;
+};
+
+// > 'previous' is where the expanded keys come from, if anywhere
+class MetaTableSource : public MetaSource {
+public:
+    MetaTableSource(const std::unique_ptr<Connect> &e_conn,
+                    const MetaSource *const previous = NULL)
+        : e_conn(e_conn), previous(previous) {}
+
+    void children(unsigned int parent_id,
+                  std::function<void(const std::string &,
+                                     const std::string &,
+                                     const std::string &)> fn) const;
+    std::string expandedKey(unsigned int id, const std::string &serial)
+        const
+    {
+        return previous ? previous->expandedKey(id, serial) : "";
+    }
+
+private:
+    const std::unique_ptr<Connect> &e_conn;
+    const MetaSource *const previous;
+};
+
 /*
  * DBMeta is also a design choice about how we use Deltas.
  * i) Read SchemaInfo from database, read Deltaz from database then
@@ -146,7 +234,7 @@ public:
     // FIXME: Use rtti.
     virtual std::string typeName() const = 0;
     virtual std::vector<DBMeta *>
-        fetchChildren(const std::unique_ptr<Connect> &e_conn) = 0;
+        fetchChildren(const MetaSource &source) = 0;
     // Stops processing on error.
     virtual bool
         applyToChildren(std::function<bool(const DBMeta &)>)
@@ -156,7 +244,7 @@ public:
 
 protected:
     std::vector<DBMeta*>
-        doFetchChildren(const std::unique_ptr<Connect> &e_conn,
+        doFetchChildren(const MetaSource &source,
                         std::function<DBMeta*
                             (const std::string &, const std::string &,
                              const std::string &)>
@@ -169,7 +257,7 @@ public:
     LeafDBMeta(unsigned int id) : DBMeta(id) {}
 
     std::vector<DBMeta *>
-        fetchChildren(const std::unique_ptr<Connect> &e_conn)
+        fetchChildren(const MetaSource &source)
     {
         return std::vector<DBMeta *>();
     }
@@ -190,8 +278,8 @@ public:
 // > TODO: Use static deserialization functions for the derived types so we
 //   can get rid of the <Constructor>(std::string serial) functions and put
 //   'const' back on the members.
-// > FIXME: The key in children is a pointer so this means our lookup is
-//   slow. Use std::reference_wrapper.
+// > Lookups go through a hashed index over children, so resolving a name
+//   neither builds a key nor walks the map.
 template <typename ChildType, typename KeyType>
 class MappedDBMeta : public DBMeta {
 public:
@@ -201,9 +289,12 @@ public:
     virtual bool addChild(KeyType key, std::unique_ptr<ChildType> meta);
     virtual bool childExists(const KeyType &key) const;
     virtual ChildType * getChild(const KeyType &key) const;
+    // > fold_case for the identifiers MySQL compares case-insensitively.
+    ChildType *findChild(const typename KeyType::value_type &value,
+                         bool fold_case = false) const;
     KeyType const &getKey(const DBMeta &child) const;
     virtual std::vector<DBMeta *>
-        fetchChildren(const std::unique_ptr<Connect> &e_conn);
+        fetchChildren(const MetaSource &source);
     bool applyToChildren(std::function<bool(const DBMeta &)> fn) const;
     const std::map<KeyType, std::unique_ptr<ChildType> > &
         getChildren() const {return children;}
@@ -211,7 +302,15 @@ public:
         getChildWithGChild(const DBMeta &gchild) const;
 
 private:
+    typedef typename std::map<KeyType, std::unique_ptr<ChildType> >::value_type
+        Entry;
+
     std::map<KeyType, std::unique_ptr<ChildType> > children;
+    // open addressed over children; a power of two in size and at most
+    // half full
+    std::vector<const Entry *> index;
+
+    void indexChild(const Entry &entry);
 };
 
 #include <main/dbobject.tt>
@@ -7,6 +7,7 @@
 #include <main/dispatcher.hh>
 #include <main/macro_util.hh>
 #include <main/metadata_tables.hh>
+#include <main/phase.hh>
 #include <parser/lex_util.hh>
 
 #include <util/yield.hpp>
@@ -66,21 +67,34 @@ class CreateTableHandler : public DDLHandler {
             // collect the keys (and their types) as they may affect the onion
             // layout we use
             const auto &key_data = collectKeyData(*lex);
+            const auto &packs = packedAggSlots(*lex, pre);
 
             auto it =
                 List_iterator<Create_field>(lex->alter_info.create_list);
             new_lex->alter_info.create_list =
                 accumList<Create_field>(it,
-                    [&a, &tm, &key_data] (List<Create_field> out_list,
-                                          Create_field *const cf) {
-                        return createAndRewriteField(a, cf, tm.get(),
-                                                     true, key_data, out_list);
+                    [&a, &tm, &key_data, &pre, &packs]
+                        (List<Create_field> out_list,
+                         Create_field *const cf) {
+                        const auto &packed = packs.find(cf->field_name);
+                        return createAndRewriteField(a, cf, tm.get(), true,
+                                                     key_data, pre, out_list,
+                                                     packs.end() == packed
+                                                       ? NULL
+                                                       : &packed->second);
                 });
+            new_lex->alter_info.create_list.concat(
+                vectorToListWithTHD(
+                    rewrite_create_packs(*tm.get(),
+                                         lex->alter_info.create_list, a)));
 
             // -----------------------------
             //         Rewrite INDEX
             // -----------------------------
-            highLevelRewriteKey(*tm.get(), *lex, new_lex, a);
+            highLevelRewriteKey(*tm.get(), *lex, new_lex, pre, a);
+
+            const std::list<std::string> &index_queries =
+                keywordIndexQueries(pre.dbname, *tm.get(), true);
 
             // -----------------------------
             //         Update TABLE
@@ -89,6 +103,9 @@ class CreateTableHandler : public DDLHandler {
                             new CreateDelta(std::move(tm),
                                             a.getDatabaseMeta(pre.dbname),
                                             IdentityMetaKey(pre.table))));
+
+            return new DDLQueryExecutor(*new_lex, std::move(a.deltas),
+                                        index_queries);
         } else { // Table already exists.
 
             // Make sure we aren't trying to create a table that
@@ -174,9 +191,11 @@ class DropTableHandler : public DDLHandler {
         assert(a.deltas.size() == 0);
 
         LEX *const final_lex = rewrite(a, lex);
-        update(a, lex);
+        std::list<std::string> index_queries;
+        update(a, lex, &index_queries);
 
-        return new DDLQueryExecutor(*final_lex, std::move(a.deltas));
+        return new DDLQueryExecutor(*final_lex, std::move(a.deltas),
+                                    index_queries);
     }
     
     LEX *rewrite(Analysis &a, LEX *lex) const
@@ -188,7 +207,8 @@ class DropTableHandler : public DDLHandler {
         return new_lex;
     }
 
-    void update(Analysis &a, LEX *lex) const
+    void update(Analysis &a, LEX *lex,
+                std::list<std::string> *const index_queries) const
     {
         TABLE_LIST *tbl = lex->select_lex.table_list.first;
         for (; tbl; tbl = tbl->next_local) {
@@ -203,6 +223,8 @@ class DropTableHandler : public DDLHandler {
 
             // Remove from *Meta structures.
             TableMeta const &tm = a.getTableMeta(tbl->db, table);
+            index_queries->splice(index_queries->end(),
+                                  keywordIndexQueries(tbl->db, tm, false));
             a.deltas.push_back(std::unique_ptr<Delta>(
                             new DeleteDelta(tm,
                                             a.getDatabaseMeta(tbl->db))));
@@ -290,9 +312,11 @@ class CreateIndexHandler : public DDLHandler {
             rewrite_table_list(lex->select_lex.table_list, a);
 
         TEST_DatabaseDiscrepancy(pre.dbname, a.getDatabaseName());
-        TableMeta const &tm = a.getTableMeta(pre.dbname, pre.table);
+        TableMeta &tm = a.getTableMeta(pre.dbname, pre.table);
 
-        highLevelRewriteKey(tm, *lex, new_lex, a);
+        highLevelRewriteKey(tm, *lex, new_lex, pre, a);
+        a.deltas.push_back(std::unique_ptr<Delta>(
+               new ReplaceDelta(tm, a.getDatabaseMeta(pre.dbname))));
 
         return new DDLQueryExecutor(*new_lex, std::move(a.deltas));
     }
@@ -309,6 +333,7 @@ empty_if_null(const char *const p)
 AbstractQueryExecutor *DDLHandler::
 transformLex(Analysis &a, LEX *lex) const
 {
+    const PhaseTimer t(Phase::REWRITE, lex->sql_command);
     assert(a.deltas.size() == 0);
 
     AssignOnce<std::string> db;
@@ -387,6 +412,13 @@ nextImpl(const ResType &res, const NextParams &nparams)
         // save the results so we can return them to the client
         this->ddl_res = res;
 
+        for (this->after_it = this->after_queries.begin();
+             this->after_it != this->after_queries.end();
+             ++this->after_it) {
+            yield return CR_QUERY_AGAIN(*this->after_it);
+            TEST_ErrPkt(res.success(), "DDL query failed: " + *this->after_it);
+        }
+
         yield {
             return CR_QUERY_AGAIN(
                 " INSERT INTO " + MetaData::Table::remoteQueryCompletion() +
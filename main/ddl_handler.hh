@@ -1,5 +1,6 @@
 #pragma once
 
+#include <list>
 #include <map>
 
 #include <main/Analysis.hh>
@@ -8,17 +9,27 @@
 
 #include <sql_lex.h>
 
+// @after_queries run once the rewritten query succeeds; they create and
+// drop the tables that go with the table, ie keyword indexes.
 class DDLQueryExecutor : public AbstractQueryExecutor {
     const std::string new_query;
     const std::vector<std::unique_ptr<Delta> > deltas;
+    const std::list<std::string> after_queries;
 
     AssignOnce<ResType> ddl_res;
     AssignOnce<uint64_t> embedded_completion_id;
+    std::list<std::string>::const_iterator after_it;
 
 public:
     DDLQueryExecutor(const LEX &new_lex,
+                     std::vector<std::unique_ptr<Delta> > &&deltas,
+                     const std::list<std::string> &after_queries =
+                        std::list<std::string>())
+        : new_query(lexToQuery(new_lex)), deltas(std::move(deltas)),
+          after_queries(after_queries) {}
+    DDLQueryExecutor(const std::string &new_query,
                      std::vector<std::unique_ptr<Delta> > &&deltas)
-        : new_query(lexToQuery(new_lex)), deltas(std::move(deltas)) {}
+        : new_query(new_query), deltas(std::move(deltas)) {}
     ~DDLQueryExecutor() {}
     std::pair<ResultType, AbstractAnything *>
         nextImpl(const ResType &res, const NextParams &nparams);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <functional>
 
 #include <main/dml_handler.hh>
@@ -6,6 +7,8 @@
 #include <main/dispatcher.hh>
 #include <main/macro_util.hh>
 #include <main/metadata_tables.hh>
+#include <main/phase.hh>
+#include <main/rotate.hh>
 #include <parser/lex_util.hh>
 #include <util/onions.hh>
 #include <util/yield.hpp>
@@ -100,6 +103,10 @@ class InsertHandler : public DMLHandler {
         // FIXME: Make vector of references.
         std::vector<FieldMeta *> fmVec;
         std::vector<Item *> implicit_defaults;
+        // > Packed AGG onions take their slots from several fields of the
+        //   row, so their columns come last.
+        const auto &packs = packedAggOnions(tm);
+        std::map<const FieldMeta *, const Item *> pack_defaults;
         if (lex->field_list.head()) {
             auto it = List_iterator<Item>(lex->field_list);
             List<Item> newList;
@@ -136,8 +143,10 @@ class InsertHandler : public DMLHandler {
 
                 // Get default values.
                 const std::string def_value = implicit_it->defaultValue();
-                rewriteInsertHelper(*make_item_string(def_value),
-                                    *implicit_it, a, &implicit_defaults);
+                const Item *const def_item = make_item_string(def_value);
+                rewriteInsertHelper(*def_item, *implicit_it, a,
+                                    &implicit_defaults);
+                pack_defaults[implicit_it] = def_item;
             }
 
             new_lex->field_list = newList;
@@ -149,6 +158,45 @@ class InsertHandler : public DMLHandler {
             assert(fmVec.empty());
             std::vector<FieldMeta *> fmetas = tm.orderedFieldMetas();
             fmVec.assign(fmetas.begin(), fmetas.end());
+
+            // > The columns of a table created with packs are only in
+            //   field order until ALTER TABLE adds one after the packs,
+            //   and a rotating onion has its shadow column at the end;
+            //   so we name them.
+            bool rotating = false;
+            for (const auto &it : fmVec) {
+                for (const auto &onion_it : it->getChildren()) {
+                    rotating = rotating || onion_it.second->getRotating();
+                }
+            }
+            if (false == packs.empty() || rotating) {
+                THD *const thd = current_thd;
+                List<Item> newList;
+                for (auto it : fmVec) {
+                    const Item_field *const field =
+                        new Item_field(&new_lex->select_lex.context, NULL,
+                                       thd->strdup(table.c_str()),
+                                       thd->strdup(it->getFieldName()
+                                                     .c_str()));
+                    rewriteInsertHelper(*field, *it, a, &newList);
+                }
+                new_lex->field_list = newList;
+            }
+        }
+
+        if (false == packs.empty()) {
+            TEST_TextMessageError(NULL != lex->many_values.head(),
+                                  "INSERT ... SELECT can not fill packed"
+                                  " AGG onions");
+            const Item_field *const seed_item_field =
+                static_cast<Item_field *>(new_lex->field_list.head());
+            assert(seed_item_field);
+            const std::string &anon_table_name = tm.getAnonTableName();
+            for (const auto &it : packs) {
+                new_lex->field_list.push_back(
+                    make_item_field(*seed_item_field, anon_table_name,
+                                    it.first));
+            }
         }
 
         // -----------------
@@ -168,10 +216,15 @@ class InsertHandler : public DMLHandler {
                                          && NULL == lex->field_list.head(),
                                           "size mismatch between fields"
                                           " and values!");
+                    TEST_TextMessageError(packs.empty(),
+                                          "a table with packed AGG onions"
+                                          " needs its values listed");
                     // Query such as this.
                     // > INSERT INTO <table> () VALUES ();
                     // > INSERT INTO <table> VALUES ();
                 } else {
+                    std::map<const FieldMeta *, const Item *>
+                        row(pack_defaults);
                     auto it0 = List_iterator<Item>(*li);
                     auto fmVecIt = fmVec.begin();
                     for (;;) {
@@ -181,11 +234,18 @@ class InsertHandler : public DMLHandler {
                             break;
                         }
                         rewriteInsertHelper(*i, **fmVecIt, a, newList0);
+                        row[*fmVecIt] = i;
                         ++fmVecIt;
                     }
                     for (auto def_it : implicit_defaults) {
                         newList0->push_back(def_it);
                     }
+
+                    std::vector<Item *> pack_values;
+                    encrypt_packs(packs, row, &pack_values);
+                    for (auto pack_it : pack_values) {
+                        newList0->push_back(pack_it);
+                    }
                 }
                 newList.push_back(newList0);
             }
@@ -212,6 +272,117 @@ class InsertHandler : public DMLHandler {
     }
 };
 
+// SpecialUpdateExecutor walks the matching rows in chunks ordered by a
+// single column PRIMARY KEY; returns the key and the onion it walks.
+// > the key must take range predicates without an onion adjustment, or
+//   else it is walked on its oDET onion, which for a key starts at DET
+//   and never goes below DETJOIN.
+// > an UPDATE that changes the key, or that has ORDER BY or LIMIT, is
+//   done in one chunk.
+static std::pair<std::string, onion>
+specialUpdateChunkKey(const Analysis &a, LEX *const lex)
+{
+    const auto &none = std::make_pair(std::string(), oINVALID);
+    if (lex->select_lex.select_limit
+        || lex->select_lex.order_list.elements > 0) {
+        return none;
+    }
+
+    const TABLE_LIST *const table = lex->select_lex.top_join_list.head();
+    const TableMeta &tm = a.getTableMeta(table->db, table->table_name);
+    const OnionIndex *const primary = tm.getOnionIndex("PRIMARY");
+    if (NULL == primary || 1 != primary->columns.size()
+        || 0 != primary->columns.front().second) {
+        return none;
+    }
+
+    const std::string &key = primary->columns.front().first;
+    const FieldMeta &fm = a.getFieldMeta(tm, key);
+    const OnionMeta *const om_plain = fm.getOnionMeta(oPLAIN);
+    const OnionMeta *const om_ope = fm.getOnionMeta(oOPE);
+    const OnionMeta *const om_det = fm.getOnionMeta(oDET);
+    onion o = oINVALID;
+    if (om_plain) {
+        o = oPLAIN;
+    } else if (om_ope && SECLEVEL::OPE == a.getOnionLevel(*om_ope)) {
+        o = oOPE;
+    } else if (om_det && (SECLEVEL::DET == a.getOnionLevel(*om_det)
+                          || SECLEVEL::DETJOIN == a.getOnionLevel(*om_det))) {
+        o = oDET;
+    } else {
+        return none;
+    }
+
+    auto field_it = List_iterator<Item>(lex->select_lex.item_list);
+    for (const Item *field = field_it++; field; field = field_it++) {
+        if (Item::Type::FIELD_ITEM == field->type()
+            && equalsIgnoreCase(key,
+                   static_cast<const Item_field *>(field)->field_name)) {
+            return none;
+        }
+    }
+
+    return std::make_pair(key, o);
+}
+
+// Removes the keyword index entries of the rows a DELETE or UPDATE of
+// one table picks, for the oSWP onions 'pruned' accepts; empty if there
+// are none.
+// > only for space: a row that is gone, or that got a new value and so a
+//   new salt, no longer matches its old entries; so they stay where we
+//   can not pick the rows exactly, ie under LIMIT, in a join, or when the
+//   statement searches the index itself.
+static std::list<std::string>
+keywordPrunes(const Analysis &a, const LEX &lex, const LEX &new_lex,
+              std::function<bool(const OnionMeta &)> pruned)
+{
+    const TABLE_LIST *const tbl = lex.select_lex.table_list.first;
+    const TABLE_LIST *const new_tbl = new_lex.select_lex.table_list.first;
+    if (NULL == tbl || NULL == new_tbl || tbl->next_local
+        || lex.select_lex.select_limit
+        || 0 != strcmp(tbl->alias, tbl->table_name)) {
+        return std::list<std::string>();
+    }
+
+    const std::string &db =
+        tbl->db ? std::string(tbl->db, tbl->db_length)
+                : a.getDatabaseName();
+    if (false == a.nonAliasTableMetaExists(db, tbl->table_name)) {
+        return std::list<std::string>();
+    }
+    const TableMeta &tm = a.getTableMeta(db, tbl->table_name);
+
+    std::string where;
+    if (new_lex.select_lex.where) {
+        std::ostringstream where_stream;
+        where_stream << *new_lex.select_lex.where;
+        where = where_stream.str();
+    }
+
+    const std::string &table =
+        "`" + db + "`.`" + tm.getAnonTableName() + "`";
+    std::list<std::string> prunes;
+    for (const auto &it : tm.getChildren()) {
+        const FieldMeta &fm = *it.second;
+        const OnionMeta *const om = fm.getOnionMeta(oSWP);
+        if (NULL == om || false == pruned(*om)) {
+            continue;
+        }
+        if (std::string::npos != where.find(om->getKeywordIndexName())) {
+            return std::list<std::string>();
+        }
+
+        prunes.push_back(
+            " DELETE `k`"
+            "   FROM `" + db + "`.`" + om->getKeywordIndexName() + "`"
+            "        AS `k`, " + table +
+            "  WHERE `k`.salt = " + table + ".`" + fm.getSaltName() + "`"
+            + (where.empty() ? "" : "    AND (" + where + ")") + ";");
+    }
+
+    return prunes;
+}
+
 class UpdateHandler : public DMLHandler {
     virtual void gather(Analysis &a, LEX *lex) const
     {
@@ -268,12 +439,46 @@ class UpdateHandler : public DMLHandler {
                 where_clause = " TRUE ";
             }
 
-            return new SpecialUpdateExecutor(plain_table, crypted_table,
-                                             where_clause.get());
+            const TABLE_LIST *const tbl =
+                lex->select_lex.top_join_list.head();
+            const std::string &db =
+                tbl->db ? std::string(tbl->db, tbl->db_length)
+                        : a.getDatabaseName();
+            const auto &chunk_key = specialUpdateChunkKey(a, lex);
+            return new SpecialUpdateExecutor(db, plain_table, crypted_table,
+                                             where_clause.get(),
+                                             chunk_key.first,
+                                             chunk_key.second);
+        }
+
+        // > the keyword search columns that get a new value are NULL
+        //   until the backfill indexes it
+        std::set<std::string> searched;
+        {
+            auto field_it = List_iterator<Item>(res_fields);
+            auto value_it = List_iterator<Item>(res_values);
+            for (Item *field = field_it++, *value = value_it++; field;
+                 field = field_it++, value = value_it++) {
+                if (Item::Type::FIELD_ITEM == field->type()
+                    && Item::Type::NULL_ITEM == value->type()) {
+                    searched.insert(
+                        static_cast<Item_field *>(field)->field_name);
+                }
+            }
         }
 
         new_lex->select_lex.item_list = res_fields;
         new_lex->value_list = res_values;
+
+        const std::list<std::string> &prunes =
+            keywordPrunes(a, *lex, *new_lex,
+                          [&searched] (const OnionMeta &om)
+        {
+            return searched.end() != searched.find(om.getAnonOnionName());
+        });
+        if (false == prunes.empty()) {
+            return new KeywordPruneExecutor(*new_lex, prunes);
+        }
         return new DMLQueryExecutor(*new_lex, a.rmeta);
     }
 };
@@ -294,6 +499,12 @@ class DeleteHandler : public DMLHandler {
         set_select_lex(new_lex,
                        rewrite_select_lex(new_lex->select_lex, a));
 
+        const std::list<std::string> &prunes =
+            keywordPrunes(a, *lex, *new_lex,
+                          [] (const OnionMeta &) {return true;});
+        if (false == prunes.empty()) {
+            return new KeywordPruneExecutor(*new_lex, prunes);
+        }
         return new DMLQueryExecutor(*new_lex, a.rmeta);
     }
 };
@@ -412,8 +623,16 @@ class SelectHandler : public DMLHandler {
         LEX *const new_lex = copyWithTHD(lex);
         new_lex->select_lex.top_join_list =
             rewrite_table_list(lex->select_lex.top_join_list, a);
+        // > ORDER BY and HAVING may name a SUM by its place or its
+        //   alias, and the selects of a UNION must agree on their
+        //   columns, so these keep a column for every SUM
+        const st_select_lex &select_lex = lex->select_lex;
+        const bool merge_packed_sums =
+            NULL == select_lex.next_select()
+            && 0 == select_lex.order_list.elements
+            && NULL == select_lex.having;
         set_select_lex(new_lex,
-            rewrite_select_lex(new_lex->select_lex, a));
+            rewrite_select_lex(new_lex->select_lex, a, merge_packed_sums));
 
         return new DMLQueryExecutor(*new_lex, a.rmeta);
     }
@@ -422,8 +641,12 @@ class SelectHandler : public DMLHandler {
 AbstractQueryExecutor *DMLHandler::
 transformLex(Analysis &analysis, LEX *lex) const
 {
-    this->gather(analysis, lex);
+    {
+        const PhaseTimer t(Phase::GATHER, lex->sql_command);
+        this->gather(analysis, lex);
+    }
 
+    const PhaseTimer t(Phase::REWRITE, lex->sql_command);
     return this->rewrite(analysis, lex);
 }
 
@@ -642,9 +865,28 @@ addSaltToReturn(ReturnMeta *const rm, int pos)
     rm->rfmeta.insert(pair);
 }
 
+// The fields returned so far; the place the next one takes.
+static unsigned int
+returnedFields(const ReturnMeta &rm)
+{
+    unsigned int returned = rm.shared.size();
+    for (const auto &it : rm.rfmeta) {
+        if (false == it.second.getIsSalt()) {
+            ++returned;
+        }
+    }
+
+    return returned;
+}
+
+// SUM(a), SUM(b) over one packed AGG onion rewrite to the same
+// cryptdb_agg(...) of the pack; it is run once, and the later SUMs
+// decrypt their slots out of the first one's result.
+// > the server sums each row's pack once however many of its columns
+//   the query sums
 static void
 rewrite_proj(const Item &i, const RewritePlan &rp, Analysis &a,
-             List<Item> *const newList)
+             List<Item> *const newList, bool merge_packed_sums)
 {
     AssignOnce<OLK> olk;
     AssignOnce<Item *> ir;
@@ -663,9 +905,27 @@ rewrite_proj(const Item &i, const RewritePlan &rp, Analysis &a,
         olk = rp.es_out.chooseOne();
     }
     assert(ir.assigned() && ir.get());
-    newList->push_back(ir.get());
     const bool use_salt = needsSalt(olk.get());
 
+    if (merge_packed_sums && oAGG == olk.get().o && olk.get().key
+        && false == use_salt
+        && a.getOnionMeta(*olk.get().key, oAGG).getPacked()) {
+        std::ostringstream sum;
+        sum << *ir.get();
+        const auto &first = a.packed_sums.find(sum.str());
+        if (a.packed_sums.end() != first) {
+            a.rmeta.shared.insert(
+                std::make_pair(returnedFields(a.rmeta),
+                    std::make_pair(first->second,
+                                   ReturnField(false, i.name, olk.get(),
+                                               -1))));
+            return;
+        }
+        a.packed_sums[sum.str()] = a.pos;
+    }
+
+    newList->push_back(ir.get());
+
     // This line implicity handles field aliasing for at least some cases.
     // As i->name can/will be the alias.
     addToReturn(&a.rmeta, a.pos++, olk.get(), use_salt, i.name);
@@ -686,7 +946,8 @@ rewrite_proj(const Item &i, const RewritePlan &rp, Analysis &a,
 }
 
 st_select_lex *
-rewrite_select_lex(const st_select_lex &select_lex, Analysis &a)
+rewrite_select_lex(const st_select_lex &select_lex, Analysis &a,
+                   bool merge_packed_sums)
 {
     // rewrite_filters_lex must be called before rewrite_proj because
     // it is responsible for filling Analysis::item_cache which
@@ -707,7 +968,7 @@ rewrite_select_lex(const st_select_lex &select_lex, Analysis &a)
                    << item->name << std::endl;
         rewrite_proj(*item,
                      *constGetAssert(a.rewritePlans, item).get(),
-                     a, &newList);
+                     a, &newList, merge_packed_sums);
     }
 
     new_select_lex->item_list = newList;
@@ -795,6 +1056,10 @@ invalidates(const FieldMeta &fm, const EncSet & es)
         if (es.osl.find(o) == es.osl.end()) {
             return true;
         }
+        // > a new value would overwrite the whole pack
+        if (om_it.second->getPacked()) {
+            return true;
+        }
     }
 
     return false;
@@ -822,11 +1087,13 @@ determineUpdateType(const Item &value_item, const FieldMeta &fm,
     return SIMPLE_UPDATE_TYPE::NEW_VALUE;
 }
 
+// > a new value leaves the oSWP onion to the backfill, which also indexes
+//   the value by keyword
 static void
 doPairRewrite(FieldMeta &fm, const EncSet &es,
               const Item_field &field_item, const Item &value_item,
               List<Item> *const res_fields, List<Item> *const res_values,
-              Analysis &a)
+              Analysis &a, bool new_value)
 {
     const std::unique_ptr<RewritePlan> &field_rp =
         constGetAssert(a.rewritePlans,
@@ -837,6 +1104,19 @@ doPairRewrite(FieldMeta &fm, const EncSet &es,
     for (auto pair : es.osl) {
         const OLK &olk = {pair.first, pair.second.first, &fm};
 
+        const OnionMeta *const om = fm.getOnionMeta(olk.o);
+        if (new_value && oSWP == olk.o && om && om->getDeferred()) {
+            const std::string &anon_table_name =
+                a.getAnonTableName(a.getDatabaseName(),
+                                   field_item.table_name);
+            res_fields->push_back(make_item_field(field_item,
+                                                  anon_table_name,
+                                                  om->getAnonOnionName()));
+            res_values->push_back(new Item_null());
+            DeferredOnions::deferred(om->getAnonOnionName());
+            continue;
+        }
+
         Item *const re_field =
             itemTypes.do_rewrite(field_item, olk, *field_rp, a);
         res_fields->push_back(re_field);
@@ -844,6 +1124,17 @@ doPairRewrite(FieldMeta &fm, const EncSet &es,
         Item *const re_value =
             itemTypes.do_rewrite(value_item, olk, *value_rp, a);
         res_values->push_back(re_value);
+
+        // > the rotation re-encrypts the row again
+        if (om && om->getRotating()) {
+            const std::string &anon_table_name =
+                a.getAnonTableName(a.getDatabaseName(),
+                                   field_item.table_name);
+            res_fields->push_back(make_item_field(field_item,
+                                                  anon_table_name,
+                                                  om->getNextOnionName()));
+            res_values->push_back(new Item_null());
+        }
     }
 }
 
@@ -882,8 +1173,15 @@ handleUpdateType(SIMPLE_UPDATE_TYPE update_type, const EncSet &es,
             if (fm.getHasSalt()) {
                 // Search for a salt first as a previous iteration may 
                 // have already referenced this @fm.
+                // > a new value for a keyword search column gets a new
+                //   salt, so that the index entries of the old value do
+                //   not match the row
+                const OnionMeta *const search = fm.getOnionMeta(oSWP);
+                const bool new_search = search && search->getDeferred()
+                                        && es.osl.end() != es.osl.find(oSWP);
                 const auto it_salt = a.salts.find(&fm);
-                if ((it_salt == a.salts.end()) && needsSalt(es)) {
+                if ((it_salt == a.salts.end())
+                    && (needsSalt(es) || new_search)) {
                     add_salt = true;
                     const salt_type salt = randomValue();
                     a.salts.insert(std::make_pair(&fm, salt));
@@ -891,7 +1189,7 @@ handleUpdateType(SIMPLE_UPDATE_TYPE update_type, const EncSet &es,
             }
 
             doPairRewrite(fm, es, field_item, value_item, res_fields,
-                          res_values, a);
+                          res_values, a, true);
 
             if (add_salt) {
                 addSalt(fm, field_item, res_fields, res_values, a,
@@ -906,12 +1204,12 @@ handleUpdateType(SIMPLE_UPDATE_TYPE update_type, const EncSet &es,
         }
         case SIMPLE_UPDATE_TYPE::SAME_VALUE: {
             doPairRewrite(fm, es, field_item, value_item, res_fields,
-                          res_values, a);
+                          res_values, a, false);
             break;
         }
         case SIMPLE_UPDATE_TYPE::ON_DUPLICATE_VALUE: {
             doPairRewrite(fm, es, field_item, value_item, res_fields,
-                          res_values, a);
+                          res_values, a, false);
             if (fm.getHasSalt()) {
                 addSalt(fm, field_item, res_fields, res_values, a,
                         [&value_item, &fm, &a]
@@ -962,7 +1260,13 @@ class SetHandler : public DMLHandler {
              {"sensitive",
               DIRECTIVE_HANDLER(&SetHandler::handleSensitiveDirective)},
              {"killzone",
-              DIRECTIVE_HANDLER(&SetHandler::handleKillZoneDirective)}};
+              DIRECTIVE_HANDLER(&SetHandler::handleKillZoneDirective)},
+             {"index", DIRECTIVE_HANDLER(&SetHandler::handleIndexDirective)},
+             {"backfill",
+              DIRECTIVE_HANDLER(&SetHandler::handleBackfillDirective)},
+             {"rotate", DIRECTIVE_HANDLER(&SetHandler::handleRotateDirective)},
+             {"retire", DIRECTIVE_HANDLER(&SetHandler::handleRetireDirective)},
+             {"status", DIRECTIVE_HANDLER(&SetHandler::handleStatusDirective)}};
 
         DirectiveHandler dhandler = nullptr;
         std::map<std::string, std::string> var_pairs;
@@ -1079,6 +1383,18 @@ private:
         return new ShowDirectiveExecutor(a.getSchema());
     }
 
+    // per phase counts and latencies since the proxy started
+    //   SET @cryptdb='status'
+    AbstractQueryExecutor *
+    handleStatusDirective(std::map<std::string, std::string> &var_pairs,
+                          Analysis &a) const
+    {
+        TEST_TextMessageError(var_pairs.empty(),
+                              "the status directive takes no parameters");
+
+        return new StatusDirectiveExecutor();
+    }
+
     AbstractQueryExecutor *
     handleSensitiveDirective(std::map<std::string, std::string> &var_pairs,
                              Analysis &a) const
@@ -1131,6 +1447,241 @@ private:
         return new NoOpExecutor();
     }
 
+    // Build or drop the anonymous index that one onion contributes to a
+    // user index; lets the onion indexes follow the workload.
+    //   SET @cryptdb='index', @database='db', @table='t', @index='i',
+    //       @oOrder='add', @oEq='drop'
+    AbstractQueryExecutor *
+    handleIndexDirective(std::map<std::string, std::string> &var_pairs,
+                         Analysis &a) const
+    {
+        assert(a.deltas.size() == 0);
+
+        std::function<std::string(std::string)> getAndDestroy(
+            [&var_pairs] (const std::string &key)
+        {
+            auto it = var_pairs.find(key);
+            TEST_TextMessageError(it != var_pairs.end(),
+                                  "must supply a " + key);
+            const std::string value = it->second;
+            var_pairs.erase(it);
+
+            return value;
+        });
+
+        const std::string &database   = getAndDestroy("database");
+        const std::string &table      = getAndDestroy("table");
+        const std::string &index_name = getAndDestroy("index");
+
+        TableMeta &tm = a.getTableMeta(database, table);
+        const OnionIndex *const current = tm.getOnionIndex(index_name);
+        TEST_Text(NULL != current,
+                  "the onions of index " + index_name + " are unknown;"
+                  " drop and recreate it");
+        TEST_Text(Key::MULTIPLE == current->type
+                  || Key::UNIQUE == current->type,
+                  "only regular and UNIQUE indexes can change onions");
+        OnionIndex index = *current;
+
+        // the remaining values are <onion>=<add|drop> pairs
+        std::string alterations;
+        for (const auto &it : var_pairs) {
+            AssignOnce<onion> o;
+            try {
+                o = TypeText<onion>::noCaseToType(it.first);
+            } catch (CryptDBError &e) {
+                FAIL_TextMessageError("bad param; " + it.first + "=" +
+                                      it.second);
+            }
+
+            const std::string &anon_index_name =
+                tm.getAnonIndexName(index_name, o.get());
+            const bool exists =
+                index.onions.end() != index.onions.find(o.get());
+            if (false == alterations.empty()) {
+                alterations += ", ";
+            }
+
+            if (equalsIgnoreCase("add", it.second)) {
+                TEST_Text(false == exists,
+                          index_name + " already indexes " + it.first);
+
+                std::string columns;
+                for (const auto &col : index.columns) {
+                    const FieldMeta &fm = a.getFieldMeta(tm, col.first);
+                    const OnionMeta *const om = fm.getOnionMeta(o.get());
+                    TEST_Text(NULL != om,
+                              col.first + " does not have " + it.first);
+                    if (false == columns.empty()) {
+                        columns += ", ";
+                    }
+                    columns += "`" + om->getAnonOnionName() + "`";
+                    if (0 != col.second) {
+                        columns += "(" + std::to_string(col.second) + ")";
+                    }
+                }
+
+                alterations +=
+                    std::string(Key::UNIQUE == index.type ? " ADD UNIQUE"
+                                                          : " ADD")
+                    + " INDEX `" + anon_index_name + "` (" + columns + ")";
+                index.onions.insert(o.get());
+            } else if (equalsIgnoreCase("drop", it.second)) {
+                TEST_Text(exists,
+                          index_name + " does not index " + it.first);
+
+                alterations += " DROP INDEX `" + anon_index_name + "`";
+                index.onions.erase(o.get());
+            } else {
+                FAIL_TextMessageError("onion indexes can only be 'add'ed"
+                                      " or 'drop'ped; not " + it.second);
+            }
+        }
+        TEST_Text(false == alterations.empty(),
+                  "you must specify at least one onion");
+
+        tm.setOnionIndex(index_name, index);
+        a.deltas.push_back(std::unique_ptr<Delta>(
+                new ReplaceDelta(tm, a.getDatabaseMeta(database))));
+
+        const std::string &query =
+            " ALTER TABLE `" + database + "`.`" + tm.getAnonTableName()
+            + "`" + alterations + ";";
+        return new DDLQueryExecutor(query, std::move(a.deltas));
+    }
+
+    // Encrypt the values INSERT deferred so that reads of the onions do
+    // not have to; ie a cron job can drain a table between peaks.
+    //   SET @cryptdb='backfill', @database='db', @table='t'[, @field='f']
+    AbstractQueryExecutor *
+    handleBackfillDirective(std::map<std::string, std::string> &var_pairs,
+                            Analysis &a) const
+    {
+        const auto &database = var_pairs.find("database");
+        const auto &table = var_pairs.find("table");
+        const auto &field = var_pairs.find("field");
+        TEST_Text(var_pairs.end() != database && var_pairs.end() != table
+                  && var_pairs.size()
+                     == (var_pairs.end() != field ? 3u : 2u),
+                  "the backfill directive takes the parameters 'database',"
+                  " 'table' and optionally 'field'");
+
+        const TableMeta &tm = a.getTableMeta(database->second,
+                                             table->second);
+        std::vector<std::pair<std::string, onion> > onions;
+        for (const auto &field_it : tm.getChildren()) {
+            const FieldMeta &fm = *field_it.second;
+            if (var_pairs.end() != field
+                && field->second != fm.getFieldName()) {
+                continue;
+            }
+
+            for (const auto &onion_it : fm.getChildren()) {
+                if (onion_it.second->getDeferred()) {
+                    onions.push_back(
+                        std::make_pair(fm.getFieldName(),
+                                       onion_it.first.getValue()));
+                }
+            }
+        }
+        TEST_Text(false == onions.empty(),
+                  "there are no deferred onions in " + table->second);
+
+        return new BackfillExecutor(database->second, table->second,
+                                    onions, false);
+    }
+
+    // re-encrypts the onions of a table, or of one of its fields, under
+    // new keys; the fill leaves the table online
+    //   SET @cryptdb='rotate', @database='db', @table='t'[, @field='f']
+    //       [, @batch='rows'][, @threads='n'][, @rate='rows per second']
+    // > the ALTER TABLE that adds the shadow columns copies the whole
+    //   table on MySQL 5.5, and writes wait for it; so does the one that
+    //   swaps them in when the PRIMARY KEY is on a rotated onion. Else
+    //   the old columns are left for the 'retire' directive.
+    AbstractQueryExecutor *
+    handleRotateDirective(std::map<std::string, std::string> &var_pairs,
+                          Analysis &a) const
+    {
+        const auto &database = var_pairs.find("database");
+        const auto &table = var_pairs.find("table");
+        const auto &field = var_pairs.find("field");
+        TEST_Text(var_pairs.end() != database && var_pairs.end() != table,
+                  "the rotate directive takes the parameters 'database',"
+                  " 'table' and optionally 'field', 'batch', 'threads'"
+                  " and 'rate'");
+
+        const auto number =
+            [&var_pairs] (const std::string &name, unsigned long dfault)
+        {
+            const auto &it = var_pairs.find(name);
+            if (var_pairs.end() == it) {
+                return dfault;
+            }
+
+            unsigned long value = 0;
+            try {
+                value = std::stoul(it->second);
+            } catch (const std::exception &e) {
+                FAIL_TextMessageError("'" + name + "' must be a number");
+            }
+            var_pairs.erase(it);
+            return value;
+        };
+        const unsigned long batch = number("batch", 256);
+        const unsigned long threads =
+            number("threads",
+                   std::max(1u, std::thread::hardware_concurrency()));
+        const unsigned long rate = number("rate", 0);
+        TEST_Text(batch > 0 && threads > 0,
+                  "'batch' and 'threads' must be positive");
+        TEST_Text(var_pairs.size() == (var_pairs.end() != field ? 3u : 2u),
+                  "unknown parameter to the rotate directive");
+
+        const TableMeta &tm = a.getTableMeta(database->second,
+                                             table->second);
+        std::vector<std::pair<std::string, onion> > onions;
+        for (const auto &field_it : tm.getChildren()) {
+            const FieldMeta &fm = *field_it.second;
+            if (var_pairs.end() != field
+                && field->second != fm.getFieldName()) {
+                continue;
+            }
+
+            for (const auto &onion_it : fm.getChildren()) {
+                const onion o = onion_it.first.getValue();
+                if (RotateExecutor::rotatable(o, *onion_it.second)) {
+                    onions.push_back(std::make_pair(fm.getFieldName(), o));
+                }
+            }
+        }
+        TEST_Text(false == onions.empty(),
+                  "there are no onions to rotate in " + table->second);
+
+        return new RotateExecutor(database->second, table->second, onions,
+                                  batch, threads, rate);
+    }
+
+    // drops the old columns and indexes that rotations of a table left
+    // behind
+    //   SET @cryptdb='retire', @database='db', @table='t'
+    // > one ALTER TABLE that copies the table on MySQL 5.5
+    AbstractQueryExecutor *
+    handleRetireDirective(std::map<std::string, std::string> &var_pairs,
+                          Analysis &a) const
+    {
+        const auto &database = var_pairs.find("database");
+        const auto &table = var_pairs.find("table");
+        TEST_Text(var_pairs.end() != database && var_pairs.end() != table
+                  && 2 == var_pairs.size(),
+                  "the retire directive takes the parameters 'database'"
+                  " and 'table'");
+        // > fails early on a table we do not know
+        a.getTableMeta(database->second, table->second);
+
+        return new RetireExecutor(database->second, table->second);
+    }
+
     KillZone::Where
     typeWhere(const std::string &untyped_where) const
     {
@@ -1277,16 +1828,56 @@ nextImpl(const ResType &res, const NextParams &nparams)
     assert(false);
 }
 
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+KeywordPruneExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    static const std::string savepoint = "cryptdb_keyword_prune";
+
+    reenter(this->corot) {
+        yield return CR_QUERY_AGAIN(
+            "CALL " + MetaData::Proc::activeTransactionP());
+        TEST_ErrPkt(res.success(),
+                    "failed to determine if there is an active transaction");
+        this->in_trx = handleActiveTransactionPResults(res);
+
+        yield return CR_QUERY_AGAIN(this->in_trx.get()
+                                    ? "SAVEPOINT " + savepoint
+                                    : std::string("START TRANSACTION"));
+        TEST_ErrPkt(res.success(), "failed to begin keyword prune");
+
+        for (this->prune = this->prunes.begin();
+             this->prune != this->prunes.end(); ++this->prune) {
+            yield return CR_QUERY_AGAIN(*this->prune);
+            CR_UNDO_AND_FAIL(res, this->in_trx.get(), savepoint,
+                             "failed to prune keyword index");
+        }
+
+        yield return CR_QUERY_AGAIN(this->query);
+        CR_UNDO_AND_FAIL(res, this->in_trx.get(), savepoint,
+                         "DML query failed against remote database");
+        this->affected_rows = res.affected_rows;
+
+        if (false == this->in_trx.get()) {
+            yield return CR_QUERY_AGAIN("COMMIT");
+            CR_ROLLBACK_AND_FAIL(res, "failed to commit keyword prune");
+        }
+
+        return CR_RESULTS(ResType(true, this->affected_rows, 0));
+    }
+
+    assert(false);
+}
+
 // currently only supports queries that return QUERY_COME_AGAIN
 // > this is an attempt to keep this function simple
 static std::pair<std::string, ReturnMeta>
-rewriteAndGetFirstQuery(const std::string &query, NextParams nparams)
+rewriteAndGetFirstQuery(const std::string &query, const SchemaInfo &schema,
+                        NextParams nparams)
 {
     try {
-        const std::shared_ptr<const SchemaInfo> schema =
-            nparams.ps.getSchemaInfo();
         QueryRewrite delete_rewrite =
-            Rewriter::rewrite(query, *schema.get(), nparams.default_db,
+            Rewriter::rewrite(query, schema, nparams.default_db,
                               nparams.ps);
 
         auto results =
@@ -1307,6 +1898,272 @@ rewriteAndGetFirstQuery(const std::string &query, NextParams nparams)
 #define SPECIALIZED_SYNC(test)                               \
     SYNC_IF_FALSE((test), nparams.ps.getEConn())
 
+// Item -> std::string -> escaped -> quoted; creates a value that can
+// actually be used in an INSERT statement
+static std::string
+itemToNiceString(const Item &item, const std::unique_ptr<Connect> &e_conn)
+{
+    const std::string &s = ItemToString(item);
+    if (Item::Type::STRING_ITEM != item.type()) {
+        return s;
+    }
+
+    return "'" + escapeString(e_conn, s) + "'";
+}
+
+// a comma separated list of parenthesized rows
+static std::string
+itemRowsToValueList(const std::vector<std::vector<Item *> > &rows,
+                    const std::unique_ptr<Connect> &e_conn)
+{
+    std::vector<std::string> esses;
+    for (const auto &row_it : rows) {
+        std::vector<std::string> nice_values;
+        for (const auto &item : row_it) {
+            nice_values.push_back(itemToNiceString(*item, e_conn));
+        }
+        esses.push_back("(" + vector_join(nice_values, ",") + ")");
+    }
+
+    return vector_join(esses, ",");
+}
+
+const OnionMeta &
+SpecialUpdateExecutor::keyOnionMeta() const
+{
+    DatabaseMeta *const dm = this->schema->findChild(this->db_name);
+    TEST_DatabaseNotFound(dm, this->db_name);
+    TableMeta *const tm = dm->findChild(this->plain_table);
+    TEST_IdentifierNotFound(tm, this->plain_table);
+    FieldMeta *const fm = tm->findChild(this->chunk_key);
+    TEST_IdentifierNotFound(fm, this->chunk_key);
+    OnionMeta *const om = fm->getOnionMeta(this->key_onion);
+    TEST_IdentifierNotFound(om, TypeText<onion>::toText(this->key_onion));
+
+    return *om;
+}
+
+// The next page of keys in the order of their oDET ciphertexts; so all
+// of the keys of the table, the WHERE clause is left to the chunk.
+// > the PRIMARY KEY of the backend is on this column
+std::string
+SpecialUpdateExecutor::selectKeyPage() const
+{
+    const std::string &column =
+        "`" + this->keyOnionMeta().getAnonOnionName() + "`";
+    return " SELECT " + column + " FROM " + this->crypted_table +
+           (this->last_key.empty()
+            ? ""
+            : "  WHERE " + column + " > " + this->last_key) +
+           "  ORDER BY " + column +
+           "  LIMIT " + std::to_string(chunk_size) + ";";
+}
+
+// Decrypts the page selectKeyPage() returned into 'page_keys'.
+// > oDET does not take a salt
+void
+SpecialUpdateExecutor::pageKeys(const ResType &res,
+                                const NextParams &nparams)
+{
+    const std::unique_ptr<Connect> &e_conn = nparams.ps.getEConn();
+
+    std::vector<const Item *> ctexts;
+    for (const auto &row : res.rows) {
+        assert(1 == row.size());
+        ctexts.push_back(row.front());
+    }
+    const std::vector<uint64_t> salts(ctexts.size(), 0);
+
+    std::vector<std::string> keys;
+    if (this->pool) {
+        keys = this->pool->decrypt(this->keyOnionMeta(), ctexts, salts);
+    } else {
+        for (const auto &it :
+                decrypt_layers(ctexts, this->keyOnionMeta().getLayers(),
+                               salts)) {
+            keys.push_back(itemToNiceString(*it, e_conn));
+        }
+    }
+    this->page_keys = vector_join(keys, ",");
+
+    // > numbers as they are, ciphertexts as hex
+    const Item &last = *res.rows.back().front();
+    const std::string &value = ItemToString(last);
+    this->chunk_last_key =
+        Item::Type::STRING_ITEM == last.type() ? "X'" + toHex(value) + "'"
+                                               : value;
+}
+
+std::string SpecialUpdateExecutor::
+chunkWhere(const std::string &upper_key) const
+{
+    std::string out = " (" + this->where_clause + ") ";
+    if (this->chunk_key.empty()) {
+        return out;
+    }
+
+    const std::string &key = "`" + this->chunk_key + "`";
+    if (oDET == this->key_onion) {
+        return out + " AND " + key + " IN (" + this->page_keys + ")";
+    }
+    if (false == this->last_key.empty()) {
+        out += " AND " + key + " > " + this->last_key;
+    }
+    if (false == upper_key.empty()) {
+        out += " AND " + key + " <= " + upper_key;
+    }
+
+    return out;
+}
+
+// Rewriter::decryptResults(...) for a chunk, into SQL literals; on the
+// pool if there is one.
+std::vector<std::vector<std::string> >
+SpecialUpdateExecutor::decryptChunk(const ResType &res,
+                                    const NextParams &nparams)
+{
+    const std::unique_ptr<Connect> &e_conn = nparams.ps.getEConn();
+    assert(this->select_rmeta.shared.empty());
+
+    std::vector<std::vector<std::string> > rows(res.rows.size());
+    for (unsigned int c = 0; c < res.names.size(); ++c) {
+        const ReturnField &rf = this->select_rmeta.rfmeta.at(c);
+        if (rf.getIsSalt()) {
+            continue;
+        }
+
+        const FieldMeta *const fm = rf.getOLK().key;
+        std::vector<unsigned int> enc_rows;
+        std::vector<const Item *> enc_items;
+        std::vector<uint64_t> salts;
+        for (unsigned int r = 0; r < res.rows.size(); ++r) {
+            const Item &item = *res.rows[r][c];
+            if (!fm || RiboldMYSQL::is_null(item)) {
+                rows[r].push_back(itemToNiceString(item, e_conn));
+                continue;
+            }
+
+            uint64_t salt = 0;
+            const int salt_pos = rf.getSaltPosition();
+            if (salt_pos >= 0) {
+                const Item_int *const salt_item =
+                    static_cast<Item_int *>(res.rows[r][salt_pos]);
+                assert_s(!salt_item->null_value, "salt item is null");
+                salt = salt_item->value;
+            }
+            enc_rows.push_back(r);
+            enc_items.push_back(&item);
+            salts.push_back(salt);
+            rows[r].push_back("");
+        }
+        if (enc_items.empty()) {
+            continue;
+        }
+
+        const OnionMeta *const om = fm->getOnionMeta(rf.getOLK().o);
+        assert(om);
+        std::vector<std::string> literals;
+        if (this->pool) {
+            literals = this->pool->decrypt(*om, enc_items, salts);
+        } else {
+            for (const auto &it :
+                    decrypt_layers(enc_items, om->getLayers(), salts)) {
+                literals.push_back(itemToNiceString(*it, e_conn));
+            }
+        }
+        for (unsigned int i = 0; i < enc_rows.size(); ++i) {
+            rows[enc_rows[i]].back() = literals[i];
+        }
+    }
+
+    return rows;
+}
+
+// Runs the original query over the chunk in the embedded database and
+// keeps the updated rows for the INSERT.
+// > the embedded database is empty before and after.
+bool SpecialUpdateExecutor::
+updateChunk(const std::vector<std::vector<std::string> > &rows,
+            const NextParams &nparams)
+{
+    const std::unique_ptr<Connect> &e_conn = nparams.ps.getEConn();
+
+    if (false == this->chunk_key.empty()) {
+        AssignOnce<size_t> key_index;
+        size_t index = 0;
+        for (const auto &it : this->select_rmeta.rfmeta) {
+            if (it.second.getIsSalt()) {
+                continue;
+            }
+            if (equalsIgnoreCase(this->chunk_key, it.second.fieldCalled())) {
+                key_index = index;
+            }
+            ++index;
+        }
+        if (oDET == this->key_onion) {
+            std::vector<std::string> keys;
+            for (const auto &it : rows) {
+                keys.push_back(it.at(key_index.get()));
+            }
+            this->chunk_keys = vector_join(keys, ",");
+        } else {
+            this->chunk_last_key = rows.back().at(key_index.get());
+        }
+    }
+
+    std::vector<std::string> values;
+    for (const auto &it : rows) {
+        values.push_back("(" + vector_join(it, ",") + ")");
+    }
+
+    // do the query on the embedded database inside of a transaction so
+    // that we can prevent failure artifacts from populating the embedded
+    // database
+    // > strict mode lets us determine if we have bad values; ie trying
+    //   to insert 256 into a TINYINT UNSIGNED column
+    const std::string &push_q =
+        " INSERT INTO " + this->plain_table +
+        " VALUES " + vector_join(values, ",") + ";";
+    const std::string &select_results_q =
+        " SELECT * FROM " + this->plain_table + ";";
+    std::unique_ptr<DBResult> original_query_dbres;
+    std::unique_ptr<DBResult> dbres;
+    const bool ok =
+        e_conn->execute("START TRANSACTION;")
+        && strictMode(e_conn.get())
+        && e_conn->execute(push_q)
+        && e_conn->execute(nparams.original_query, &original_query_dbres)
+        && e_conn->execute(select_results_q, &dbres);
+    if (false == ok) {
+        this->embedded_error = e_conn->getError();
+        e_conn->execute("ROLLBACK;");
+        e_conn->execute("SET SESSION sql_mode = ''");
+        return false;
+    }
+
+    assert(original_query_dbres && dbres);
+    this->affected_rows += original_query_dbres->unpack().affected_rows;
+    const ResType &interim_res = dbres->unpack();
+    assert(interim_res.success());
+    this->escaped_output_values =
+        itemRowsToValueList(interim_res.rows, e_conn);
+
+    // > this code relies on single threaded access to the database and
+    //   on the fact that the database is cleaned up after every chunk
+    const std::string &cleanup_q = "DELETE FROM " + this->plain_table + ";";
+    const bool cleaned =
+        e_conn->execute("SET SESSION sql_mode = ''")
+        && e_conn->execute(cleanup_q)
+        && e_conn->execute("COMMIT;");
+    if (false == cleaned) {
+        this->embedded_error = e_conn->getError();
+        e_conn->execute("ROLLBACK;");
+        return false;
+    }
+
+    return true;
+}
+
 std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
 SpecialUpdateExecutor::
 nextImpl(const ResType &res, const NextParams &nparams)
@@ -1323,125 +2180,14 @@ nextImpl(const ResType &res, const NextParams &nparams)
     reenter(this->corot) {
         assert(res.success());
 
-        yield {
-            // Retrieve rows from database.
-            const std::string &select_q =
-                " SELECT * FROM " + this->plain_table +
-                " WHERE " + this->where_clause + ";";
-            // Should never cause an onion adjustment
-            const auto &rewritten_select_q =
-                rewriteAndGetFirstQuery(select_q, nparams);
-            this->select_rmeta = rewritten_select_q.second;
-            return CR_QUERY_AGAIN(rewritten_select_q.first);
-        }
-        TEST_ErrPkt(res.success(),
-                    "initial select query in SpecialUpdate failed");
-
-        try {
-            this->dec_res =
-                Rewriter::decryptResults(res, this->select_rmeta.get());
-        } catch (...) {
-            TEST_ErrPkt(res.success(),
-                        "decrypting initial SELECT failed for SpecialUpdate");
-        }
-        assert(this->dec_res.get().success());
-        if (this->dec_res.get().rows.size() == 0) {
-            yield return CR_RESULTS(ResType(true, 0, 0));
-        }
-
-        yield {
-            const auto itemToNiceString =
-                [&nparams] (const Item *const p_item)
-                {
-                    const std::string &s = ItemToString(*p_item);
-
-                    if (Item::Type::STRING_ITEM != p_item->type()) {
-                        return s;
-                    }
-
-                    // escaping and quoting the string creates a value that can
-                    // actually be used in an INSERT statement
-                    return "'" + escapeString(nparams.ps.getEConn(), s) + "'";
-                };
-
-            // We must take these items and convert them into quoted, escaped
-            // strings
-            //  > Item -> std::string -> escaped -> quoted
-            // then we join the results into a single comma seperated values list
-            const auto pItemVectorToNiceValueList =
-                [&itemToNiceString]
-                    (const std::vector<std::vector<Item *> > &vec)
-                {
-                    std::vector<std::string> esses;
-                    for (auto row_it : vec) {
-                        std::vector<std::string> nice_values(row_it.size());
-                        std::transform(row_it.begin(), row_it.end(),
-                                       nice_values.begin(), itemToNiceString);
-                        esses.push_back("("+ vector_join(nice_values, ",") + ")");
-                    }
-
-                    return vector_join(esses, ",");
-                };
-
-            const std::string &values_string =
-                pItemVectorToNiceValueList(dec_res.get().rows);
-
-            // do the query on the embedded database inside of a transaction
-            // so that we can prevent failure artifacts from populating the
-            // embedded database
-            TEST_ErrPkt(nparams.ps.getEConn()->execute("START TRANSACTION;"),
-                        "failed to start transaction");
-
-            // turn on strict mode so we can determine if we have bad values
-            // > ie trying to insert 256 into a TINYINT UNSIGNED column
-            SPECIALIZED_SYNC(strictMode(nparams.ps.getEConn().get()));
-
-            // Push the plaintext rows to the embedded database.
-            const std::string &push_q =
-                " INSERT INTO " + this->plain_table +
-                " VALUES " + values_string + ";";
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(push_q));
-
-            // Run the original (unmodified) query on the data in the embedded
-            // database.
-            std::unique_ptr<DBResult> original_query_dbres;
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(
-                                nparams.original_query, &original_query_dbres));
-            assert(original_query_dbres);
-            // HACK
-            this->original_query_dbres = original_query_dbres.release();
-
-            // strict mode off
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(
-                                "SET SESSION sql_mode = ''"));
-
-            // > Collect the results from the embedded database.
-            // > This code relies on single threaded access to the database
-            //   and on the fact that the database is cleaned up after
-            //   every such operation.
-            std::unique_ptr<DBResult> dbres;
-            const std::string &select_results_q =
-                " SELECT * FROM " + this->plain_table + ";";
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(select_results_q,
-                                                            &dbres));
-            const ResType interim_res = ResType(dbres->unpack());
-            assert(interim_res.success());
-            this->escaped_output_values =
-                pItemVectorToNiceValueList(interim_res.rows);
-
-            // Cleanup the embedded database.
-            const std::string &cleanup_q =
-                "DELETE FROM " + this->plain_table + ";";
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(cleanup_q));
-
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute("COMMIT;"));
-
-            // This query is necessary to propagate a transaction into
-            // INFORMATION_SCHEMA.
-            return CR_QUERY_AGAIN(
-                "SELECT NULL FROM " + this->crypted_table + ";");
-        }
+        // > the chunks are rewritten against this schema; and the pool
+        //   keeps the layers of its onions
+        this->schema = nparams.ps.getSchemaInfo();
 
+        // This query is necessary to propagate a transaction into
+        // INFORMATION_SCHEMA.
+        yield return CR_QUERY_AGAIN(
+            "SELECT NULL FROM " + this->crypted_table + " LIMIT 1;");
         TEST_ErrPkt(res.success(),
             "transaction propagation query failed in SpecialUpdate");
 
@@ -1451,33 +2197,132 @@ nextImpl(const ResType &res, const NextParams &nparams)
                     "failed to determine if we are in a transaction");
         this->in_trx = handleActiveTransactionPResults(res);
 
+        // > the chunks are written back in one transaction
         if (false == this->in_trx.get()) {
             yield return CR_QUERY_AGAIN("START TRANSACTION");
             TEST_ErrPkt(res.success(),
                         "failed to start transaction in SpecialUpdate");
         }
 
-        yield {
-            // DELETE the rows matching the WHERE clause from the database.
-            const std::string &delete_q =
-                " DELETE FROM " + this->plain_table +
-                " WHERE " + this->where_clause + ";";
-            const auto &rewritten_delete_q =
-                rewriteAndGetFirstQuery(delete_q, nparams);
-            return CR_QUERY_AGAIN(rewritten_delete_q.first);
-        }
-        CR_ROLLBACK_AND_FAIL(res, "delete query failed in SpecialUpdate");
+        for (;;) {
+            if (oDET == this->key_onion) {
+                yield return CR_QUERY_AGAIN(this->selectKeyPage());
+                CR_ROLLBACK_AND_FAIL(res,
+                                     "key page query failed in SpecialUpdate");
+                if (res.rows.empty()) {
+                    break;
+                }
+                this->page_rows = res.rows.size();
+            }
 
-        yield {
-            // > Add each row from the embedded database to the data database.
-            const std::string &insert_q =
-                " INSERT INTO " + this->plain_table +
-                " VALUES " + this->escaped_output_values.get() + ";";
-            const auto &rewritten_insert_q =
-                rewriteAndGetFirstQuery(insert_q, nparams);
-            return CR_QUERY_AGAIN(rewritten_insert_q.first);
+            yield {
+                if (oDET == this->key_onion) {
+                    try {
+                        this->pageKeys(res, nparams);
+                    } catch (...) {
+                        this->embedded_error = "failed to decrypt the keys";
+                        return CR_QUERY_AGAIN("ROLLBACK");
+                    }
+                }
+
+                // Retrieve the next chunk of rows from the database.
+                // > should never cause an onion adjustment; see
+                //   specialUpdateChunkKey(...)
+                const std::string &select_q =
+                    " SELECT * FROM " + this->plain_table +
+                    " WHERE " + this->chunkWhere("") +
+                    (this->chunk_key.empty() || oDET == this->key_onion
+                        ? ""
+                        : " ORDER BY `" + this->chunk_key + "`"
+                          " LIMIT " + std::to_string(chunk_size)) + ";";
+                const auto &rewritten_select_q =
+                    rewriteAndGetFirstQuery(select_q, *this->schema,
+                                            nparams);
+                this->select_rmeta = rewritten_select_q.second;
+                return CR_QUERY_AGAIN(rewritten_select_q.first);
+            }
+            if (false == this->embedded_error.empty()) {
+                FAIL_GenericPacketException("SpecialUpdate failed: "
+                                            + this->embedded_error);
+            }
+            CR_ROLLBACK_AND_FAIL(res,
+                                 "chunk select query failed in SpecialUpdate");
+            this->chunk_rows = res.rows.size();
+            if (0 == this->chunk_rows) {
+                // > none of the page's keys matched
+                if (oDET != this->key_onion
+                    || this->page_rows < chunk_size) {
+                    break;
+                }
+                this->last_key = this->chunk_last_key;
+                continue;
+            }
+
+            yield {
+                try {
+                    // > an UPDATE that needs more than one chunk gets the
+                    //   pool for the rest of them
+                    const unsigned int threads =
+                        std::thread::hardware_concurrency();
+                    if (!this->pool && false == this->chunk_key.empty()
+                        && chunk_size == std::max(this->chunk_rows,
+                                                  this->page_rows)
+                        && threads > 1) {
+                        this->pool.reset(
+                            new RotatePool(nparams.ps.getShared(), threads));
+                    }
+
+                    const std::vector<std::vector<std::string> > &rows =
+                        this->decryptChunk(res, nparams);
+                    if (false == this->updateChunk(rows, nparams)) {
+                        return CR_QUERY_AGAIN("ROLLBACK");
+                    }
+                } catch (...) {
+                    this->embedded_error = "failed to process a chunk";
+                    return CR_QUERY_AGAIN("ROLLBACK");
+                }
+
+                // DELETE the rows of the chunk from the database.
+                // > walking the oDET onion, exactly the rows selected
+                const std::string &delete_q =
+                    " DELETE FROM " + this->plain_table +
+                    " WHERE " +
+                    (oDET == this->key_onion
+                        ? " `" + this->chunk_key + "` IN ("
+                          + this->chunk_keys + ")"
+                        : this->chunkWhere(this->chunk_last_key)) + ";";
+                const auto &rewritten_delete_q =
+                    rewriteAndGetFirstQuery(delete_q, *this->schema,
+                                            nparams);
+                return CR_QUERY_AGAIN(rewritten_delete_q.first);
+            }
+            if (false == this->embedded_error.empty()) {
+                FAIL_GenericPacketException("SpecialUpdate failed: "
+                                            + this->embedded_error);
+            }
+            CR_ROLLBACK_AND_FAIL(res, "delete query failed in SpecialUpdate");
+
+            yield {
+                // > Add each updated row of the chunk to the database in
+                //   one multi row INSERT.
+                const std::string &insert_q =
+                    " INSERT INTO " + this->plain_table +
+                    " VALUES " + this->escaped_output_values + ";";
+                const auto &rewritten_insert_q =
+                    rewriteAndGetFirstQuery(insert_q, *this->schema,
+                                            nparams);
+                return CR_QUERY_AGAIN(rewritten_insert_q.first);
+            }
+            CR_ROLLBACK_AND_FAIL(res, "insert query failed in SpecialUpdate");
+
+            if (this->chunk_key.empty()
+                || (oDET == this->key_onion ? this->page_rows
+                                            : this->chunk_rows)
+                   < chunk_size) {
+                break;
+            }
+            this->last_key = this->chunk_last_key;
         }
-        CR_ROLLBACK_AND_FAIL(res, "insert query failed in SpecialUpdate");
 
         if (false == this->in_trx.get()) {
             yield return CR_QUERY_AGAIN("COMMIT");
@@ -1492,7 +2337,7 @@ nextImpl(const ResType &res, const NextParams &nparams)
         crEndBlock
         */
 
-        return CR_RESULTS(this->original_query_dbres.get()->unpack());
+        return CR_RESULTS(ResType(true, this->affected_rows, 0));
     }
 
     assert(false);
@@ -1588,6 +2433,48 @@ getAllShowDirectiveEntries(const std::unique_ptr<Connect> &e_conn,
     return e_conn->execute(query, db_res);
 }
 
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+StatusDirectiveExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield {
+            const auto number = [] (uint64_t n)
+            {
+                return new Item_int(static_cast<longlong>(n));
+            };
+
+            std::vector<std::vector<Item *> > rows;
+            for (const auto &it : PhaseCounters::status()) {
+                std::vector<Item *> row{make_item_string(it.phase),
+                                        make_item_string(it.detail),
+                                        number(it.count), number(it.total)};
+                if (it.percentiles) {
+                    row.push_back(number(it.p50));
+                    row.push_back(number(it.p99));
+                    row.push_back(number(it.max));
+                } else {
+                    for (unsigned int i = 0; i < 3; ++i) {
+                        row.push_back(new Item_null());
+                    }
+                }
+                rows.push_back(row);
+            }
+
+            return CR_RESULTS(ResType(true, 0, 0,
+                {"phase", "detail", "count", "total_ns", "p50_ns", "p99_ns",
+                 "max_ns"},
+                {MYSQL_TYPE_VAR_STRING, MYSQL_TYPE_VAR_STRING,
+                 MYSQL_TYPE_LONGLONG, MYSQL_TYPE_LONGLONG,
+                 MYSQL_TYPE_LONGLONG, MYSQL_TYPE_LONGLONG,
+                 MYSQL_TYPE_LONGLONG},
+                std::move(rows)));
+        }
+    }
+
+    assert(false);
+}
+
 std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
 SensitiveDirectiveExecutor::
 nextImpl(const ResType &res, const NextParams &nparams)
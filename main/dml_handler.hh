@@ -1,10 +1,15 @@
 #pragma once
 
+#include <list>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <main/Analysis.hh>
 #include <main/sql_handler.hh>
 #include <main/dispatcher.hh>
+#include <main/rotate.hh>
 
 #include <sql_lex.h>
 
@@ -21,31 +26,94 @@ private:
     const ReturnMeta rmeta;
 };
 
+// Runs a DELETE, or an UPDATE that gives keyword search columns new
+// values, after it removes the keyword index entries of the rows it
+// picks; the two take effect together or not at all.
+class KeywordPruneExecutor : public AbstractQueryExecutor {
+public:
+    KeywordPruneExecutor(const LEX &lex,
+                         const std::list<std::string> &prunes)
+        : query(lexToQuery(lex)), prunes(prunes), affected_rows(0) {}
+    ~KeywordPruneExecutor() {}
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const std::string query;
+    const std::list<std::string> prunes;
+
+    // coroutine state
+    AssignOnce<bool> in_trx;
+    std::list<std::string>::const_iterator prune;
+    uint64_t affected_rows;
+};
+
+// Runs an UPDATE the rewriter can not do over ciphertext: the matching
+// rows are decrypted, updated by the embedded database and written back
+// re-encrypted.
+// > with a chunk_key, a chunk of rows at a time; so the proxy only ever
+//   holds one chunk.
+// > a key that only has its oDET onion is walked in the order of its
+//   ciphertexts: the proxy pages through the keys, decrypts them and
+//   selects, deletes and inserts the rows of exactly those keys.
+// > once a chunk comes back full, the columns of each chunk are
+//   decrypted on a RotatePool.
 class SpecialUpdateExecutor : public AbstractQueryExecutor {
     const std::string original_query;
+    const std::string db_name;
     const std::string plain_table;
     const std::string crypted_table;
     const std::string where_clause;
+    // empty if the rows must be updated in one chunk
+    const std::string chunk_key;
+    // oDET, or the onion that takes the range predicates on chunk_key
+    const onion key_onion;
 
     // coroutine state
-    AssignOnce<ResType> dec_res;
-    AssignOnce<DBResult *> original_query_dbres;
-    AssignOnce<std::string> escaped_output_values;
-    AssignOnce<ReturnMeta> select_rmeta;
+    std::shared_ptr<const SchemaInfo> schema;
+    std::unique_ptr<RotatePool> pool;
     AssignOnce<bool> in_trx;
+    ReturnMeta select_rmeta;
+    // the key of the last row written back, as a SQL literal; the last
+    // oDET ciphertext of the page, walking those
+    std::string last_key;
+    std::string chunk_last_key;
+    // walking the oDET onion, the keys of the page and those of the rows
+    // of the chunk
+    std::string page_keys;
+    std::string chunk_keys;
+    unsigned int page_rows;
+    unsigned int chunk_rows;
+    std::string escaped_output_values;
+    std::string embedded_error;
+    uint64_t affected_rows;
 
 public:
-    SpecialUpdateExecutor(const std::string &plain_table,
+    SpecialUpdateExecutor(const std::string &db_name,
+                          const std::string &plain_table,
                           const std::string &crypted_table,
-                          const std::string &where_clause)
-        : plain_table(plain_table), crypted_table(crypted_table),
-          where_clause(where_clause) {}
+                          const std::string &where_clause,
+                          const std::string &chunk_key, onion key_onion)
+        : db_name(db_name), plain_table(plain_table),
+          crypted_table(crypted_table), where_clause(where_clause),
+          chunk_key(chunk_key), key_onion(key_onion), page_rows(0),
+          chunk_rows(0), affected_rows(0) {}
     ~SpecialUpdateExecutor() {}
     std::pair<ResultType, AbstractAnything *>
         nextImpl(const ResType &res, const NextParams &nparams);
 
 private:
+    static const unsigned int chunk_size = 512;
+
     bool usesEmbedded() const {return true;}
+    const OnionMeta &keyOnionMeta() const;
+    std::string selectKeyPage() const;
+    void pageKeys(const ResType &res, const NextParams &nparams);
+    std::string chunkWhere(const std::string &upper_key) const;
+    std::vector<std::vector<std::string> >
+        decryptChunk(const ResType &res, const NextParams &nparams);
+    bool updateChunk(const std::vector<std::vector<std::string> > &rows,
+                     const NextParams &nparams);
 };
 
 class ShowDirectiveExecutor : public AbstractQueryExecutor {
@@ -78,6 +146,16 @@ private:
                                std::unique_ptr<DBResult> *db_res);
 };
 
+// answers SET @cryptdb='status' with the live PhaseCounters
+class StatusDirectiveExecutor : public AbstractQueryExecutor {
+public:
+    StatusDirectiveExecutor() {}
+    ~StatusDirectiveExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+};
+
 class SensitiveDirectiveExecutor : public AbstractQueryExecutor {
     const std::vector<std::unique_ptr<Delta> > deltas;
 
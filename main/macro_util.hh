@@ -162,6 +162,30 @@ testDatabaseNotFound(const std::string &file_name,
     }                                                                   \
 }
 
+// > inside the client's transaction only our work since 'savepoint' is
+//   undone; the rest of the transaction is theirs to keep or drop
+#define CR_UNDO_AND_FAIL(res, in_trx, savepoint, msg)                   \
+{                                                                       \
+    if (false == res.success()) {                                       \
+        yield return CR_QUERY_AGAIN(                                    \
+        (in_trx) ? "ROLLBACK TO SAVEPOINT " + std::string(savepoint)    \
+                 : std::string("ROLLBACK"));                            \
+                                                                        \
+        FAIL_GenericPacketException((msg));                             \
+    }                                                                   \
+}
+
+// > the session keeps its table locks until it ends otherwise
+#define CR_UNLOCK_AND_FAIL(res, msg)                                    \
+{                                                                       \
+    if (false == res.success()) {                                       \
+        yield return CR_QUERY_AGAIN("UNLOCK TABLES");                   \
+                                                                        \
+        assert(res.success());                                          \
+        FAIL_GenericPacketException((msg));                             \
+    }                                                                   \
+}
+
 #define ROLLBACK_ERROR_PACKET                                               \
 {                                                                           \
     throw ErrorPacketException(__FILE__, __LINE__, "proxy did rollback",    \
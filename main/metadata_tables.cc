@@ -46,6 +46,13 @@ MetaData::Table::remoteQueryCompletion()
            "remoteQueryCompletion";
 }
 
+std::string
+MetaData::Table::importProgress()
+{
+    return DB::remoteDB() + "." + Internal::getPrefix() +
+           "importProgress";
+}
+
 std::string
 MetaData::Proc::activeTransactionP()
 {
@@ -19,6 +19,8 @@ namespace MetaData {
         std::string staleness();
         std::string showDirective();
         std::string remoteQueryCompletion();
+        // > cryptdbimport creates it
+        std::string importProgress();
     };
 
     namespace Proc {
@@ -0,0 +1,392 @@
+#include <main/phase.hh>
+#include <main/trace.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+__thread PhaseSink *PhaseTimer::sink = NULL;
+__thread PhaseTimer *PhaseTimer::current = NULL;
+
+const char *
+phaseName(Phase p)
+{
+    static const char *const names[phase_count] = {
+        "parse", "gather", "rewrite", "stringify", "backend", "decrypt",
+        "adjust", "layer_encrypt", "layer_decrypt"
+    };
+
+    const unsigned int i = static_cast<unsigned int>(p);
+    assert(i < phase_count);
+    return names[i];
+}
+
+uint64_t
+PhaseTimer::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+PhaseTimer::PhaseTimer(Phase p, unsigned int detail)
+    : phase(p), detail(detail), to(sink), parent(current), start(now()),
+      nested(0)
+{
+    assert(detail < phase_detail_count);
+    current = this;
+}
+
+PhaseTimer::~PhaseTimer()
+{
+    const uint64_t end = now();
+    const uint64_t elapsed = end - start;
+    PhaseCounters::add(phase, detail, elapsed - nested);
+    if (to) {
+        to->record(phase, detail, elapsed - nested);
+    }
+    if (QueryTrace *const trace = QueryTrace::active()) {
+        const std::string &name = phaseDetailName(phase, detail);
+        trace->span(phaseName(phase), start, end,
+                    name.empty() ? NULL : "detail", name);
+    }
+
+    current = parent;
+    if (parent) {
+        parent->nested += elapsed;
+    }
+}
+
+unsigned int
+LatencyHistogram::bucket(uint64_t nsec)
+{
+    if (nsec < 4) {
+        return static_cast<unsigned int>(nsec);
+    }
+
+    // > the top bit picks the power of two, the next two the quarter
+    const unsigned int msb = 63 - __builtin_clzll(nsec);
+    return msb * 4 + static_cast<unsigned int>((nsec >> (msb - 2)) & 3);
+}
+
+uint64_t
+LatencyHistogram::upperBound(unsigned int bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    const unsigned int msb = bucket / 4;
+    const uint64_t quarter = bucket % 4;
+    // > the last bucket ends at 2^64 - 1
+    if (63 == msb && 3 == quarter) {
+        return UINT64_MAX;
+    }
+    return ((4 + quarter + 1) << (msb - 2)) - 1;
+}
+
+LatencyHistogram::LatencyHistogram(const std::vector<uint64_t> &buckets,
+                                   uint64_t sum, uint64_t max)
+    : buckets(buckets), n(0), sum(sum), max(max)
+{
+    assert(bucket_count == buckets.size());
+    for (auto it : buckets) {
+        n += it;
+    }
+}
+
+void
+LatencyHistogram::add(uint64_t nsec)
+{
+    ++buckets[bucket(nsec)];
+    ++n;
+    sum += nsec;
+    if (nsec > max) {
+        max = nsec;
+    }
+}
+
+void
+LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (unsigned int i = 0; i < bucket_count; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    n += other.n;
+    sum += other.sum;
+    if (other.max > max) {
+        max = other.max;
+    }
+}
+
+uint64_t
+LatencyHistogram::percentile(double p) const
+{
+    if (0 == n) {
+        return 0;
+    }
+
+    const uint64_t rank = static_cast<uint64_t>(p / 100.0 * (n - 1)) + 1;
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < bucket_count; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(upperBound(i), max);
+        }
+    }
+
+    return max;
+}
+
+std::vector<std::pair<uint64_t, uint64_t> >
+LatencyHistogram::nonEmpty() const
+{
+    std::vector<std::pair<uint64_t, uint64_t> > out;
+    for (unsigned int i = 0; i < bucket_count; ++i) {
+        if (buckets[i]) {
+            out.push_back(std::make_pair(upperBound(i), buckets[i]));
+        }
+    }
+
+    return out;
+}
+
+namespace {
+
+typedef std::atomic<uint64_t> Counter;
+
+struct PhaseSlot {
+    std::atomic<bool> owned;
+    PhaseSlot *next;
+
+    Counter buckets[phase_count][LatencyHistogram::bucket_count];
+    Counter max[phase_count];
+    Counter count[phase_count][phase_detail_count];
+    Counter nsec[phase_count][phase_detail_count];
+
+    PhaseSlot() : owned(true), next(NULL)
+    {
+        for (unsigned int p = 0; p < phase_count; ++p) {
+            for (auto &it : buckets[p]) it.store(0);
+            max[p].store(0);
+            for (auto &it : count[p]) it.store(0);
+            for (auto &it : nsec[p]) it.store(0);
+        }
+    }
+};
+
+}
+
+// only ever pushed to
+static std::atomic<PhaseSlot *> slots(NULL);
+static __thread PhaseSlot *slot = NULL;
+
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+static void
+releaseSlot(void *const s)
+{
+    static_cast<PhaseSlot *>(s)->owned.store(false,
+                                             std::memory_order_release);
+}
+
+static void
+makeSlotKey()
+{
+    const int rc = pthread_key_create(&slot_key, releaseSlot);
+    assert(0 == rc);
+}
+
+static PhaseSlot *
+claimSlot()
+{
+    PhaseSlot *s = NULL;
+    for (PhaseSlot *it = slots.load(std::memory_order_acquire); it;
+         it = it->next) {
+        bool expected = false;
+        if (it->owned.compare_exchange_strong(expected, true,
+                                              std::memory_order_acquire)) {
+            s = it;
+            break;
+        }
+    }
+
+    if (NULL == s) {
+        s = new PhaseSlot();
+        PhaseSlot *head = slots.load(std::memory_order_relaxed);
+        do {
+            s->next = head;
+        } while (!slots.compare_exchange_weak(head, s,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    pthread_once(&slot_key_once, makeSlotKey);
+    pthread_setspecific(slot_key, s);
+    return s;
+}
+
+// the owner is the only writer; so a plain load and store is enough
+static inline void
+bump(Counter *const c, uint64_t by)
+{
+    c->store(c->load(std::memory_order_relaxed) + by,
+             std::memory_order_relaxed);
+}
+
+void
+PhaseCounters::add(Phase p, unsigned int detail, uint64_t nsec)
+{
+    if (NULL == slot) {
+        slot = claimSlot();
+    }
+
+    const unsigned int i = static_cast<unsigned int>(p);
+    assert(i < phase_count && detail < phase_detail_count);
+    bump(&slot->buckets[i][LatencyHistogram::bucket(nsec)], 1);
+    bump(&slot->count[i][detail], 1);
+    bump(&slot->nsec[i][detail], nsec);
+    if (nsec > slot->max[i].load(std::memory_order_relaxed)) {
+        slot->max[i].store(nsec, std::memory_order_relaxed);
+    }
+}
+
+std::vector<LatencyHistogram>
+PhaseCounters::histograms()
+{
+    std::vector<LatencyHistogram> out;
+    for (unsigned int p = 0; p < phase_count; ++p) {
+        std::vector<uint64_t> buckets(LatencyHistogram::bucket_count, 0);
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        for (const PhaseSlot *s = slots.load(std::memory_order_acquire); s;
+             s = s->next) {
+            for (unsigned int b = 0; b < LatencyHistogram::bucket_count;
+                 ++b) {
+                buckets[b] += s->buckets[p][b].load(std::memory_order_relaxed);
+            }
+            for (const auto &it : s->nsec[p]) {
+                sum += it.load(std::memory_order_relaxed);
+            }
+            max = std::max(max, s->max[p].load(std::memory_order_relaxed));
+        }
+
+        out.push_back(LatencyHistogram(buckets, sum, max));
+    }
+
+    return out;
+}
+
+std::vector<PhaseStatusRow>
+PhaseCounters::status()
+{
+    const std::vector<LatencyHistogram> &phases = histograms();
+
+    std::vector<PhaseStatusRow> out;
+    for (unsigned int p = 0; p < phase_count; ++p) {
+        const Phase phase = static_cast<Phase>(p);
+        const LatencyHistogram &h = phases[p];
+        out.push_back(PhaseStatusRow{phaseName(phase), "", h.count(),
+                                     h.total(), true, h.percentile(50),
+                                     h.percentile(99), h.maximum()});
+
+        for (unsigned int d = 0; d < phase_detail_count; ++d) {
+            uint64_t count = 0;
+            uint64_t nsec = 0;
+            for (const PhaseSlot *s = slots.load(std::memory_order_acquire);
+                 s; s = s->next) {
+                count += s->count[p][d].load(std::memory_order_relaxed);
+                nsec += s->nsec[p][d].load(std::memory_order_relaxed);
+            }
+
+            // > Most slots are never hit; only name those that were, the
+            //   detail namers need not handle every slot index.
+            if (0 == count) {
+                continue;
+            }
+            const std::string &detail = phaseDetailName(phase, d);
+            if (detail.empty()) {
+                continue;
+            }
+            out.push_back(PhaseStatusRow{phaseName(phase), detail, count,
+                                         nsec, false, 0, 0, 0});
+        }
+    }
+
+    return out;
+}
+
+std::string
+PhaseCounters::statusText()
+{
+    std::ostringstream out;
+    out << "phase\tdetail\tcount\ttotal_ns\tp50_ns\tp99_ns\tmax_ns\n";
+    for (const auto &it : status()) {
+        out << it.phase << "\t" << it.detail << "\t" << it.count << "\t"
+            << it.total;
+        if (it.percentiles) {
+            out << "\t" << it.p50 << "\t" << it.p99 << "\t" << it.max;
+        }
+        out << "\n";
+    }
+
+    return out.str();
+}
+
+namespace {
+
+struct DumpTarget {
+    const std::string path;
+    const unsigned int seconds;
+};
+
+}
+
+static void *
+dumpLoop(void *const arg)
+{
+    const std::unique_ptr<DumpTarget> target(static_cast<DumpTarget *>(arg));
+    const std::string &tmp = target->path + ".tmp";
+    for (;;) {
+        sleep(target->seconds);
+
+        // > readers never see a half written file
+        {
+            std::ofstream f(tmp.c_str(), std::ios::trunc);
+            f << "# " << time(NULL) << "\n" << PhaseCounters::statusText();
+            if (!f) {
+                continue;
+            }
+        }
+        rename(tmp.c_str(), target->path.c_str());
+    }
+
+    return NULL;
+}
+
+bool
+PhaseCounters::startDump(const std::string &path, unsigned int seconds)
+{
+    if (path.empty() || 0 == seconds) {
+        return false;
+    }
+
+    DumpTarget *const target = new DumpTarget{path, seconds};
+    pthread_t t;
+    if (0 != pthread_create(&t, NULL, dumpLoop, target)) {
+        delete target;
+        return false;
+    }
+    pthread_detach(t);
+
+    return true;
+}
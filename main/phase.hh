@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// The phases a statement goes through in the proxy.
+enum class Phase : unsigned int {
+    PARSE,          // query_parse(...)
+    GATHER,         // DMLHandler::gather(...)
+    REWRITE,        // handler rewrite, DDL rewrite and metadata update
+    STRINGIFY,      // lexToQuery(...)
+    BACKEND,        // waiting on the remote server
+    DECRYPT,        // Rewriter::decryptResults(...)
+    ADJUST,         // planning an onion adjustment
+    LAYER_ENCRYPT,  // EncLayer::encrypt(...) and encryptBatch(...)
+    LAYER_DECRYPT   // EncLayer::decryptBatch(...)
+};
+
+const unsigned int phase_count = 9;
+
+// A phase can be split by a detail; the handlers use their sql command
+// and the layers their SECLEVEL.
+const unsigned int phase_detail_count = 256;
+
+const char *phaseName(Phase p);
+// defined with the handlers; empty if the phase does not use details
+std::string phaseDetailName(Phase p, unsigned int detail);
+
+// Receives the time a thread spends in each phase.
+class PhaseSink {
+public:
+    virtual ~PhaseSink() {}
+    virtual void record(Phase p, unsigned int detail, uint64_t nsec) = 0;
+};
+
+// Charges the time from construction to destruction to its phase in
+// this thread's counters and sink.
+// > a phase inside another (ie, STRINGIFY inside REWRITE) is charged to
+//   the inner one only.
+// > the cost is two clock reads and a handful of thread private stores.
+// > in a sampled statement each timer is also a QueryTrace span.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase p, unsigned int detail = 0);
+    ~PhaseTimer();
+
+    static void setSink(PhaseSink *s) {sink = s;}
+    static PhaseSink *getSink() {return sink;}
+
+    static uint64_t now();
+
+private:
+    const Phase phase;
+    const unsigned int detail;
+    PhaseSink *const to;
+    PhaseTimer *const parent;
+    const uint64_t start;
+    uint64_t nested;
+
+    static __thread PhaseSink *sink;
+    static __thread PhaseTimer *current;
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+};
+
+// Latencies in buckets of a quarter power of two, so percentiles are
+// within 19% of the truth; enough to compare runs.
+class LatencyHistogram {
+public:
+    LatencyHistogram() : buckets(bucket_count, 0), n(0), sum(0), max(0) {}
+    // rebuild a histogram from bucket counts
+    LatencyHistogram(const std::vector<uint64_t> &buckets, uint64_t sum,
+                     uint64_t max);
+
+    void add(uint64_t nsec);
+    void merge(const LatencyHistogram &other);
+
+    uint64_t count() const {return n;}
+    uint64_t total() const {return sum;}
+    uint64_t maximum() const {return max;}
+    // the upper bound of the bucket holding the p'th percentile
+    uint64_t percentile(double p) const;
+
+    // (upper bound, count) of each non empty bucket
+    std::vector<std::pair<uint64_t, uint64_t> > nonEmpty() const;
+
+    static const unsigned int bucket_count = 64 * 4;
+    static unsigned int bucket(uint64_t nsec);
+    static uint64_t upperBound(unsigned int bucket);
+
+private:
+    std::vector<uint64_t> buckets;
+    uint64_t n;
+    uint64_t sum;
+    uint64_t max;
+};
+
+// One line of the live counters; the phase rows have an empty detail
+// and carry the percentiles, the detail rows only count and time.
+struct PhaseStatusRow {
+    std::string phase;
+    std::string detail;
+    uint64_t count;
+    uint64_t total;
+    bool percentiles;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+};
+
+// The always on counters every PhaseTimer feeds.
+// > each thread owns a slot that only it writes, so recording takes no
+//   lock and no atomic read-modify-write.
+// > readers sum the slots with relaxed loads; a snapshot taken under load
+//   may be a few events behind.
+// > the slot of a finished thread is kept, counts and all, for the next
+//   thread.
+class PhaseCounters {
+public:
+    static void add(Phase p, unsigned int detail, uint64_t nsec);
+
+    static std::vector<LatencyHistogram> histograms();
+    // the phases followed by their used details, in phase order
+    static std::vector<PhaseStatusRow> status();
+    static std::string statusText();
+
+    // rewrite @path with statusText() every @seconds from a background
+    // thread
+    static bool startDump(const std::string &path, unsigned int seconds);
+
+private:
+    PhaseCounters() = delete;
+};
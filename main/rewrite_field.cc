@@ -51,7 +51,7 @@ deductPlainTableName(const std::string &field_name,
         const TableMeta &tm =
             a.getTableMeta(current_table->db,
                            current_table->table_name);
-        if (tm.childExists(IdentityMetaKey(field_name))) {
+        if (tm.findChild(field_name, true)) {
             return std::string(current_table->table_name);
         }
 
@@ -111,6 +111,13 @@ class ANON : public CItemSubtypeIT<Item_field, Item::Type::FIELD_ITEM> {
                 a.getTableMeta(db_name, plain_table_name);
             throw OnionAdjustExcept(tm, fm, constr.o, constr.l);
         }
+        // the onion must hold every value before we can read it
+        if (om.getDeferred()
+            && DeferredOnions::behind(om.getAnonOnionName())) {
+            throw DeferredOnionExcept(plain_table_name, fm, constr.o);
+        }
+        OnionUsage::record(db_name, plain_table_name, i.field_name,
+                           constr.o, constr.l);
 
         bool is_alias;
         const std::string anon_table_name =
@@ -150,6 +157,10 @@ class ANON : public CItemSubtypeIT<Item_field, Item::Type::FIELD_ITEM> {
 
         Item_field *new_field = NULL;
         for (auto it : fm.orderedOnionMetas()) {
+            // > InsertHandler names the columns of the row's packs
+            if (it.second->getPacked()) {
+                continue;
+            }
             const std::string anon_field_name =
                 it.second->getAnonOnionName();
             new_field =
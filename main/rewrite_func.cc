@@ -761,12 +761,108 @@ static CItemBitfunc<str_bit_xor> ANON;
 extern const char str_bit_and[] = "&";
 static CItemBitfunc<str_bit_and> ANON;
 
+// LIKE '%word%' on a column with an oSWP onion looks the word up in the
+// onion's keyword index; as with SWP, only whole words match.
+static bool
+keywordPattern(const Item_func_like &i, std::string *const word)
+{
+    const Item *const *const args = i.arguments();
+    if (Item::Type::FIELD_ITEM != args[0]->type()
+        || Item::Type::STRING_ITEM != args[1]->type()) {
+        return false;
+    }
+
+    const std::string &pattern = ItemToString(*args[1]);
+    // > Search::keywords(...) leaves out words shorter than three letters
+    if (pattern.length() < 5 || '%' != pattern.front()
+        || '%' != pattern.back()) {
+        return false;
+    }
+    *word = pattern.substr(1, pattern.length() - 2);
+
+    return std::string::npos == word->find_first_of(" ,;:.%_\\");
+}
+
+// `salt` IN (SELECT salt FROM keywords_<onion> WHERE keyword = ...); the
+// server looks the keyword up in the index for each row it considers.
+// > the parser can not build a subquery outside of a parse, so the item
+//   prints it.
+class KeywordSearchItem : public Item_bool_func {
+    const std::string index;
+    const std::string keyword;
+
+public:
+    KeywordSearchItem(Item *const salt_field, const std::string &index,
+                      const std::string &keyword)
+        : Item_bool_func(salt_field), index(index), keyword(keyword) {}
+
+    const char *func_name() const {return "keyword_search";}
+    // > only ever printed into a query for the server
+    longlong val_int()
+    {
+        assert(false);
+        return 0;
+    }
+    void print(String *const str, enum_query_type query_type)
+    {
+        const std::string &in =
+            " IN (SELECT salt FROM " + this->index +
+            "      WHERE keyword = X'" + toHex(this->keyword) + "')";
+        str->append('(');
+        this->args[0]->print(str, query_type);
+        str->append(in.data(), in.length());
+        str->append(')');
+    }
+};
+
+static Item *
+rewriteKeywordSearch(const Item_func_like &i, const RewritePlanOneOLK &rp,
+                     Analysis &a)
+{
+    const FieldMeta &fm = *rp.olk.key;
+    const OnionMeta *const om = fm.getOnionMeta(oSWP);
+    assert(om);
+
+    // > throws while the onion, and so its index, is behind
+    const Item_field *const onion_field =
+        static_cast<Item_field *>(
+            itemTypes.do_rewrite(*i.arguments()[0], rp.olk,
+                                 *rp.childr_rp[0].get(), a));
+
+    std::string word;
+    const bool pattern = keywordPattern(i, &word);
+    assert(pattern);
+    const std::string &keyword =
+        static_cast<const Search &>(*om->getLayer(SECLEVEL::SEARCH))
+            .keyword(word);
+
+    return new KeywordSearchItem(
+        make_item_field(*onion_field, onion_field->table_name,
+                        fm.getSaltName()),
+        "`" + a.getDatabaseName() + "`.`" + om->getKeywordIndexName() + "`",
+        keyword);
+}
+
 static class ANON : public CItemSubtypeFT<Item_func_like, Item_func::Functype::LIKE_FUNC> {
     virtual RewritePlan *
     do_gather_type(const Item_func_like &i, Analysis &a) const
     {
         TEST_BadItemArgumentCount(i.type(), 2, i.argument_count());
         const std::string why = "like";
+
+        std::string word;
+        if (keywordPattern(i, &word)) {
+            const std::shared_ptr<RewritePlan>
+                field_rp(gather(*i.arguments()[0], a));
+            const auto &it = field_rp->es_out.osl.find(oSWP);
+            if (field_rp->es_out.osl.end() != it) {
+                const OLK olk(oSWP, it->second.first, it->second.second);
+                const reason rsn(PLAIN_EncSet, why + " keyword", i);
+                return new RewritePlanOneOLK(PLAIN_EncSet, olk, {field_rp},
+                                             rsn);
+            }
+        }
+
         return allPlainIterateGather(i, why, a);
 
 	/*
@@ -824,6 +920,9 @@ static class ANON : public CItemSubtypeFT<Item_func_like, Item_func::Functype::L
     {
         const RewritePlanOneOLK &one_rp =
             static_cast<const RewritePlanOneOLK &>(rp);
+        if (oSWP == one_rp.olk.o) {
+            return rewriteKeywordSearch(i, one_rp, a);
+        }
         return rewrite_args_FN(i, constr, one_rp, a);
 /*	LOG(cdb_v) << "Item_func_like do_rewrite_type " << *i;
 
@@ -9,6 +9,7 @@
 #include <set>
 #include <list>
 #include <algorithm>
+#include <cctype>
 #include <stdio.h>
 #include <typeinfo>
 
@@ -24,6 +25,8 @@
 #include <main/ddl_handler.hh>
 #include <main/metadata_tables.hh>
 #include <main/macro_util.hh>
+#include <main/phase.hh>
+#include <main/trace.hh>
 
 #include "field.h"
 #include <errmsg.h>
@@ -63,6 +66,77 @@ crashTest(const std::string &current_point) {
     }
 }
 
+// FNV-1a with the seed folded into the offset basis
+uint32_t
+CItemFuncNameDir::hash(const char *name, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (; *name; ++name) {
+        h ^= static_cast<unsigned char>(*name);
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+void
+CItemFuncNameDir::reg(const std::string &name, const CItemType &ct)
+{
+    for (const auto &it : names) {
+        if (name == it.first) {
+            thrower() << "duplicate key " << name << std::endl;
+        }
+    }
+
+    names.push_back(std::make_pair(name, &ct));
+    rebuild();
+}
+
+// Tries seeds until every name gets a slot of its own; at a quarter load
+// a few tries do.
+void
+CItemFuncNameDir::rebuild()
+{
+    size_t size = 1;
+    while (size < names.size() * 4) {
+        size *= 2;
+    }
+
+    for (;; size *= 2) {
+        for (uint32_t s = 0; s < 1024; ++s) {
+            slots.assign(size, -1);
+            bool perfect = true;
+            for (size_t i = 0; i < names.size(); ++i) {
+                int &slot = slots[hash(names[i].first.c_str(), s) & (size - 1)];
+                if (-1 != slot) {
+                    perfect = false;
+                    break;
+                }
+                slot = static_cast<int>(i);
+            }
+
+            if (perfect) {
+                seed = s;
+                return;
+            }
+        }
+    }
+}
+
+const CItemType &
+CItemFuncNameDir::lookup(const Item &i) const
+{
+    const char *const name = static_cast<const Item_func &>(i).func_name();
+    const int slot =
+        slots.empty() ? -1 : slots[hash(name, seed) & (slots.size() - 1)];
+    if (-1 == slot || names[slot].first != name) {
+        thrower() << "missing func name " << name << " in " << i
+                  << std::endl;
+    }
+
+    return *names[slot].second;
+}
+
 static inline std::string
 extract_fieldname(Item_field *const i)
 {
@@ -481,7 +555,7 @@ fixDDL(const std::unique_ptr<Connect> &conn,
     }
 }
 
-static bool
+bool
 deltaSanityCheck(const std::unique_ptr<Connect> &conn,
                  const std::unique_ptr<Connect> &e_conn)
 {
@@ -598,11 +672,19 @@ loadSchemaInfo(const std::unique_ptr<Connect> &conn,
     // Must be done before loading the children.
     assert(deltaSanityCheck(conn, e_conn));
 
+    return loadSchemaInfo(conn, e_conn, MetaTableSource(e_conn));
+}
+
+std::unique_ptr<SchemaInfo>
+loadSchemaInfo(const std::unique_ptr<Connect> &conn,
+               const std::unique_ptr<Connect> &e_conn,
+               const MetaSource &source)
+{
     std::unique_ptr<SchemaInfo>schema(new SchemaInfo());
     // Recursively rebuild the AbstractMeta<Whatever> and it's children.
     std::function<DBMeta *(DBMeta *const)> loadChildren =
-        [&loadChildren, &e_conn](DBMeta *const parent) {
-            auto kids = parent->fetchChildren(e_conn);
+        [&loadChildren, &source](DBMeta *const parent) {
+            auto kids = parent->fetchChildren(source);
             for (auto it : kids) {
                 loadChildren(it);
             }
@@ -848,8 +930,30 @@ removeOnionLayer(const Analysis &a, const TableMeta &tm,
 
     std::stringstream query;
     query << " UPDATE " << quoteText(dbname) << "." << anon_table_name
-          << "    SET " << fieldanon  << " = " << *decUDF
-          << ";";
+          << "    SET " << fieldanon  << " = " << *decUDF;
+
+    // > a key rotation peels the same layer off the next column
+    const OnionMeta &om = om_adjustor->getOnionMeta();
+    if (om.getRotating()) {
+        const auto &layers = om.getLayers();
+        const auto &layer_it =
+            std::find_if(layers.begin(), layers.end(),
+                         [&back_el] (const std::unique_ptr<EncLayer> &l)
+                         {return &back_el == l.get();});
+        assert(layers.end() != layer_it);
+        const EncLayer &next_el =
+            *om.getNextLayers().at(layer_it - layers.begin());
+        deltas->push_back(std::unique_ptr<Delta>(
+                            new DeleteDelta(next_el, om)));
+
+        const std::string next_anon = om.getNextOnionName();
+        Item_field *const next_field =
+            new Item_field(NULL, dbname.c_str(), anon_table_name.c_str(),
+                           next_anon.c_str());
+        query << ", " << next_anon << " = "
+              << *next_el.decryptUDF(next_field, salt);
+    }
+    query << ";";
 
     std::cerr << GREEN_BEGIN << "\nADJUST: \n" << COLOR_END << terminalEscape(query.str()) << std::endl;
 
@@ -999,27 +1103,74 @@ do_optimize_const_item(T *i, Analysis &a) {
     */
 }
 
-static Item *
-decrypt_item_layers(const Item &i, const FieldMeta *const fm, onion o,
-                    uint64_t IV)
+// peels the layers off a whole column at a time so that each layer can
+// decrypt all of the values in one call
+std::vector<Item *>
+decrypt_layers(const std::vector<const Item *> &items,
+               const std::vector<std::unique_ptr<EncLayer> > &enc_layers,
+               const std::vector<uint64_t> &IVs)
 {
-    assert(!RiboldMYSQL::is_null(i));
+    assert(items.size() == IVs.size());
 
-    const Item *dec = &i;
-    Item *out_i = NULL;
+    std::vector<const Item *> dec(items);
+    std::vector<Item *> out_items;
 
-    const OnionMeta *const om = fm->getOnionMeta(o);
-    assert(om);
-    const auto &enc_layers = om->getLayers();
+    assert(enc_layers.size() > 0);
     for (auto it = enc_layers.rbegin(); it != enc_layers.rend(); ++it) {
-        out_i = (*it)->decrypt(*dec, IV);
-        assert(out_i);
-        dec = out_i;
+        {
+            const PhaseTimer t(Phase::LAYER_DECRYPT,
+                               static_cast<unsigned int>((*it)->level()));
+            out_items = (*it)->decryptBatch(dec, IVs);
+        }
+        assert(out_items.size() == items.size());
+        dec.assign(out_items.begin(), out_items.end());
         LOG(cdb_v) << "dec okay";
     }
 
-    assert(out_i && out_i != &i);
-    return out_i;
+    return out_items;
+}
+
+// the inverse of decrypt_layers(...)
+std::vector<Item *>
+encrypt_layers(const std::vector<const Item *> &items,
+               const std::vector<std::unique_ptr<EncLayer> > &enc_layers,
+               const std::vector<uint64_t> &IVs)
+{
+    assert(items.size() == IVs.size());
+
+    std::vector<const Item *> enc(items);
+    std::vector<Item *> out_items;
+
+    assert(enc_layers.size() > 0);
+    for (const auto &it : enc_layers) {
+        {
+            const PhaseTimer t(Phase::LAYER_ENCRYPT,
+                               static_cast<unsigned int>(it->level()));
+            out_items = it->encryptBatch(enc, IVs);
+        }
+        assert(out_items.size() == items.size());
+        enc.assign(out_items.begin(), out_items.end());
+    }
+
+    return out_items;
+}
+
+std::vector<Item *>
+decrypt_column_layers(const std::vector<const Item *> &items,
+                      const FieldMeta *const fm, onion o,
+                      const std::vector<uint64_t> &IVs)
+{
+    const OnionMeta *const om = fm->getOnionMeta(o);
+    assert(om);
+
+    return decrypt_layers(items, om->getLayers(), IVs);
+}
+
+static std::vector<Item *>
+encrypt_column_layers(const std::vector<const Item *> &items,
+                      const OnionMeta &om, const std::vector<uint64_t> &IVs)
+{
+    return encrypt_layers(items, om.getLayers(), IVs);
 }
 
 
@@ -1361,6 +1512,192 @@ noRewrite(const LEX &lex) {
     return false;
 }
 
+// The words of a statement, with its backquoted and double quoted names;
+// false when the statement is not one we can read without the parser,
+// ie it has a /*! comment, more than one statement, or an unterminated
+// quote or comment.
+// > single quoted strings are values and are left out.
+// > a user variable is kept as @name; MySQL also takes a quoted name or
+//   whitespace after the '@', so any other '@' ends the fast path.
+static bool
+lexicalTokens(const std::string &q, std::vector<std::string> *const out)
+{
+    const auto is_word = [] (char c) {
+        return isalnum(static_cast<unsigned char>(c)) || '_' == c
+            || '$' == c || static_cast<unsigned char>(c) >= 0x80;
+    };
+
+    bool ended = false;
+    size_t i = 0;
+    while (i < q.size()) {
+        const char c = q[i];
+        if (isspace(static_cast<unsigned char>(c))) {
+            ++i;
+            continue;
+        }
+
+        // comments
+        const bool dashes =
+            0 == q.compare(i, 2, "--")
+            && (i + 2 == q.size()
+                || isspace(static_cast<unsigned char>(q[i + 2])));
+        if ('#' == c || dashes) {
+            const size_t eol = q.find('\n', i);
+            i = std::string::npos == eol ? q.size() : eol + 1;
+            continue;
+        }
+        if (0 == q.compare(i, 2, "/*")) {
+            const size_t close = q.find("*/", i + 2);
+            if (0 == q.compare(i, 3, "/*!") || std::string::npos == close) {
+                return false;
+            }
+            i = close + 2;
+            continue;
+        }
+
+        // > only trailing whitespace and comments after the first ';'
+        if (ended) {
+            return false;
+        }
+        if (';' == c) {
+            ended = true;
+            ++i;
+            continue;
+        }
+
+        if ('\'' == c || '"' == c || '`' == c) {
+            std::string name;
+            size_t j = i + 1;
+            for (;; ++j) {
+                if (j >= q.size()) {
+                    return false;
+                }
+                if ('\\' == q[j] && '`' != c) {
+                    if (++j >= q.size()) {
+                        return false;
+                    }
+                } else if (c == q[j]) {
+                    // > a doubled quote stands for itself
+                    if (j + 1 < q.size() && c == q[j + 1]) {
+                        ++j;
+                    } else {
+                        break;
+                    }
+                }
+                name.push_back(q[j]);
+            }
+            if ('\'' != c) {
+                // > so as not to be taken for a variable
+                if ('@' == name[0]) {
+                    return false;
+                }
+                out->push_back(name);
+            }
+            i = j + 1;
+            continue;
+        }
+
+        if (is_word(c) || '@' == c) {
+            size_t j = i;
+            while (j < q.size() && '@' == q[j]) {
+                ++j;
+            }
+            // > ie, @`cryptdb`, @'cryptdb' or @ cryptdb
+            if (j >= q.size() || false == is_word(q[j])) {
+                return false;
+            }
+            while (j < q.size() && is_word(q[j])) {
+                ++j;
+            }
+            out->push_back(q.substr(i, j - i));
+            i = j;
+            continue;
+        }
+
+        // operators and punctuation
+        ++i;
+    }
+
+    return true;
+}
+
+// Statements that noRewrite(...) or the SET handler would give to a
+// SimpleExecutor anyway, and SELECTs, that name no database or table of
+// the schema and carry no @cryptdb directive; these are forwarded as they
+// are, without query_parse(...) or an Analysis.
+// > keepalives and the chatter of client frameworks are mostly these.
+// > conservative: any word that matches the name of an encrypted database
+//   or table, in any case, sends the statement down the full path; a
+//   column can not be named without its table being in scope.
+bool
+lexicallyPlain(const std::string &q, const SchemaInfo &schema)
+{
+    std::vector<std::string> tokens;
+    if (false == lexicalTokens(q, &tokens) || tokens.empty()) {
+        return false;
+    }
+
+    const auto word = [&tokens] (unsigned int i) {
+        return i < tokens.size() ? toLowerCase(tokens[i]) : std::string();
+    };
+    const std::string &first = word(0);
+    const std::string &second = word(1);
+    const std::string &third = word(2);
+    const unsigned int count = tokens.size();
+
+    bool plain;
+    if ("select" == first || "set" == first) {
+        plain = true;
+    } else if ("begin" == first || "commit" == first
+               || "rollback" == first) {
+        // > ROLLBACK TO SAVEPOINT is not ROLLBACK
+        plain = 1 == count || (2 == count && "work" == second);
+    } else if ("start" == first) {
+        plain = 2 == count && "transaction" == second;
+    } else if ("unlock" == first) {
+        plain = 2 == count && ("tables" == second || "table" == second);
+    } else if ("show" == first) {
+        plain = "databases" == second || "schemas" == second
+             || "variables" == second || "engines" == second
+             || "collation" == second
+             || ("storage" == second && "engines" == third)
+             || (("global" == second || "session" == second)
+                 && "variables" == third);
+    } else {
+        plain = false;
+    }
+    if (false == plain) {
+        return false;
+    }
+
+    for (const auto &it : tokens) {
+        const size_t at = it.find_first_not_of('@');
+        const std::string &name =
+            std::string::npos == at ? "" : it.substr(at);
+        if (1 == at && equalsIgnoreCase("cryptdb", name)) {
+            return false;
+        }
+        // > we do not let the client turn on SQL_SAFE_UPDATES
+        if (equalsIgnoreCase("sql_safe_updates", name)) {
+            return false;
+        }
+        // > variables are not tables
+        if (0 != at) {
+            continue;
+        }
+        if (schema.findChild(it, true)) {
+            return false;
+        }
+        for (const auto &db_it : schema.getChildren()) {
+            if (db_it.second->findChild(it, true)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 const bool Rewriter::translator_dummy = buildTypeTextTranslatorHack();
 const std::unique_ptr<SQLDispatcher> Rewriter::dml_dispatcher =
     std::unique_ptr<SQLDispatcher>(buildDMLDispatcher());
@@ -1368,11 +1705,40 @@ const std::unique_ptr<SQLDispatcher> Rewriter::ddl_dispatcher =
     std::unique_ptr<SQLDispatcher>(buildDDLDispatcher());
 
 // NOTE : This will probably choke on multidatabase queries.
+// Catches up the column whose OPE onion has @layer; NULL when the
+// layer is not in the schema.
+static AbstractQueryExecutor *
+newMOPEExecutor(const Analysis &a, const MOPE_int &layer)
+{
+    for (const auto &db_it : a.getSchema().getChildren()) {
+        for (const auto &table_it : db_it.second->getChildren()) {
+            const TableMeta &tm = *table_it.second.get();
+            for (const auto &field_it : tm.getChildren()) {
+                const FieldMeta &fm = *field_it.second.get();
+                const OnionMeta *const om = fm.getOnionMeta(oOPE);
+                if (NULL == om) {
+                    continue;
+                }
+                for (const auto &it : om->getLayers()) {
+                    if (&layer == it.get()) {
+                        return new MOPEExecutor(db_it.first.getValue(), tm,
+                                                fm, layer);
+                    }
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
 AbstractQueryExecutor *
 Rewriter::dispatchOnLex(Analysis &a, const std::string &query)
 {
+    const TraceSpan span("dispatchOnLex");
     std::unique_ptr<query_parse> p;
     try {
+        const PhaseTimer t(Phase::PARSE);
         p = std::unique_ptr<query_parse>(
                 new query_parse(a.getDatabaseName(), query));
     } catch (const CryptDBError &e) {
@@ -1407,6 +1773,7 @@ Rewriter::dispatchOnLex(Analysis &a, const std::string &query)
             std::cout << GREEN_BEGIN << "Adjusting onion!" << COLOR_END
                       << std::endl;
 
+            const PhaseTimer t(Phase::ADJUST);
             std::pair<std::vector<std::unique_ptr<Delta> >,
                       std::list<std::string> >
                 out_data = adjustOnion(a, e.o, e.tm, e.fm, e.tolevel);
@@ -1415,6 +1782,32 @@ Rewriter::dispatchOnLex(Analysis &a, const std::string &query)
 
             return new OnionAdjustmentExecutor(std::move(deltas),
                                                adjust_queries);
+        } catch (DeferredOnionExcept e) {
+            LOG(cdb_v) << "caught deferred onion";
+            std::cout << GREEN_BEGIN << "Backfilling onion!" << COLOR_END
+                      << std::endl;
+
+            return new BackfillExecutor(a.getDatabaseName(), e.table,
+                {std::make_pair(e.fm.getFieldName(), e.o)}, true);
+        } catch (MOPEExcept e) {
+            LOG(cdb_v) << "caught mOPE tree load";
+            AbstractQueryExecutor *const mope = newMOPEExecutor(a, e.layer);
+            TEST_Text(mope, "the mOPE layer is not in the schema");
+            return mope;
+        }
+
+        // > what this query encrypted before a rebalance moved it is as
+        //   stale as the column
+        while (const MOPE_int *const moved = MOPE_int::anyRelabeled()) {
+            const MOPE_int &layer = *moved;
+            AbstractQueryExecutor *const mope = newMOPEExecutor(a, layer);
+            if (mope) {
+                LOG(cdb_v) << "mOPE rebalance moved ciphertexts";
+                delete executor.get();
+                return mope;
+            }
+            // > the layer belongs to a schema we no longer use
+            layer.takeMoved();
         }
 
         return executor.get();
@@ -1440,6 +1833,11 @@ Rewriter::rewrite(const std::string &q, const SchemaInfo &schema,
     LOG(cdb_v) << "q " << q;
     assert(0 == mysql_thread_init());
 
+    if (lexicallyPlain(q, schema)) {
+        return QueryRewrite(true, ReturnMeta(), KillZone(),
+                            new SimpleExecutor());
+    }
+
     Analysis analysis(default_db, schema, ps.getMasterKey(),
                       ps.defaultSecurityRating());
 
@@ -1471,29 +1869,42 @@ std::string ReturnMeta::stringify() {
     for (auto it : rfmeta) {
         res << it.first << " " << it.second.stringify() << "\n";
     }
+    for (auto it : shared) {
+        res << it.first << " of " << it.second.first << " "
+            << it.second.second.stringify() << "\n";
+    }
     return res.str();
 }
 
 ResType
 Rewriter::decryptResults(const ResType &dbres, const ReturnMeta &rmeta)
 {
+    const PhaseTimer t(Phase::DECRYPT);
     assert(dbres.success());
 
     const unsigned int rows = dbres.rows.size();
     LOG(cdb_v) << "rows in result " << rows << "\n";
     const unsigned int cols = dbres.names.size();
 
-    // un-anonymize the names
-    std::vector<std::string> dec_names;
-    for (auto it = dbres.names.begin();
-        it != dbres.names.end(); it++) {
-        const unsigned int index = it - dbres.names.begin();
-        const ReturnField &rf = rmeta.rfmeta.at(index);
+    // the fields to return, in order, with the column each reads
+    std::vector<std::pair<unsigned int, const ReturnField *> > fields;
+    for (unsigned int c = 0; c < cols; c++) {
+        const ReturnField &rf = rmeta.rfmeta.at(c);
         if (!rf.getIsSalt()) {
-            //need to return this field
-            dec_names.push_back(rf.fieldCalled());
+            fields.push_back(std::make_pair(c, &rf));
         }
     }
+    for (const auto &it : rmeta.shared) {
+        assert(it.first <= fields.size());
+        fields.insert(fields.begin() + it.first,
+                      std::make_pair(it.second.first, &it.second.second));
+    }
+
+    // un-anonymize the names
+    std::vector<std::string> dec_names;
+    for (const auto &it : fields) {
+        dec_names.push_back(it.second->fieldCalled());
+    }
 
     const unsigned int real_cols = dec_names.size();
 
@@ -1504,14 +1915,14 @@ Rewriter::decryptResults(const ResType &dbres, const ReturnMeta &rmeta)
     }
 
     // decrypt rows
-    unsigned int col_index = 0;
-    for (unsigned int c = 0; c < cols; c++) {
-        const ReturnField &rf = rmeta.rfmeta.at(c);
-        if (rf.getIsSalt()) {
-            continue;
-        }
+    for (unsigned int col_index = 0; col_index < real_cols; col_index++) {
+        const unsigned int c = fields[col_index].first;
+        const ReturnField &rf = *fields[col_index].second;
 
         FieldMeta *const fm = rf.getOLK().key;
+        std::vector<unsigned int> enc_rows;
+        std::vector<const Item *> enc_items;
+        std::vector<uint64_t> salts;
         for (unsigned int r = 0; r < rows; r++) {
             if (!fm || dbres.rows[r][c]->is_null()) {
                 dec_rows[r][col_index] = dbres.rows[r][c];
@@ -1525,12 +1936,19 @@ Rewriter::decryptResults(const ResType &dbres, const ReturnMeta &rmeta)
                     salt = salt_item->value;
                 }
 
-                dec_rows[r][col_index] = 
-                    decrypt_item_layers(*dbres.rows[r][c],
-                                        fm, rf.getOLK().o, salt);
+                enc_rows.push_back(r);
+                enc_items.push_back(dbres.rows[r][c]);
+                salts.push_back(salt);
+            }
+        }
+
+        if (enc_items.size() > 0) {
+            const std::vector<Item *> &dec_items =
+                decrypt_column_layers(enc_items, fm, rf.getOLK().o, salts);
+            for (unsigned int i = 0; i < enc_rows.size(); i++) {
+                dec_rows[enc_rows[i]][col_index] = dec_items[i];
             }
         }
-        col_index++;
     }
 
     return ResType(dbres.ok, dbres.affected_rows, dbres.insert_id,
@@ -1569,6 +1987,85 @@ printRes(const ResType &r) {
     }
 }
 
+static std::unique_ptr<ResType>
+backendQuery(const std::unique_ptr<Connect> &conn, const std::string &q)
+{
+    const PhaseTimer t(Phase::BACKEND);
+    std::unique_ptr<DBResult> dbres;
+    if (false == conn->execute(q, &dbres) || !dbres) {
+        return std::unique_ptr<ResType>(new ResType(false, 0, 0));
+    }
+
+    return std::unique_ptr<ResType>(new ResType(dbres->unpack()));
+}
+
+// Mirrors the control flow of mysqlproxy/wrapper.lua so that tools can
+// push queries through CryptDB without a running proxy.
+bool
+executeQuery(ProxyState &ps, const std::string &q,
+             const std::string &default_db,
+             std::unique_ptr<ResType> *const out_res)
+{
+    assert(0 == mysql_thread_init());
+    thread_ps = &ps;
+    ps.safeCreateEmbeddedTHD();
+
+    const std::unique_ptr<QueryTrace> trace(QueryTrace::sample(q));
+    const QueryTrace::Scope trace_scope(trace.get());
+    try {
+        const std::shared_ptr<const SchemaInfo> &schema =
+            ps.getSchemaInfo();
+        const QueryRewrite qr =
+            Rewriter::rewrite(q, *schema.get(), default_db, ps);
+        const NextParams nparams(ps, default_db, q);
+
+        std::unique_ptr<ResType> res(new ResType(true, 0, 0));
+        while (true) {
+            const auto &new_results = qr.executor->next(*res, nparams);
+            const std::unique_ptr<AbstractAnything>
+                output(new_results.second);
+            switch (new_results.first) {
+            case AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN: {
+                const std::string &next_query =
+                    output->extract<std::pair<bool, std::string> >().second;
+                const TraceSpan span("query", "query", next_query);
+                res = backendQuery(ps.getConn(), next_query);
+                break;
+            }
+            case AbstractQueryExecutor::ResultType::QUERY_USE_RESULTS: {
+                const std::string &next_query =
+                    output->extract<std::string>();
+                const TraceSpan span("query", "query", next_query);
+                res = backendQuery(ps.getConn(), next_query);
+                const bool ok = res->ok;
+                if (out_res) {
+                    *out_res = std::move(res);
+                }
+                return ok;
+            }
+            case AbstractQueryExecutor::ResultType::RESULTS: {
+                res.reset(new ResType(output->extract<ResType>()));
+                const bool ok = res->ok;
+                if (out_res) {
+                    *out_res = std::move(res);
+                }
+                return ok;
+            }
+            default:
+                assert(false);
+            }
+        }
+    } catch (const ErrorPacketException &e) {
+        LOG(warn) << "executeQuery: " << e.getMessage();
+    } catch (const AbstractException &e) {
+        LOG(warn) << "executeQuery: " << e.to_string();
+    } catch (const CryptDBError &e) {
+        LOG(warn) << "executeQuery: " << e.msg;
+    }
+
+    return false;
+}
+
 EncLayer &OnionMetaAdjustor::getBackEncLayer() const
 {
     return *duped_layers.back();
@@ -1712,3 +2209,471 @@ nextImpl(const ResType &res, const NextParams &nparams)
     assert(false);
 }
 
+const FieldMeta *
+BackfillExecutor::getFieldMeta(const SchemaInfo &schema,
+                               const TableMeta **const tm_out) const
+{
+    const DatabaseMeta *const dm = schema.findChild(this->db_name);
+    const TableMeta *const tm =
+        dm ? dm->findChild(this->table_name) : NULL;
+    const auto &it = this->onions.at(this->onion_index);
+    const FieldMeta *const fm = tm ? tm->findChild(it.first) : NULL;
+    if (tm_out) {
+        *tm_out = tm;
+    }
+    const OnionMeta *const om = fm ? fm->getOnionMeta(it.second) : NULL;
+    if (NULL == om || false == om->getDeferred()) {
+        return NULL;
+    }
+
+    return fm;
+}
+
+std::string
+BackfillExecutor::deferredName(const NextParams &nparams) const
+{
+    const std::shared_ptr<const SchemaInfo> &schema =
+        nparams.ps.getSchemaInfo();
+    const FieldMeta *const fm = this->getFieldMeta(*schema.get(), NULL);
+    if (NULL == fm) {
+        return "";
+    }
+
+    const onion o = this->onions.at(this->onion_index).second;
+    return fm->getOnionMeta(o)->getAnonOnionName();
+}
+
+// FOR UPDATE makes us wait for the transactions that are still
+// inserting placeholders.
+std::string
+BackfillExecutor::selectPending(const NextParams &nparams) const
+{
+    const std::shared_ptr<const SchemaInfo> &schema =
+        nparams.ps.getSchemaInfo();
+    const TableMeta *tm;
+    const FieldMeta *const fm = this->getFieldMeta(*schema.get(), &tm);
+    if (NULL == fm) {
+        return "";
+    }
+
+    const OnionMeta *const det_om = fm->getOnionMeta(oDET);
+    assert(det_om);
+    const std::string &det_name = det_om->getAnonOnionName();
+    const onion o = this->onions.at(this->onion_index).second;
+    const std::string &deferred_name =
+        fm->getOnionMeta(o)->getAnonOnionName();
+
+    return " SELECT `" + det_name + "`, `" + fm->getSaltName() + "`"
+           "   FROM `" + this->db_name + "`.`" + tm->getAnonTableName()
+           + "`"
+           "  WHERE `" + deferred_name + "` IS NULL"
+           "    AND `" + det_name + "` IS NOT NULL"
+           "  LIMIT " + std::to_string(batch_size) +
+           "    FOR UPDATE;";
+}
+
+// Decrypts the DET onions that selectPending() returned and builds the
+// UPDATE that puts the values into the deferred onion; empty if the
+// onion is gone.
+// > and for an oSWP onion, the INSERT that indexes them by keyword
+std::string
+BackfillExecutor::backfill(const ResType &res, const NextParams &nparams,
+                           std::string *const index_query) const
+{
+    const std::shared_ptr<const SchemaInfo> &schema =
+        nparams.ps.getSchemaInfo();
+    const TableMeta *tm;
+    const FieldMeta *const fm = this->getFieldMeta(*schema.get(), &tm);
+    if (NULL == fm) {
+        return "";
+    }
+    const onion o = this->onions.at(this->onion_index).second;
+    const OnionMeta &om = *fm->getOnionMeta(o);
+
+    std::vector<const Item *> det_items;
+    std::vector<uint64_t> salts;
+    for (const auto &row : res.rows) {
+        assert(2 == row.size());
+        const Item_int *const salt_item = static_cast<Item_int *>(row[1]);
+        assert_s(!salt_item->null_value, "salt item is null");
+
+        det_items.push_back(row[0]);
+        salts.push_back(salt_item->value);
+    }
+
+    const std::vector<Item *> &plain_items =
+        decrypt_column_layers(det_items, fm, oDET, salts);
+    const std::vector<Item *> &enc_items =
+        encrypt_column_layers(std::vector<const Item *>(plain_items.begin(),
+                                                        plain_items.end()),
+                              om, salts);
+    *index_query = oSWP == o
+                   ? this->keywordIndex(om, plain_items, salts, nparams)
+                   : "";
+
+    std::string cases, salt_list;
+    for (unsigned int i = 0; i < enc_items.size(); ++i) {
+        const std::string &salt = std::to_string(salts[i]);
+        const std::string &value = ItemToString(*enc_items[i]);
+        cases += " WHEN " + salt + " THEN " +
+                 (Item::Type::STRING_ITEM == enc_items[i]->type()
+                    ? "'" + escapeString(nparams.ps.getConn(), value) + "'"
+                    : value);
+        salt_list += (0 == i ? "" : ", ") + salt;
+    }
+
+    const std::string &deferred_name = om.getAnonOnionName();
+    const std::string &salt_name = fm->getSaltName();
+    return " UPDATE `" + this->db_name + "`.`" + tm->getAnonTableName()
+           + "`"
+           "    SET `" + deferred_name + "` = CASE `" + salt_name + "`"
+           + cases + " END"
+           "  WHERE `" + deferred_name + "` IS NULL"
+           "    AND `" + salt_name + "` IN (" + salt_list + ");";
+}
+
+std::string
+BackfillExecutor::keywordIndex(const OnionMeta &om,
+                               const std::vector<Item *> &plain_items,
+                               const std::vector<uint64_t> &salts,
+                               const NextParams &nparams) const
+{
+    const Search &search =
+        static_cast<const Search &>(*om.getLayer(SECLEVEL::SEARCH));
+
+    std::string values;
+    for (unsigned int i = 0; i < plain_items.size(); ++i) {
+        const std::string &salt = std::to_string(salts[i]);
+        for (const auto &it : search.keywords(*plain_items[i])) {
+            values += (values.empty() ? "" : ", ") + std::string("('")
+                      + escapeString(nparams.ps.getConn(), it) + "', "
+                      + salt + ")";
+        }
+    }
+    if (values.empty()) {
+        return "";
+    }
+
+    // > rows that share a salt share the keywords
+    return " INSERT IGNORE INTO `" + this->db_name + "`.`"
+           + om.getKeywordIndexName() + "` (keyword, salt)"
+           " VALUES " + values + ";";
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+BackfillExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    static const std::string savepoint = "cryptdb_backfill";
+
+    reenter(this->corot) {
+        yield return CR_QUERY_AGAIN(
+            "CALL " + MetaData::Proc::activeTransactionP());
+        TEST_ErrPkt(res.success(),
+                    "failed to determine if there is an active transasction");
+        this->in_trx = handleActiveTransactionPResults(res);
+
+        for (this->onion_index = 0;
+             this->onion_index < this->onions.size();
+             ++this->onion_index) {
+            this->deferred_name = this->deferredName(nparams);
+            if (this->deferred_name.empty()) {
+                continue;
+            }
+            // values deferred after we begin are left for the next backfill
+            this->mark = DeferredOnions::mark(this->deferred_name);
+            do {
+                this->pending_query = this->selectPending(nparams);
+                // > the onion went away while we yielded
+                if (this->pending_query.empty()) {
+                    break;
+                }
+
+                // > inside the client's transaction, which holds the row
+                //   locks, only a failed batch of ours is undone
+                yield return CR_QUERY_AGAIN(this->in_trx.get()
+                                            ? "SAVEPOINT " + savepoint
+                                            : std::string("START TRANSACTION"));
+                TEST_ErrPkt(res.success(),
+                            "failed to start backfill transaction");
+
+                yield return CR_QUERY_AGAIN(this->pending_query);
+                CR_UNDO_AND_FAIL(res, this->in_trx.get(), savepoint,
+                                 "failed to select values to backfill");
+                this->batch_rows = res.rows.size();
+
+                if (this->batch_rows > 0) {
+                    try {
+                        this->update_query =
+                            this->backfill(res, nparams, &this->index_query);
+                    } catch (...) {
+                        this->update_query.clear();
+                    }
+                    if (this->update_query.empty()) {
+                        yield return CR_QUERY_AGAIN(this->in_trx.get()
+                            ? "ROLLBACK TO SAVEPOINT " + savepoint
+                            : std::string("ROLLBACK"));
+                        FAIL_GenericPacketException(
+                            "failed to encrypt backfill values");
+                    }
+
+                    yield return CR_QUERY_AGAIN(this->update_query);
+                    CR_UNDO_AND_FAIL(res, this->in_trx.get(), savepoint,
+                                     "failed to backfill values");
+                    // else we would select the same rows forever
+                    if (0 == res.affected_rows) {
+                        yield return CR_QUERY_AGAIN(this->in_trx.get()
+                            ? "ROLLBACK TO SAVEPOINT " + savepoint
+                            : std::string("ROLLBACK"));
+                        FAIL_GenericPacketException(
+                            "backfill did not update any rows");
+                    }
+
+                    if (false == this->index_query.empty()) {
+                        yield return CR_QUERY_AGAIN(this->index_query);
+                        CR_UNDO_AND_FAIL(res, this->in_trx.get(), savepoint,
+                                         "failed to index keywords");
+                    }
+                }
+
+                yield return CR_QUERY_AGAIN(this->in_trx.get()
+                                            ? "RELEASE SAVEPOINT " + savepoint
+                                            : std::string("COMMIT"));
+                TEST_ErrPkt(res.success(), "failed to commit backfill");
+            } while (batch_size == this->batch_rows);
+
+            if (false == this->pending_query.empty()) {
+                DeferredOnions::filled(this->deferred_name, this->mark);
+            }
+        }
+
+        if (false == this->reissue) {
+            yield return CR_QUERY_RESULTS("DO 0;");
+        }
+        assert(this->reissue);
+
+        try {
+            this->reissue_query_rewrite = new QueryRewrite(
+                Rewriter::rewrite(
+                    nparams.original_query, *nparams.ps.getSchemaInfo().get(),
+                    nparams.default_db, nparams.ps));
+        } catch (const AbstractException &e) {
+            FAIL_GenericPacketException(e.to_string());
+        } catch (...) {
+            FAIL_GenericPacketException(
+                "unknown error occured while rewriting backfilled query");
+        }
+
+        this->reissue_nparams =
+            NextParams(nparams.ps, nparams.default_db, nparams.original_query);
+        while (true) {
+            yield {
+                auto result =
+                    this->reissue_query_rewrite->executor->next(
+                        first_reissue ? ResType(true, 0, 0)
+                                      : res,
+                        reissue_nparams.get());
+                this->first_reissue = false;
+                return result;
+            }
+        }
+    }
+
+    assert(false);
+}
+
+
+const OnionMeta &
+MOPEExecutor::getOnionMeta() const
+{
+    const OnionMeta *const om = this->fm.getOnionMeta(oOPE);
+    assert(om);
+
+    return *om;
+}
+
+// Only the mOPE layer is left, so the column holds its ciphertexts.
+bool
+MOPEExecutor::exposed() const
+{
+    return &this->layer == this->getOnionMeta().getLayers().back().get();
+}
+
+std::string
+MOPEExecutor::selectColumn() const
+{
+    const std::string &onion_name = this->getOnionMeta().getAnonOnionName();
+
+    return " SELECT `" + onion_name + "`, `" + this->fm.getSaltName() + "`"
+           "   FROM `" + this->db_name + "`.`" + this->anon_table_name + "`"
+           "  WHERE `" + onion_name + "` IS NOT NULL"
+           "    FOR UPDATE;";
+}
+
+// Loads the tree from the rows selectColumn() returned and gives the
+// ciphertexts in the column that the tree has moved.
+// > under RND the layers above are peeled to get at the paths
+std::vector<std::pair<std::string, std::string> >
+MOPEExecutor::load(const ResType &res) const
+{
+    std::vector<const Item *> enc_items;
+    std::vector<uint64_t> salts;
+    for (const auto &row : res.rows) {
+        assert(2 == row.size());
+        const Item_int *const salt_item = static_cast<Item_int *>(row[1]);
+        assert_s(!salt_item->null_value, "salt item is null");
+
+        enc_items.push_back(row[0]);
+        salts.push_back(salt_item->value);
+    }
+
+    // > newMOPEExecutor(...) found the layer in this onion
+    const auto &layers = this->getOnionMeta().getLayers();
+    for (auto it = layers.rbegin(); it->get() != &this->layer; ++it) {
+        const std::vector<Item *> &out =
+            (*it)->decryptBatch(enc_items, salts);
+        enc_items.assign(out.begin(), out.end());
+    }
+
+    std::vector<std::string> ctexts;
+    ctexts.reserve(enc_items.size());
+    for (auto it : enc_items) {
+        ctexts.push_back(ItemToString(*it));
+    }
+    this->layer.load(ctexts);
+
+    std::map<std::string, std::string> stale;
+    if (this->exposed()) {
+        const std::vector<Item *> &plain_items =
+            this->layer.decryptBatch(enc_items, salts);
+        for (unsigned int i = 0; i < ctexts.size(); ++i) {
+            const std::string &now =
+                this->layer.current(RiboldMYSQL::val_uint(*plain_items[i]));
+            if (ctexts[i] != now) {
+                stale[ctexts[i]] = now;
+            }
+        }
+    }
+
+    return std::vector<std::pair<std::string, std::string> >(stale.begin(),
+                                                             stale.end());
+}
+
+// The UPDATE for the next batch of moves.
+// > a ciphertext ends with its value under blowfish, so the new
+//   ciphertext of one value is never the old one of another and the
+//   batches can not undo each other
+std::string
+MOPEExecutor::relabel(const NextParams &nparams) const
+{
+    const unsigned int end =
+        std::min<size_t>(this->moved.size(), this->moved_index + batch_size);
+    std::string cases, from_list;
+    for (unsigned int i = this->moved_index; i < end; ++i) {
+        const std::string &from =
+            "'" + escapeString(nparams.ps.getConn(), this->moved[i].first)
+            + "'";
+        const std::string &to =
+            "'" + escapeString(nparams.ps.getConn(), this->moved[i].second)
+            + "'";
+        cases += " WHEN " + from + " THEN " + to;
+        from_list += (this->moved_index == i ? "" : ", ") + from;
+    }
+
+    const std::string &onion_name = this->getOnionMeta().getAnonOnionName();
+    return " UPDATE `" + this->db_name + "`.`" + this->anon_table_name + "`"
+           "    SET `" + onion_name + "` = CASE `" + onion_name + "`"
+           + cases + " END"
+           "  WHERE `" + onion_name + "` IN (" + from_list + ");";
+}
+
+// > inside the client's transaction the column may yet roll back to
+//   paths the tree no longer has, and what we loaded may hold moves that
+//   are not committed; so the layer is unloaded once the query is
+//   rewritten, and the next query to need it reloads the column
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+MOPEExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield return CR_QUERY_AGAIN(
+            "CALL " + MetaData::Proc::activeTransactionP());
+        TEST_ErrPkt(res.success(),
+                    "failed to determine if there is an active transasction");
+        this->in_trx = handleActiveTransactionPResults(res);
+
+        if (false == this->in_trx.get()) {
+            yield return CR_QUERY_AGAIN("START TRANSACTION");
+            TEST_ErrPkt(res.success(), "failed to start mOPE transaction");
+        }
+
+        if (false == this->layer.loaded()) {
+            yield return CR_QUERY_AGAIN(this->selectColumn());
+            CR_ROLLBACK_AND_FAIL(res, "failed to select the mOPE column");
+
+            try {
+                this->moved = this->load(res);
+            } catch (...) {
+                FAIL_GenericPacketException("failed to load the mOPE tree");
+            }
+        } else {
+            this->moved = this->layer.takeMoved();
+            if (false == this->exposed()) {
+                this->moved.clear();
+            }
+        }
+
+        for (this->moved_index = 0;
+             this->moved_index < this->moved.size();
+             this->moved_index += batch_size) {
+            yield return CR_QUERY_AGAIN(this->relabel(nparams));
+            if (false == res.success()) {
+                // > the column no longer agrees with the tree
+                this->layer.unload();
+            }
+            CR_ROLLBACK_AND_FAIL(res, "failed to move mOPE ciphertexts");
+        }
+
+        if (false == this->in_trx.get()) {
+            yield return CR_QUERY_AGAIN("COMMIT");
+            if (false == res.success()) {
+                this->layer.unload();
+            }
+            TEST_ErrPkt(res.success(), "failed to commit mOPE moves");
+        }
+
+        try {
+            this->reissue_query_rewrite = new QueryRewrite(
+                Rewriter::rewrite(
+                    nparams.original_query, *nparams.ps.getSchemaInfo().get(),
+                    nparams.default_db, nparams.ps));
+        } catch (const AbstractException &e) {
+            this->layer.unload();
+            FAIL_GenericPacketException(e.to_string());
+        } catch (...) {
+            this->layer.unload();
+            FAIL_GenericPacketException(
+                "unknown error occured while rewriting mOPE query");
+        }
+
+        if (true == this->in_trx.get()) {
+            this->layer.unload();
+        }
+
+        this->reissue_nparams =
+            NextParams(nparams.ps, nparams.default_db, nparams.original_query);
+        while (true) {
+            yield {
+                auto result =
+                    this->reissue_query_rewrite->executor->next(
+                        first_reissue ? ResType(true, 0, 0)
+                                      : res,
+                        reissue_nparams.get());
+                this->first_reissue = false;
+                return result;
+            }
+        }
+    }
+
+    assert(false);
+}
@@ -90,6 +90,18 @@ private:
     static const std::unique_ptr<SQLDispatcher> ddl_dispatcher;
 };
 
+// Runs 'q' to completion against the backend, issuing every query the
+// executor asks for; returns false if any part of it failed.
+bool
+executeQuery(ProxyState &ps, const std::string &q,
+             const std::string &default_db,
+             std::unique_ptr<ResType> *const out_res = NULL);
+
+// true when 'q' can be forwarded as is without being parsed; it names
+// nothing in 'schema' and carries no directive.
+bool
+lexicallyPlain(const std::string &q, const SchemaInfo &schema);
+
 #define UNIMPLEMENTED                                               \
     FAIL_TextMessageError(std::string("Unimplemented: ") +          \
                             std::string(__PRETTY_FUNCTION__))
@@ -171,18 +183,8 @@ class CItemSubtype : public CItemType {
 /*
  * Directories for locating an appropriate CItemType for a given Item.
  */
-template <class T>
-class CItemTypeDir : public CItemType {
+class CItemDir : public CItemType {
  public:
-    void reg(T t, const CItemType &ct)
-    {
-        auto x = types.find(t);
-        if (x != types.end()) {
-            thrower() << "duplicate key " << t << std::endl;
-        }
-        types.insert(std::make_pair(t, &ct));
-    }
-
     RewritePlan *do_gather(const Item &i, Analysis &a) const
     {
         return lookup(i).do_gather(i, a);
@@ -207,20 +209,39 @@ class CItemTypeDir : public CItemType {
 
 protected:
     virtual const CItemType &lookup(const Item &i) const = 0;
+};
 
+// Keyed by a MySQL enum; the handlers sit in an array indexed by the
+// enum value, so a lookup is one bounds check and one load.
+template <class T>
+class CItemTypeDir : public CItemDir {
+ public:
+    void reg(T t, const CItemType &ct)
+    {
+        const size_t index = static_cast<size_t>(t);
+        if (index >= types.size()) {
+            types.resize(index + 1, NULL);
+        }
+        if (NULL != types[index]) {
+            thrower() << "duplicate key " << t << std::endl;
+        }
+        types[index] = &ct;
+    }
+
+protected:
     const CItemType &do_lookup(const Item &i, const T &t,
-                               const std::string &errname) const
+                               const char *const errname) const
     {
-        auto x = types.find(t);
-        if (x == types.end()) {
+        const size_t index = static_cast<size_t>(t);
+        if (index >= types.size() || NULL == types[index]) {
             thrower() << "missing " << errname << " " << t << " in "
                       << i << std::endl;
         }
-        return *x->second;
+        return *types[index];
     }
 
  private:
-    std::map<T, const CItemType *const > types;
+    std::vector<const CItemType *> types;
 };
 
 class CItemTypesDir : public CItemTypeDir<Item::Type> {
@@ -266,18 +287,29 @@ public:
 extern CItemSumFuncDir sumFuncTypes;
 
 
-class CItemFuncNameDir : public CItemTypeDir<std::string> {
-    const CItemType &lookup(const Item &i) const
-    {
-        return do_lookup(i, static_cast<const Item_func &>(i).func_name(),
-                         "func name");
-    }
+// Keyed by Item_func::func_name().
+// > every registration rebuilds a perfect hash over the names, so a
+//   lookup hashes the name once and compares it against one entry.
+// > the names register from static constructors, before any lookup.
+class CItemFuncNameDir : public CItemDir {
+    const CItemType &lookup(const Item &i) const;
 
 public:
     CItemFuncNameDir() {
         funcTypes.reg(Item_func::Functype::UNKNOWN_FUNC, *this);
         funcTypes.reg(Item_func::Functype::NOW_FUNC, *this);
     }
+
+    void reg(const std::string &name, const CItemType &ct);
+
+private:
+    std::vector<std::pair<std::string, const CItemType *> > names;
+    // indexes into names; -1 for an empty slot
+    std::vector<int> slots;
+    uint32_t seed;
+
+    static uint32_t hash(const char *name, uint32_t seed);
+    void rebuild();
 };
 
 extern CItemFuncNameDir funcNames;
@@ -310,6 +342,32 @@ public:
 std::unique_ptr<SchemaInfo>
 loadSchemaInfo(const std::unique_ptr<Connect> &conn,
                const std::unique_ptr<Connect> &e_conn);
+// > the caller has run deltaSanityCheck(...)
+std::unique_ptr<SchemaInfo>
+loadSchemaInfo(const std::unique_ptr<Connect> &conn,
+               const std::unique_ptr<Connect> &e_conn,
+               const MetaSource &source);
+// finishes the delta an earlier proxy left unfinished, if any
+bool
+deltaSanityCheck(const std::unique_ptr<Connect> &conn,
+                 const std::unique_ptr<Connect> &e_conn);
+
+// Decrypts a column of onion 'o' of 'fm'; 'IVs' are the rows' salts.
+std::vector<Item *>
+decrypt_column_layers(const std::vector<const Item *> &items,
+                      const FieldMeta *const fm, onion o,
+                      const std::vector<uint64_t> &IVs);
+
+// The same for a column under 'enc_layers', and its inverse; a thread
+// that owns copies of an onion's layers can use these concurrently.
+std::vector<Item *>
+decrypt_layers(const std::vector<const Item *> &items,
+               const std::vector<std::unique_ptr<EncLayer> > &enc_layers,
+               const std::vector<uint64_t> &IVs);
+std::vector<Item *>
+encrypt_layers(const std::vector<const Item *> &items,
+               const std::vector<std::unique_ptr<EncLayer> > &enc_layers,
+               const std::vector<uint64_t> &IVs);
 
 class OnionMetaAdjustor {
 public:
@@ -355,3 +413,98 @@ private:
     bool stales() const {return true;}
     bool usesEmbedded() const {return true;}
 };
+
+// Encrypts the values INSERT deferred (see DeferredOnions) from each
+// row's DET onion, a batch at a time. When @reissue is set the query
+// that needed the onions runs afterwards.
+// > the schema may be reloaded while we yield, so the fields are kept
+//   by name and looked up again after each yield.
+class BackfillExecutor : public AbstractQueryExecutor {
+    const std::string db_name;
+    const std::string table_name;
+    const std::vector<std::pair<std::string, onion> > onions;
+    const bool reissue;
+
+    // coroutine state
+    unsigned int onion_index;
+    std::string deferred_name;
+    uint64_t mark;
+    std::string pending_query;
+    unsigned int batch_rows;
+    std::string update_query;
+    std::string index_query;
+    AssignOnce<bool> in_trx;
+    bool first_reissue;
+    QueryRewrite *reissue_query_rewrite;
+    AssignOnce<NextParams> reissue_nparams;
+
+public:
+    BackfillExecutor(const std::string &db_name,
+                     const std::string &table_name,
+                     const std::vector<std::pair<std::string, onion> >
+                        &onions,
+                     bool reissue)
+        : db_name(db_name), table_name(table_name), onions(onions),
+          reissue(reissue), onion_index(0), mark(0), batch_rows(0),
+          first_reissue(true) {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    static const unsigned int batch_size = 256;
+
+    // NULL once the table, the field or its deferred onion is gone
+    const FieldMeta *getFieldMeta(const SchemaInfo &schema,
+                                  const TableMeta **const tm_out) const;
+    std::string deferredName(const NextParams &nparams) const;
+    std::string selectPending(const NextParams &nparams) const;
+    std::string backfill(const ResType &res, const NextParams &nparams,
+                         std::string *const index_query) const;
+    std::string keywordIndex(const OnionMeta &om,
+                             const std::vector<Item *> &plain_items,
+                             const std::vector<uint64_t> &salts,
+                             const NextParams &nparams) const;
+};
+
+
+// Brings the column of a MOPE_int layer up to date with its tree, then
+// runs the query that needed it. The first time, the tree is loaded from
+// the column's values; after that the ciphertexts that rebalances moved
+// are rewritten, a batch at a time.
+// > while RND is on top the column holds no bare mOPE ciphertexts, so
+//   there is nothing to rewrite; peeling RND reloads the schema and so
+//   the tree.
+class MOPEExecutor : public AbstractQueryExecutor {
+    const std::string db_name;
+    const std::string anon_table_name;
+    const FieldMeta &fm;
+    const MOPE_int &layer;
+
+    // coroutine state
+    AssignOnce<bool> in_trx;
+    std::vector<std::pair<std::string, std::string> > moved;
+    unsigned int moved_index;
+    bool first_reissue;
+    QueryRewrite *reissue_query_rewrite;
+    AssignOnce<NextParams> reissue_nparams;
+
+public:
+    MOPEExecutor(const std::string &db_name, const TableMeta &tm,
+                 const FieldMeta &fm, const MOPE_int &layer)
+        : db_name(db_name), anon_table_name(tm.getAnonTableName()),
+          fm(fm), layer(layer), moved_index(0), first_reissue(true) {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    static const unsigned int batch_size = 256;
+
+    const OnionMeta &getOnionMeta() const;
+    bool exposed() const;
+    std::string selectColumn() const;
+    std::vector<std::pair<std::string, std::string> >
+        load(const ResType &res) const;
+    std::string relabel(const NextParams &nparams) const;
+};
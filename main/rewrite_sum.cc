@@ -310,7 +310,11 @@ static class ANON : public CItemSubtypeIT<Item_null, Item::Type::NULL_ITEM> {
     do_rewrite_insert_type(const Item_null &i, const FieldMeta &fm,
                            Analysis &a, std::vector<Item *> *l) const
     {
-        for (uint j = 0; j < fm.getChildren().size(); ++j) {
+        for (auto it : fm.orderedOnionMetas()) {
+            // > the row's packs are encrypted by encrypt_packs(...)
+            if (it.second->getPacked()) {
+                continue;
+            }
             l->push_back(RiboldMYSQL::clone_item(i));
         }
         if (fm.getHasSalt()) {
@@ -1,11 +1,16 @@
+#include <algorithm>
 #include <memory>
+#include <fstream>
+#include <sstream>
 
 #include <main/rewrite_util.hh>
 #include <main/rewrite_main.hh>
 #include <main/macro_util.hh>
 #include <main/metadata_tables.hh>
 #include <main/schema.hh>
+#include <main/phase.hh>
 #include <parser/lex_util.hh>
+#include <parser/mysql_type_metadata.hh>
 #include <parser/stringify.hh>
 #include <util/enum_text.hh>
 
@@ -243,9 +248,19 @@ rewrite_create_field(const FieldMeta * const fm,
     f->def = NULL;
 
     // create each onion column
+    // > a packed AGG onion is not the field's own column; see
+    //   rewrite_create_packs(...)
     for (auto oit : fm->orderedOnionMetas()) {
         OnionMeta * const om = oit.second;
+        if (om->getPacked()) {
+            continue;
+        }
         Create_field * const new_cf = get_create_field(a, f, *om);
+        // > NULL is the placeholder for a value that has not been
+        //   backfilled
+        if (om->getDeferred()) {
+            new_cf->flags = new_cf->flags & ~NOT_NULL_FLAG;
+        }
 
         output_cfields.push_back(new_cf);
     }
@@ -271,6 +286,87 @@ rewrite_create_field(const FieldMeta * const fm,
     return output_cfields;
 }
 
+std::map<std::string, std::vector<const FieldMeta *> >
+packedAggOnions(const TableMeta &tm)
+{
+    std::map<std::string, std::vector<const FieldMeta *> > packs;
+    for (const auto &it : tm.getChildren()) {
+        const FieldMeta *const fm = it.second.get();
+        const OnionMeta *const om = fm->getOnionMeta(oAGG);
+        if (NULL == om || NULL == om->getPacked()) {
+            continue;
+        }
+
+        std::vector<const FieldMeta *> &pack =
+            packs[om->getAnonOnionName()];
+        const unsigned int slot = om->getPacked()->getSlot();
+        if (pack.size() <= slot) {
+            pack.resize(slot + 1, NULL);
+        }
+        pack[slot] = fm;
+    }
+
+    return packs;
+}
+
+std::vector<Create_field *>
+rewrite_create_packs(const TableMeta &tm,
+                     List<Create_field> &create_list, const Analysis &a)
+{
+    std::vector<Create_field *> output_cfields;
+    for (const auto &it : packedAggOnions(tm)) {
+        const auto &fm_it =
+            std::find_if(it.second.begin(), it.second.end(),
+                         [] (const FieldMeta *const fm) {return NULL != fm;});
+        assert(it.second.end() != fm_it);
+        const FieldMeta &fm = **fm_it;
+
+        // the pack column is modelled on the field in slot 0
+        auto cf_it = List_iterator<Create_field>(create_list);
+        for (;;) {
+            Create_field *const cf = cf_it++;
+            assert(cf);
+            if (equalsIgnoreCase(fm.getFieldName(), cf->field_name)) {
+                output_cfields.push_back(
+                    get_create_field(a, cf, *fm.getOnionMeta(oAGG)));
+                break;
+            }
+        }
+    }
+
+    return output_cfields;
+}
+
+void
+encrypt_packs(const std::map<std::string,
+                             std::vector<const FieldMeta *> > &packs,
+              const std::map<const FieldMeta *, const Item *> &row,
+              std::vector<Item *> *l)
+{
+    for (const auto &it : packs) {
+        const std::vector<const FieldMeta *> &pack = it.second;
+        std::vector<uint64_t> values(pack.size(), 0);
+        const HOMPack *el = NULL;
+        for (unsigned int slot = 0; slot < pack.size(); ++slot) {
+            if (NULL == pack[slot]) {
+                continue;
+            }
+
+            el = pack[slot]->getOnionMeta(oAGG)->getPacked();
+            // > MySQL stores 0 for a NOT NULL column the INSERT leaves
+            //   out or gives NULL
+            const auto &value = row.find(pack[slot]);
+            if (row.end() != value
+                && false == RiboldMYSQL::is_null(*value->second)) {
+                values[slot] = RiboldMYSQL::val_uint(*value->second);
+            }
+        }
+
+        assert(el);
+        l->push_back(el->encryptPack(values));
+    }
+}
+
 std::vector<onion>
 getOnionIndexTypes()
 {
@@ -291,63 +387,162 @@ getOriginalKeyName(const Key &key)
     return out_name;
 }
 
+// The onion a key answers equality on: oDET, or oPLAIN if one of its
+// columns has no oDET onion.
+static onion
+equalityOnion(const Key &key, const TableMeta &tm, const Analysis &a)
+{
+    auto col_it =
+        RiboldMYSQL::constList_iterator<Key_part_spec>(key.columns);
+    for (;;) {
+        const Key_part_spec *const key_part = col_it++;
+        if (NULL == key_part) {
+            return oDET;
+        }
+
+        const FieldMeta &fm =
+            a.getFieldMeta(tm, convert_lex_str(key_part->field_name));
+        if (NULL == fm.getOnionMeta(oDET)) {
+            return oPLAIN;
+        }
+    }
+}
+
+// An index on an onion is only worth maintaining if the workload
+// cryptdblearn recorded searches one of the key's columns on it: oDET
+// for equality, oOPE for range predicates or ORDER BY, oPLAIN for
+// either. A key none of whose columns we have a record of gets its
+// equality onion only; the index directive adds oOPE when the workload
+// needs it. A UNIQUE key always keeps its equality onion, as that is
+// where the backend enforces it.
+static bool
+wantOnionIndex(onion o, const Key &key, const TableMeta &tm,
+               const Preamble &preamble, const Analysis &a)
+{
+    const onion equality = equalityOnion(key, tm, a);
+    if (Key::UNIQUE == key.type && equality == o) {
+        return true;
+    }
+
+    bool recorded = false;
+    auto col_it =
+        RiboldMYSQL::constList_iterator<Key_part_spec>(key.columns);
+    for (;;) {
+        const Key_part_spec *const key_part = col_it++;
+        if (NULL == key_part) {
+            break;
+        }
+
+        OnionLevelMap used;
+        if (false == onionUsageHint(preamble.dbname, preamble.table,
+                                    convert_lex_str(key_part->field_name),
+                                    &used)) {
+            continue;
+        }
+        recorded = true;
+
+        const auto &it = used.find(o);
+        if (used.end() == it) {
+            continue;
+        }
+        if ((oDET == o && it->second <= SECLEVEL::DET)
+            || (oOPE == o && it->second <= SECLEVEL::OPE)
+            || oPLAIN == o) {
+            return true;
+        }
+    }
+
+    return false == recorded && equality == o;
+}
+
+static Key *
+rewrite_key_onion(const TableMeta &tm, const Key &key, onion o,
+                  const Analysis &a)
+{
+    Key *const new_key = key.clone(current_thd->mem_root);
+
+    // Set anonymous name.
+    const std::string new_name =
+        a.getAnonIndexName(tm, getOriginalKeyName(key), o);
+    new_key->name = string_to_lex_str(new_name);
+    new_key->columns.empty();
+
+    // Set anonymous columns.
+    auto col_it =
+        RiboldMYSQL::constList_iterator<Key_part_spec>(key.columns);
+    for (;;) {
+        const Key_part_spec *const key_part = col_it++;
+        if (NULL == key_part) {
+            return new_key;
+        }
+
+        Key_part_spec *const new_key_part = copyWithTHD(key_part);
+        const std::string field_name =
+            convert_lex_str(new_key_part->field_name);
+        // > the onion may not exist; ie oPLAIN with SENSITIVE and not
+        // an AUTO INCREMENT column
+        const FieldMeta &fm = a.getFieldMeta(tm, field_name);
+        const OnionMeta *const om = fm.getOnionMeta(o);
+        if (NULL == om) {
+            return NULL;
+        }
+
+        new_key_part->field_name =
+            string_to_lex_str(om->getAnonOnionName());
+        new_key->columns.push_back(new_key_part);
+    }
+}
+
+// Records the onions it used in 'tm' so that the index can be dropped
+// (or have onions added) later.
 static std::vector<Key *>
-rewrite_key(const TableMeta &tm, const Key &key, const Analysis &a)
+rewrite_key(TableMeta &tm, const Key &key, const Preamble &preamble,
+            const Analysis &a)
 {
     std::vector<Key *> output_keys;
+    OnionIndex index;
+    index.type = key.type;
+    auto col_it =
+        RiboldMYSQL::constList_iterator<Key_part_spec>(key.columns);
+    for (const Key_part_spec *key_part = col_it++; NULL != key_part;
+         key_part = col_it++) {
+        index.columns.push_back(
+            std::make_pair(convert_lex_str(key_part->field_name),
+                           key_part->length));
+    }
 
     const std::vector<onion> key_onions = getOnionIndexTypes();
     for (auto onion_it : key_onions) {
         const onion o = onion_it;
-        Key *const new_key = key.clone(current_thd->mem_root);
-
-        // Set anonymous name.
-        const std::string new_name =
-            a.getAnonIndexName(tm, getOriginalKeyName(key), o);
-        new_key->name = string_to_lex_str(new_name);
-        new_key->columns.empty();
-
-        // Set anonymous columns.
-        auto col_it =
-            RiboldMYSQL::constList_iterator<Key_part_spec>(key.columns);
-        for (;;) {
-            const Key_part_spec *const key_part = col_it++;
-            if (NULL == key_part) {
-                output_keys.push_back(new_key);
-                break;
-            }
-
-            Key_part_spec *const new_key_part = copyWithTHD(key_part);
-            const std::string field_name =
-                convert_lex_str(new_key_part->field_name);
-            // > the onion may not exist; ie oPLAIN with SENSITIVE and not
-            // an AUTO INCREMENT column
-            const FieldMeta &fm = a.getFieldMeta(tm, field_name);
-            const OnionMeta *const om = fm.getOnionMeta(o);
-            if (NULL == om) {
-                break;
-            }
+        // The PRIMARY KEY is the clustered index so we keep putting it
+        // on the first onion available regardless of the workload.
+        if (Key::PRIMARY != key.type
+            && false == wantOnionIndex(o, key, tm, preamble, a)) {
+            continue;
+        }
 
-            new_key_part->field_name =
-                string_to_lex_str(om->getAnonOnionName());
-            new_key->columns.push_back(new_key_part);
+        Key *const new_key = rewrite_key_onion(tm, key, o, a);
+        if (NULL == new_key) {
+            continue;
         }
-    }
+        output_keys.push_back(new_key);
+        index.onions.insert(o);
 
-    // Only create one PRIMARY KEY.
-    if (Key::PRIMARY == key.type) {
-        if (output_keys.size() > 0) {
-            return std::vector<Key *>({output_keys.front()});
+        // Only create one PRIMARY KEY.
+        if (Key::PRIMARY == key.type) {
+            break;
         }
     }
 
+    tm.setOnionIndex(getOriginalKeyName(key), index);
     return output_keys;
 }
 
 // 'seed_lex' and 'out_lex' can be the same object.
 void
-highLevelRewriteKey(const TableMeta &tm, const LEX &seed_lex,
-                    LEX *const out_lex, const Analysis &a)
+highLevelRewriteKey(TableMeta &tm, const LEX &seed_lex,
+                    LEX *const out_lex, const Preamble &preamble,
+                    const Analysis &a)
 {
     assert(out_lex);
 
@@ -356,11 +551,11 @@ highLevelRewriteKey(const TableMeta &tm, const LEX &seed_lex,
         List_iterator<Key>(const_cast<LEX &>(seed_lex).alter_info.key_list);
     out_lex->alter_info.key_list =
         accumList<Key>(key_it,
-            [&tm, &a] (List<Key> out_list, const Key *const key) {
+            [&tm, &preamble, &a] (List<Key> out_list, const Key *const key) {
                 // -----------------------------
                 //         Rewrite INDEX
                 // -----------------------------
-                auto new_keys = rewrite_key(tm, *key, a);
+                auto new_keys = rewrite_key(tm, *key, preamble, a);
                 out_list.concat(vectorToListWithTHD(new_keys));
 
                 return out_list;    /* lambda */
@@ -369,6 +564,17 @@ highLevelRewriteKey(const TableMeta &tm, const LEX &seed_lex,
     return;
 }
 
+std::vector<onion>
+getIndexOnions(const TableMeta &tm, const std::string &index_name)
+{
+    const OnionIndex *const index = tm.getOnionIndex(index_name);
+    if (NULL == index) {
+        return getOnionIndexTypes();
+    }
+
+    return std::vector<onion>(index->onions.begin(), index->onions.end());
+}
+
 std::string
 bool_to_string(bool b)
 {
@@ -416,16 +622,33 @@ createAndRewriteField(Analysis &a, Create_field * const cf,
                       const std::vector<std::tuple<std::vector<std::string>,
                                         Key::Keytype> >
                           &key_data,
-                      List<Create_field> &rewritten_cfield_list)
+                      const Preamble &preamble,
+                      List<Create_field> &rewritten_cfield_list,
+                      const PackedSlot *const packed)
 {
     // we only support the creation of UNSIGNED fields
     cf->flags = cf->flags | UNSIGNED_FLAG;
 
     const std::string &name = std::string(cf->field_name);
+    const bool unique = isUnique(name, key_data);
+    // > the keyword index is created with the table; see
+    //   keywordIndexQueries(...)
+    const bool search = searchColumn(preamble.dbname, preamble.table, *cf);
+    TEST_TextMessageError(new_table || false == search,
+                          "a keyword search column must be created with"
+                          " its table, not added to " + preamble.table);
+    // > PRIMARY and UNIQUE keys can not wait for the backfill
     std::unique_ptr<FieldMeta>
         fm(new FieldMeta(*cf, a.getMasterKey().get(),
                          a.getDefaultSecurityRating(), tm->leaseCount(),
-                         isUnique(name, key_data)));
+                         unique,
+                         onionLayoutHint(preamble.dbname, preamble.table,
+                                         name),
+                         unique ? std::set<onion>() : deferredOnions(),
+                         packed,
+                         mopeColumn(preamble.dbname, preamble.table, *cf),
+                         search,
+                         ffxColumn(preamble.dbname, preamble.table, *cf)));
 
     // -----------------------------
     //         Rewrite FIELD
@@ -467,7 +690,11 @@ encrypt_item_layers(const Item &i, onion o, const OnionMeta &om,
     for (const auto &it : enc_layers) {
         LOG(encl) << "encrypt layer "
                   << TypeText<SECLEVEL>::toText(it->level()) << "\n";
-        new_enc = it->encrypt(*enc, IV);
+        {
+            const PhaseTimer t(Phase::LAYER_ENCRYPT,
+                               static_cast<unsigned int>(it->level()));
+            new_enc = it->encrypt(*enc, IV);
+        }
         assert(new_enc);
         enc = new_enc;
     }
@@ -494,9 +721,21 @@ void
 encrypt_item_all_onions(const Item &i, const FieldMeta &fm,
                         uint64_t IV, Analysis &a, std::vector<Item*> *l)
 {
+    static const std::set<onion> deferred = deferredOnions();
+
     for (auto it : fm.orderedOnionMetas()) {
         const onion o = it.first->getValue();
         OnionMeta * const om = it.second;
+        // > the row's packs are encrypted by encrypt_packs(...)
+        if (om->getPacked()) {
+            continue;
+        }
+        if (om->getDeferred()
+            && (oSWP == o || deferred.end() != deferred.find(o))) {
+            DeferredOnions::deferred(om->getAnonOnionName());
+            l->push_back(new Item_null());
+            continue;
+        }
         l->push_back(encrypt_item_layers(i, o, *om, a, IV));
     }
 }
@@ -637,6 +876,321 @@ determineSecurityRating()
     return SECURITY_RATING::SENSITIVE;
 }
 
+// CRYPTDB_ONION_LAYOUTS names a file written by cryptdblearn; each line
+// restricts one column, and then gives the lowest level the trace used
+// each of its onions at, or '-' if it used none.
+//   <database> <table> <field> <onion>[,<onion>...] [<onion>:<level>[,...]]
+// > a line without the usage is a column we have no record of
+struct OnionLayoutHint {
+    std::set<onion> keep;
+    bool recorded;
+    OnionLevelMap used;
+};
+
+static std::map<OnionUsage::FieldKey, OnionLayoutHint>
+loadOnionLayoutHints()
+{
+    std::map<OnionUsage::FieldKey, OnionLayoutHint> hints;
+    const char *const path = getenv("CRYPTDB_ONION_LAYOUTS");
+    if (NULL == path) {
+        return hints;
+    }
+
+    std::ifstream input(path);
+    TEST_TextMessageError(input.is_open(),
+                          "failed to open onion layout file "
+                          + std::string(path));
+    std::string line;
+    while (std::getline(input, line)) {
+        if (line.empty() || '#' == line[0]) {
+            continue;
+        }
+
+        std::istringstream ss(line);
+        std::string db, table, field, onions, used;
+        TEST_TextMessageError(static_cast<bool>(ss >> db >> table >> field
+                                                   >> onions),
+                              "bad line in onion layout file: " + line);
+        OnionLayoutHint &hint = hints[OnionUsage::FieldKey(db, table, field)];
+        for (const auto &it : split(onions, ",")) {
+            hint.keep.insert(TypeText<onion>::toType(it));
+        }
+
+        hint.recorded = static_cast<bool>(ss >> used);
+        if (false == hint.recorded || "-" == used) {
+            continue;
+        }
+        for (const auto &it : split(used, ",")) {
+            const std::list<std::string> &level = split(it, ":");
+            TEST_TextMessageError(2 == level.size(),
+                                  "bad onion usage in onion layout file: "
+                                  + line);
+            hint.used[TypeText<onion>::toType(level.front())] =
+                TypeText<SECLEVEL>::toType(level.back());
+        }
+    }
+
+    return hints;
+}
+
+static const OnionLayoutHint *
+findOnionLayoutHint(const std::string &db, const std::string &table,
+                    const std::string &field)
+{
+    static const std::map<OnionUsage::FieldKey, OnionLayoutHint> hints =
+        loadOnionLayoutHints();
+
+    const auto &it = hints.find(OnionUsage::FieldKey(db, table, field));
+    if (hints.end() == it) {
+        return NULL;
+    }
+
+    return &it->second;
+}
+
+std::set<onion>
+onionLayoutHint(const std::string &db, const std::string &table,
+                const std::string &field)
+{
+    const OnionLayoutHint *const hint =
+        findOnionLayoutHint(db, table, field);
+    if (NULL == hint) {
+        return std::set<onion>();
+    }
+
+    return hint->keep;
+}
+
+bool
+onionUsageHint(const std::string &db, const std::string &table,
+               const std::string &field, OnionLevelMap *const used)
+{
+    const OnionLayoutHint *const hint =
+        findOnionLayoutHint(db, table, field);
+    if (NULL == hint || false == hint->recorded) {
+        return false;
+    }
+
+    *used = hint->used;
+    return true;
+}
+
+static bool
+isPackable(const Create_field &cf)
+{
+    switch (cf.sql_type) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONG:
+            break;
+        default:
+            return false;
+    }
+
+    // > NULL has no place in a slot
+    // > the server picks AUTO_INCREMENT values, we never see them
+    return (cf.flags & NOT_NULL_FLAG)
+           && false == static_cast<bool>(cf.flags & AUTO_INCREMENT_FLAG);
+}
+
+// CRYPTDB_PACKED_AGG=1 packs the AGG onions of a new table's NOT NULL
+// integer columns of up to 32 bits, HOMPack::slots() to a ciphertext.
+// A 64-bit slot holds the sum of 2^32 such values.
+// > the SUMs of a SELECT over one pack are one cryptdb_agg(...); see
+//   rewrite_proj(...)
+// > a new value for one column means a new ciphertext for the whole
+//   pack, so no UPDATE of a packed column runs on the server alone:
+//   SpecialUpdateExecutor reads every row it matches back through the
+//   proxy and writes it again, a chunk at a time only where
+//   specialUpdateChunkKey(...) finds a key to walk
+std::map<std::string, PackedSlot>
+packedAggSlots(const LEX &lex, const Preamble &preamble)
+{
+    std::map<std::string, PackedSlot> slots;
+    const char *const packed = getenv("CRYPTDB_PACKED_AGG");
+    if (NULL == packed || std::string("1") != packed) {
+        return slots;
+    }
+
+    std::vector<std::string> fields;
+    auto it =
+        RiboldMYSQL::constList_iterator<Create_field>(
+            lex.alter_info.create_list);
+    for (;;) {
+        const Create_field *const cf = it++;
+        if (NULL == cf) {
+            break;
+        }
+
+        const std::string name(cf->field_name);
+        const std::set<onion> &hint =
+            onionLayoutHint(preamble.dbname, preamble.table, name);
+        if (isPackable(*cf)
+            && (hint.empty() || hint.end() != hint.find(oAGG))) {
+            fields.push_back(name);
+        }
+    }
+
+    // > nothing to share
+    if (fields.size() < 2) {
+        return slots;
+    }
+
+    std::string onionname;
+    for (unsigned int i = 0; i < fields.size(); ++i) {
+        const unsigned int slot = i % HOMPack::slots();
+        if (0 == slot) {
+            onionname = getpRandomName() + TypeText<onion>::toText(oAGG);
+        }
+        slots[fields[i]] = PackedSlot{onionname, slot};
+    }
+
+    return slots;
+}
+
+// CRYPTDB_MOPE_COLUMNS lists the columns, ie 'db.t.a,db.t.b', whose OPE
+// onion should be a MOPE_int rather than an OPE_int.
+bool
+mopeColumn(const std::string &db, const std::string &table,
+           const Create_field &cf)
+{
+    const char *const columns = getenv("CRYPTDB_MOPE_COLUMNS");
+    if (NULL == columns) {
+        return false;
+    }
+
+    const std::string name = db + "." + table + "." + cf.field_name;
+    for (const auto &it : split(columns, ",")) {
+        if (name == it) {
+            TEST_TextMessageError(isMySQLTypeNumeric(cf)
+                                  && MYSQL_TYPE_DECIMAL != cf.sql_type
+                                  && MYSQL_TYPE_NEWDECIMAL != cf.sql_type,
+                                  "mOPE only supports integer columns, not "
+                                  + name);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// CRYPTDB_SEARCH_COLUMNS lists the text columns, ie 'db.t.a,db.t.b', that
+// get an oSWP onion with a keyword index.
+bool
+searchColumn(const std::string &db, const std::string &table,
+             const Create_field &cf)
+{
+    const char *const columns = getenv("CRYPTDB_SEARCH_COLUMNS");
+    if (NULL == columns) {
+        return false;
+    }
+
+    const std::string name = db + "." + table + "." + cf.field_name;
+    for (const auto &it : split(columns, ",")) {
+        if (name == it) {
+            TEST_TextMessageError(false == isMySQLTypeNumeric(cf),
+                                  "keyword search only supports text"
+                                  " columns, not " + name);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// CRYPTDB_FFX_COLUMNS lists the short string columns, ie 'db.t.a,db.t.b',
+// whose DET onion is encrypted under FFX rather than AES-CMC; a value is
+// then stored, and indexed, in as many bytes as it has.
+// > FFX gains nothing on the RND layer, which has to pad for the IV
+//   anyway, so only the onion's equality layers change
+// > the limit is in bytes, so a CHAR(4) CHARACTER SET utf8 column
+//   counts as 12
+bool
+ffxColumn(const std::string &db, const std::string &table,
+          const Create_field &cf)
+{
+    const char *const columns = getenv("CRYPTDB_FFX_COLUMNS");
+    if (NULL == columns) {
+        return false;
+    }
+
+    const std::string name = db + "." + table + "." + cf.field_name;
+    for (const auto &it : split(columns, ",")) {
+        if (name == it) {
+            TEST_TextMessageError(MYSQL_TYPE_STRING == cf.sql_type
+                                  || MYSQL_TYPE_VARCHAR == cf.sql_type
+                                  || MYSQL_TYPE_VAR_STRING == cf.sql_type,
+                                  "FFX only supports CHAR and VARCHAR"
+                                  " columns, not " + name);
+            const unsigned long bytes = EncLayerFactory::ffxBytes(cf);
+            TEST_TextMessageError(bytes <= FFX_MAX_BYTES,
+                                  "FFX only supports columns of up to "
+                                  + std::to_string(FFX_MAX_BYTES)
+                                  + " bytes, not " + name + " at "
+                                  + std::to_string(bytes));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Each oSWP onion of the table has a keyword index; a row appears under
+// the keywords of its value, by salt.
+// > the salt stands in for the row: rows that share a salt also share
+//   the value
+std::list<std::string>
+keywordIndexQueries(const std::string &db, const TableMeta &tm,
+                    bool create)
+{
+    std::list<std::string> queries;
+    for (const auto &field_it : tm.getChildren()) {
+        const OnionMeta *const om = field_it.second->getOnionMeta(oSWP);
+        if (NULL == om) {
+            continue;
+        }
+
+        const std::string &table =
+            "`" + db + "`.`" + om->getKeywordIndexName() + "`";
+        if (false == create) {
+            queries.push_back("DROP TABLE IF EXISTS " + table + ";");
+            continue;
+        }
+        queries.push_back(
+            " CREATE TABLE IF NOT EXISTS " + table +
+            "   (keyword VARBINARY(" + std::to_string(Search::keyword_bytes)
+            + ") NOT NULL,"
+            "    salt BIGINT UNSIGNED NOT NULL,"
+            "    PRIMARY KEY (keyword, salt))"
+            " ENGINE=InnoDB;");
+    }
+
+    return queries;
+}
+
+// CRYPTDB_DEFERRED_ONIONS lists the onions INSERT should leave to the
+// backfill, ie 'oADD,oOrder'.
+std::set<onion>
+deferredOnions()
+{
+    std::set<onion> deferred;
+    const char *const onions = getenv("CRYPTDB_DEFERRED_ONIONS");
+    if (NULL == onions) {
+        return deferred;
+    }
+
+    for (const auto &it : split(onions, ",")) {
+        const onion o = TypeText<onion>::toType(it);
+        TEST_TextMessageError(oDET != o && oPLAIN != o,
+                              "the backfill needs " + it + "; it can"
+                              " not be deferred");
+        deferred.insert(o);
+    }
+
+    return deferred;
+}
+
 bool
 handleActiveTransactionPResults(const ResType &res)
 {
@@ -648,3 +1202,47 @@ handleActiveTransactionPResults(const ResType &res)
     return ("1" == trx);
 }
 
+
+static_assert(SQLCOM_END <= phase_detail_count,
+              "the handler phases can not tell every command apart");
+
+std::string
+phaseDetailName(Phase p, unsigned int detail)
+{
+    switch (p) {
+    case Phase::GATHER:
+    case Phase::REWRITE:
+        switch (static_cast<enum_sql_command>(detail)) {
+        case SQLCOM_SELECT:         return "select";
+        case SQLCOM_INSERT:         return "insert";
+        case SQLCOM_REPLACE:        return "replace";
+        case SQLCOM_UPDATE:         return "update";
+        case SQLCOM_DELETE:         return "delete";
+        case SQLCOM_DELETE_MULTI:   return "delete_multi";
+        case SQLCOM_SET_OPTION:     return "set";
+        case SQLCOM_SHOW_TABLES:    return "show_tables";
+        case SQLCOM_CREATE_TABLE:   return "create_table";
+        case SQLCOM_ALTER_TABLE:    return "alter_table";
+        case SQLCOM_DROP_TABLE:     return "drop_table";
+        case SQLCOM_CREATE_DB:      return "create_db";
+        case SQLCOM_CHANGE_DB:      return "change_db";
+        case SQLCOM_DROP_DB:        return "drop_db";
+        case SQLCOM_LOCK_TABLES:    return "lock_tables";
+        case SQLCOM_CREATE_INDEX:   return "create_index";
+        default:
+            return "sqlcom_" + std::to_string(detail);
+        }
+    case Phase::LAYER_ENCRYPT:
+    case Phase::LAYER_DECRYPT:
+        // > TypeText throws on unregistered values; never let a stray
+        //   detail take down the status directive or the dump thread.
+        for (const auto &it : TypeText<SECLEVEL>::allEnum()) {
+            if (static_cast<unsigned int>(it) == detail) {
+                return TypeText<SECLEVEL>::toText(it);
+            }
+        }
+        return "";
+    default:
+        return "";
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <list>
+#include <set>
 #include <string>
 
 #include <main/rewrite_main.hh>
@@ -49,9 +51,32 @@ std::vector<Create_field *>
 rewrite_create_field(const FieldMeta * const fm, Create_field * const f,
                      const Analysis &a);
 
+// The packed AGG onions of 'tm' by column, with their fields in slot
+// order; NULL for a slot that no field ended up using.
+std::map<std::string, std::vector<const FieldMeta *> >
+packedAggOnions(const TableMeta &tm);
+
+// The columns of the packed AGG onions; they follow the fields' own.
+std::vector<Create_field *>
+rewrite_create_packs(const TableMeta &tm,
+                     List<Create_field> &create_list, const Analysis &a);
+
+// One ciphertext per pack for an INSERTed row, in the order of 'packs'.
+void
+encrypt_packs(const std::map<std::string,
+                             std::vector<const FieldMeta *> > &packs,
+              const std::map<const FieldMeta *, const Item *> &row,
+              std::vector<Item *> *l);
+
 void
-highLevelRewriteKey(const TableMeta &tm, const LEX &seed_lex,
-                    LEX *const out_lex, const Analysis &a);
+highLevelRewriteKey(TableMeta &tm, const LEX &seed_lex,
+                    LEX *const out_lex, const Preamble &preamble,
+                    const Analysis &a);
+
+// The onions 'index_name' was built on; every index onion for indexes
+// that predate OnionIndex.
+std::vector<onion>
+getIndexOnions(const TableMeta &tm, const std::string &index_name);
 
 std::string
 bool_to_string(bool b);
@@ -64,7 +89,9 @@ createAndRewriteField(Analysis &a, Create_field * const cf,
                       const std::vector<std::tuple<std::vector<std::string>,
                                         Key::Keytype> >
                           &key_data,
-                      List<Create_field> &rewritten_cfield_list);
+                      const Preamble &preamble,
+                      List<Create_field> &rewritten_cfield_list,
+                      const PackedSlot *const packed = NULL);
 
 Item *
 encrypt_item_layers(const Item &i, onion o, const OnionMeta &om,
@@ -122,8 +149,11 @@ process_select_lex(const st_select_lex &select_lex, Analysis &a);
 void
 process_table_list(const List<TABLE_LIST> &tll, Analysis &a);
 
+// @merge_packed_sums: the SUMs over one packed AGG onion may share a
+// column of the result; see rewrite_proj(...).
 st_select_lex *
-rewrite_select_lex(const st_select_lex &select_lex, Analysis &a);
+rewrite_select_lex(const st_select_lex &select_lex, Analysis &a,
+                   bool merge_packed_sums = false);
 
 std::string
 getDefaultDatabaseForConnection(const std::unique_ptr<Connect> &c);
@@ -141,6 +171,49 @@ prettyPrintQuery(const std::string &query);
 SECURITY_RATING
 determineSecurityRating();
 
+// The onions cryptdblearn decided a column needs; empty when the
+// column has no hint and should get its full layout.
+std::set<onion>
+onionLayoutHint(const std::string &db, const std::string &table,
+                const std::string &field);
+
+// The lowest level the trace cryptdblearn ran used each onion of a column
+// at; false if we have no record of the column.
+bool
+onionUsageHint(const std::string &db, const std::string &table,
+               const std::string &field, OnionLevelMap *const used);
+
+// Where the AGG onion of each column of a new table goes, by field
+// name; columns that are not packed are left out.
+std::map<std::string, PackedSlot>
+packedAggSlots(const LEX &lex, const Preamble &preamble);
+
+// The column's OPE onion keeps its values in a tree; see MOPE_int.
+bool
+mopeColumn(const std::string &db, const std::string &table,
+           const Create_field &cf);
+
+// The column gets an oSWP onion with a keyword index.
+bool
+searchColumn(const std::string &db, const std::string &table,
+             const Create_field &cf);
+
+// The DET and DETJOIN layers of the column keep the length of its values;
+// see DET_ffx.
+bool
+ffxColumn(const std::string &db, const std::string &table,
+          const Create_field &cf);
+
+// CREATE (or DROP) the keyword indexes of the table's oSWP onions.
+std::list<std::string>
+keywordIndexQueries(const std::string &db, const TableMeta &tm,
+                    bool create);
+
+// The onions INSERT leaves NULL for a backfill to encrypt; only applies
+// to onions created while they were listed.
+std::set<onion>
+deferredOnions();
+
 bool
 handleActiveTransactionPResults(const ResType &res);
 
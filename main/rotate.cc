@@ -0,0 +1,1383 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include <main/rotate.hh>
+#include <main/rewrite_main.hh>
+#include <main/rewrite_util.hh>
+#include <main/CryptoHandlers.hh>
+#include <main/macro_util.hh>
+#include <main/metadata_tables.hh>
+#include <main/phase.hh>
+#include <parser/embedmysql.hh>
+#include <parser/lex_util.hh>
+#include <parser/sql_utils.hh>
+#include <parser/stringify.hh>
+#include <util/yield.hpp>
+
+/*
+ * Helpers
+ */
+
+// Calls 'fn' with the definition the embedded database has for each
+// field of the table.
+// > the Create_fields live on the THD of the parse, so only as long as
+//   the call
+static void
+withCreateFields(const std::unique_ptr<Connect> &e_conn,
+                 const std::string &db, const std::string &table,
+                 std::function<void(const Create_field &)> fn)
+{
+    std::unique_ptr<DBResult> dbres;
+    TEST_TextMessageError(e_conn->execute("SHOW CREATE TABLE `" + db
+                                          + "`.`" + table + "`;", &dbres),
+                          "failed to read the definition of " + table);
+    const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+    TEST_TextMessageError(row && row[1],
+                          "no definition for " + table);
+    const unsigned long *const lengths = mysql_fetch_lengths(dbres->n);
+    const std::string create(row[1], lengths[1]);
+
+    {
+        query_parse p(db, create);
+        auto cf_it =
+            List_iterator<Create_field>(p.lex()->alter_info.create_list);
+        for (const Create_field *cf = cf_it++; cf; cf = cf_it++) {
+            fn(*cf);
+        }
+    }
+
+    // > the parse took the THD of the query with it
+    assert(thread_ps);
+    thread_ps->safeCreateEmbeddedTHD();
+}
+
+// The column get_create_field(...) would build for an onion named
+// 'onionname' under 'layers'.
+static std::string
+onionColumn(const Create_field &cf,
+            const std::vector<std::unique_ptr<EncLayer> > &layers,
+            const std::string &onionname, bool not_null)
+{
+    // Default value is handled during INSERTion.
+    Create_field seed(cf);
+    seed.def = NULL;
+
+    const Create_field *new_cf = &seed;
+    for (const auto &it : layers) {
+        new_cf = it->newCreateField(*new_cf, onionname);
+    }
+
+    Create_field column(*new_cf);
+    column.flags &= ~(NOT_NULL_FLAG | AUTO_INCREMENT_FLAG);
+    if (not_null) {
+        column.flags |= NOT_NULL_FLAG;
+    }
+
+    std::ostringstream out;
+    out << column;
+    return out.str();
+}
+
+// > an FFX onion stays one under its new keys
+static bool
+hasFFX(const std::vector<std::unique_ptr<EncLayer> > &layers)
+{
+    for (const auto &it : layers) {
+        if (EncLayerFactory::isFFX(*it)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static std::vector<SECLEVEL>
+layerLevels(const std::vector<std::unique_ptr<EncLayer> > &layers)
+{
+    std::vector<SECLEVEL> levels;
+    for (const auto &it : layers) {
+        levels.push_back(it->level());
+    }
+
+    return levels;
+}
+
+// > a layer's state is not safe to share between threads
+static std::vector<std::unique_ptr<EncLayer> >
+copyLayers(const OnionMeta &om,
+           const std::vector<std::unique_ptr<EncLayer> > &layers)
+{
+    std::vector<std::unique_ptr<EncLayer> > out;
+    for (const auto &it : layers) {
+        std::unique_ptr<EncLayer>
+            layer(EncLayerFactory::deserializeLayer(it->getDatabaseID(),
+                                                    it->serialize(om)));
+        layer->sealKey();
+        out.push_back(std::move(layer));
+    }
+
+    return out;
+}
+
+static std::string
+sqlLiteral(const Item &item, const std::unique_ptr<Connect> &conn)
+{
+    const std::string &value = ItemToString(item);
+    return Item::Type::STRING_ITEM == item.type()
+           ? "'" + escapeString(conn, value) + "'"
+           : value;
+}
+
+// Runs 'fn' and returns the message of the error it threw, if any; so
+// that a coroutine can clean up the backend before it fails.
+static std::string
+failureOf(std::function<void()> fn)
+{
+    try {
+        fn();
+    } catch (const AbstractException &e) {
+        return e.to_string();
+    } catch (const CryptDBError &e) {
+        return e.msg;
+    }
+
+    return "";
+}
+
+// The key of a row from its columns 'first' on; numbers as they are,
+// ciphertexts as hex.
+static std::string
+rowKey(const std::vector<Item *> &row, unsigned int first)
+{
+    std::string key;
+    for (unsigned int i = first; i < row.size(); ++i) {
+        const std::string &value = ItemToString(*row[i]);
+        key += std::string(first == i ? "" : ", ")
+               + (Item::Type::STRING_ITEM == row[i]->type()
+                  ? "X'" + toHex(value) + "'" : value);
+    }
+
+    return key;
+}
+
+// The columns of the 'o' index of 'index', with the shadow in 'renamed'
+// for each column that has one; '*covers' tells if one did.
+static std::string
+indexColumns(const TableMeta &tm, const std::string &index_name,
+             const OnionIndex &index, onion o,
+             const std::map<std::string, std::string> &renamed,
+             bool *const covers)
+{
+    *covers = false;
+    std::string columns;
+    for (const auto &col : index.columns) {
+        const FieldMeta *const fm = tm.findChild(col.first);
+        const OnionMeta *const om = fm ? fm->getOnionMeta(o) : NULL;
+        TEST_Text(NULL != om, "the index " + index_name
+                              + " is on a missing onion");
+        const auto &shadow = renamed.find(om->getAnonOnionName());
+        *covers = *covers || renamed.end() != shadow;
+        columns += std::string(columns.empty() ? "" : ", ") + "`"
+                   + (renamed.end() == shadow
+                      ? om->getAnonOnionName() : shadow->second)
+                   + "`";
+        if (0 != col.second) {
+            columns += "(" + std::to_string(col.second) + ")";
+        }
+    }
+
+    return columns;
+}
+
+// The name of the index a rotation builds on the shadows; it takes the
+// place of TableMeta::getAnonIndexName(...) once the onions move.
+// > the shadows' names make it differ from the index it replaces
+static std::string
+shadowIndexName(const TableMeta &tm, const std::string &index_name,
+                onion o, const std::string &columns)
+{
+    const std::string hash_input =
+        tm.getAnonTableName() + index_name + TypeText<onion>::toText(o)
+        + columns;
+    const std::size_t hsh = std::hash<std::string>()(hash_input);
+
+    return "index_" + std::to_string(hsh);
+}
+
+/*
+ * RotatePool
+ */
+
+// > ProxyState is not safe to build concurrently, so the caller builds
+//   the workers' states
+RotatePool::RotatePool(const SharedProxyState &shared,
+                       unsigned int threads)
+    : thread_count(threads), om(NULL), reading(NULL), onion_serial(0),
+      batch_serial(0), ctexts(NULL), salts(NULL), literals(NULL),
+      pending(0), closed(false)
+{
+    assert(threads > 0);
+    for (unsigned int i = 0; i < threads; ++i) {
+        this->states.push_back(
+            std::unique_ptr<ProxyState>(new ProxyState(shared)));
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        this->threads.push_back(std::thread(&RotatePool::work, this, i));
+    }
+}
+
+RotatePool::~RotatePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->closed = true;
+    }
+    this->changed.notify_all();
+
+    for (auto &it : this->threads) {
+        it.join();
+    }
+}
+
+void
+RotatePool::setOnion(const OnionMeta &om)
+{
+    assert(om.getRotating());
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->om = &om;
+    ++this->onion_serial;
+}
+
+std::vector<std::string>
+RotatePool::reencrypt(const std::vector<const Item *> &ctexts,
+                      const std::vector<uint64_t> &salts)
+{
+    return this->run(NULL, ctexts, salts);
+}
+
+std::vector<std::string>
+RotatePool::decrypt(const OnionMeta &om,
+                    const std::vector<const Item *> &ctexts,
+                    const std::vector<uint64_t> &salts)
+{
+    return this->run(&om, ctexts, salts);
+}
+
+std::vector<std::string>
+RotatePool::run(const OnionMeta *reading,
+                const std::vector<const Item *> &ctexts,
+                const std::vector<uint64_t> &salts)
+{
+    assert(ctexts.size() == salts.size());
+
+    std::vector<std::string> literals(ctexts.size());
+    std::unique_lock<std::mutex> lock(this->mutex);
+    assert(reading || this->om);
+    this->reading = reading;
+    this->ctexts = &ctexts;
+    this->salts = &salts;
+    this->literals = &literals;
+    this->pending = this->thread_count;
+    this->error = "";
+    ++this->batch_serial;
+    this->changed.notify_all();
+
+    this->changed.wait(lock, [this] () {return 0 == this->pending;});
+    TEST_TextMessageError(this->error.empty(),
+                          std::string(reading ? "failed to decrypt: "
+                                              : "failed to re-encrypt: ")
+                          + this->error);
+
+    return literals;
+}
+
+void
+RotatePool::work(unsigned int index)
+{
+    assert(0 == mysql_thread_init());
+    ProxyState &ps = *this->states.at(index);
+    thread_ps = &ps;
+
+    std::vector<std::unique_ptr<EncLayer> > layers, next_layers;
+    std::map<const OnionMeta *, std::vector<std::unique_ptr<EncLayer> > >
+        read_layers;
+    unsigned long onion_seen = 0;
+    unsigned long batch_seen = 0;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->changed.wait(lock,
+            [this, batch_seen] () {
+                return this->closed || batch_seen != this->batch_serial;
+            });
+        if (this->closed) {
+            break;
+        }
+        batch_seen = this->batch_serial;
+
+        const OnionMeta *const reading = this->reading;
+        if (reading) {
+            auto &copies = read_layers[reading];
+            if (copies.empty()) {
+                copies = copyLayers(*reading, reading->getLayers());
+            }
+        } else if (onion_seen != this->onion_serial) {
+            layers = copyLayers(*this->om, this->om->getLayers());
+            next_layers = copyLayers(*this->om, this->om->getNextLayers());
+            onion_seen = this->onion_serial;
+        }
+        const std::vector<std::unique_ptr<EncLayer> > &from =
+            reading ? read_layers[reading] : layers;
+
+        const size_t n = this->ctexts->size();
+        const size_t first = n * index / this->thread_count;
+        const size_t last = n * (index + 1) / this->thread_count;
+        const std::vector<const Item *> slice(this->ctexts->begin() + first,
+                                              this->ctexts->begin() + last);
+        const std::vector<uint64_t> slice_salts(this->salts->begin() + first,
+                                                this->salts->begin() + last);
+        std::vector<std::string> &out = *this->literals;
+        lock.unlock();
+
+        // > the slices are disjoint, so are the strings we write
+        std::string failure;
+        if (false == slice.empty()) {
+            ps.safeCreateEmbeddedTHD();
+            failure = failureOf([&] () {
+                const std::vector<Item *> &plain =
+                    decrypt_layers(slice, from, slice_salts);
+                if (reading) {
+                    for (size_t i = 0; i < plain.size(); ++i) {
+                        out[first + i] = sqlLiteral(*plain[i],
+                                                    ps.getEConn());
+                    }
+                    return;
+                }
+
+                const std::vector<Item *> &enc =
+                    encrypt_layers(std::vector<const Item *>(plain.begin(),
+                                                             plain.end()),
+                                   next_layers, slice_salts);
+                for (size_t i = 0; i < enc.size(); ++i) {
+                    out[first + i] = sqlLiteral(*enc[i], ps.getEConn());
+                }
+            });
+            // > the slice's Items live on the THD
+            ps.releaseTHDs();
+        }
+
+        lock.lock();
+        if (false == failure.empty()) {
+            this->error = failure;
+        }
+        if (0 == --this->pending) {
+            this->changed.notify_all();
+        }
+    }
+    lock.unlock();
+
+    mysql_thread_end();
+}
+
+/*
+ * RotateExecutor
+ */
+
+bool
+RotateExecutor::rotatable(onion o, const OnionMeta &om)
+{
+    if (oPLAIN == o || oSWP == o || om.getPacked()) {
+        return false;
+    }
+    for (const auto &it : om.getLayers()) {
+        if ("MOPE_int" == it->name()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TableMeta &
+RotateExecutor::getTableMeta() const
+{
+    DatabaseMeta *const dm = this->schema->findChild(this->db_name);
+    TEST_DatabaseNotFound(dm, this->db_name);
+    TableMeta *const tm = dm->findChild(this->table_name);
+    TEST_IdentifierNotFound(tm, this->table_name);
+
+    return *tm;
+}
+
+FieldMeta &
+RotateExecutor::getFieldMeta(unsigned int index) const
+{
+    const std::string &field = this->onions.at(index).first;
+    FieldMeta *const fm = this->getTableMeta().findChild(field);
+    TEST_IdentifierNotFound(fm, field);
+
+    return *fm;
+}
+
+OnionMeta &
+RotateExecutor::getOnionMeta(unsigned int index) const
+{
+    const onion o = this->onions.at(index).second;
+    OnionMeta *const om = this->getFieldMeta(index).getOnionMeta(o);
+    TEST_IdentifierNotFound(om, TypeText<onion>::toText(o));
+
+    return *om;
+}
+
+// The backend's PRIMARY KEY columns; empty if we do not know them.
+std::vector<std::string>
+RotateExecutor::keyColumns() const
+{
+    const TableMeta &tm = this->getTableMeta();
+    const OnionIndex *const primary = tm.getOnionIndex("PRIMARY");
+    if (NULL == primary || 1 != primary->onions.size()) {
+        return std::vector<std::string>();
+    }
+
+    std::vector<std::string> key;
+    for (const auto &it : primary->columns) {
+        const FieldMeta *const fm = tm.findChild(it.first);
+        const OnionMeta *const om =
+            fm ? fm->getOnionMeta(*primary->onions.begin()) : NULL;
+        if (NULL == om) {
+            return std::vector<std::string>();
+        }
+        key.push_back(om->getAnonOnionName());
+    }
+
+    return key;
+}
+
+// The shadow of each onion we rotate by its column; empty before begin(...)
+// names them.
+std::map<std::string, std::string>
+RotateExecutor::shadows() const
+{
+    std::map<std::string, std::string> renamed;
+    for (unsigned int i = 0; i < this->onions.size(); ++i) {
+        const OnionMeta &om = this->getOnionMeta(i);
+        renamed[om.getAnonOnionName()] = om.getNextOnionName();
+    }
+
+    return renamed;
+}
+
+// Whether the PRIMARY KEY is on one of the onions we rotate; see
+// swap(...).
+bool
+RotateExecutor::movesPrimary() const
+{
+    const TableMeta &tm = this->getTableMeta();
+    const OnionIndex *const primary = tm.getOnionIndex("PRIMARY");
+    if (NULL == primary) {
+        return false;
+    }
+
+    const std::map<std::string, std::string> &renamed = this->shadows();
+    for (const onion o : primary->onions) {
+        bool covers = false;
+        indexColumns(tm, "PRIMARY", *primary, o, renamed, &covers);
+        if (covers) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Adds the shadow column and the next layers of each onion that is not
+// rotating yet; NULL if they all are and the backend is ready for them.
+// > unless the swap goes through an ALTER TABLE, the old columns take
+//   the NULLs the rotation leaves behind, and every index on them gets
+//   a twin on the shadows. Both are looked up in the backend
+//   ('not_null_columns', 'backend_indexes'), so that a rotation the
+//   proxy picks up again finds them whichever way it began.
+AbstractQueryExecutor *
+RotateExecutor::begin(const NextParams &nparams)
+{
+    const TableMeta &tm = this->getTableMeta();
+    const bool repointing = false == this->movesPrimary();
+    std::vector<std::unique_ptr<Delta> > deltas;
+    std::string alterations;
+    withCreateFields(nparams.ps.getEConn(), this->db_name, this->table_name,
+        [this, &nparams, repointing, &deltas, &alterations]
+            (const Create_field &cf)
+    {
+        for (unsigned int i = 0; i < this->onions.size(); ++i) {
+            if (false == equalsIgnoreCase(this->onions[i].first,
+                                          cf.field_name)) {
+                continue;
+            }
+
+            FieldMeta &fm = this->getFieldMeta(i);
+            OnionMeta &om = this->getOnionMeta(i);
+            if (repointing
+                && this->not_null_columns.count(om.getAnonOnionName())) {
+                alterations += std::string(alterations.empty() ? "" : ",")
+                               + " MODIFY COLUMN "
+                               + onionColumn(cf, om.getLayers(),
+                                             om.getAnonOnionName(), false);
+            }
+            if (om.getRotating()) {
+                continue;
+            }
+
+            const onion o = this->onions[i].second;
+            const std::string &next_name =
+                getpRandomName() + TypeText<onion>::toText(o);
+            std::vector<std::unique_ptr<EncLayer> > next_layers =
+                OnionMeta::newLayers(o, layerLevels(om.getLayers()),
+                                     nparams.ps.getMasterKey().get(), cf,
+                                     next_name, NULL, false,
+                                     hasFFX(om.getLayers()));
+
+            // > NULL until the fill gets to the row
+            alterations += std::string(alterations.empty() ? "" : ",")
+                           + " ADD COLUMN "
+                           + onionColumn(cf, next_layers, next_name, false);
+            for (unsigned int j = 0; j < next_layers.size(); ++j) {
+                deltas.push_back(std::unique_ptr<Delta>(
+                    new CreateDelta(
+                        std::unique_ptr<DBMeta>(std::move(next_layers[j])),
+                        om,
+                        IdentityMetaKey(std::to_string(
+                            OnionMeta::next_layer_base + j)))));
+            }
+            om.setNextOnionName(next_name);
+            deltas.push_back(std::unique_ptr<Delta>(new ReplaceDelta(om, fm)));
+        }
+    });
+
+    if (repointing) {
+        const std::map<std::string, std::string> &renamed = this->shadows();
+        for (const auto &index_it : tm.getOnionIndexes()) {
+            const std::string &index_name = index_it.first;
+            const OnionIndex &index = index_it.second;
+            for (const onion o : index.onions) {
+                bool covers = false;
+                const std::string &columns =
+                    indexColumns(tm, index_name, index, o, renamed, &covers);
+                const std::string &shadow_index_name =
+                    shadowIndexName(tm, index_name, o, columns);
+                if (false == covers
+                    || this->backend_indexes.count(shadow_index_name)) {
+                    continue;
+                }
+
+                alterations +=
+                    std::string(alterations.empty() ? "" : ",")
+                    + (Key::UNIQUE == index.type ? " ADD UNIQUE"
+                                                 : " ADD")
+                    + " INDEX `" + shadow_index_name + "` (" + columns
+                    + ")";
+            }
+        }
+    }
+
+    if (alterations.empty()) {
+        return NULL;
+    }
+
+    return new DDLQueryExecutor(
+        " ALTER TABLE `" + this->db_name + "`.`" + tm.getAnonTableName()
+        + "`" + alterations + ";", std::move(deltas));
+}
+
+// Drops the old columns, moves the shadows into their places and
+// rebuilds the indexes that covered them; the metadata gets a new
+// OnionMeta for each onion.
+// > only for a rotation that moves the PRIMARY KEY (see repoint(...))
+// > 'columns' is the backend table in order
+AbstractQueryExecutor *
+RotateExecutor::swap(const NextParams &nparams) const
+{
+    const TableMeta &tm = this->getTableMeta();
+    const std::map<std::string, std::string> &renamed = this->shadows();
+
+    std::vector<std::unique_ptr<Delta> > deltas;
+    std::map<std::string, std::string> definitions;
+    withCreateFields(nparams.ps.getEConn(), this->db_name, this->table_name,
+        [this, &nparams, &deltas, &definitions] (const Create_field &cf)
+    {
+        for (unsigned int i = 0; i < this->onions.size(); ++i) {
+            if (false == equalsIgnoreCase(this->onions[i].first,
+                                          cf.field_name)) {
+                continue;
+            }
+
+            const FieldMeta &fm = this->getFieldMeta(i);
+            const OnionMeta &om = this->getOnionMeta(i);
+            const onion o = this->onions[i].second;
+            const std::string &next_name = om.getNextOnionName();
+            // > the keys derive from the name, so these are the layers
+            //   the fill encrypted under
+            std::vector<std::unique_ptr<EncLayer> > layers =
+                OnionMeta::newLayers(o, layerLevels(om.getNextLayers()),
+                                     nparams.ps.getMasterKey().get(), cf,
+                                     next_name, NULL, false,
+                                     hasFFX(om.getNextLayers()));
+            definitions[om.getAnonOnionName()] =
+                onionColumn(cf, layers, next_name,
+                            (cf.flags & NOT_NULL_FLAG)
+                            && false == om.getDeferred());
+
+            std::unique_ptr<DBMeta>
+                next(new OnionMeta(next_name, std::move(layers),
+                                   om.getUniq(), om.getMinimumSecLevel(),
+                                   om.getDeferred()));
+            deltas.push_back(std::unique_ptr<Delta>(new DeleteDelta(om, fm)));
+            deltas.push_back(std::unique_ptr<Delta>(
+                new CreateDelta(std::move(next), fm,
+                                IdentityMetaKey(
+                                    TypeText<onion>::toText(o)))));
+        }
+    });
+    assert(definitions.size() == this->onions.size());
+
+    // > in table order, so that a shadow is in place before the next one
+    //   goes AFTER it
+    std::string alterations;
+    for (auto it = this->columns.begin(); it != this->columns.end(); ++it) {
+        const auto &definition = definitions.find(*it);
+        if (definitions.end() == definition) {
+            continue;
+        }
+
+        std::string position = " FIRST";
+        if (this->columns.begin() != it) {
+            const std::string &previous = *(it - 1);
+            const auto &shadow = renamed.find(previous);
+            position = " AFTER `" + (renamed.end() == shadow
+                                     ? previous : shadow->second) + "`";
+        }
+        alterations += std::string(alterations.empty() ? "" : ",")
+                       + " DROP COLUMN `" + *it + "`,"
+                       + " MODIFY COLUMN " + definition->second + position;
+    }
+
+    for (const auto &index_it : tm.getOnionIndexes()) {
+        const std::string &index_name = index_it.first;
+        const OnionIndex &index = index_it.second;
+        for (const onion o : index.onions) {
+            bool covers = false;
+            const std::string &columns =
+                indexColumns(tm, index_name, index, o, renamed, &covers);
+            if (false == covers) {
+                continue;
+            }
+
+            const std::string &anon_index_name =
+                tm.getAnonIndexName(index_name, o);
+            if (Key::PRIMARY == index.type) {
+                alterations += ", DROP PRIMARY KEY,"
+                               " ADD PRIMARY KEY (" + columns + ")";
+            } else {
+                // > a rotation that began without the PRIMARY KEY built
+                //   a twin on the shadows
+                const std::string &shadow_index_name =
+                    shadowIndexName(tm, index_name, o, columns);
+                if (this->backend_indexes.count(shadow_index_name)) {
+                    alterations += ", DROP INDEX `" + shadow_index_name
+                                   + "`";
+                }
+                alterations +=
+                    ", DROP INDEX `" + anon_index_name + "`,"
+                    + std::string(Key::UNIQUE == index.type ? " ADD UNIQUE"
+                                                            : " ADD")
+                    + " INDEX `" + anon_index_name + "` (" + columns + ")";
+            }
+        }
+    }
+
+    return new DDLQueryExecutor(
+        " ALTER TABLE `" + this->db_name + "`.`" + tm.getAnonTableName()
+        + "`" + alterations + ";", std::move(deltas));
+}
+
+// Points the metadata of each onion at its shadow, and of each index
+// that covered one at the twin begin(...) built; the old columns and
+// indexes are retired (see TableMeta::retire(...)).
+// > the backend is not altered, so the table is locked only for the
+//   sweep; the shadows stay nullable until RetireExecutor.
+AbstractQueryExecutor *
+RotateExecutor::repoint(const NextParams &nparams) const
+{
+    TableMeta &tm = this->getTableMeta();
+    const std::map<std::string, std::string> &renamed = this->shadows();
+
+    // > the names are those of the current metadata, so take them before
+    //   we move any
+    std::map<std::string, OnionIndex> indexes = tm.getOnionIndexes();
+    std::set<std::string> old_columns, old_indexes;
+    for (auto &index_it : indexes) {
+        const std::string &index_name = index_it.first;
+        OnionIndex &index = index_it.second;
+        for (const onion o : index.onions) {
+            bool covers = false;
+            const std::string &columns =
+                indexColumns(tm, index_name, index, o, renamed, &covers);
+            if (false == covers) {
+                continue;
+            }
+
+            assert(Key::PRIMARY != index.type);
+            old_indexes.insert(tm.getAnonIndexName(index_name, o));
+            index.anon_names[o] = shadowIndexName(tm, index_name, o, columns);
+        }
+    }
+    for (const auto &it : renamed) {
+        old_columns.insert(it.first);
+    }
+
+    std::vector<std::unique_ptr<Delta> > deltas;
+    withCreateFields(nparams.ps.getEConn(), this->db_name, this->table_name,
+        [this, &nparams, &deltas] (const Create_field &cf)
+    {
+        for (unsigned int i = 0; i < this->onions.size(); ++i) {
+            if (false == equalsIgnoreCase(this->onions[i].first,
+                                          cf.field_name)) {
+                continue;
+            }
+
+            const FieldMeta &fm = this->getFieldMeta(i);
+            const OnionMeta &om = this->getOnionMeta(i);
+            const onion o = this->onions[i].second;
+            const std::string &next_name = om.getNextOnionName();
+            // > the keys derive from the name, so these are the layers
+            //   the fill encrypted under
+            std::vector<std::unique_ptr<EncLayer> > layers =
+                OnionMeta::newLayers(o, layerLevels(om.getNextLayers()),
+                                     nparams.ps.getMasterKey().get(), cf,
+                                     next_name, NULL, false,
+                                     hasFFX(om.getNextLayers()));
+
+            std::unique_ptr<DBMeta>
+                next(new OnionMeta(next_name, std::move(layers),
+                                   om.getUniq(), om.getMinimumSecLevel(),
+                                   om.getDeferred()));
+            deltas.push_back(std::unique_ptr<Delta>(new DeleteDelta(om, fm)));
+            deltas.push_back(std::unique_ptr<Delta>(
+                new CreateDelta(std::move(next), fm,
+                                IdentityMetaKey(
+                                    TypeText<onion>::toText(o)))));
+        }
+    });
+    assert(deltas.size() == 2 * this->onions.size());
+
+    for (const auto &it : indexes) {
+        tm.setOnionIndex(it.first, it.second);
+    }
+    tm.retire(old_columns, old_indexes);
+    deltas.push_back(std::unique_ptr<Delta>(
+        new ReplaceDelta(tm, *this->schema->findChild(this->db_name))));
+
+    // > the backend has nothing to change
+    return new DDLQueryExecutor(" DO 0;", std::move(deltas));
+}
+
+// Filling, the next batch in PRIMARY KEY order, FOR UPDATE so that a
+// write to one of its rows waits for us. Sweeping, or without a key, the
+// rows that still need the shadow.
+std::string
+RotateExecutor::selectBatch() const
+{
+    const FieldMeta &fm = this->getFieldMeta(this->onion_index);
+    const OnionMeta &om = this->getOnionMeta(this->onion_index);
+    const std::string &old_name = om.getAnonOnionName();
+    const std::string &from =
+        "   FROM `" + this->db_name + "`.`"
+        + this->getTableMeta().getAnonTableName() + "`";
+    const std::vector<std::string> &key = this->keyColumns();
+
+    if (this->sweeping || key.empty()) {
+        return " SELECT `" + old_name + "`, `" + fm.getSaltName() + "`"
+               + from +
+               "  WHERE `" + om.getNextOnionName() + "` IS NULL"
+               "    AND `" + old_name + "` IS NOT NULL"
+               "  LIMIT " + std::to_string(this->batch_rows) +
+               (this->sweeping ? ";" : " FOR UPDATE;");
+    }
+
+    std::string columns;
+    for (const auto &it : key) {
+        columns += std::string(columns.empty() ? "" : ", ") + "`" + it + "`";
+    }
+    return " SELECT `" + old_name + "`, `" + fm.getSaltName() + "`, "
+           + columns + from +
+           (this->last_key.empty()
+            ? ""
+            : "  WHERE (" + columns + ") > (" + this->last_key + ")") +
+           "  ORDER BY " + columns +
+           "  LIMIT " + std::to_string(this->batch_rows) +
+           "    FOR UPDATE;";
+}
+
+// Re-encrypts the batch selectBatch() returned and builds the UPDATE that
+// puts it into the shadow; empty if no row of the batch has a value.
+std::string
+RotateExecutor::rotateBatch(const ResType &res)
+{
+    const FieldMeta &fm = this->getFieldMeta(this->onion_index);
+    const OnionMeta &om = this->getOnionMeta(this->onion_index);
+
+    std::vector<const Item *> ctexts;
+    std::vector<uint64_t> salts;
+    for (const auto &row : res.rows) {
+        assert(row.size() >= 2);
+        // > NULL, or a deferred onion that waits for a backfill
+        if (RiboldMYSQL::is_null(*row[0])) {
+            continue;
+        }
+        const Item_int *const salt_item = static_cast<Item_int *>(row[1]);
+        assert_s(!salt_item->null_value, "salt item is null");
+
+        ctexts.push_back(row[0]);
+        salts.push_back(salt_item->value);
+    }
+
+    if (false == res.rows.empty() && res.rows.back().size() > 2) {
+        this->last_key = rowKey(res.rows.back(), 2);
+    }
+
+    if (ctexts.empty()) {
+        return "";
+    }
+
+    const std::vector<std::string> &literals =
+        this->pool->reencrypt(ctexts, salts);
+    std::string cases, salt_list;
+    for (unsigned int i = 0; i < literals.size(); ++i) {
+        const std::string &salt = std::to_string(salts[i]);
+        cases += " WHEN " + salt + " THEN " + literals[i];
+        salt_list += (0 == i ? "" : ", ") + salt;
+    }
+
+    const std::string &salt_name = fm.getSaltName();
+    return " UPDATE `" + this->db_name + "`.`"
+           + this->getTableMeta().getAnonTableName() + "`"
+           "    SET `" + om.getNextOnionName() + "` = CASE `" + salt_name
+           + "`" + cases + " END"
+           "  WHERE `" + om.getAnonOnionName() + "` IS NOT NULL"
+           "    AND `" + salt_name + "` IN (" + salt_list + ");";
+}
+
+// The keys of the next batch of rows whose old columns clearBatch(...)
+// NULLs out.
+// > the old columns are not indexed, so the batches follow the key
+std::string
+RotateExecutor::selectCleared() const
+{
+    const std::vector<std::string> &key = this->keyColumns();
+    assert(false == key.empty());
+
+    std::string columns;
+    for (const auto &it : key) {
+        columns += std::string(columns.empty() ? "" : ", ") + "`" + it + "`";
+    }
+    return " SELECT " + columns +
+           "   FROM `" + this->db_name + "`.`"
+           + this->getTableMeta().getAnonTableName() + "`" +
+           (this->last_key.empty()
+            ? ""
+            : "  WHERE (" + columns + ") > (" + this->last_key + ")") +
+           "  ORDER BY " + columns +
+           "  LIMIT " + std::to_string(this->batch_rows) + ";";
+}
+
+// NULLs out the old columns ('retiring') of the rows selectCleared()
+// returned; without a key, of the next batch of rows that still have a
+// value. Empty if there are no rows left.
+std::string
+RotateExecutor::clearBatch(const ResType &res)
+{
+    std::string set, values;
+    for (const auto &it : this->retiring) {
+        set += std::string(set.empty() ? "" : ", ") + "`" + it + "` = NULL";
+        values += std::string(values.empty() ? "" : " OR ") + "`" + it
+                  + "` IS NOT NULL";
+    }
+    const std::string &update =
+        " UPDATE `" + this->db_name + "`.`"
+        + this->getTableMeta().getAnonTableName() + "`"
+        "    SET " + set;
+
+    const std::vector<std::string> &key = this->keyColumns();
+    if (key.empty()) {
+        return update +
+               "  WHERE " + values +
+               "  LIMIT " + std::to_string(this->batch_rows) + ";";
+    }
+    if (res.rows.empty()) {
+        return "";
+    }
+
+    std::string columns;
+    for (const auto &it : key) {
+        columns += std::string(columns.empty() ? "" : ", ") + "`" + it + "`";
+    }
+    const std::string first_key = this->last_key;
+    this->last_key = rowKey(res.rows.back(), 0);
+    return update +
+           "  WHERE (" + columns + ") <= (" + this->last_key + ")" +
+           (first_key.empty()
+            ? ""
+            : "    AND (" + columns + ") > (" + first_key + ")") +
+           "    AND (" + values + ");";
+}
+
+// > DDLQueryExecutor records its completion in the remote database
+std::string
+RotateExecutor::lockTables() const
+{
+    return " LOCK TABLES `" + this->db_name + "`.`"
+           + this->getTableMeta().getAnonTableName() + "` WRITE, "
+           + MetaData::Table::remoteQueryCompletion() + " WRITE;";
+}
+
+// Seconds to wait so that the last batch does not go over the rate.
+uint64_t
+RotateExecutor::throttle() const
+{
+    if (0 == this->rate) {
+        return 0;
+    }
+
+    const uint64_t due =
+        this->selected * 1000000000ULL / this->rate;
+    const uint64_t took = PhaseTimer::now() - this->batch_start;
+    return due > took ? (due - took + 999999999ULL) / 1000000000ULL : 0;
+}
+
+void
+RotateExecutor::progress(unsigned int rows)
+{
+    this->rotated.at(this->onion_index) += rows;
+
+    const uint64_t now = PhaseTimer::now();
+    if (now - this->last_report < report_interval) {
+        return;
+    }
+    this->last_report = now;
+
+    uint64_t total = 0;
+    for (const auto &it : this->rotated) {
+        total += it;
+    }
+    const uint64_t seconds = std::max<uint64_t>(1,
+                                 (now - this->start) / 1000000000ULL);
+    const auto &it = this->onions.at(this->onion_index);
+    std::cerr << GREEN_BEGIN << "ROTATE: " << COLOR_END
+              << this->table_name << "." << it.first << " "
+              << TypeText<onion>::toText(it.second) << ": "
+              << this->rotated.at(this->onion_index) << " rows, "
+              << total / seconds << " rows/s" << std::endl;
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+RotateExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield return CR_QUERY_AGAIN(
+            "CALL " + MetaData::Proc::activeTransactionP());
+        TEST_ErrPkt(res.success(),
+                    "failed to determine if there is an active transasction");
+        // > LOCK TABLES would commit the client's transaction
+        TEST_ErrPkt(false == handleActiveTransactionPResults(res),
+                    "keys can not be rotated inside a transaction");
+
+        this->start = PhaseTimer::now();
+        this->schema = nparams.ps.getSchemaInfo();
+
+        // > what begin(...) has to change depends on how far a rotation
+        //   the proxy lost got
+        yield return CR_QUERY_AGAIN(
+            " SHOW COLUMNS FROM `" + this->db_name + "`.`"
+            + this->getTableMeta().getAnonTableName() + "`;");
+        TEST_ErrPkt(res.success(), "failed to read the columns of "
+                                   + this->table_name);
+        this->not_null_columns.clear();
+        for (const auto &row : res.rows) {
+            if ("NO" == ItemToString(*row.at(2))) {
+                this->not_null_columns.insert(ItemToString(*row.at(0)));
+            }
+        }
+
+        yield return CR_QUERY_AGAIN(
+            " SHOW INDEX FROM `" + this->db_name + "`.`"
+            + this->getTableMeta().getAnonTableName() + "`;");
+        TEST_ErrPkt(res.success(), "failed to read the indexes of "
+                                   + this->table_name);
+        this->backend_indexes.clear();
+        for (const auto &row : res.rows) {
+            this->backend_indexes.insert(ItemToString(*row.at(2)));
+        }
+
+        this->failure =
+            failureOf([this, &nparams] () {
+                this->ddl.reset(this->begin(nparams));
+            });
+        TEST_ErrPkt(this->failure.empty(),
+                    "failed to begin rotation: " + this->failure);
+        if (this->ddl) {
+            this->first_ddl = true;
+            while (true) {
+                this->ddl_result =
+                    this->ddl->next(this->first_ddl ? ResType(true, 0, 0)
+                                                    : res,
+                                    nparams);
+                this->first_ddl = false;
+                if (ResultType::RESULTS == this->ddl_result.first) {
+                    break;
+                }
+                yield return this->ddl_result;
+            }
+            delete this->ddl_result.second;
+            // > the DDL staled the schema; this loads the next layers
+            this->schema = nparams.ps.getSchemaInfo();
+        }
+
+        this->pool.reset(new RotatePool(nparams.ps.getShared(),
+                                        this->threads));
+
+        // fill
+        for (this->onion_index = 0;
+             this->onion_index < this->onions.size();
+             ++this->onion_index) {
+            this->pool->setOnion(this->getOnionMeta(this->onion_index));
+            this->last_key = "";
+            do {
+                this->batch_start = PhaseTimer::now();
+                yield return CR_QUERY_AGAIN("START TRANSACTION");
+                TEST_ErrPkt(res.success(),
+                            "failed to start rotation transaction");
+
+                yield return CR_QUERY_AGAIN(this->selectBatch());
+                CR_ROLLBACK_AND_FAIL(res, "failed to select values to rotate");
+                this->selected = res.rows.size();
+
+                this->failure =
+                    failureOf([this, &res] () {
+                        this->update = this->rotateBatch(res);
+                    });
+                if (false == this->failure.empty()) {
+                    yield return CR_QUERY_AGAIN("ROLLBACK");
+                    FAIL_GenericPacketException(
+                        "failed to rotate values: " + this->failure);
+                }
+
+                if (false == this->update.empty()) {
+                    yield return CR_QUERY_AGAIN(this->update);
+                    CR_ROLLBACK_AND_FAIL(res, "failed to write rotated values");
+                    // > else without a key we would select the same rows
+                    //   forever
+                    if (this->keyColumns().empty()
+                        && 0 == res.affected_rows) {
+                        yield return CR_QUERY_AGAIN("ROLLBACK");
+                        FAIL_GenericPacketException(
+                            "rotation did not update any rows");
+                    }
+                }
+
+                yield return CR_QUERY_AGAIN("COMMIT");
+                TEST_ErrPkt(res.success(), "failed to commit rotation");
+                this->progress(this->selected);
+
+                if (this->throttle() > 0) {
+                    yield return CR_QUERY_AGAIN(
+                        "DO SLEEP(" + std::to_string(this->throttle())
+                        + ");");
+                    TEST_ErrPkt(res.success(), "failed to throttle rotation");
+                }
+            } while (this->batch_rows == this->selected);
+        }
+
+        // sweep up the rows written during the fill, then swap
+        yield return CR_QUERY_AGAIN(this->lockTables());
+        TEST_ErrPkt(res.success(), "failed to lock " + this->table_name);
+        this->sweeping = true;
+
+        yield return CR_QUERY_AGAIN(
+            " SHOW COLUMNS FROM `" + this->db_name + "`.`"
+            + this->getTableMeta().getAnonTableName() + "`;");
+        CR_UNLOCK_AND_FAIL(res, "failed to read the columns of "
+                                + this->table_name);
+        this->columns.clear();
+        for (const auto &row : res.rows) {
+            this->columns.push_back(ItemToString(*row.at(0)));
+        }
+
+        for (this->onion_index = 0;
+             this->onion_index < this->onions.size();
+             ++this->onion_index) {
+            this->pool->setOnion(this->getOnionMeta(this->onion_index));
+            do {
+                yield return CR_QUERY_AGAIN(this->selectBatch());
+                CR_UNLOCK_AND_FAIL(res, "failed to select values to rotate");
+                this->selected = res.rows.size();
+
+                this->failure =
+                    failureOf([this, &res] () {
+                        this->update = this->rotateBatch(res);
+                    });
+                if (false == this->failure.empty()) {
+                    yield return CR_QUERY_AGAIN("UNLOCK TABLES");
+                    FAIL_GenericPacketException(
+                        "failed to rotate values: " + this->failure);
+                }
+
+                if (false == this->update.empty()) {
+                    yield return CR_QUERY_AGAIN(this->update);
+                    CR_UNLOCK_AND_FAIL(res, "failed to write rotated values");
+                    if (0 == res.affected_rows) {
+                        yield return CR_QUERY_AGAIN("UNLOCK TABLES");
+                        FAIL_GenericPacketException(
+                            "rotation did not update any rows");
+                    }
+                }
+                this->progress(this->selected);
+            } while (this->batch_rows == this->selected);
+        }
+
+        this->failure =
+            failureOf([this, &nparams] () {
+                this->retiring.clear();
+                if (this->movesPrimary()) {
+                    this->ddl.reset(this->swap(nparams));
+                    return;
+                }
+
+                for (const auto &it : this->shadows()) {
+                    this->retiring.push_back(it.first);
+                }
+                this->ddl.reset(this->repoint(nparams));
+            });
+        if (false == this->failure.empty()) {
+            yield return CR_QUERY_AGAIN("UNLOCK TABLES");
+            FAIL_GenericPacketException(
+                "failed to swap rotated columns: " + this->failure);
+        }
+        this->first_ddl = true;
+        while (true) {
+            this->ddl_result =
+                this->ddl->next(this->first_ddl ? ResType(true, 0, 0) : res,
+                                nparams);
+            this->first_ddl = false;
+            if (ResultType::RESULTS == this->ddl_result.first) {
+                break;
+            }
+            yield return this->ddl_result;
+        }
+        delete this->ddl_result.second;
+
+        // > the values INSERT deferred are still owed to the new column
+        for (const auto &it : this->onions) {
+            const OnionMeta *const om =
+                this->getTableMeta().findChild(it.first)
+                    ->getOnionMeta(it.second);
+            if (om->getDeferred()
+                && DeferredOnions::behind(om->getAnonOnionName())) {
+                DeferredOnions::deferred(om->getNextOnionName());
+            }
+        }
+        this->pool.reset();
+        // > the DDL staled the schema; else our next() would mark it
+        //   fresh
+        this->schema = nparams.ps.getSchemaInfo();
+
+        yield return CR_QUERY_AGAIN("UNLOCK TABLES");
+        TEST_ErrPkt(res.success(), "failed to unlock " + this->table_name);
+
+        // > NULL out the old columns so that the values under the old
+        //   keys do not wait for RetireExecutor to go
+        this->last_key = "";
+        this->selected = 0;
+        while (false == this->retiring.empty()) {
+            this->batch_start = PhaseTimer::now();
+            if (this->keyColumns().empty()) {
+                this->update = this->clearBatch(ResType(true, 0, 0));
+            } else {
+                yield return CR_QUERY_AGAIN(this->selectCleared());
+                TEST_ErrPkt(res.success(),
+                            "failed to select the rows to clear");
+                this->selected = res.rows.size();
+                this->update = this->clearBatch(res);
+            }
+
+            if (false == this->update.empty()) {
+                yield return CR_QUERY_AGAIN(this->update);
+                TEST_ErrPkt(res.success(), "failed to clear the old columns");
+                if (this->keyColumns().empty()) {
+                    this->selected = res.affected_rows;
+                }
+            }
+            if (this->batch_rows != this->selected) {
+                break;
+            }
+
+            if (this->throttle() > 0) {
+                yield return CR_QUERY_AGAIN(
+                    "DO SLEEP(" + std::to_string(this->throttle()) + ");");
+                TEST_ErrPkt(res.success(), "failed to throttle rotation");
+            }
+        }
+
+        std::cerr << GREEN_BEGIN << "ROTATE: " << COLOR_END
+                  << this->table_name << " done in "
+                  << (PhaseTimer::now() - this->start) / 1000000000ULL
+                  << "s" << std::endl;
+
+        yield {
+            std::vector<std::vector<Item *> > rows;
+            for (unsigned int i = 0; i < this->onions.size(); ++i) {
+                rows.push_back(std::vector<Item *>{
+                    make_item_string(this->onions[i].first),
+                    make_item_string(
+                        TypeText<onion>::toText(this->onions[i].second)),
+                    new Item_int(static_cast<longlong>(this->rotated[i]))});
+            }
+
+            return CR_RESULTS(ResType(true, 0, 0,
+                {"field", "onion", "rows"},
+                {MYSQL_TYPE_VAR_STRING, MYSQL_TYPE_VAR_STRING,
+                 MYSQL_TYPE_LONGLONG},
+                std::move(rows)));
+        }
+    }
+
+    assert(false);
+}
+
+/*
+ * RetireExecutor
+ */
+
+TableMeta &
+RetireExecutor::getTableMeta() const
+{
+    DatabaseMeta *const dm = this->schema->findChild(this->db_name);
+    TEST_DatabaseNotFound(dm, this->db_name);
+    TableMeta *const tm = dm->findChild(this->table_name);
+    TEST_IdentifierNotFound(tm, this->table_name);
+
+    return *tm;
+}
+
+// NULL if there is nothing to drop and no shadow waits for its NOT NULL.
+// > an onion that is rotating keeps its old column nullable for the
+//   rotation to clear
+AbstractQueryExecutor *
+RetireExecutor::alter(const NextParams &nparams) const
+{
+    TableMeta &tm = this->getTableMeta();
+    std::string alterations;
+    for (const auto &it : tm.getRetiredIndexes()) {
+        alterations += std::string(alterations.empty() ? "" : ",")
+                       + " DROP INDEX `" + it + "`";
+    }
+    for (const auto &it : tm.getRetiredColumns()) {
+        alterations += std::string(alterations.empty() ? "" : ",")
+                       + " DROP COLUMN `" + it + "`";
+    }
+
+    withCreateFields(nparams.ps.getEConn(), this->db_name, this->table_name,
+        [this, &tm, &alterations] (const Create_field &cf)
+    {
+        if (false == (cf.flags & NOT_NULL_FLAG)) {
+            return;
+        }
+
+        for (const auto &field_it : tm.getChildren()) {
+            const FieldMeta &fm = *field_it.second;
+            if (false == equalsIgnoreCase(fm.getFieldName(),
+                                          cf.field_name)) {
+                continue;
+            }
+
+            for (const auto &onion_it : fm.getChildren()) {
+                const OnionMeta &om = *onion_it.second;
+                if (false == RotateExecutor::rotatable(
+                                 onion_it.first.getValue(), om)
+                    || om.getDeferred() || om.getRotating()
+                    || 0 == this->nullable_columns.count(
+                                om.getAnonOnionName())) {
+                    continue;
+                }
+
+                alterations += std::string(alterations.empty() ? "" : ",")
+                               + " MODIFY COLUMN "
+                               + onionColumn(cf, om.getLayers(),
+                                             om.getAnonOnionName(), true);
+            }
+        }
+    });
+
+    if (alterations.empty()) {
+        return NULL;
+    }
+
+    std::vector<std::unique_ptr<Delta> > deltas;
+    tm.clearRetired();
+    deltas.push_back(std::unique_ptr<Delta>(
+        new ReplaceDelta(tm, *this->schema->findChild(this->db_name))));
+    return new DDLQueryExecutor(
+        " ALTER TABLE `" + this->db_name + "`.`" + tm.getAnonTableName()
+        + "`" + alterations + ";", std::move(deltas));
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+RetireExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        this->schema = nparams.ps.getSchemaInfo();
+        yield return CR_QUERY_AGAIN(
+            " SHOW COLUMNS FROM `" + this->db_name + "`.`"
+            + this->getTableMeta().getAnonTableName() + "`;");
+        TEST_ErrPkt(res.success(), "failed to read the columns of "
+                                   + this->table_name);
+        this->nullable_columns.clear();
+        for (const auto &row : res.rows) {
+            if ("YES" == ItemToString(*row.at(2))) {
+                this->nullable_columns.insert(ItemToString(*row.at(0)));
+            }
+        }
+
+        this->failure =
+            failureOf([this, &nparams] () {
+                this->ddl.reset(this->alter(nparams));
+            });
+        TEST_ErrPkt(this->failure.empty(),
+                    "failed to retire columns: " + this->failure);
+        if (this->ddl) {
+            this->first_ddl = true;
+            while (true) {
+                this->ddl_result =
+                    this->ddl->next(this->first_ddl ? ResType(true, 0, 0)
+                                                    : res,
+                                    nparams);
+                this->first_ddl = false;
+                if (ResultType::RESULTS == this->ddl_result.first) {
+                    break;
+                }
+                yield return this->ddl_result;
+            }
+            // > the DDL staled the schema; else our next() would mark it
+            //   fresh
+            this->schema = nparams.ps.getSchemaInfo();
+            yield return this->ddl_result;
+        } else {
+            yield return CR_RESULTS(ResType(true, 0, 0));
+        }
+    }
+
+    assert(false);
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <main/Analysis.hh>
+#include <main/schema.hh>
+#include <main/sql_handler.hh>
+
+// Re-encrypts the batches of a key rotation on worker threads, each
+// taking a slice of every batch; SpecialUpdateExecutor has it decrypt
+// the columns of its chunks the same way.
+// > each worker has a THD of its own for the Items it makes, and its own
+//   copies of the layers; OPE and HOM keep state in theirs.
+class RotatePool {
+public:
+    RotatePool(const SharedProxyState &shared, unsigned int threads);
+    ~RotatePool();
+
+    // The onion the next batches are decrypted from and encrypted into.
+    void setOnion(const OnionMeta &om);
+    // The values under the next layers as SQL literals; 'salts' are the
+    // rows' IVs.
+    std::vector<std::string>
+        reencrypt(const std::vector<const Item *> &ctexts,
+                  const std::vector<uint64_t> &salts);
+    // The values of a column under the layers of 'om' as SQL literals;
+    // 'om' need not be rotating.
+    // > the workers keep the copies they make of the layers of each
+    //   onion, so 'om' must outlive the pool
+    std::vector<std::string>
+        decrypt(const OnionMeta &om, const std::vector<const Item *> &ctexts,
+                const std::vector<uint64_t> &salts);
+
+private:
+    const unsigned int thread_count;
+    std::vector<std::unique_ptr<ProxyState> > states;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // the current batch, guarded by 'mutex'
+    const OnionMeta *om;
+    // the onion of a batch that is only decrypted, else NULL
+    const OnionMeta *reading;
+    unsigned long onion_serial;
+    unsigned long batch_serial;
+    const std::vector<const Item *> *ctexts;
+    const std::vector<uint64_t> *salts;
+    std::vector<std::string> *literals;
+    unsigned int pending;
+    std::string error;
+    bool closed;
+
+    std::vector<std::string>
+        run(const OnionMeta *reading,
+            const std::vector<const Item *> &ctexts,
+            const std::vector<uint64_t> &salts);
+    void work(unsigned int index);
+};
+
+// Rotates the keys of onions of a table while it stays online (see
+// OnionMeta::getRotating()). Each onion is re-encrypted into a shadow
+// column under layers keyed from a new name, in PRIMARY KEY order a
+// batch at a time; a write in the meantime leaves the row's shadow NULL.
+// With the table locked the NULLs are swept up and the metadata points
+// each onion at its shadow; the old columns are NULLed out once the
+// table is unlocked and RetireExecutor drops them later.
+// > an onion that is already rotating (ie, the proxy went down) starts
+//   its fill over.
+// > the ALTER TABLE that adds the shadows, with an index on them for
+//   each index on the old columns, rebuilds the table on MySQL 5.5 and
+//   blocks writes while it runs; the swap does not touch the backend.
+// > an onion under the PRIMARY KEY can not move to a nullable shadow,
+//   so a rotation that covers one swaps with an ALTER TABLE that drops
+//   the old columns, under LOCK TABLES.
+class RotateExecutor : public AbstractQueryExecutor {
+    const std::string db_name;
+    const std::string table_name;
+    // (field, onion)
+    const std::vector<std::pair<std::string, onion> > onions;
+    const unsigned int batch_rows;
+    const unsigned int threads;
+    // rows per second, 0 for no limit
+    const uint64_t rate;
+
+    // coroutine state
+    std::shared_ptr<const SchemaInfo> schema;
+    std::unique_ptr<RotatePool> pool;
+    std::unique_ptr<AbstractQueryExecutor> ddl;
+    std::pair<ResultType, AbstractAnything *> ddl_result;
+    bool first_ddl;
+    unsigned int onion_index;
+    bool sweeping;
+    std::string last_key;
+    unsigned int selected;
+    std::string update;
+    std::string failure;
+    std::vector<std::string> columns;
+    std::set<std::string> not_null_columns;
+    std::set<std::string> backend_indexes;
+    std::vector<std::string> retiring;
+    std::vector<uint64_t> rotated;
+    uint64_t start;
+    uint64_t last_report;
+    uint64_t batch_start;
+
+public:
+    RotateExecutor(const std::string &db_name, const std::string &table_name,
+                   const std::vector<std::pair<std::string, onion> > &onions,
+                   unsigned int batch_rows, unsigned int threads,
+                   uint64_t rate)
+        : db_name(db_name), table_name(table_name), onions(onions),
+          batch_rows(batch_rows), threads(threads), rate(rate),
+          first_ddl(true), onion_index(0), sweeping(false), selected(0),
+          rotated(onions.size(), 0), start(0), last_report(0),
+          batch_start(0) {}
+    ~RotateExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+    // > oPLAIN has no key; the keyword index of an oSWP onion, the tree
+    //   of a mOPE layer and the other slots of a pack are all under the
+    //   old one
+    static bool rotatable(onion o, const OnionMeta &om);
+
+private:
+    static const uint64_t report_interval = 10000000000ULL;
+
+    TableMeta &getTableMeta() const;
+    FieldMeta &getFieldMeta(unsigned int index) const;
+    OnionMeta &getOnionMeta(unsigned int index) const;
+    std::vector<std::string> keyColumns() const;
+    std::map<std::string, std::string> shadows() const;
+    bool movesPrimary() const;
+    AbstractQueryExecutor *begin(const NextParams &nparams);
+    AbstractQueryExecutor *swap(const NextParams &nparams) const;
+    AbstractQueryExecutor *repoint(const NextParams &nparams) const;
+    std::string selectBatch() const;
+    std::string rotateBatch(const ResType &res);
+    std::string selectCleared() const;
+    std::string clearBatch(const ResType &res);
+    std::string lockTables() const;
+    uint64_t throttle() const;
+    void progress(unsigned int rows);
+};
+
+// Drops the columns and indexes that key rotations retired (see
+// TableMeta::retire(...)) with one ALTER TABLE, and gives the shadows
+// that took their places back the NOT NULL they were created without.
+// > the ALTER TABLE copies the table on MySQL 5.5; run it in a quiet
+//   hour, and not while a rotation of the table is NULLing out its old
+//   columns.
+class RetireExecutor : public AbstractQueryExecutor {
+    const std::string db_name;
+    const std::string table_name;
+
+    // coroutine state
+    std::shared_ptr<const SchemaInfo> schema;
+    std::set<std::string> nullable_columns;
+    std::unique_ptr<AbstractQueryExecutor> ddl;
+    std::pair<ResultType, AbstractAnything *> ddl_result;
+    bool first_ddl;
+    std::string failure;
+
+public:
+    RetireExecutor(const std::string &db_name, const std::string &table_name)
+        : db_name(db_name), table_name(table_name), first_ddl(true) {}
+    ~RetireExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    TableMeta &getTableMeta() const;
+    AbstractQueryExecutor *alter(const NextParams &nparams) const;
+};
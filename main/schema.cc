@@ -11,27 +11,26 @@
 #include <main/dbobject.hh>
 #include <main/metadata_tables.hh>
 #include <main/macro_util.hh>
+#include <main/trace.hh>
 
-std::vector<DBMeta *>
-DBMeta::doFetchChildren(const std::unique_ptr<Connect> &e_conn,
-                        std::function<DBMeta *(const std::string &,
-                                               const std::string &,
-                                               const std::string &)>
-                            deserialHandler)
+void
+MetaTableSource::children(unsigned int parent_id,
+                          std::function<void(const std::string &,
+                                             const std::string &,
+                                             const std::string &)> fn)
+    const
 {
     const std::string table_name = MetaData::Table::metaObject();
 
     // Now that we know the table exists, SELECT the data we want.
-    std::vector<DBMeta *> out_vec;
     std::unique_ptr<DBResult> db_res;
-    const std::string parent_id = std::to_string(this->getDatabaseID());
     const std::string serials_query =
         " SELECT " + table_name + ".serial_object,"
         "        " + table_name + ".serial_key,"
         "        " + table_name + ".id"
         " FROM " + table_name +
         " WHERE " + table_name + ".parent_id"
-        "   = " + parent_id + ";";
+        "   = " + std::to_string(parent_id) + ";";
     TEST_TextMessageError(e_conn->execute(serials_query, &db_res),
                           "doFetchChildren query failed");
     MYSQL_ROW row;
@@ -43,10 +42,25 @@ DBMeta::doFetchChildren(const std::unique_ptr<Connect> &e_conn,
         const std::string child_key(row[1], l[1]);
         const std::string child_id(row[2], l[2]);
 
-        DBMeta *const new_old_meta =
-            deserialHandler(child_key, child_serial_object, child_id);
-        out_vec.push_back(new_old_meta);
+        fn(child_key, child_serial_object, child_id);
     }
+}
+
+std::vector<DBMeta *>
+DBMeta::doFetchChildren(const MetaSource &source,
+                        std::function<DBMeta *(const std::string &,
+                                               const std::string &,
+                                               const std::string &)>
+                            deserialHandler)
+{
+    std::vector<DBMeta *> out_vec;
+    source.children(this->getDatabaseID(),
+        [&out_vec, &deserialHandler] (const std::string &key,
+                                      const std::string &serial,
+                                      const std::string &id)
+    {
+        out_vec.push_back(deserialHandler(key, serial, id));
+    });
 
     return out_vec;
 }
@@ -54,29 +68,55 @@ DBMeta::doFetchChildren(const std::unique_ptr<Connect> &e_conn,
 OnionMeta::OnionMeta(onion o, std::vector<SECLEVEL> levels,
                      const AES_KEY * const m_key,
                      const Create_field &cf, unsigned long uniq_count,
-                     SECLEVEL minimum_seclevel)
-    : onionname(getpRandomName() + TypeText<onion>::toText(o)),
-      uniq_count(uniq_count), minimum_seclevel(minimum_seclevel)
+                     SECLEVEL minimum_seclevel, bool deferred,
+                     const PackedSlot *const packed, bool mope, bool ffx)
+    : onionname(packed ? packed->onionname
+                       : getpRandomName() + TypeText<onion>::toText(o)),
+      uniq_count(uniq_count), minimum_seclevel(minimum_seclevel),
+      deferred(deferred), packed_layer(NULL)
+{
+    this->layers = newLayers(o, levels, m_key, cf, this->getAnonOnionName(),
+                             packed, mope, ffx);
+    this->packed_layer = packedLayer(this->layers);
+}
+
+std::vector<std::unique_ptr<EncLayer> >
+OnionMeta::newLayers(onion o, const std::vector<SECLEVEL> &levels,
+                     const AES_KEY * const m_key, const Create_field &cf,
+                     const std::string &onionname,
+                     const PackedSlot *const packed, bool mope, bool ffx)
 {
     assert(levels.size() >= 1);
+    assert(!packed || oAGG == o);
+    assert(!mope || oOPE == o);
+    assert(!ffx || oDET == o);
 
+    std::vector<std::unique_ptr<EncLayer> > layers;
     const Create_field * newcf = &cf;
     //generate enclayers for encrypted field
-    const std::string uniqueFieldName = this->getAnonOnionName();
     for (auto l: levels) {
         const std::string key =
-            m_key ? getLayerKey(m_key, uniqueFieldName, l)
+            m_key ? getLayerKey(m_key, onionname, l)
                   : "plainkey";
         std::unique_ptr<EncLayer>
-            el(EncLayerFactory::encLayer(o, l, *newcf, key));
+            el(packed && SECLEVEL::HOM == l
+               ? std::unique_ptr<EncLayer>(new HOMPack(*newcf, key,
+                                                       packed->slot))
+               : mope && SECLEVEL::OPE == l
+               ? std::unique_ptr<EncLayer>(new MOPE_int(*newcf, key))
+               : ffx && (SECLEVEL::DET == l || SECLEVEL::DETJOIN == l)
+               ? EncLayerFactory::ffxLayer(l, *newcf, key)
+               : EncLayerFactory::encLayer(o, l, *newcf, key));
 
         const Create_field &oldcf = *newcf;
         newcf = el->newCreateField(oldcf);
 
-        this->layers.push_back(std::move(el));
+        el->sealKey();
+        layers.push_back(std::move(el));
     }
 
-    assert(this->layers.size() >= 1);
+    assert(layers.size() >= 1);
+    return layers;
 }
 
 std::unique_ptr<OnionMeta>
@@ -84,14 +124,19 @@ OnionMeta::deserialize(unsigned int id, const std::string &serial)
 {
     assert(id != 0);
     const auto vec = unserialize_string(serial);
-    assert(3 == vec.size());
+    // > onions serialized before deferral existed have three elements,
+    //   and before key rotation four
+    assert(vec.size() >= 3 && vec.size() <= 5);
 
     const std::string onionname = vec[0];
     const unsigned int uniq_count = atoi(vec[1].c_str());
     const SECLEVEL minimum_seclevel = TypeText<SECLEVEL>::toType(vec[2]);
+    const bool deferred = vec.size() >= 4 && string_to_bool(vec[3]);
+    const std::string next_onionname = 5 == vec.size() ? vec[4] : "";
 
     return std::unique_ptr<OnionMeta>
-        (new OnionMeta(id, onionname, uniq_count, minimum_seclevel));
+        (new OnionMeta(id, onionname, uniq_count, minimum_seclevel,
+                       deferred, next_onionname));
 }
 
 std::string OnionMeta::serialize(const DBObject &parent) const
@@ -99,7 +144,9 @@ std::string OnionMeta::serialize(const DBObject &parent) const
     const std::string &serial =
         serialize_string(this->onionname) +
         serialize_string(std::to_string(this->uniq_count)) +
-        serialize_string(TypeText<SECLEVEL>::toText(this->minimum_seclevel));
+        serialize_string(TypeText<SECLEVEL>::toText(this->minimum_seclevel)) +
+        serialize_string(bool_to_string(this->deferred)) +
+        serialize_string(this->next_onionname);
 
     return serial;
 }
@@ -109,33 +156,61 @@ std::string OnionMeta::getAnonOnionName() const
     return onionname;
 }
 
+const HOMPack *
+OnionMeta::packedLayer(const std::vector<std::unique_ptr<EncLayer> > &layers)
+{
+    if (0 == layers.size() || NULL == layers.back()) {
+        return NULL;
+    }
+
+    // > the tree is built without RTTI
+    const EncLayer *const back = layers.back().get();
+    return "HOM_pack" == back->name() ? static_cast<const HOMPack *>(back)
+                                      : NULL;
+}
+
 std::vector<DBMeta *>
-OnionMeta::fetchChildren(const std::unique_ptr<Connect> &e_conn)
+OnionMeta::fetchChildren(const MetaSource &source)
 {
     std::function<DBMeta *(const std::string &,
                            const std::string &,
                            const std::string &)>
         deserialHelper =
-    [this] (const std::string &key, const std::string &serial,
-            const std::string &id) -> EncLayer *
+    [this, &source] (const std::string &key, const std::string &serial,
+                     const std::string &id) -> EncLayer *
     {
         // > Probably going to want to use indexes in AbstractMetaKey
         // for now, otherwise you will need to abstract and rederive
         // a keyed and nonkeyed version of Delta.
         const std::unique_ptr<UIntMetaKey>
             meta_key(AbstractMetaKey::factory<UIntMetaKey>(key));
-        const unsigned int index = meta_key->getValue();
-        if (index >= this->layers.size()) {
-            this->layers.resize(index + 1);
+        const unsigned int key_index = meta_key->getValue();
+        std::vector<std::unique_ptr<EncLayer> > &to =
+            key_index >= next_layer_base ? this->next_layers
+                                         : this->layers;
+        const unsigned int index =
+            key_index >= next_layer_base ? key_index - next_layer_base
+                                         : key_index;
+        if (index >= to.size()) {
+            to.resize(index + 1);
         }
         std::unique_ptr<EncLayer>
             layer(EncLayerFactory::deserializeLayer(atoi(id.c_str()),
                                                     serial));
-        this->layers[index] = std::move(layer);
-        return this->layers[index].get();
+        const std::string &expanded =
+            source.expandedKey(layer->getDatabaseID(), serial);
+        if (false == expanded.empty()) {
+            layer->restoreExpandedKey(expanded);
+        }
+        layer->sealKey();
+        to[index] = std::move(layer);
+        return to[index].get();
     };
 
-    return DBMeta::doFetchChildren(e_conn, deserialHelper);
+    const std::vector<DBMeta *> &children =
+        DBMeta::doFetchChildren(source, deserialHelper);
+    this->packed_layer = packedLayer(this->layers);
+    return children;
 }
 
 bool
@@ -147,23 +222,36 @@ OnionMeta::applyToChildren(std::function<bool(const DBMeta &)>
             return false;
         }
     }
+    for (const auto &it : next_layers) {
+        if (false == fn(*it.get())) {
+            return false;
+        }
+    }
 
     return true;
 }
 
 UIntMetaKey const &OnionMeta::getKey(const DBMeta &child) const
 {
+    AssignOnce<unsigned int> index;
     for (std::vector<EncLayer *>::size_type i = 0; i< layers.size(); ++i) {
         if (&child == layers[i].get()) {
-            UIntMetaKey *const key = new UIntMetaKey(i);
-            // Hold onto the key so we can destroy it when OnionMeta is
-            // destructed.
-            generated_keys.push_back(std::unique_ptr<UIntMetaKey>(key));
-            return *key;
+            index = i;
+        }
+    }
+    for (std::vector<EncLayer *>::size_type i = 0;
+         i < next_layers.size(); ++i) {
+        if (&child == next_layers[i].get()) {
+            index = next_layer_base + i;
         }
     }
+    assert(index.assigned());
 
-    assert(false);
+    UIntMetaKey *const key = new UIntMetaKey(index.get());
+    // Hold onto the key so we can destroy it when OnionMeta is
+    // destructed.
+    generated_keys.push_back(std::unique_ptr<UIntMetaKey>(key));
+    return *key;
 }
 
 EncLayer *OnionMeta::getLayerBack() const
@@ -207,6 +295,59 @@ SECLEVEL OnionMeta::getSecLevel() const
     return layers.back()->level();
 }
 
+// The named layouts serialize as their names; a layout that was pruned
+// by an onion layout hint is written out in full.
+//   oEq:DETJOIN.DET.RND|oOrder:OPE.RND
+static std::string
+serializeOnionLayout(const onionlayout &layout)
+{
+    const std::vector<onionlayout> &named =
+        TypeText<onionlayout>::allEnum();
+    if (named.end() != std::find(named.begin(), named.end(), layout)) {
+        return TypeText<onionlayout>::toText(layout);
+    }
+
+    std::string out;
+    for (const auto &it : layout) {
+        if (false == out.empty()) {
+            out += "|";
+        }
+        out += TypeText<onion>::toText(it.first) + ":";
+        for (auto level = it.second.begin(); level != it.second.end();
+             ++level) {
+            if (it.second.begin() != level) {
+                out += ".";
+            }
+            out += TypeText<SECLEVEL>::toText(*level);
+        }
+    }
+
+    return out;
+}
+
+static onionlayout
+deserializeOnionLayout(const std::string &serial)
+{
+    if (std::string::npos == serial.find(':')) {
+        return TypeText<onionlayout>::toType(serial);
+    }
+
+    onionlayout layout;
+    for (const auto &it : split(serial, "|")) {
+        const size_t colon = it.find(':');
+        TEST_TextMessageError(std::string::npos != colon,
+                              "bad onion layout: " + serial);
+        const onion o = TypeText<onion>::toType(it.substr(0, colon));
+        for (const auto &level : split(it.substr(colon + 1), ".")) {
+            layout[o].push_back(TypeText<SECLEVEL>::toType(level));
+        }
+        TEST_TextMessageError(layout[o].size() >= 1,
+                              "bad onion layout: " + serial);
+    }
+
+    return layout;
+}
+
 std::unique_ptr<FieldMeta>
 FieldMeta::deserialize(unsigned int id, const std::string &serial)
 {
@@ -217,7 +358,7 @@ FieldMeta::deserialize(unsigned int id, const std::string &serial)
     const std::string fname = vec[0];
     const bool has_salt = string_to_bool(vec[1]);
     const std::string salt_name = vec[2];
-    const onionlayout onion_layout = TypeText<onionlayout>::toType(vec[3]);
+    const onionlayout onion_layout = deserializeOnionLayout(vec[3]);
     const SECURITY_RATING sec_rating =
         TypeText<SECURITY_RATING>::toType(vec[4]);
     const unsigned int uniq_count = atoi(vec[5].c_str());
@@ -256,6 +397,8 @@ determineSecLevelData(onion o, std::vector<SECLEVEL> levels, bool unique)
         assert(SECLEVEL::RND == levels.back());
     } else if (oAGG == o) {
         assert(SECLEVEL::HOM == levels.back());
+    } else if (oSWP == o) {
+        assert(SECLEVEL::SEARCH == levels.back());
     } else {
         assert(false);
     }
@@ -266,7 +409,9 @@ determineSecLevelData(onion o, std::vector<SECLEVEL> levels, bool unique)
 // If mkey == NULL, the field is not encrypted
 static bool
 init_onions_layout(const AES_KEY *const m_key, FieldMeta *const fm,
-                   const Create_field &cf, bool unique)
+                   const Create_field &cf, bool unique,
+                   const std::set<onion> &deferred,
+                   const PackedSlot *const packed, bool mope, bool ffx)
 {
     const onionlayout onion_layout = fm->getOnionLayout();
     if (fm->getHasSalt() != (static_cast<bool>(m_key)
@@ -287,11 +432,25 @@ init_onions_layout(const AES_KEY *const m_key, FieldMeta *const fm,
             determineSecLevelData(o, levels, unique);
         assert(level_data.first.size() >= 1);
 
+        // A value can only be backfilled from its DET onion with the
+        // row's salt.
+        // > nor can one slot of a pack be left for later
+        // > nor an mOPE onion; encrypting into it may first have to load
+        //   its tree from the column
+        // > an oSWP onion always is; the backfill keeps its keyword index
+        const PackedSlot *const slot = oAGG == o ? packed : NULL;
+        const bool tree = mope && oOPE == o;
+        const bool defer = fm->getHasSalt() && oDET != o && oPLAIN != o
+                           && !slot && !tree
+                           && (oSWP == o
+                               || deferred.end() != deferred.find(o));
+
         // A new OnionMeta will only occur with a new FieldMeta so
         // we never have to build Deltaz for our OnionMetaz.
         std::unique_ptr<OnionMeta>
             om(new OnionMeta(o, std::get<0>(level_data), m_key, cf,
-                             fm->leaseCount(), std::get<1>(level_data)));
+                             fm->leaseCount(), std::get<1>(level_data),
+                             defer, slot, tree, ffx && oDET == o));
         const std::string &onion_name = om->getAnonOnionName();
         fm->addChild(OnionMetaKey(o), std::move(om));
 
@@ -306,17 +465,26 @@ FieldMeta::FieldMeta(const Create_field &field,
                      const AES_KEY * const m_key,
                      SECURITY_RATING sec_rating,
                      unsigned long uniq_count,
-                     bool unique)
+                     bool unique,
+                     const std::set<onion> &onion_hint,
+                     const std::set<onion> &deferred,
+                     const PackedSlot *const packed, bool mope,
+                     bool search, bool ffx)
     : fname(std::string(field.field_name)),
       salt_name(BASE_SALT_NAME + getpRandomName()),
-      onion_layout(determineOnionLayout(m_key, field, sec_rating)),
+      onion_layout(searchOnionLayout(
+                       restrictOnionLayout(determineOnionLayout(m_key, field,
+                                                                sec_rating),
+                                           onion_hint),
+                       search)),
       has_salt(static_cast<bool>(m_key)
               && onion_layout != PLAIN_ONION_LAYOUT),
       sec_rating(sec_rating), uniq_count(uniq_count), counter(0),
       has_default(determineHasDefault(field)),
       default_value(determineDefaultValue(has_default, field))
 {
-    TEST_TextMessageError(init_onions_layout(m_key, this, field, unique),
+    TEST_TextMessageError(init_onions_layout(m_key, this, field, unique,
+                                             deferred, packed, mope, ffx),
                           "Failed to build onions for new FieldMeta!");
 }
 
@@ -329,7 +497,7 @@ std::string FieldMeta::serialize(const DBObject &parent) const
         serialize_string(fname) +
         serialize_string(bool_to_string(has_salt)) +
         serialized_salt_name +
-        serialize_string(TypeText<onionlayout>::toText(onion_layout)) +
+        serialize_string(serializeOnionLayout(onion_layout)) +
         serialize_string(TypeText<SECURITY_RATING>::toText(sec_rating)) +
         serialize_string(std::to_string(uniq_count)) +
         serialize_string(std::to_string(counter)) +
@@ -371,7 +539,7 @@ std::string FieldMeta::getSaltName() const
 
 SECLEVEL FieldMeta::getOnionLevel(onion o) const
 {
-    const auto om = getChild(OnionMetaKey(o));
+    const auto om = findChild(o);
     if (om == NULL) {
         return SECLEVEL::INVALID;
     }
@@ -381,7 +549,7 @@ SECLEVEL FieldMeta::getOnionLevel(onion o) const
 
 OnionMeta *FieldMeta::getOnionMeta(onion o) const
 {
-    return getChild(OnionMetaKey(o));
+    return findChild(o);
 }
 
 onionlayout FieldMeta::determineOnionLayout(const AES_KEY *const m_key,
@@ -426,6 +594,43 @@ onionlayout FieldMeta::determineOnionLayout(const AES_KEY *const m_key,
     }
 }
 
+// Drop the onions that the workload never used; oDET always stays as it
+// carries UNIQUE constraints and gives us something to decrypt from.
+// oPLAIN stays too as a best effort layout falls back to it.
+onionlayout FieldMeta::restrictOnionLayout(const onionlayout &layout,
+                                           const std::set<onion> &keep)
+{
+    if (keep.empty() || PLAIN_ONION_LAYOUT == layout) {
+        return layout;
+    }
+
+    onionlayout out;
+    for (const auto &it : layout) {
+        const onion o = it.first;
+        if (oDET == o || oPLAIN == o || keep.end() != keep.find(o)) {
+            out.insert(it);
+        }
+    }
+    assert(out.size() >= 1);
+
+    return out;
+}
+
+// The layouts leave oSWP out; a column that wants keyword search gets it
+// back, see CRYPTDB_SEARCH_COLUMNS.
+onionlayout FieldMeta::searchOnionLayout(const onionlayout &layout,
+                                         bool search)
+{
+    if (false == search || PLAIN_ONION_LAYOUT == layout) {
+        return layout;
+    }
+
+    onionlayout out(layout);
+    out[oSWP] = std::vector<SECLEVEL>({SECLEVEL::SEARCH});
+
+    return out;
+}
+
 // mysql is handling default values for fields with implicit defaults that
 // allow NULL; these implicit defaults being NULL.
 bool FieldMeta::determineHasDefault(const Create_field &cf)
@@ -457,7 +662,94 @@ std::string FieldMeta::determineDefaultValue(bool has_default,
 
 bool FieldMeta::hasOnion(onion o) const
 {
-    return childExists(OnionMetaKey(o));
+    return NULL != findChild(o);
+}
+
+// Each index is a nested serial of its name, type, columns, onions and
+// the anonymous names a rotation gave them.
+static std::string
+serializeOnionIndexes(const std::map<std::string, OnionIndex> &indexes)
+{
+    std::string out;
+    for (const auto &it : indexes) {
+        const OnionIndex &index = it.second;
+        std::string columns;
+        for (const auto &col : index.columns) {
+            columns += serialize_string(col.first) +
+                       serialize_string(std::to_string(col.second));
+        }
+        std::string onions;
+        for (auto o : index.onions) {
+            onions += serialize_string(TypeText<onion>::toText(o));
+        }
+        std::string anon_names;
+        for (const auto &name : index.anon_names) {
+            anon_names +=
+                serialize_string(TypeText<onion>::toText(name.first)) +
+                serialize_string(name.second);
+        }
+
+        out += serialize_string(serialize_string(it.first) +
+                                serialize_string(std::to_string(index.type)) +
+                                serialize_string(columns) +
+                                serialize_string(onions) +
+                                serialize_string(anon_names));
+    }
+
+    return out;
+}
+
+static std::string
+serializeNames(const std::set<std::string> &names)
+{
+    std::string out;
+    for (const auto &it : names) {
+        out += serialize_string(it);
+    }
+
+    return out;
+}
+
+static std::set<std::string>
+deserializeNames(const std::string &serial)
+{
+    const auto &names = unserialize_string(serial);
+    return std::set<std::string>(names.begin(), names.end());
+}
+
+static std::map<std::string, OnionIndex>
+deserializeOnionIndexes(const std::string &serial)
+{
+    std::map<std::string, OnionIndex> indexes;
+    for (const auto &it : unserialize_string(serial)) {
+        const auto vec = unserialize_string(it);
+        // > indexes serialized before rotations moved them have four
+        assert(4 == vec.size() || 5 == vec.size());
+
+        OnionIndex index;
+        index.type = static_cast<Key::Keytype>(atoi(vec[1].c_str()));
+        const auto columns = unserialize_string(vec[2]);
+        assert(0 == columns.size() % 2);
+        for (size_t i = 0; i < columns.size(); i += 2) {
+            index.columns.push_back(
+                std::make_pair(columns[i], atoi(columns[i + 1].c_str())));
+        }
+        for (const auto &o : unserialize_string(vec[3])) {
+            index.onions.insert(TypeText<onion>::toType(o));
+        }
+        if (5 == vec.size()) {
+            const auto anon_names = unserialize_string(vec[4]);
+            assert(0 == anon_names.size() % 2);
+            for (size_t i = 0; i < anon_names.size(); i += 2) {
+                index.anon_names[TypeText<onion>::toType(anon_names[i])] =
+                    anon_names[i + 1];
+            }
+        }
+
+        indexes[vec[0]] = index;
+    }
+
+    return indexes;
 }
 
 std::unique_ptr<TableMeta>
@@ -465,17 +757,31 @@ TableMeta::deserialize(unsigned int id, const std::string &serial)
 {
     assert(id != 0);
     const auto vec = unserialize_string(serial);
-    assert(5 == vec.size());
+    // tables created before we tracked index onions have no sixth
+    // element, those serialized before rotations retired columns no
+    // seventh
+    assert(5 == vec.size() || 6 == vec.size() || 7 == vec.size());
 
     const std::string anon_table_name = vec[0];
     const bool hasSensitive = string_to_bool(vec[1]);
     const bool has_salt = string_to_bool(vec[2]);
     const std::string salt_name = vec[3];
     const unsigned int counter = atoi(vec[4].c_str());
+    const std::map<std::string, OnionIndex> &indexes =
+        vec.size() >= 6 ? deserializeOnionIndexes(vec[5])
+                        : std::map<std::string, OnionIndex>();
+    std::set<std::string> retired_columns, retired_indexes;
+    if (7 == vec.size()) {
+        const auto retired = unserialize_string(vec[6]);
+        assert(2 == retired.size());
+        retired_columns = deserializeNames(retired[0]);
+        retired_indexes = deserializeNames(retired[1]);
+    }
 
     return std::unique_ptr<TableMeta>
         (new TableMeta(id, anon_table_name, hasSensitive, has_salt,
-                       salt_name, counter));
+                       salt_name, counter, indexes, retired_columns,
+                       retired_indexes));
 }
 
 std::string TableMeta::serialize(const DBObject &parent) const
@@ -485,7 +791,10 @@ std::string TableMeta::serialize(const DBObject &parent) const
         serialize_string(bool_to_string(hasSensitive)) +
         serialize_string(bool_to_string(has_salt)) +
         serialize_string(salt_name) +
-        serialize_string(std::to_string(counter));
+        serialize_string(std::to_string(counter)) +
+        serialize_string(serializeOnionIndexes(indexes)) +
+        serialize_string(serialize_string(serializeNames(retired_columns)) +
+                         serialize_string(serializeNames(retired_indexes)));
 
     return serial;
 }
@@ -532,9 +841,18 @@ std::vector<FieldMeta *> TableMeta::defaultedFieldMetas() const
 }
 
 // TODO: Add salt.
+// > an index a rotation moved keeps the name it was given then
 std::string TableMeta::getAnonIndexName(const std::string &index_name,
                                         onion o) const
 {
+    const OnionIndex *const index = this->getOnionIndex(index_name);
+    if (index) {
+        const auto &it = index->anon_names.find(o);
+        if (index->anon_names.end() != it) {
+            return it->second;
+        }
+    }
+
     const std::string hash_input =
         anon_table_name + index_name + TypeText<onion>::toText(o);
     const std::size_t hsh = std::hash<std::string>()(hash_input);
@@ -542,6 +860,41 @@ std::string TableMeta::getAnonIndexName(const std::string &index_name,
     return std::string("index_") + std::to_string(hsh);
 }
 
+const OnionIndex *
+TableMeta::getOnionIndex(const std::string &index_name) const
+{
+    const auto &it = indexes.find(index_name);
+    if (indexes.end() == it) {
+        return NULL;
+    }
+
+    return &it->second;
+}
+
+void TableMeta::setOnionIndex(const std::string &index_name,
+                              const OnionIndex &index)
+{
+    indexes[index_name] = index;
+}
+
+void TableMeta::removeOnionIndex(const std::string &index_name)
+{
+    indexes.erase(index_name);
+}
+
+void TableMeta::retire(const std::set<std::string> &columns,
+                       const std::set<std::string> &index_names)
+{
+    retired_columns.insert(columns.begin(), columns.end());
+    retired_indexes.insert(index_names.begin(), index_names.end());
+}
+
+void TableMeta::clearRetired()
+{
+    retired_columns.clear();
+    retired_indexes.clear();
+}
+
 std::unique_ptr<DatabaseMeta>
 DatabaseMeta::deserialize(unsigned int id, const std::string &serial)
 {
@@ -593,14 +946,56 @@ SchemaCache::getSchema(const std::unique_ptr<Connect> &conn,
     }
 
     if (true == lowLevelGetCurrentStaleness(e_conn, this->id)) {
-        this->schema =
-            std::shared_ptr<SchemaInfo>(loadSchemaInfo(conn, e_conn));
+        const TraceSpan span("schema_reload");
+        this->schema = std::shared_ptr<SchemaInfo>(this->load(conn, e_conn));
     }
 
     assert(this->schema);
     return this->schema;
 }
 
+// Loads from the snapshot while it matches the table; else walks the table
+// and writes a new snapshot.
+std::unique_ptr<SchemaInfo>
+SchemaCache::load(const std::unique_ptr<Connect> &conn,
+                  const std::unique_ptr<Connect> &e_conn) const
+{
+    // Must be done before loading the children.
+    TEST_SchemaFailure(deltaSanityCheck(conn, e_conn));
+    if (this->snapshot_path.empty()) {
+        return loadSchemaInfo(conn, e_conn, MetaTableSource(e_conn));
+    }
+
+    const MetaSnapshot::Version &version =
+        MetaSnapshot::currentVersion(e_conn);
+    // > another proxy may have written a newer snapshot
+    if (!this->snapshot || false == (version == this->snapshot->getVersion())) {
+        std::unique_ptr<MetaSnapshot>
+            mapped(MetaSnapshot::map(this->snapshot_path));
+        if (mapped) {
+            this->snapshot = std::move(mapped);
+        }
+    }
+    if (this->snapshot && version == this->snapshot->getVersion()) {
+        return loadSchemaInfo(conn, e_conn, *this->snapshot);
+    }
+
+    std::unique_ptr<SchemaInfo> schema =
+        loadSchemaInfo(conn, e_conn,
+                       MetaTableSource(e_conn, this->snapshot.get()));
+    // > a delta committed during the walk would make the snapshot lie
+    if (version == MetaSnapshot::currentVersion(e_conn)) {
+        if (MetaSnapshot::write(this->snapshot_path, version, *schema)) {
+            this->snapshot = MetaSnapshot::map(this->snapshot_path);
+        } else {
+            std::cerr << "failed to write the schema snapshot to "
+                      << this->snapshot_path << std::endl;
+        }
+    }
+
+    return schema;
+}
+
 static void
 lowLevelAllStale(const std::unique_ptr<Connect> &e_conn)
 {
@@ -8,8 +8,10 @@
 #include <main/Translator.hh>
 #include <main/dbobject.hh>
 #include <main/macro_util.hh>
+#include <main/snapshot.hh>
 #include <string>
 #include <map>
+#include <set>
 #include <list>
 #include <iostream>
 #include <sstream>
@@ -28,26 +30,57 @@
  * > Also note that like FieldMeta, OnionMeta's children have an explicit
  *   order that must be encoded.
  */
+// A column's place in a packed AGG onion; every column of the pack
+// shares the onion's name, and so its key and its ciphertext column.
+struct PackedSlot {
+    std::string onionname;
+    unsigned int slot;
+};
+
 class OnionMeta : public DBMeta {
 public:
     // New.
     OnionMeta(onion o, std::vector<SECLEVEL> levels,
               const AES_KEY * const m_key, const Create_field &cf,
-              unsigned long uniq_count, SECLEVEL minimum_seclevel);
+              unsigned long uniq_count, SECLEVEL minimum_seclevel,
+              bool deferred, const PackedSlot *const packed = NULL,
+              bool mope = false, bool ffx = false);
+
+    // New, from the layers a key rotation built (see RotateExecutor).
+    OnionMeta(const std::string &onionname,
+              std::vector<std::unique_ptr<EncLayer> > &&layers,
+              unsigned long uniq_count, SECLEVEL minimum_seclevel,
+              bool deferred)
+        : layers(std::move(layers)), onionname(onionname),
+          uniq_count(uniq_count), minimum_seclevel(minimum_seclevel),
+          deferred(deferred), packed_layer(packedLayer(this->layers)) {}
 
     // Restore.
     static std::unique_ptr<OnionMeta>
         deserialize(unsigned int id, const std::string &serial);
     OnionMeta(unsigned int id, const std::string &onionname,
-              unsigned long uniq_count, SECLEVEL minimum_seclevel)
+              unsigned long uniq_count, SECLEVEL minimum_seclevel,
+              bool deferred, const std::string &next_onionname = "")
         : DBMeta(id), onionname(onionname), uniq_count(uniq_count),
-          minimum_seclevel(minimum_seclevel) {}
+          minimum_seclevel(minimum_seclevel), deferred(deferred),
+          next_onionname(next_onionname), packed_layer(NULL) {}
+
+    // The layers of a new onion column; the keys derive from its name.
+    static std::vector<std::unique_ptr<EncLayer> >
+        newLayers(onion o, const std::vector<SECLEVEL> &levels,
+                  const AES_KEY * const m_key, const Create_field &cf,
+                  const std::string &onionname,
+                  const PackedSlot *const packed = NULL, bool mope = false,
+                  bool ffx = false);
 
     std::string serialize(const DBObject &parent) const;
     std::string getAnonOnionName() const;
+    // The table that indexes an oSWP onion by keyword.
+    std::string getKeywordIndexName() const
+        {return "keywords_" + onionname;}
     TYPENAME("onionMeta")
     std::vector<DBMeta *>
-        fetchChildren(const std::unique_ptr<Connect> &e_conn);
+        fetchChildren(const MetaSource &source);
     bool applyToChildren(std::function<bool(const DBMeta &)>) const;
     UIntMetaKey const &getKey(const DBMeta &child) const;
     EncLayer *getLayerBack() const;
@@ -59,14 +92,39 @@ public:
         {return layers;}
     SECLEVEL getMinimumSecLevel() const {return minimum_seclevel;}
     void setMinimumSecLevel(SECLEVEL seclevel) {this->minimum_seclevel = seclevel;}
+    // INSERT may leave this onion NULL; see DeferredOnions.
+    bool getDeferred() const {return deferred;}
+    // The column is one slot of a packed AGG onion; see HOMPack.
+    const HOMPack *getPacked() const {return packed_layer;}
+
+    // A key rotation is re-encrypting the onion into the column
+    // getNextOnionName() under the next layers; reads keep using the
+    // current layers until RotateExecutor swaps the columns.
+    // > the next layers are children keyed from next_layer_base up
+    bool getRotating() const {return false == next_layers.empty();}
+    std::string getNextOnionName() const {return next_onionname;}
+    void setNextOnionName(const std::string &name)
+        {this->next_onionname = name;}
+    const std::vector<std::unique_ptr<EncLayer> > &getNextLayers() const
+        {return next_layers;}
+    static const unsigned int next_layer_base = 1024;
 
 private:
     // first in list is lowest layer
     std::vector<std::unique_ptr<EncLayer> > layers;
+    std::vector<std::unique_ptr<EncLayer> > next_layers;
     const std::string onionname;
     const unsigned long uniq_count;
     SECLEVEL minimum_seclevel;
+    const bool deferred;
+    std::string next_onionname;
     mutable std::list<std::unique_ptr<UIntMetaKey>> generated_keys;
+    // > found once, when the layers are built or restored; the rewrite
+    //   asks on every column
+    const HOMPack *packed_layer;
+
+    static const HOMPack *
+        packedLayer(const std::vector<std::unique_ptr<EncLayer> > &layers);
 };
 
 class UniqueCounter {
@@ -84,7 +142,11 @@ public:
     // New.
     FieldMeta(const Create_field &field, const AES_KEY * const mKey,
               SECURITY_RATING sec_rating, unsigned long uniq_count,
-              bool unique);
+              bool unique,
+              const std::set<onion> &onion_hint = std::set<onion>(),
+              const std::set<onion> &deferred = std::set<onion>(),
+              const PackedSlot *const packed = NULL, bool mope = false,
+              bool search = false, bool ffx = false);
     // Restore (WARN: Creates an incomplete type as it will not have it's
     // OnionMetas until they are added by the caller).
     static std::unique_ptr<FieldMeta>
@@ -134,12 +196,28 @@ private:
     static onionlayout determineOnionLayout(const AES_KEY *const m_key,
                                             const Create_field &f,
                                             SECURITY_RATING sec_rating);
+    static onionlayout restrictOnionLayout(const onionlayout &layout,
+                                           const std::set<onion> &keep);
+    static onionlayout searchOnionLayout(const onionlayout &layout,
+                                         bool search);
     static bool determineHasDefault(const Create_field &cf);
     static std::string determineDefaultValue(bool has_default,
                                              const Create_field &cf);
     uint64_t &getCounter_() {return counter;}
 };
 
+// A user index and the onions we built it on; each onion gets its own
+// anonymous index so we must remember which of them exist.
+struct OnionIndex {
+    Key::Keytype type;
+    // column and prefix length, 0 means the whole column
+    std::vector<std::pair<std::string, unsigned int> > columns;
+    std::set<onion> onions;
+    // the anonymous names of the onions' indexes that a key rotation
+    // moved to its shadow columns; see TableMeta::getAnonIndexName(...)
+    std::map<onion, std::string> anon_names;
+};
+
 class TableMeta : public MappedDBMeta<FieldMeta, IdentityMetaKey>,
                   public UniqueCounter {
 public:
@@ -154,10 +232,15 @@ public:
         deserialize(unsigned int id, const std::string &serial);
     TableMeta(unsigned int id, const std::string &anon_table_name,
               bool has_sensitive, bool has_salt,
-              const std::string &salt_name, unsigned int counter)
+              const std::string &salt_name, unsigned int counter,
+              const std::map<std::string, OnionIndex> &indexes,
+              const std::set<std::string> &retired_columns,
+              const std::set<std::string> &retired_indexes)
         : MappedDBMeta(id), hasSensitive(has_sensitive),
           has_salt(has_salt), salt_name(salt_name),
-          anon_table_name(anon_table_name), counter(counter) {}
+          anon_table_name(anon_table_name), counter(counter),
+          indexes(indexes), retired_columns(retired_columns),
+          retired_indexes(retired_indexes) {}
     ~TableMeta() {;}
 
     std::string serialize(const DBObject &parent) const;
@@ -167,6 +250,22 @@ public:
     TYPENAME("tableMeta")
     std::string getAnonIndexName(const std::string &index_name,
                                  onion o) const;
+    // NULL for indexes created before we kept track of their onions.
+    const OnionIndex *getOnionIndex(const std::string &index_name) const;
+    void setOnionIndex(const std::string &index_name,
+                       const OnionIndex &index);
+    void removeOnionIndex(const std::string &index_name);
+    const std::map<std::string, OnionIndex> &getOnionIndexes() const
+        {return indexes;}
+    // The backend columns and indexes a key rotation left behind; no
+    // query reads them and they wait to be dropped (see RetireExecutor).
+    void retire(const std::set<std::string> &columns,
+                const std::set<std::string> &index_names);
+    void clearRetired();
+    const std::set<std::string> &getRetiredColumns() const
+        {return retired_columns;}
+    const std::set<std::string> &getRetiredIndexes() const
+        {return retired_indexes;}
 
 private:
     const bool hasSensitive;
@@ -174,6 +273,9 @@ private:
     const std::string salt_name;
     const std::string anon_table_name;
     uint64_t counter;
+    std::map<std::string, OnionIndex> indexes;
+    std::set<std::string> retired_columns;
+    std::set<std::string> retired_indexes;
 
     uint64_t &getCounter_() {return counter;}
 };
@@ -215,10 +317,14 @@ class SchemaCache {
     SchemaCache &operator=(SchemaCache &&cache) = delete;
 
 public:
-    SchemaCache() : no_loads(true), id(randomValue() % UINT_MAX) {}
+    // > an empty 'snapshot_path' loads every schema from the table
+    explicit SchemaCache(const std::string &snapshot_path = "")
+        : no_loads(true), id(randomValue() % UINT_MAX),
+          snapshot_path(snapshot_path) {}
     SchemaCache(SchemaCache &&cache)
         : schema(std::move(cache.schema)), no_loads(cache.no_loads),
-          id(cache.id) {}
+          id(cache.id), snapshot_path(cache.snapshot_path),
+          snapshot(std::move(cache.snapshot)) {}
 
     std::shared_ptr<const SchemaInfo>
         getSchema(const std::unique_ptr<Connect> &conn,
@@ -234,6 +340,12 @@ private:
     mutable std::shared_ptr<const SchemaInfo> schema;
     mutable bool no_loads;
     const unsigned int id;
+    const std::string snapshot_path;
+    mutable std::unique_ptr<MetaSnapshot> snapshot;
+
+    std::unique_ptr<SchemaInfo>
+        load(const std::unique_ptr<Connect> &conn,
+             const std::unique_ptr<Connect> &e_conn) const;
 };
 
 typedef std::shared_ptr<const SchemaInfo> SchemaInfoRef;
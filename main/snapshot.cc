@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <main/snapshot.hh>
+#include <main/schema.hh>
+#include <main/CryptoHandlers.hh>
+#include <main/metadata_tables.hh>
+#include <main/macro_util.hh>
+#include <util/util.hh>
+
+// > the layout of the header and of the entries; bump on any change
+static const char snapshot_magic[8] = {'C', 'D', 'B', 'S', 'N', 'A', 'P',
+                                       '1'};
+static const uint64_t snapshot_format = 1;
+//   magic, format, checksum, objects, completion, entry count, payload
+//   checksum
+static const size_t header_size = sizeof(snapshot_magic) + 6 * 8;
+//   parent_id, id, then the lengths of the key, serial and expanded key
+static const size_t entry_size = 2 * 8 + 3 * 4;
+
+static uint64_t
+fnv1a(const char *const data, size_t length)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+template <typename Type> static void
+put(std::string *const out, Type value)
+{
+    out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// > false if it would read past 'end'
+template <typename Type> static bool
+get(const char **const p, const char *const end, Type *const value)
+{
+    if (static_cast<size_t>(end - *p) < sizeof(Type)) {
+        return false;
+    }
+    memcpy(value, *p, sizeof(Type));
+    *p += sizeof(Type);
+
+    return true;
+}
+
+static uint64_t
+uint64Column(const MYSQL_ROW row, const unsigned long *const l,
+             unsigned int i)
+{
+    TEST_TextMessageError(NULL != row[i],
+                          "metadata version is missing a column");
+    return std::stoull(std::string(row[i], l[i]));
+}
+
+MetaSnapshot::Version
+MetaSnapshot::currentVersion(const std::unique_ptr<Connect> &e_conn)
+{
+    Version version;
+    {
+        std::unique_ptr<DBResult> dbres;
+        TEST_TextMessageError(e_conn->execute(
+            "CHECKSUM TABLE " + MetaData::Table::metaObject() + ";",
+            &dbres), "failed to checksum the metadata");
+        const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+        TEST_TextMessageError(NULL != row,
+                              "failed to checksum the metadata");
+        version.checksum =
+            uint64Column(row, mysql_fetch_lengths(dbres->n), 1);
+    }
+
+    {
+        std::unique_ptr<DBResult> dbres;
+        TEST_TextMessageError(e_conn->execute(
+            " SELECT (SELECT COUNT(*) FROM "
+                        + MetaData::Table::metaObject() + "),"
+            "        (SELECT IFNULL(MAX(id), 0) FROM "
+                        + MetaData::Table::embeddedQueryCompletion()
+                        + ");", &dbres),
+            "failed to read the metadata version");
+        const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+        TEST_TextMessageError(NULL != row,
+                              "failed to read the metadata version");
+        const unsigned long *const l = mysql_fetch_lengths(dbres->n);
+        version.objects = uint64Column(row, l, 0);
+        version.completion = uint64Column(row, l, 1);
+    }
+
+    return version;
+}
+
+std::unique_ptr<MetaSnapshot>
+MetaSnapshot::map(const std::string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return std::unique_ptr<MetaSnapshot>();
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st)
+        || static_cast<size_t>(st.st_size) < header_size) {
+        close(fd);
+        return std::unique_ptr<MetaSnapshot>();
+    }
+    const size_t size = st.st_size;
+    void *const data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // > the mapping outlives the descriptor
+    close(fd);
+    if (MAP_FAILED == data) {
+        return std::unique_ptr<MetaSnapshot>();
+    }
+
+    const char *p = static_cast<const char *>(data);
+    const char *const end = p + size;
+    const auto fail = [data, size] () {
+        munmap(data, size);
+        std::cerr << "ignoring a damaged schema snapshot" << std::endl;
+        return std::unique_ptr<MetaSnapshot>();
+    };
+
+    if (0 != memcmp(p, snapshot_magic, sizeof(snapshot_magic))) {
+        return fail();
+    }
+    p += sizeof(snapshot_magic);
+
+    uint64_t format, count, payload_checksum;
+    Version version;
+    if (false == (get(&p, end, &format) && get(&p, end, &version.checksum)
+                  && get(&p, end, &version.objects)
+                  && get(&p, end, &version.completion)
+                  && get(&p, end, &count)
+                  && get(&p, end, &payload_checksum))
+        || snapshot_format != format
+        || fnv1a(p, end - p) != payload_checksum
+        || count > static_cast<uint64_t>(end - p) / entry_size) {
+        return fail();
+    }
+
+    std::vector<Entry> entries;
+    entries.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        Entry entry;
+        if (false == (get(&p, end, &entry.parent_id)
+                      && get(&p, end, &entry.id)
+                      && get(&p, end, &entry.key_length)
+                      && get(&p, end, &entry.serial_length)
+                      && get(&p, end, &entry.expanded_length))) {
+            return fail();
+        }
+        const uint64_t lengths = static_cast<uint64_t>(entry.key_length)
+                                 + entry.serial_length
+                                 + entry.expanded_length;
+        if (static_cast<uint64_t>(end - p) < lengths) {
+            return fail();
+        }
+        entry.key = p;
+        entry.serial = entry.key + entry.key_length;
+        entry.expanded = entry.serial + entry.serial_length;
+        p = entry.expanded + entry.expanded_length;
+
+        if (false == entries.empty()
+            && entries.back().parent_id > entry.parent_id) {
+            return fail();
+        }
+        entries.push_back(entry);
+    }
+    if (end != p) {
+        return fail();
+    }
+
+    return std::unique_ptr<MetaSnapshot>(
+        new MetaSnapshot(data, size, version, std::move(entries)));
+}
+
+static bool
+writeAll(int fd, const std::string &s)
+{
+    for (size_t done = 0; done < s.size(); ) {
+        const ssize_t n = ::write(fd, s.data() + done, s.size() - done);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+
+    return true;
+}
+
+bool
+MetaSnapshot::write(const std::string &path, const Version &version,
+                    const SchemaInfo &schema)
+{
+    struct Row {
+        uint64_t parent_id;
+        uint64_t id;
+        std::string key;
+        std::string serial;
+        std::string expanded;
+    };
+
+    // > this is where a new HOM key pays for its expansion, once
+    std::vector<Row> rows;
+    std::function<void(const DBMeta &)> collect =
+        [&collect, &rows] (const DBMeta &parent)
+    {
+        parent.applyToChildren(
+            [&collect, &rows, &parent] (const DBMeta &child)
+        {
+            rows.push_back(Row{parent.getDatabaseID(), child.getDatabaseID(),
+                               parent.getKey(child).getSerial(),
+                               child.serialize(parent),
+                               EncLayer::instanceTypeName()
+                                   == child.typeName()
+                               ? static_cast<const EncLayer &>(child)
+                                   .expandedKey()
+                               : ""});
+            collect(child);
+            return true;
+        });
+    };
+    collect(schema);
+    std::stable_sort(rows.begin(), rows.end(),
+                     [] (const Row &a, const Row &b)
+                     {
+                         return a.parent_id < b.parent_id
+                             || (a.parent_id == b.parent_id && a.id < b.id);
+                     });
+
+    std::string payload;
+    for (const auto &it : rows) {
+        put(&payload, it.parent_id);
+        put(&payload, it.id);
+        put(&payload, static_cast<uint32_t>(it.key.size()));
+        put(&payload, static_cast<uint32_t>(it.serial.size()));
+        put(&payload, static_cast<uint32_t>(it.expanded.size()));
+        payload += it.key + it.serial + it.expanded;
+    }
+
+    std::string header(snapshot_magic, sizeof(snapshot_magic));
+    put(&header, snapshot_format);
+    put(&header, version.checksum);
+    put(&header, version.objects);
+    put(&header, version.completion);
+    put(&header, static_cast<uint64_t>(rows.size()));
+    put(&header, fnv1a(payload.data(), payload.size()));
+    assert(header_size == header.size());
+
+    // > written aside and renamed over the old one, so that a proxy
+    //   never maps half a snapshot; the keys in it are for the proxy's
+    //   user alone, and it is on disk before it replaces the old one
+    const std::string &temp = path + "." + std::to_string(randomValue());
+    const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    const bool written =
+        writeAll(fd, header) && writeAll(fd, payload) && 0 == fsync(fd);
+    if (0 != close(fd) || false == written
+        || 0 != rename(temp.c_str(), path.c_str())) {
+        unlink(temp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+MetaSnapshot::MetaSnapshot(void *data, size_t size, const Version &version,
+                           std::vector<Entry> &&entries)
+    : data(data), size(size), version(version), entries(std::move(entries))
+{
+    for (size_t i = 0; i < this->entries.size(); ++i) {
+        this->by_id[this->entries[i].id] = i;
+    }
+}
+
+MetaSnapshot::~MetaSnapshot()
+{
+    munmap(this->data, this->size);
+}
+
+void
+MetaSnapshot::children(unsigned int parent_id,
+                       std::function<void(const std::string &,
+                                          const std::string &,
+                                          const std::string &)> fn) const
+{
+    auto it =
+        std::lower_bound(this->entries.begin(), this->entries.end(),
+                         parent_id,
+                         [] (const Entry &entry, uint64_t id)
+                         {
+                             return entry.parent_id < id;
+                         });
+    for (; it != this->entries.end() && parent_id == it->parent_id; ++it) {
+        fn(std::string(it->key, it->key_length),
+           std::string(it->serial, it->serial_length),
+           std::to_string(it->id));
+    }
+}
+
+std::string
+MetaSnapshot::expandedKey(unsigned int id, const std::string &serial) const
+{
+    const auto &it = this->by_id.find(id);
+    if (this->by_id.end() == it) {
+        return "";
+    }
+
+    // > a layer that was replaced may have come back under the same id
+    const Entry &entry = this->entries[it->second];
+    if (serial.size() != entry.serial_length
+        || 0 != memcmp(serial.data(), entry.serial, entry.serial_length)) {
+        return "";
+    }
+
+    return std::string(entry.expanded, entry.expanded_length);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include <main/dbobject.hh>
+
+class SchemaInfo;
+
+// A binary copy of the metadata table, with the expanded keys of the
+// layers, mapped from a file; a proxy loads its schema from it instead of
+// walking the table while the table is as it was when the copy was made.
+// > the file is written next to the embedded database after each load
+//   that had to walk the table, ie after each committed delta.
+// > a damaged file, or one of another format, is ignored.
+class MetaSnapshot : public MetaSource {
+public:
+    // what the metadata table looked like
+    struct Version {
+        uint64_t checksum;
+        uint64_t objects;
+        // the last DDL or onion adjustment that was recorded
+        uint64_t completion;
+
+        bool operator==(const Version &other) const
+        {
+            return checksum == other.checksum
+                && objects == other.objects
+                && completion == other.completion;
+        }
+    };
+
+    static Version currentVersion(const std::unique_ptr<Connect> &e_conn);
+    // NULL if there is no usable snapshot at 'path'
+    static std::unique_ptr<MetaSnapshot> map(const std::string &path);
+    // replaces the snapshot at 'path' with 'schema', as loaded when the
+    // table was at 'version'
+    static bool write(const std::string &path, const Version &version,
+                      const SchemaInfo &schema);
+
+    ~MetaSnapshot();
+
+    const Version &getVersion() const {return version;}
+    void children(unsigned int parent_id,
+                  std::function<void(const std::string &,
+                                     const std::string &,
+                                     const std::string &)> fn) const;
+    std::string expandedKey(unsigned int id, const std::string &serial)
+        const;
+
+private:
+    // points into the mapping
+    struct Entry {
+        uint64_t parent_id;
+        uint64_t id;
+        const char *key;
+        uint32_t key_length;
+        const char *serial;
+        uint32_t serial_length;
+        const char *expanded;
+        uint32_t expanded_length;
+    };
+
+    void *const data;
+    const size_t size;
+    const Version version;
+    // in parent_id order
+    const std::vector<Entry> entries;
+    // id -> entries index
+    std::unordered_map<uint64_t, size_t> by_id;
+
+    MetaSnapshot(void *data, size_t size, const Version &version,
+                 std::vector<Entry> &&entries);
+    MetaSnapshot(const MetaSnapshot &) = delete;
+    MetaSnapshot &operator=(const MetaSnapshot &) = delete;
+};
@@ -0,0 +1,171 @@
+#include <main/trace.hh>
+#include <main/phase.hh>
+#include <util/scoped_lock.hh>
+
+#include <atomic>
+#include <sstream>
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+__thread QueryTrace *QueryTrace::current = NULL;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+// > zero when tracing is off
+static std::atomic<unsigned int> trace_every(0);
+static std::atomic<uint64_t> trace_statements(0);
+
+bool
+QueryTrace::configure(const std::string &path, unsigned int sample_every)
+{
+    scoped_lock l(&trace_lock);
+
+    if (trace_file) {
+        trace_every.store(0);
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    if (path.empty() || 0 == sample_every) {
+        return true;
+    }
+
+    trace_file = fopen(path.c_str(), "w");
+    if (NULL == trace_file) {
+        return false;
+    }
+    fputs("[\n", trace_file);
+    fflush(trace_file);
+
+    trace_every.store(sample_every);
+    return true;
+}
+
+std::unique_ptr<QueryTrace>
+QueryTrace::sample(const std::string &query)
+{
+    const unsigned int every = trace_every.load(std::memory_order_relaxed);
+    if (0 == every) {
+        return std::unique_ptr<QueryTrace>();
+    }
+
+    const uint64_t n =
+        trace_statements.fetch_add(1, std::memory_order_relaxed);
+    if (0 != n % every) {
+        return std::unique_ptr<QueryTrace>();
+    }
+
+    return std::unique_ptr<QueryTrace>(new QueryTrace(query, n));
+}
+
+QueryTrace::QueryTrace(const std::string &query, uint64_t id)
+    : query(query), id(id), start(PhaseTimer::now()) {}
+
+// > ciphertexts and binary values are not UTF-8; every byte outside
+//   printable ASCII becomes the code point of the same value, so the
+//   file stays valid JSON and the bytes can be read back.
+static std::string
+jsonString(const std::string &s)
+{
+    std::ostringstream out;
+    out << "\"";
+    for (const char c : s) {
+        switch (c) {
+        case '"':   out << "\\\""; break;
+        case '\\':  out << "\\\\"; break;
+        case '\n':  out << "\\n"; break;
+        case '\r':  out << "\\r"; break;
+        case '\t':  out << "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20
+                || static_cast<unsigned char>(c) >= 0x7f) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x",
+                         static_cast<unsigned int>(
+                             static_cast<unsigned char>(c)));
+                out << buf;
+            } else {
+                out << c;
+            }
+        }
+    }
+    out << "\"";
+
+    return out.str();
+}
+
+// > the viewers want microseconds
+static std::string
+usec(uint64_t nsec)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%03llu",
+             static_cast<unsigned long long>(nsec / 1000),
+             static_cast<unsigned long long>(nsec % 1000));
+    return buf;
+}
+
+QueryTrace::~QueryTrace()
+{
+    assert(this != current);
+    this->span("statement", this->start, PhaseTimer::now(), "query",
+               this->query);
+
+    // > each statement gets its own row in the viewer
+    std::ostringstream out;
+    for (const auto &it : this->events) {
+        out << "{\"name\":" << jsonString(it.name)
+            << ",\"ph\":\"X\",\"pid\":" << getpid()
+            << ",\"tid\":" << this->id
+            << ",\"ts\":" << usec(it.start)
+            << ",\"dur\":" << usec(it.end - it.start);
+        if (it.arg_name) {
+            out << ",\"args\":{" << jsonString(it.arg_name) << ":"
+                << jsonString(it.arg) << "}";
+        }
+        out << "},\n";
+    }
+
+    const std::string &s = out.str();
+    scoped_lock l(&trace_lock);
+    if (trace_file) {
+        fwrite(s.data(), 1, s.size(), trace_file);
+        fflush(trace_file);
+    }
+}
+
+void
+QueryTrace::span(const char *name, uint64_t start, uint64_t end,
+                 const char *arg_name, const std::string &arg)
+{
+    this->events.push_back(Event{name, start, end, arg_name, arg});
+}
+
+QueryTrace::Scope::Scope(QueryTrace *trace)
+    : previous(current)
+{
+    current = trace;
+}
+
+QueryTrace::Scope::~Scope()
+{
+    current = previous;
+}
+
+TraceSpan::TraceSpan(const char *name)
+    : trace(QueryTrace::active()), name(name), arg_name(NULL),
+      start(trace ? PhaseTimer::now() : 0) {}
+
+TraceSpan::TraceSpan(const char *name, const char *arg_name,
+                     const std::string &arg)
+    : trace(QueryTrace::active()), name(name), arg_name(arg_name),
+      arg(trace ? arg : std::string()),
+      start(trace ? PhaseTimer::now() : 0) {}
+
+TraceSpan::~TraceSpan()
+{
+    if (trace) {
+        trace->span(name, start, PhaseTimer::now(), arg_name, arg);
+    }
+}
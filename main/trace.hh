@@ -0,0 +1,84 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Span trees of sampled statements in the Chrome trace event format, for
+// chrome://tracing or Perfetto.
+// > every PhaseTimer of a sampled statement becomes a span.
+// > the file is a JSON array that is never closed, which the viewers
+//   accept; so a killed proxy still leaves a readable trace.
+// > with tracing off, or for a statement that is not sampled, a span
+//   costs one thread local load.
+class QueryTrace {
+public:
+    // trace one statement in @sample_every to @path
+    static bool configure(const std::string &path,
+                          unsigned int sample_every);
+
+    // NULL unless tracing is on and this statement is sampled
+    static std::unique_ptr<QueryTrace> sample(const std::string &query);
+    // the trace the calling thread is working for, if any
+    static QueryTrace *active() {return current;}
+
+    // closes the statement span and writes the trace out
+    ~QueryTrace();
+
+    void span(const char *name, uint64_t start, uint64_t end,
+              const char *arg_name, const std::string &arg);
+
+    // makes @trace the thread's active trace for the life of the scope;
+    // the proxy works on one statement over several calls
+    class Scope {
+    public:
+        explicit Scope(QueryTrace *trace);
+        ~Scope();
+
+    private:
+        QueryTrace *const previous;
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+private:
+    struct Event {
+        const char *name;
+        uint64_t start;
+        uint64_t end;
+        const char *arg_name;
+        std::string arg;
+    };
+
+    const std::string query;
+    const uint64_t id;
+    const uint64_t start;
+    std::vector<Event> events;
+
+    static __thread QueryTrace *current;
+
+    QueryTrace(const std::string &query, uint64_t id);
+    QueryTrace(const QueryTrace &) = delete;
+    QueryTrace &operator=(const QueryTrace &) = delete;
+};
+
+// Adds a span from construction to destruction to the active trace.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name);
+    TraceSpan(const char *name, const char *arg_name,
+              const std::string &arg);
+    ~TraceSpan();
+
+private:
+    QueryTrace *const trace;
+    const char *const name;
+    const char *const arg_name;
+    const std::string arg;
+    const uint64_t start;
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+};
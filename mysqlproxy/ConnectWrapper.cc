@@ -12,6 +12,8 @@
 #include <main/rewrite_util.hh>
 #include <main/schema.hh>
 #include <main/Analysis.hh>
+#include <main/phase.hh>
+#include <main/trace.hh>
 
 #include <parser/sql_utils.hh>
 #include <parser/mysql_type_metadata.hh>
@@ -75,6 +77,12 @@ public:
     //        is using
     std::vector<SchemaInfoRef> schema_info_refs;
 
+    // the sampled statement spans rewrite(...) and every next(...) call;
+    // a rewritten query runs between two calls
+    std::unique_ptr<QueryTrace> trace;
+    uint64_t backend_start;
+    std::string backend_query;
+
 private:
     std::unique_ptr<QueryRewrite> qr;
 };
@@ -181,6 +189,28 @@ connect(lua_State *const L)
             //cl->loadEncTables(string(ev));
         }
 
+        // periodically write the live phase counters to a file
+        ev = getenv("CRYPTDB_STATUS_FILE");
+        if (ev) {
+            const char *const interval = getenv("CRYPTDB_STATUS_INTERVAL");
+            const unsigned int seconds = interval ? atoi(interval) : 10;
+            if (false == PhaseCounters::startDump(ev, seconds)) {
+                std::cerr << "failed to start dumping status to " << ev
+                          << std::endl;
+            }
+        }
+
+        // trace one statement in CRYPTDB_TRACE_SAMPLE (default 100)
+        ev = getenv("CRYPTDB_TRACE_FILE");
+        if (ev) {
+            const char *const sample = getenv("CRYPTDB_TRACE_SAMPLE");
+            const unsigned int every = sample ? atoi(sample) : 100;
+            if (false == QueryTrace::configure(ev, every)) {
+                std::cerr << "failed to start tracing to " << ev
+                          << std::endl;
+            }
+        }
+
         ev = getenv("LOG_PLAIN_QUERIES");
         if (ev) {
             std::string logPlainQueries = std::string(ev);
@@ -273,6 +303,12 @@ rewrite(lua_State *const L)
     c_wrapper->last_query = query;
     t.lap_ms();
     if (EXECUTE_QUERIES) {
+        // > a failed statement is over; its trace is written out once
+        //   the scope is gone
+        std::unique_ptr<QueryTrace> failed_trace;
+        c_wrapper->trace = QueryTrace::sample(query);
+        c_wrapper->backend_query.clear();
+        const QueryTrace::Scope trace_scope(c_wrapper->trace.get());
         try {
             TEST_Text(retrieveDefaultDatabase(_thread_id, ps->getConn(),
                                               &c_wrapper->default_db),
@@ -291,10 +327,12 @@ rewrite(lua_State *const L)
 
             c_wrapper->setQueryRewrite(std::move(qr));
         } catch (const AbstractException &e) {
+            failed_trace = std::move(c_wrapper->trace);
             lua_pushboolean(L, false);              // status
             xlua_pushlstring(L, e.to_string());     // error message
             return 2;
         } catch (const CryptDBError &e) {
+            failed_trace = std::move(c_wrapper->trace);
             lua_pushboolean(L, false);              // status
             xlua_pushlstring(L, e.msg);             // error message
             return 2;
@@ -431,6 +469,17 @@ next(lua_State *const L)
 
     const ResType &res = getResTypeFromLuaTable(L, 2, 3, 4, 5, 6);
     const std::unique_ptr<QueryRewrite> &qr = c_wrapper->getQueryRewrite();
+
+    // > once the statement is over its trace is written out, after the
+    //   scope is gone
+    std::unique_ptr<QueryTrace> finished_trace;
+    const QueryTrace::Scope trace_scope(c_wrapper->trace.get());
+    if (c_wrapper->trace && false == c_wrapper->backend_query.empty()) {
+        c_wrapper->trace->span("query", c_wrapper->backend_start,
+                               PhaseTimer::now(), "query",
+                               c_wrapper->backend_query);
+        c_wrapper->backend_query.clear();
+    }
     try {
         NextParams nparams(*ps, c_wrapper->default_db, c_wrapper->last_query);
 
@@ -443,6 +492,7 @@ next(lua_State *const L)
             // set the killzone when we are done with this query
             // > a given killzone will only apply to the next query translation
             c_wrapper->setKillZone(qr->kill_zone);
+            finished_trace = std::move(c_wrapper->trace);
         }
         switch (result_type) {
         case AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN: {
@@ -457,6 +507,10 @@ next(lua_State *const L)
 
             const auto &next_query = output.second;
             xlua_pushlstring(L, next_query);
+            if (c_wrapper->trace) {
+                c_wrapper->backend_start = PhaseTimer::now();
+                c_wrapper->backend_query = next_query;
+            }
 
             nilBuffer(L, 2);
             return 5;
@@ -484,6 +538,7 @@ next(lua_State *const L)
             assert(false);
         }
     } catch (const ErrorPacketException &e) {
+        finished_trace = std::move(c_wrapper->trace);
         // lua_pop(L, lua_gettop(L));
         xlua_pushlstring(L, "error");
         xlua_pushlstring(L, e.getMessage());
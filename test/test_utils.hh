@@ -15,6 +15,7 @@
 #include <util/util.hh>
 #include <parser/sql_utils.hh>
 #include <main/rewrite_main.hh>
+#include <main/phase.hh>
 
 typedef std::map<const std::string, const std::string> FieldOnionState;
 typedef std::map<const std::string, FieldOnionState> TableOnionState;
@@ -236,3 +237,94 @@ testSlowMatch()
 
     return false;
 }
+
+// > the status directive and the dump thread name every counted detail;
+//   a layer encrypt must show up by its SECLEVEL and a detail that is
+//   not a SECLEVEL must not throw
+inline bool
+testPhaseStatus()
+{
+    {
+        const PhaseTimer t(Phase::LAYER_ENCRYPT,
+                           static_cast<unsigned int>(SECLEVEL::DET));
+    }
+    {
+        const PhaseTimer t(Phase::LAYER_DECRYPT, phase_detail_count - 1);
+    }
+
+    std::string text;
+    try {
+        text = PhaseCounters::statusText();
+    } catch (...) {
+        return false;
+    }
+
+    return std::string::npos != text.find("layer_encrypt\tDET\t");
+}
+
+// > the statements the proxy forwards without parsing them
+inline bool
+testLexicallyPlain()
+{
+    SchemaInfo schema;
+    std::unique_ptr<DatabaseMeta> db(new DatabaseMeta());
+    db->addChild(IdentityMetaKey("secrets"),
+                 std::unique_ptr<TableMeta>(new TableMeta(true, true)));
+    schema.addChild(IdentityMetaKey("cryptdbtest"), std::move(db));
+
+    const std::vector<std::string> plain({
+        "SELECT 1",
+        "select @@version_comment limit 1",
+        "SET @x = 'cryptdb', @y = 2",
+        "SET NAMES utf8",
+        "BEGIN",
+        "COMMIT WORK",
+        "SHOW DATABASES",
+        "SELECT * FROM other /* secrets */ -- secrets",
+        "SELECT 'secrets';  "
+    });
+    const std::vector<std::string> parsed({
+        // directives, however the variable is spelled
+        "SET @cryptdb='show'",
+        "SET @CryptDB='show'",
+        "SET @`cryptdb`='status'",
+        "SET @'cryptdb'='adjust'",
+        "SET @\"cryptdb\"='adjust'",
+        "SET @ cryptdb='show'",
+        "SET @x = 1, @`cryptdb` = 'status'",
+        // executable comments
+        "SELECT /*!40001 SQL_NO_CACHE */ 1",
+        "SELECT 1 /*! FROM secrets */",
+        // multi statements
+        "SELECT 1; SELECT 2",
+        "SELECT 1; DELETE FROM secrets",
+        // unqualified encrypted tables and databases, in any case
+        "SELECT * FROM secrets",
+        "SELECT * FROM SECRETS",
+        "select * from `Secrets`",
+        "SELECT * FROM \"secrets\"",
+        "SELECT * FROM CryptDBTest.other",
+        // the client may not turn on SQL_SAFE_UPDATES
+        "SET SQL_SAFE_UPDATES = 1",
+        "SET @@session.sql_safe_updates = 1",
+        // unterminated quotes and comments
+        "SELECT 'secrets",
+        "SELECT 1 /* secrets",
+        // statements we always parse
+        "DELETE FROM other",
+        "ROLLBACK TO SAVEPOINT x"
+    });
+
+    for (const auto &it : plain) {
+        if (false == lexicallyPlain(it, schema)) {
+            return false;
+        }
+    }
+    for (const auto &it : parsed) {
+        if (true == lexicallyPlain(it, schema)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,720 @@
+/*
+ * cryptdbexport
+ *
+ * Writes the plaintext of encrypted tables as CSV or SQL, reading the
+ * backend directly rather than through the proxy.
+ *
+ *   obj/tools/export/cryptdbexport -u root -p letmein -d shop -F csv \
+ *       -o /backups/shop -j 8
+ *
+ * The reader walks each anonymized table in chunks of -c rows, ordered by
+ * the backend's PRIMARY KEY, or by a UNIQUE key on NOT NULL columns. A
+ * pool of -j workers decrypts the chunks a column at a time against the
+ * schema in the embedded metadata, and the chunks are written in table
+ * order as they finish.
+ *
+ * Each field is decrypted from the cheapest onion it has: oPLAIN, oDET,
+ * oOPE, then oAGG.
+ * > a table with neither key is refused; reading it by LIMIT offset would
+ *   be quadratic in its size.
+ *
+ * CSV is written the way SELECT ... INTO OUTFILE writes it, so it loads
+ * back with
+ *
+ *   LOAD DATA INFILE 't.csv' INTO TABLE t FIELDS TERMINATED BY ','
+ *       IGNORE 1 LINES;
+ */
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <main/rewrite_main.hh>
+#include <main/rewrite_util.hh>
+#include <main/phase.hh>
+#include <parser/lex_util.hh>
+#include <parser/sql_utils.hh>
+#include <cryptdbexport.hh>
+
+static void help(const char *prog)
+{
+    std::cout << "Usage: " << prog <<
+        " -u user -p password -d database [-t table] [-F csv|sql]"
+        " [-o output directory] [-j workers] [-c chunk rows]"
+        " [-k master key] [-e embedded dir]" << "\n";
+}
+
+/*
+ * Tables
+ */
+
+// > a deferred onion may still be NULL, and a packed AGG onion holds
+//   several fields.
+static bool
+exportOnion(const FieldMeta &fm, onion *const out)
+{
+    for (const onion o : {oPLAIN, oDET, oOPE, oAGG}) {
+        const OnionMeta *const om = fm.getOnionMeta(o);
+        if (om && false == om->getDeferred() && NULL == om->getPacked()) {
+            *out = o;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// > a UNIQUE key may hold any number of NULLs, and a row whose key is NULL
+//   is never greater than the last one; so only NOT NULL columns do.
+static bool
+nullableKey(const std::unique_ptr<Connect> &conn, const ExportTable &table,
+            const std::vector<std::string> &columns)
+{
+    std::vector<std::string> names;
+    for (const auto &it : columns) {
+        names.push_back("'" + it + "'");
+    }
+
+    const std::string &q =
+        "SELECT COUNT(*) FROM information_schema.COLUMNS"
+        " WHERE TABLE_SCHEMA = '" + escapeString(conn, table.db) + "'"
+        "   AND TABLE_NAME = '" + table.anon_table + "'"
+        "   AND IS_NULLABLE = 'YES'"
+        "   AND COLUMN_NAME IN (" + vector_join(names, ",") + ");";
+    std::unique_ptr<DBResult> dbres;
+    TEST_TextMessageError(conn->execute(q, &dbres) && dbres && dbres->n,
+                          "failed: " + q + "\n  " + conn->getError());
+    const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+    assert(row && row[0]);
+
+    return 0 != strtoul(row[0], NULL, 10);
+}
+
+// The anonymized columns of 'index' on its onion, or false if that onion
+// is not filled in yet.
+static bool
+keyColumns(const TableMeta &tm, const OnionIndex &index,
+           std::vector<std::string> *const out)
+{
+    // > the index lives on a single onion; see rewrite_key(...)
+    const onion key_onion = *index.onions.begin();
+    for (const auto &it : index.columns) {
+        const FieldMeta *const fm = tm.findChild(it.first, true);
+        assert(fm && fm->getOnionMeta(key_onion));
+        const OnionMeta &om = *fm->getOnionMeta(key_onion);
+        if (om.getDeferred()) {
+            return false;
+        }
+        out->push_back(om.getAnonOnionName());
+    }
+
+    return true;
+}
+
+static bool
+describeTable(const SchemaInfo &schema, const std::unique_ptr<Connect> &conn,
+              const std::string &db, const std::string &table,
+              ExportTable *const out)
+{
+    const DatabaseMeta *const dm = schema.findChild(db);
+    const TableMeta *const tm = dm ? dm->findChild(table) : NULL;
+    if (NULL == tm) {
+        std::cerr << "no table " << db << "." << table << "\n";
+        return false;
+    }
+
+    out->db = db;
+    out->table = table;
+    out->anon_table = tm->getAnonTableName();
+
+    const std::vector<FieldMeta *> &fms = tm->orderedFieldMetas();
+    for (const auto &it : fms) {
+        onion o;
+        if (false == exportOnion(*it, &o)) {
+            std::cerr << "no onion to decrypt " << table << "."
+                      << it->getFieldName() << " from\n";
+            return false;
+        }
+        out->fields.push_back(std::make_pair(it->getFieldName(), o));
+        out->select.push_back(
+            "`" + it->getOnionMeta(o)->getAnonOnionName() + "`");
+    }
+    for (const auto &it : fms) {
+        if (false == it->getHasSalt()) {
+            out->salt_pos.push_back(-1);
+            continue;
+        }
+        out->salt_pos.push_back(out->select.size());
+        out->select.push_back("`" + it->getSaltName() + "`");
+    }
+
+    // > the PRIMARY KEY first, then the UNIQUE keys in name order
+    std::vector<const OnionIndex *> candidates;
+    const OnionIndex *const primary = tm->getOnionIndex("PRIMARY");
+    if (primary) {
+        candidates.push_back(primary);
+    }
+    for (const auto &it : tm->getOnionIndexes()) {
+        if (Key::UNIQUE == it.second.type) {
+            candidates.push_back(&it.second);
+        }
+    }
+
+    for (const auto &it : candidates) {
+        std::vector<std::string> columns;
+        if (it->onions.empty() || false == keyColumns(*tm, *it, &columns)) {
+            continue;
+        }
+        if (it != primary && nullableKey(conn, *out, columns)) {
+            continue;
+        }
+
+        for (const auto &column : columns) {
+            out->key.push_back("`" + column + "`");
+        }
+        out->select.insert(out->select.end(), out->key.begin(),
+                           out->key.end());
+        return true;
+    }
+
+    std::cerr << "no PRIMARY KEY or NOT NULL UNIQUE key to read " << db
+              << "." << table << " by; add one, or export it through the"
+              << " proxy\n";
+    return false;
+}
+
+// The key of the chunk's last row as SQL literals, for the next chunk's
+// WHERE.
+static std::string
+lastKey(MYSQL_RES *const res, unsigned int first)
+{
+    mysql_data_seek(res, mysql_num_rows(res) - 1);
+    const MYSQL_ROW row = mysql_fetch_row(res);
+    const unsigned long *const lengths = mysql_fetch_lengths(res);
+    const MYSQL_FIELD *const fields = mysql_fetch_fields(res);
+
+    std::vector<std::string> literals;
+    for (unsigned int i = first; i < mysql_num_fields(res); ++i) {
+        assert(row[i]);
+        const std::string value(row[i], lengths[i]);
+        literals.push_back(IS_NUM(fields[i].type)
+                           ? value : "X'" + toHex(value) + "'");
+    }
+
+    // > the worker unpacks the chunk from its first row
+    mysql_data_seek(res, 0);
+    return vector_join(literals, ",");
+}
+
+/*
+ * Output
+ */
+
+// As SELECT ... INTO OUTFILE escapes a field that is not enclosed: the
+// escape character, the first characters of the field and line
+// terminators, and NUL as \0.
+static std::string
+csvEscape(const std::string &s)
+{
+    std::string out;
+    for (const char c : s) {
+        switch (c) {
+        case '\0':
+            out += "\\0";
+            break;
+        case '\\':
+        case ',':
+        case '\n':
+            out += '\\';
+            out += c;
+            break;
+        default:
+            out += c;
+        }
+    }
+
+    return out;
+}
+
+// > NULL is \N, as LOAD DATA reads it.
+static std::string
+csvField(const Item &item)
+{
+    if (RiboldMYSQL::is_null(item)) {
+        return "\\N";
+    }
+
+    return csvEscape(ItemToString(item));
+}
+
+static std::string
+sqlValue(const Item &item)
+{
+    if (RiboldMYSQL::is_null(item)) {
+        return "NULL";
+    }
+
+    const std::string &s = ItemToString(item);
+    if (Item::Type::STRING_ITEM != item.type()) {
+        return s;
+    }
+
+    std::string out = "'";
+    for (const char c : s) {
+        switch (c) {
+        case '\0':
+            out += "\\0";
+            break;
+        case '\'':
+            out += "\\'";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\032':
+            out += "\\Z";
+            break;
+        default:
+            out += c;
+        }
+    }
+
+    return out + "'";
+}
+
+static std::string
+sqlInsertHead(const ExportTable &table)
+{
+    std::vector<std::string> names;
+    for (const auto &it : table.fields) {
+        names.push_back("`" + it.first + "`");
+    }
+
+    return "INSERT INTO `" + table.table + "` ("
+           + vector_join(names, ",") + ") VALUES\n";
+}
+
+/*
+ * Chunks
+ */
+
+unsigned long
+ExportState::admit()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock,
+                 [this] () {return next_seq < next_write + window;});
+    return next_seq++;
+}
+
+void
+ExportState::push(ExportJob &&job)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+    changed.notify_all();
+}
+
+bool
+ExportState::pop(ExportJob *const out)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] () {return closed || !jobs.empty();});
+    if (jobs.empty()) {
+        return false;
+    }
+
+    *out = std::move(jobs.front());
+    jobs.pop_front();
+    return true;
+}
+
+void
+ExportState::deliver(unsigned long seq, std::ostream *const out,
+                     std::string &&text)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    written[seq] = std::make_pair(out, std::move(text));
+    for (auto it = written.find(next_write); written.end() != it;
+         it = written.find(next_write)) {
+        *it->second.first << it->second.second;
+        written.erase(it);
+        ++next_write;
+    }
+    changed.notify_all();
+}
+
+void
+ExportState::drain()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] () {return next_write == next_seq;});
+}
+
+void
+ExportState::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    changed.notify_all();
+}
+
+/*
+ * Workers
+ */
+
+ExportWorker::ExportWorker(ExportState &state)
+    : state(state), ps(state.shared),
+      conn(new Connect(state.ci.server, state.ci.user, state.ci.passwd,
+                       state.ci.port))
+{
+    thread_ps = &ps;
+    ps.safeCreateEmbeddedTHD();
+    this->schema = loadSchemaInfo(conn, ps.getEConn());
+}
+
+void
+ExportWorker::run()
+{
+    ExportJob job;
+    while (state.pop(&job)) {
+        std::string text;
+        if (false == state.failed) {
+            thread_ps = &ps;
+            ps.safeCreateEmbeddedTHD();
+            try {
+                text = this->decrypt(job);
+            } catch (const AbstractException &e) {
+                std::cerr << "failed: " << job.table->table << "\n  "
+                          << e.to_string() << "\n";
+                state.failed = true;
+            } catch (const CryptDBError &e) {
+                std::cerr << "failed: " << job.table->table << "\n  "
+                          << e.msg << "\n";
+                state.failed = true;
+            }
+            // > the chunk's Items live on the THD
+            ps.releaseTHDs();
+        }
+
+        // > a failed chunk is delivered empty so that the ones after it
+        //   are not stuck behind it
+        job.dbres.reset();
+        state.deliver(job.seq, job.out, std::move(text));
+    }
+}
+
+// Mirrors Rewriter::decryptResults(...).
+std::string
+ExportWorker::decrypt(const ExportJob &job)
+{
+    const ExportTable &table = *job.table;
+    const DatabaseMeta *const dm = schema->findChild(table.db);
+    const TableMeta *const tm = dm ? dm->findChild(table.table) : NULL;
+    TEST_TextMessageError(tm, "no table " + table.table);
+
+    const ResType &res = job.dbres->unpack();
+    const size_t rows = res.rows.size();
+    const size_t fields = table.fields.size();
+    std::vector<std::vector<const Item *> >
+        plain(rows, std::vector<const Item *>(fields));
+    for (size_t f = 0; f < fields; ++f) {
+        const FieldMeta *const fm = tm->findChild(table.fields[f].first);
+        TEST_TextMessageError(fm, "no field " + table.fields[f].first);
+
+        std::vector<unsigned int> enc_rows;
+        std::vector<const Item *> enc_items;
+        std::vector<uint64_t> salts;
+        for (size_t r = 0; r < rows; ++r) {
+            const Item *const item = res.rows[r][f];
+            if (RiboldMYSQL::is_null(*item)) {
+                plain[r][f] = item;
+                continue;
+            }
+
+            uint64_t salt = 0;
+            if (table.salt_pos[f] >= 0) {
+                const Item_int *const salt_item =
+                    static_cast<const Item_int *>(
+                        res.rows[r][table.salt_pos[f]]);
+                salt = salt_item->value;
+            }
+            enc_rows.push_back(r);
+            enc_items.push_back(item);
+            salts.push_back(salt);
+        }
+
+        if (enc_items.size() > 0) {
+            const std::vector<Item *> &dec_items =
+                decrypt_column_layers(enc_items, fm,
+                                      table.fields[f].second, salts);
+            for (size_t i = 0; i < enc_rows.size(); ++i) {
+                plain[enc_rows[i]][f] = dec_items[i];
+            }
+        }
+    }
+
+    std::ostringstream out;
+    if (ExportFormat::CSV == state.format) {
+        for (const auto &row : plain) {
+            for (size_t f = 0; f < fields; ++f) {
+                out << (f ? "," : "") << csvField(*row[f]);
+            }
+            out << "\n";
+        }
+    } else {
+        out << sqlInsertHead(table);
+        for (size_t r = 0; r < rows; ++r) {
+            out << (r ? ",\n(" : "(");
+            for (size_t f = 0; f < fields; ++f) {
+                out << (f ? "," : "") << sqlValue(*plain[r][f]);
+            }
+            out << ")";
+        }
+        out << ";\n";
+    }
+
+    state.rows += rows;
+    return out.str();
+}
+
+/*
+ * Export
+ */
+
+bool
+Export::exportTable(const std::unique_ptr<Connect> &conn,
+                    const ExportTable &table, std::ostream &out)
+{
+    state.drain();
+    if (ExportFormat::CSV == state.format) {
+        std::vector<std::string> names;
+        for (const auto &it : table.fields) {
+            names.push_back(csvEscape(it.first));
+        }
+        out << vector_join(names, ",") << "\n";
+    } else {
+        out << "-- " << table.db << "." << table.table << "\n";
+    }
+
+    const std::string &select =
+        "SELECT " + vector_join(table.select, ",") + " FROM `" + table.db
+        + "`.`" + table.anon_table + "`";
+    const std::string &key = vector_join(table.key, ",");
+    assert(false == table.key.empty());
+    std::string last_key;
+    while (false == state.failed) {
+        std::string q = select;
+        if (false == last_key.empty()) {
+            q += " WHERE (" + key + ") > (" + last_key + ")";
+        }
+        q += " ORDER BY " + key + " LIMIT " + std::to_string(chunk_rows)
+             + ";";
+
+        std::unique_ptr<DBResult> dbres;
+        if (false == conn->execute(q, &dbres) || !dbres || !dbres->n) {
+            std::cerr << "failed: " << q << "\n  " << conn->getError()
+                      << "\n";
+            state.failed = true;
+            break;
+        }
+
+        const unsigned long rows = mysql_num_rows(dbres->n);
+        if (0 == rows) {
+            break;
+        }
+        last_key =
+            lastKey(dbres->n, table.select.size() - table.key.size());
+
+        const unsigned long seq = state.admit();
+        state.push(ExportJob{seq, &table, &out, std::move(dbres)});
+        if (rows < chunk_rows) {
+            break;
+        }
+    }
+
+    state.drain();
+    return false == state.failed;
+}
+
+int main(int argc, char **argv)
+{
+    int c, optind = 0;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"username", required_argument, 0, 'u'},
+        {"password", required_argument, 0, 'p'},
+        {"dbname", required_argument, 0, 'd'},
+        {"table", required_argument, 0, 't'},
+        {"format", required_argument, 0, 'F'},
+        {"output", required_argument, 0, 'o'},
+        {"workers", required_argument, 0, 'j'},
+        {"chunk", required_argument, 0, 'c'},
+        {"key", required_argument, 0, 'k'},
+        {"embedded", required_argument, 0, 'e'},
+        {NULL, 0, 0, 0},
+    };
+
+    std::string username("");
+    std::string password("");
+    std::string dbname("");
+    std::string table("");
+    std::string format("csv");
+    std::string output("");
+    unsigned int workers = std::max(1u, std::thread::hardware_concurrency());
+    unsigned long chunk_rows = 5000;
+    std::string master_key("2392834");
+    std::string embed_dir("/var/lib/shadow-mysql");
+
+    while(1)
+    {
+        c = getopt_long(argc, argv, "hu:p:d:t:F:o:j:c:k:e:",
+                        long_options, &optind);
+        if(c == -1)
+            break;
+
+        switch(c)
+        {
+            case 'h':
+                help(argv[0]);
+                exit(0);
+            case 'u':
+                username = optarg;
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            case 'd':
+                dbname = optarg;
+                break;
+            case 't':
+                table = optarg;
+                break;
+            case 'F':
+                format = toLowerCase(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'j':
+                workers = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                chunk_rows = strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                master_key = optarg;
+                break;
+            case 'e':
+                embed_dir = optarg;
+                break;
+            case '?':
+                break;
+            default:
+                break;
+        }
+    }
+
+    assert(username != "");
+    assert(password != "");
+    assert(dbname != "");
+    assert("csv" == format || "sql" == format);
+    assert(workers > 0);
+    assert(chunk_rows > 0);
+
+    ConnectionInfo ci("localhost", username, password);
+    SharedProxyState shared_ps(ci, embed_dir, master_key,
+                               determineSecurityRating());
+    ProxyState ps(shared_ps);
+    thread_ps = &ps;
+    ps.safeCreateEmbeddedTHD();
+    const std::shared_ptr<const SchemaInfo> &schema = ps.getSchemaInfo();
+
+    std::vector<std::string> names;
+    if (table != "") {
+        names.push_back(table);
+    } else {
+        const DatabaseMeta *const dm = schema->findChild(dbname);
+        if (NULL == dm) {
+            std::cerr << "no database " << dbname << "\n";
+            return 1;
+        }
+        for (const auto &it : dm->getChildren()) {
+            names.push_back(it.first.getValue());
+        }
+    }
+
+    const std::unique_ptr<Connect>
+        conn(new Connect(ci.server, ci.user, ci.passwd, ci.port));
+    std::vector<ExportTable> tables(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (false == describeTable(*schema, conn, dbname, names[i],
+                                   &tables[i])) {
+            return 1;
+        }
+    }
+
+    ExportState state(shared_ps, ci,
+                      "csv" == format ? ExportFormat::CSV
+                                      : ExportFormat::SQL,
+                      workers);
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < workers; ++i) {
+        pool.push_back(std::thread([&state] () {
+            assert(0 == mysql_thread_init());
+            std::unique_ptr<ExportWorker> worker;
+            {
+                const std::lock_guard<std::mutex> lock(state.setup);
+                worker.reset(new ExportWorker(state));
+            }
+            worker->run();
+            {
+                const std::lock_guard<std::mutex> lock(state.setup);
+                worker.reset();
+            }
+        }));
+    }
+
+    Export exporter(state, chunk_rows);
+    const uint64_t start = PhaseTimer::now();
+    bool ok = true;
+    for (const auto &it : tables) {
+        std::ofstream file;
+        if (output != "") {
+            file.open(output + "/" + it.table + "." + format);
+            assert(file.is_open());
+        }
+        std::ostream &out = output != "" ? file : std::cout;
+        if (false == exporter.exportTable(conn, it, out)) {
+            ok = false;
+            break;
+        }
+    }
+
+    state.close();
+    for (auto &it : pool) {
+        it.join();
+    }
+
+    const uint64_t nsec = PhaseTimer::now() - start;
+    std::cerr << state.rows << " rows from " << tables.size()
+              << " tables in " << std::fixed << std::setprecision(1)
+              << nsec / 1e9 << " s: " << (nsec ? state.rows * 1e9 / nsec : 0)
+              << " rows/s" << std::endl;
+
+    return ok ? 0 : 1;
+}
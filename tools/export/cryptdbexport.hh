@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+enum class ExportFormat {CSV, SQL};
+
+/**
+ * What the reader selects from an anonymized table, and how the workers
+ * decrypt it.
+ */
+struct ExportTable
+{
+    std::string db;
+    std::string table;
+    std::string anon_table;
+    // (field, onion it is decrypted from); the onion's column is at the
+    // field's position in 'select'
+    std::vector<std::pair<std::string, onion> > fields;
+    // position of each field's salt in 'select', or -1
+    std::vector<int> salt_pos;
+    std::vector<std::string> select;
+    // the columns of the backend key the table is read by, last in
+    // 'select'
+    std::vector<std::string> key;
+};
+
+/**
+ * One chunk of ciphertext rows, in table order.
+ */
+struct ExportJob
+{
+    unsigned long seq;
+    const ExportTable *table;
+    std::ostream *out;
+    std::unique_ptr<DBResult> dbres;
+};
+
+/**
+ * Hands chunks to the workers and writes the decrypted chunks in the
+ * order they were read.
+ * > the reader stays at most 'window' chunks ahead of the output, which
+ *   bounds the memory an export takes.
+ */
+class ExportState
+{
+    public:
+        ExportState(SharedProxyState &shared, const ConnectionInfo &ci,
+                    ExportFormat format, unsigned int threads)
+            : shared(shared), ci(ci), format(format), rows(0),
+              failed(false), window(2 * threads), next_seq(0),
+              next_write(0), closed(false){}
+        ~ExportState(){}
+
+        SharedProxyState &shared;
+        const ConnectionInfo ci;
+        const ExportFormat format;
+        std::atomic<unsigned long> rows;
+        std::atomic<bool> failed;
+        // > ProxyState and Connect are not safe to build concurrently
+        std::mutex setup;
+
+        // waits for room in the window; returns the chunk's sequence
+        unsigned long admit();
+        void push(ExportJob &&job);
+        // false once the state is closed and no chunk is left
+        bool pop(ExportJob *const out);
+        void deliver(unsigned long seq, std::ostream *const out,
+                     std::string &&text);
+        // waits until every chunk read so far is written
+        void drain();
+        void close();
+
+    private:
+        const unsigned long window;
+        unsigned long next_seq;
+        unsigned long next_write;
+        bool closed;
+        std::deque<ExportJob> jobs;
+        std::map<unsigned long, std::pair<std::ostream *, std::string> >
+            written;
+        std::mutex mutex;
+        std::condition_variable changed;
+};
+
+/**
+ * Decrypts chunks, every column a batch at a time.
+ * > each worker loads a schema of its own, so that no two threads share
+ *   an EncLayer; OPE and HOM keep state in theirs.
+ */
+class ExportWorker
+{
+    public:
+        ExportWorker(ExportState &state);
+        ~ExportWorker(){}
+
+        void run();
+
+    private:
+        ExportState &state;
+        ProxyState ps;
+        const std::unique_ptr<Connect> conn;
+        std::unique_ptr<SchemaInfo> schema;
+
+        std::string decrypt(const ExportJob &job);
+};
+
+/**
+ * Export database tool class.
+ */
+class Export
+{
+    public:
+        Export(ExportState &state, unsigned long chunk_rows)
+            : state(state), chunk_rows(chunk_rows){}
+        ~Export(){}
+
+        // returns false if reading or decrypting failed
+        bool exportTable(const std::unique_ptr<Connect> &conn,
+                         const ExportTable &table, std::ostream &out);
+
+    private:
+        ExportState &state;
+        const unsigned long chunk_rows;
+};
+};
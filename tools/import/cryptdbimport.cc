@@ -1,14 +1,44 @@
+/*
+ * cryptdbimport
+ *
+ * Loads a mysqldump file into CryptDB without a running proxy.
+ *
+ *   obj/tools/import/cryptdbimport -u root -p letmein -f dump.sql -t 8 \
+ *       -r dump.journal
+ *
+ * Statements other than INSERT go through the handlers one at a time,
+ * in dump order. The rows of each INSERT are cut into batches of -b rows;
+ * a pool of -t workers encrypts the batches, every onion of a row at
+ * once, and writes them to the backend as multi-row INSERTs over
+ * connections of their own. The rows of a table with an mOPE column are
+ * encrypted by the reader instead, in dump order; see submit below.
+ *
+ * Resume: -r <file> journals each statement and batch as it finishes; if
+ * the import fails, running the same command again skips what the
+ * journal holds. The file keeps the batch size and an id; the finished
+ * batches are rows in the backend, each written in the transaction of
+ * its batch, so a batch the backend has is never run again.
+ * > only on transactional tables; a batch into a MyISAM table that dies
+ *   before its row is written is inserted again on resume.
+ * > a statement other than INSERT commits by itself, before its row; one
+ *   that dies in between runs again, which the DROP TABLE IF EXISTS
+ *   mysqldump puts before each CREATE TABLE allows.
+ */
 #include <algorithm>
-#include <string>
-#include <stdio.h>
+#include <iomanip>
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
-#include <pthread.h>
 #include <getopt.h>
-#include <rewrite_main.hh>
+
+#include <main/rewrite_main.hh>
+#include <main/rewrite_util.hh>
+#include <main/phase.hh>
+#include <main/metadata_tables.hh>
 #include <cryptdbimport.hh>
 
 static void __attribute__((noreturn))
@@ -21,99 +51,776 @@ do_display_help(const char *arg)
     std::cout << "-p<password>: MySQL server password" << std::endl;
     std::cout << "-n: Do not execute queries. Only show stdout." << std::endl;
     std::cout << "-f <file>: MySQL's .sql dump file, originated from \"mysqldump\" tool." << std::endl;
+    std::cout << "-t <threads>: Workers encrypting rows (default: one per core)." << std::endl;
+    std::cout << "-b <rows>: Rows per INSERT sent to the server (default: 1000)." << std::endl;
+    std::cout << "-r <file>: Journal to resume a failed import from." << std::endl;
+    std::cout << "-d <database>: Database for a dump without USE statements." << std::endl;
+    std::cout << "-k <key>: Master key." << std::endl;
+    std::cout << "-e <dir>: Embedded database directory." << std::endl;
     std::cout << "To generate DB's dump file use mysqldump, e.g.:" << std::endl;
     std::cout << "$ mysqldump -u user -ppassword --all-databases >dumpfile.sql" << std::endl;
     exit(0);
 }
 
+static std::string
+abbreviate(const std::string &q)
+{
+    static const size_t limit = 200;
+    return q.size() > limit ? q.substr(0, limit) + "..." : q;
+}
+
+/*
+ * Dump parsing
+ */
 
-static bool 
-ignore_line(const std::string& line)
+// > lines starting with '--' or '#' between statements are comments.
+// > a statement ends at a ';' outside of quotes and comments.
+bool
+DumpReader::next(std::string *const out)
 {
-    static const std::string begin_match("--");
+    out->clear();
 
-    return(line.compare(0,2,begin_match) == 0); 
+    char quote = 0;
+    bool escaped = false;
+    bool comment = false;
+    char prev = 0;
+    char c;
+    while (input.get(c)) {
+        if (comment) {
+            out->push_back(c);
+            comment = !('*' == prev && '/' == c);
+            prev = c;
+            continue;
+        }
+
+        if (quote) {
+            out->push_back(c);
+            if (escaped) {
+                escaped = false;
+            } else if ('\\' == c && '`' != quote) {
+                escaped = true;
+            } else if (quote == c) {
+                quote = 0;
+            }
+            continue;
+        }
+
+        if (out->empty()) {
+            if (isspace(static_cast<unsigned char>(c)) || ';' == c) {
+                continue;
+            }
+            if ('#' == c || ('-' == c && '-' == input.peek())) {
+                std::string line;
+                std::getline(input, line);
+                continue;
+            }
+        }
+
+        if (';' == c) {
+            return true;
+        }
+
+        if ('/' == c && '*' == input.peek()) {
+            out->push_back(c);
+            out->push_back(static_cast<char>(input.get()));
+            comment = true;
+            prev = 0;
+            continue;
+        }
+
+        if ('\'' == c || '"' == c || '`' == c) {
+            quote = c;
+        }
+        out->push_back(c);
+    }
+
+    return false == out->empty();
 }
 
-void
-Import::printOutOnly(void)
+enum class DumpStatement {SKIP, USE, INSERT, OTHER};
+
+static DumpStatement
+classify(const std::string &q)
+{
+    // > versioned comments hold the session settings mysqldump saves and
+    //   restores, DISABLE KEYS and the like; none matter to CryptDB.
+    if (0 == q.compare(0, 3, "/*!")) {
+        return DumpStatement::SKIP;
+    }
+
+    const std::string &word =
+        toLowerCase(q.substr(0, q.find_first_of(" \t\r\n(")));
+    if ("lock" == word || "unlock" == word || "set" == word) {
+        return DumpStatement::SKIP;
+    }
+    if ("use" == word) {
+        return DumpStatement::USE;
+    }
+    if ("insert" == word) {
+        return DumpStatement::INSERT;
+    }
+
+    return DumpStatement::OTHER;
+}
+
+static size_t
+skipSpace(const std::string &q, size_t i)
+{
+    while (i < q.size() && isspace(static_cast<unsigned char>(q[i]))) {
+        ++i;
+    }
+
+    return i;
+}
+
+// Returns the index of the ')' closing the '(' at 'open', or npos.
+static size_t
+closingParen(const std::string &q, size_t open)
+{
+    assert('(' == q[open]);
+
+    unsigned int depth = 0;
+    char quote = 0;
+    for (size_t i = open; i < q.size(); ++i) {
+        const char c = q[i];
+        if (quote) {
+            if ('\\' == c && '`' != quote) {
+                ++i;
+            } else if (quote == c) {
+                quote = 0;
+            }
+        } else if ('\'' == c || '"' == c || '`' == c) {
+            quote = c;
+        } else if ('(' == c) {
+            ++depth;
+        } else if (')' == c && 0 == --depth) {
+            return i;
+        }
+    }
+
+    return std::string::npos;
+}
+
+// Finds the rows of 'INSERT ... VALUES (...), (...)'; false if the
+// statement is not a plain list of rows (ie, INSERT ... SELECT or
+// ON DUPLICATE KEY UPDATE), as then it can not be cut.
+static bool
+splitInsert(const std::string &q, std::string *const head,
+            std::vector<std::pair<size_t, size_t> > *const rows)
+{
+    size_t values = std::string::npos;
+    for (size_t i = 0; i < q.size(); ++i) {
+        const char c = q[i];
+        if ('\'' == c || '"' == c || '`' == c) {
+            // > a quoted name; skip it whole
+            const size_t end = q.find(c, i + 1);
+            if (std::string::npos == end) {
+                return false;
+            }
+            i = end;
+        } else if ('(' == c) {
+            // > the column list
+            i = closingParen(q, i);
+            if (std::string::npos == i) {
+                return false;
+            }
+        } else if (isalpha(static_cast<unsigned char>(c))) {
+            size_t end = i;
+            while (end < q.size()
+                   && (isalnum(static_cast<unsigned char>(q[end]))
+                       || '_' == q[end])) {
+                ++end;
+            }
+            const std::string &word = toLowerCase(q.substr(i, end - i));
+            if ("values" == word || "value" == word) {
+                values = end;
+                break;
+            }
+            if ("select" == word) {
+                return false;
+            }
+            i = end - 1;
+        }
+    }
+    if (std::string::npos == values) {
+        return false;
+    }
+
+    *head = q.substr(0, values);
+    for (size_t i = skipSpace(q, values); ; ) {
+        if (i >= q.size() || '(' != q[i]) {
+            return false;
+        }
+        const size_t close = closingParen(q, i);
+        if (std::string::npos == close) {
+            return false;
+        }
+        rows->push_back(std::make_pair(i, close + 1));
+
+        i = skipSpace(q, close + 1);
+        if (i == q.size()) {
+            return true;
+        }
+        if (',' != q[i]) {
+            return false;
+        }
+        i = skipSpace(q, i + 1);
+    }
+}
+
+// The database and table an INSERT head, from splitInsert(...), names;
+// the table is empty if it can not tell.
+static std::pair<std::string, std::string>
+insertTable(const std::string &head, const std::string &db)
 {
-    std::string line;
-    std::string s("");
-    std::ifstream input(this->filename);
+    static const std::set<std::string> modifiers =
+        {"insert", "low_priority", "delayed", "high_priority", "ignore",
+         "into"};
 
-    assert(input.is_open() == true); 
+    // > names, with "." for the dots between them
+    std::vector<std::string> names;
+    for (size_t i = 0; i < head.size() && '(' != head[i]; ) {
+        const char c = head[i];
+        if ('`' == c) {
+            const size_t end = head.find('`', i + 1);
+            if (std::string::npos == end) {
+                break;
+            }
+            names.push_back(head.substr(i + 1, end - i - 1));
+            i = end + 1;
+        } else if ('.' == c) {
+            names.push_back(".");
+            ++i;
+        } else if (isalnum(static_cast<unsigned char>(c)) || '_' == c
+                   || '$' == c) {
+            size_t end = i;
+            while (end < head.size()
+                   && (isalnum(static_cast<unsigned char>(head[end]))
+                       || '_' == head[end] || '$' == head[end])) {
+                ++end;
+            }
+            const std::string &word = head.substr(i, end - i);
+            if (false == names.empty()
+                || modifiers.end() == modifiers.find(toLowerCase(word))) {
+                names.push_back(word);
+            }
+            i = end;
+        } else {
+            ++i;
+        }
+    }
+
+    if (names.size() >= 3 && "." == names[1]) {
+        return std::make_pair(names[0], names[2]);
+    }
+    if (names.size() >= 1 && "." != names[0]) {
+        return std::make_pair(db, names[0]);
+    }
+    return std::make_pair(db, std::string());
+}
 
-    while(std::getline(input, line )){
-        if(ignore_line(line))
+// A table with a column whose OPE onion keeps its values in a MOPE_int
+// tree; unknown tables are taken to have one.
+static bool
+mopeTable(const SchemaInfo &schema,
+          const std::pair<std::string, std::string> &table)
+{
+    const DatabaseMeta *const dm = schema.findChild(table.first, false);
+    if (NULL == dm || table.second.empty()) {
+        return true;
+    }
+    const TableMeta *const tm = dm->findChild(table.second, false);
+    if (NULL == tm) {
+        return true;
+    }
+
+    for (const auto &it : tm->getChildren()) {
+        const OnionMeta *const om = it.second->getOnionMeta(oOPE);
+        if (NULL == om) {
             continue;
+        }
+        for (const auto &layer : om->getLayers()) {
+            if ("MOPE_int" == layer->name()) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static std::string
+useDatabase(const std::string &q)
+{
+    std::string db = q.substr(3);
+    db.erase(std::remove(db.begin(), db.end(), '`'), db.end());
+    const size_t start = skipSpace(db, 0);
+    size_t end = db.size();
+    while (end > start && isspace(static_cast<unsigned char>(db[end - 1]))) {
+        --end;
+    }
+
+    return db.substr(start, end - start);
+}
+
+/*
+ * Work queue and journal
+ */
+
+void
+WorkQueue::push(ImportJob &&job)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] () {return jobs.size() < limit;});
+    jobs.push_back(std::move(job));
+    ++pending;
+    changed.notify_all();
+}
+
+bool
+WorkQueue::pop(ImportJob *const out)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] () {return closed || !jobs.empty();});
+    if (jobs.empty()) {
+        return false;
+    }
+
+    *out = std::move(jobs.front());
+    jobs.pop_front();
+    changed.notify_all();
+    return true;
+}
+
+void
+WorkQueue::finished()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(pending > 0);
+    --pending;
+    changed.notify_all();
+}
+
+void
+WorkQueue::drain()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] () {return 0 == pending;});
+}
 
-        if (!line.empty()){
-            char lastChar = *line.rbegin();
-            if(lastChar == ';'){
-                std::cout << s + line << std::endl;
-                s.clear();
+void
+WorkQueue::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    changed.notify_all();
+}
+
+bool
+ImportJournal::open(const std::string &fname, unsigned long batch_rows,
+                    const std::unique_ptr<Connect> &conn)
+{
+    std::ifstream input(fname);
+    if (input.is_open()) {
+        unsigned long journal_batch_rows;
+        if (!(input >> journal_batch_rows >> id)
+            || journal_batch_rows != batch_rows) {
+            return false;
+        }
+    } else {
+        id = getpRandomName();
+        std::ofstream output(fname);
+        output << batch_rows << " " << id << std::endl;
+        if (false == output.good()) {
+            return false;
+        }
+    }
+
+    const std::string &create =
+        " CREATE TABLE IF NOT EXISTS " + MetaData::Table::importProgress() +
+        "   (journal VARCHAR(100) NOT NULL,"
+        "    statement BIGINT UNSIGNED NOT NULL,"
+        "    batch BIGINT UNSIGNED NOT NULL,"
+        "    PRIMARY KEY (journal, statement, batch))"
+        " ENGINE=InnoDB;";
+    std::unique_ptr<DBResult> dbres;
+    if (false == conn->execute(create)
+        || false == conn->execute(
+                " SELECT statement, batch"
+                "   FROM " + MetaData::Table::importProgress() +
+                "  WHERE journal = '" + id + "';", &dbres)) {
+        return false;
+    }
+
+    while (const MYSQL_ROW row = mysql_fetch_row(dbres->n)) {
+        finished.insert(std::make_pair(strtoul(row[0], NULL, 10),
+                                       strtoul(row[1], NULL, 10)));
+    }
+
+    return true;
+}
+
+bool
+ImportJournal::done(unsigned long statement, unsigned long batch) const
+{
+    return finished.end() != finished.find(std::make_pair(statement, batch));
+}
+
+std::string
+ImportJournal::recordQuery(unsigned long statement,
+                           unsigned long batch) const
+{
+    if (id.empty()) {
+        return "";
+    }
+
+    return " INSERT INTO " + MetaData::Table::importProgress() +
+           "   (journal, statement, batch) VALUES"
+           "   ('" + id + "', " + std::to_string(statement) + ", "
+           + std::to_string(batch) + ");";
+}
+
+/*
+ * Workers
+ */
+
+ImportWorker::ImportWorker(ImportState &state)
+    : state(state), ps(state.shared),
+      conn(new Connect(state.ci.server, state.ci.user, state.ci.passwd,
+                       state.ci.port)),
+      schema_generation(0)
+{}
+
+void
+ImportWorker::run()
+{
+    ImportJob job;
+    while (state.queue.pop(&job)) {
+        // > after a failure the rest of the queue is dropped, the journal
+        //   has it for the next run
+        if (false == state.failed && this->insert(job)) {
+            state.rows += job.rows;
+        } else {
+            state.failed = true;
+        }
+        state.queue.finished();
+    }
+}
+
+std::unique_ptr<ResType>
+ImportWorker::backend(const std::string &q)
+{
+    std::unique_ptr<DBResult> dbres;
+    if (false == conn->execute(q, &dbres) || !dbres) {
+        std::cerr << "failed: " << abbreviate(q) << "\n  "
+                  << conn->getError() << "\n";
+        return std::unique_ptr<ResType>(new ResType(false, 0, 0));
+    }
+
+    return std::unique_ptr<ResType>(new ResType(dbres->unpack()));
+}
+
+// Mirrors executeQuery(...); the batch commits with its journal row.
+bool
+ImportWorker::insert(const ImportJob &job)
+{
+    if (job.db != this->db) {
+        if (false == conn->execute("USE `" + job.db + "`;")) {
+            std::cerr << "failed: USE " << job.db << "\n";
+            return false;
+        }
+        this->db = job.db;
+    }
+
+    const std::string &record =
+        state.journal.recordQuery(job.statement, job.batch);
+    if (false == record.empty()
+        && false == this->backend("START TRANSACTION")->ok) {
+        return false;
+    }
+
+    thread_ps = &ps;
+    ps.safeCreateEmbeddedTHD();
+
+    bool ok = false;
+    try {
+        // > the reader waits for the workers before any statement that
+        //   may change the schema, so the generation is steady here
+        const unsigned int generation = state.schema_generation;
+        if (generation != this->schema_generation) {
+            this->schema = loadSchemaInfo(conn, ps.getEConn());
+            this->schema_generation = generation;
+        }
+
+        const QueryRewrite qr =
+            Rewriter::rewrite(job.query, *schema.get(), job.db, ps);
+        const NextParams nparams(ps, job.db, job.query);
+
+        std::unique_ptr<ResType> res(new ResType(true, 0, 0));
+        while (true) {
+            const auto &new_results = qr.executor->next(*res, nparams);
+            const std::unique_ptr<AbstractAnything>
+                output(new_results.second);
+            const auto type = new_results.first;
+            if (AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN
+                == type) {
+                res = this->backend(
+                    output->extract<std::pair<bool, std::string> >().second);
                 continue;
+            } else if (AbstractQueryExecutor::ResultType::QUERY_USE_RESULTS
+                       == type) {
+                ok = this->backend(output->extract<std::string>())->ok;
+            } else {
+                assert(AbstractQueryExecutor::ResultType::RESULTS == type);
+                ok = output->extract<ResType>().ok;
             }
-            s += line;
+            break;
         }
+    } catch (const ErrorPacketException &e) {
+        std::cerr << "failed: " << abbreviate(job.query) << "\n  "
+                  << e.getMessage() << "\n";
+    } catch (const AbstractException &e) {
+        std::cerr << "failed: " << abbreviate(job.query) << "\n  "
+                  << e.to_string() << "\n";
+    } catch (const CryptDBError &e) {
+        std::cerr << "failed: " << abbreviate(job.query) << "\n  "
+                  << e.msg << "\n";
     }
+
+    if (false == record.empty()) {
+        ok = ok && this->backend(record)->ok;
+        ok = this->backend(ok ? "COMMIT" : "ROLLBACK")->ok && ok;
+    }
+
+    // > the Items of a batch live on its THD; an import that kept them
+    //   would hold the whole dump in memory.
+    ps.releaseTHDs();
+    return ok;
+}
+
+/*
+ * Import
+ */
+
+static void
+reportProgress(std::ostream &out, unsigned long rows, uint64_t nsec)
+{
+    out << rows << " rows in " << std::fixed << std::setprecision(1)
+        << nsec / 1e9 << " s: " << (nsec ? rows * 1e9 / nsec : 0)
+        << " rows/s" << std::endl;
 }
 
 void
-Import::executeQueries(ProxyState& ps)
+Import::printOutOnly(void)
 {
-    std::string line;
-    std::string s("");
-    std::ifstream input(this->filename);
+    DumpReader reader(this->filename);
+    assert(reader.is_open());
 
-    assert(input.is_open() == true); 
+    std::string q;
+    while (reader.next(&q)) {
+        std::cout << q << ";" << std::endl;
+    }
+}
 
-    while(std::getline(input, line )){
-        if(ignore_line(line))
-            continue;
+// Runs 'q' through executeQuery(...) in one transaction with the query
+// that journals it; without 'record', only 'q', and without 'q', only
+// 'record'.
+static bool
+recordedQuery(ProxyState &ps, const std::string &q, const std::string &db,
+              const std::string &record)
+{
+    if (record.empty()) {
+        return q.empty() || executeQuery(ps, q, db);
+    }
 
-        if (!line.empty()){
-            char lastChar = *line.rbegin();
-            if(lastChar == ';'){
-                s += line;
-                std::cout << s << std::endl;
-                // FIXME
-                assert(false);
-                /*
-                const EpilogueResult &epi_res = executeQuery(ps, s);
-                assert(epi_res.res_type.success());
-                s.clear();
-                continue;
-                */
+    const std::unique_ptr<Connect> &conn = ps.getConn();
+    if (false == conn->execute("START TRANSACTION")) {
+        return false;
+    }
+    bool ok = q.empty() || executeQuery(ps, q, db);
+    ok = ok && conn->execute(record);
+    return conn->execute(ok ? "COMMIT" : "ROLLBACK") && ok;
+}
+
+bool
+Import::executeQueries(ImportState &state, unsigned int threads,
+                       unsigned long batch_rows, std::string db)
+{
+    DumpReader reader(this->filename);
+    assert(reader.is_open());
+
+    ProxyState ps(state.shared);
+
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < threads; ++i) {
+        pool.push_back(std::thread([&state] () {
+            assert(0 == mysql_thread_init());
+            std::unique_ptr<ImportWorker> worker;
+            {
+                const std::lock_guard<std::mutex> lock(state.setup);
+                worker.reset(new ImportWorker(state));
+            }
+            worker->run();
+            {
+                const std::lock_guard<std::mutex> lock(state.setup);
+                worker.reset();
+            }
+        }));
+    }
+
+    // > a MOPE_int keeps the column's tree in the layer, and each worker
+    //   has a schema of its own; were the rows of such a table spread
+    //   over the workers, each would insert into a tree that does not
+    //   have the others' values. They are encrypted here instead, in dump
+    //   order, against the one schema the DDL went through.
+    const auto submit = [&state, &ps] (ImportJob &&job, bool mope) {
+        if (false == mope) {
+            state.queue.push(std::move(job));
+            return;
+        }
+
+        state.queue.drain();
+        if (state.failed) {
+            return;
+        }
+        if (false == recordedQuery(ps, job.query, job.db,
+                                   state.journal.recordQuery(job.statement,
+                                                             job.batch))) {
+            std::cerr << "failed: " << abbreviate(job.query) << "\n";
+            state.failed = true;
+            return;
+        }
+        state.rows += job.rows;
+    };
+
+    static const uint64_t report_interval = 10ULL * 1000 * 1000 * 1000;
+    const uint64_t start = PhaseTimer::now();
+    uint64_t last_report = start;
+    unsigned long statement = 0;
+    unsigned long skipped = 0;
+    bool ok = true;
+    std::string q;
+    while (ok && reader.next(&q)) {
+        ++statement;
+        switch (classify(q)) {
+        case DumpStatement::SKIP:
+            ++skipped;
+            break;
+        case DumpStatement::USE:
+            db = useDatabase(q);
+            break;
+        case DumpStatement::INSERT: {
+            std::string head;
+            std::vector<std::pair<size_t, size_t> > rows;
+            if (false == splitInsert(q, &head, &rows)) {
+                if (false == state.journal.done(statement, 0)) {
+                    submit(ImportJob{statement, 0, db, q, 1}, true);
+                }
+                break;
+            }
+            const bool mope =
+                mopeTable(*ps.getSchemaInfo().get(), insertTable(head, db));
+
+            for (unsigned long b = 0; b * batch_rows < rows.size(); ++b) {
+                if (state.journal.done(statement, b)) {
+                    continue;
+                }
+                const size_t first = b * batch_rows;
+                const size_t last =
+                    std::min<size_t>(rows.size(), first + batch_rows);
+                std::string batch = head;
+                for (size_t r = first; r < last; ++r) {
+                    batch += first == r ? " " : ",";
+                    batch.append(q, rows[r].first,
+                                 rows[r].second - rows[r].first);
+                }
+                submit(ImportJob{statement, b, db, std::move(batch),
+                                 last - first},
+                       mope);
             }
-            s += line;
+            break;
+        }
+        case DumpStatement::OTHER:
+            // > DDL must see every row before it, and the workers must
+            //   see the schema after it
+            state.queue.drain();
+            if (state.failed || state.journal.done(statement, 0)) {
+                break;
+            }
+            // > the statement commits before its row; see the top
+            if (false == executeQuery(ps, q, db)
+                || false == recordedQuery(ps, "", db,
+                                          state.journal.recordQuery(
+                                              statement, 0))) {
+                std::cerr << "failed: " << abbreviate(q) << "\n";
+                ok = false;
+                break;
+            }
+            ++state.schema_generation;
+            break;
         }
+        ok = ok && false == state.failed;
+
+        const uint64_t now = PhaseTimer::now();
+        if (now - last_report >= report_interval) {
+            reportProgress(std::cerr, state.rows, now - start);
+            last_report = now;
+        }
+    }
+
+    state.queue.close();
+    for (auto &it : pool) {
+        it.join();
     }
+    ok = ok && false == state.failed;
+
+    reportProgress(std::cout, state.rows, PhaseTimer::now() - start);
+    std::cout << statement << " statements, " << skipped
+              << " skipped" << std::endl;
+    if (false == ok) {
+        std::cerr << "import failed at statement " << statement
+                  << "; run again with the same journal to resume"
+                  << std::endl;
+    }
+
+    return ok;
 }
 
 
 int main(int argc, char **argv)
 {
-    int c, threads = 1, optind = 0;
+    int c, optind = 0;
 
     static struct option long_options[] = {
         {"help", no_argument, 0, 'h'},
         {"inputfile", required_argument, 0, 'f'},
         {"password", required_argument, 0, 'p'},
         {"user", required_argument, 0, 'u'},
-        {"noexec", required_argument, 0, 'n'},
+        {"noexec", no_argument, 0, 'n'},
         {"threads", required_argument, 0, 't'},
+        {"batch", required_argument, 0, 'b'},
+        {"resume", required_argument, 0, 'r'},
+        {"database", required_argument, 0, 'd'},
+        {"key", required_argument, 0, 'k'},
+        {"embedded", required_argument, 0, 'e'},
         {NULL, 0, 0, 0},
     };
 
     std::string username("");
     std::string password("");
-    // bool exec = true;
+    std::string filename("");
+    std::string journal("");
+    std::string dbname("");
+    std::string master_key("2392834");
+    std::string embed_dir("/var/lib/shadow-mysql");
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned long batch_rows = 1000;
+    bool exec = true;
 
     while(1)
     {
-        c = getopt_long(argc, argv, "hf:p:u:t:n", long_options, &optind);
+        c = getopt_long(argc, argv, "hf:p:u:t:nb:r:d:k:e:", long_options,
+                        &optind);
         if(c == -1)
             break;
 
@@ -122,24 +829,7 @@ int main(int argc, char **argv)
             case 'h':
                 do_display_help(argv[0]);
             case 'f':
-                {
-                    /*
-                    Import import(optarg);
-                    if(exec == true){
-                        ConnectionInfo ci("localhost", username, password);
-                        const std::string master_key = "2392834";
-                        SharedProxyState shared_ps(ci,
-                                                "/var/lib/shadow-mysql",
-                                                master_key);
-                        ProxyState ps(shared_ps);
-
-                        // Execute queries
-                        import.executeQueries(ps);
-                    } else {
-                        import.printOutOnly();
-                    }
-                    */
-                }
+                filename = optarg;
                 break;
             case 'p':
                 password = optarg;
@@ -148,11 +838,25 @@ int main(int argc, char **argv)
                 username = optarg;
                 break;
             case 't':
-                threads = atoi(optarg);
-                (void)threads;
+                threads = strtoul(optarg, NULL, 10);
                 break;
             case 'n':
-                // exec = false;
+                exec = false;
+                break;
+            case 'b':
+                batch_rows = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                journal = optarg;
+                break;
+            case 'd':
+                dbname = optarg;
+                break;
+            case 'k':
+                master_key = optarg;
+                break;
+            case 'e':
+                embed_dir = optarg;
                 break;
             case '?':
                 break;
@@ -161,5 +865,34 @@ int main(int argc, char **argv)
 
         }
     }
-    return 0;
+
+    if (filename == "") {
+        do_display_help(argv[0]);
+    }
+
+    Import import(filename.c_str());
+    if (false == exec) {
+        import.printOutOnly();
+        return 0;
+    }
+
+    assert(threads > 0);
+    assert(batch_rows > 0);
+
+    ConnectionInfo ci("localhost", username, password);
+    SharedProxyState shared_ps(ci, embed_dir, master_key,
+                               determineSecurityRating());
+    ImportState state(shared_ps, ci, threads);
+    const std::unique_ptr<Connect>
+        conn(new Connect(ci.server, ci.user, ci.passwd, ci.port));
+    if (journal != ""
+        && false == state.journal.open(journal, batch_rows, conn)) {
+        std::cerr << "can not resume from " << journal
+                  << " with batches of " << batch_rows << " rows"
+                  << std::endl;
+        return 1;
+    }
+
+    return import.executeQueries(state, threads, batch_rows, dbname)
+        ? 0 : 1;
 }
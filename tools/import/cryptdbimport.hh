@@ -1,7 +1,147 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+
 namespace {
 
+/**
+ * Reads a mysqldump file one statement at a time.
+ */
+class DumpReader
+{
+    public:
+        DumpReader(const std::string &fname) : input(fname){}
+        ~DumpReader(){}
+
+        bool is_open() const {return input.is_open();}
+        // false at the end of the file
+        bool next(std::string *const out);
+
+    private:
+        std::ifstream input;
+};
+
+/**
+ * One batch of the rows of an INSERT, or the whole INSERT if it can not
+ * be cut.
+ */
+struct ImportJob
+{
+    unsigned long statement;
+    unsigned long batch;
+    std::string db;
+    std::string query;
+    unsigned long rows;
+};
+
+/**
+ * Bounded, so that the reader stays a few batches ahead of the workers
+ * rather than a whole dump.
+ */
+class WorkQueue
+{
+    public:
+        WorkQueue(size_t limit) : limit(limit), pending(0), closed(false){}
+        ~WorkQueue(){}
+
+        void push(ImportJob &&job);
+        // false once the queue is closed and empty
+        bool pop(ImportJob *const out);
+        void finished();
+        // waits until every job pushed so far has finished
+        void drain();
+        void close();
+
+    private:
+        const size_t limit;
+        std::deque<ImportJob> jobs;
+        size_t pending;
+        bool closed;
+        std::mutex mutex;
+        std::condition_variable changed;
+};
+
+/**
+ * The (statement, batch) pairs that finished, so a failed import resumes
+ * where it stopped. They are rows of MetaData::Table::importProgress()
+ * under an id the journal file keeps; each is inserted in the
+ * transaction of its batch (see recordQuery(...)).
+ * > a statement other than INSERT is batch 0.
+ */
+class ImportJournal
+{
+    public:
+        ImportJournal(){}
+        ~ImportJournal(){}
+
+        // false if an earlier run cut its batches to another size
+        bool open(const std::string &fname, unsigned long batch_rows,
+                  const std::unique_ptr<Connect> &conn);
+        // what an earlier run finished
+        bool done(unsigned long statement, unsigned long batch) const;
+        // the INSERT that records the pair; empty without a journal
+        std::string recordQuery(unsigned long statement,
+                                unsigned long batch) const;
+
+    private:
+        std::string id;
+        std::set<std::pair<unsigned long, unsigned long> > finished;
+};
+
+struct ImportState
+{
+    ImportState(SharedProxyState &shared, const ConnectionInfo &ci,
+                unsigned int threads)
+        : shared(shared), ci(ci), queue(4 * threads), rows(0),
+          schema_generation(1), failed(false){}
+
+    SharedProxyState &shared;
+    const ConnectionInfo ci;
+    WorkQueue queue;
+    ImportJournal journal;
+    std::atomic<unsigned long> rows;
+    // bumped after each statement that may change the schema
+    std::atomic<unsigned int> schema_generation;
+    std::atomic<bool> failed;
+    // > ProxyState and Connect are not safe to build concurrently
+    std::mutex setup;
+};
+
+/**
+ * Encrypts batches of rows and writes them to the backend.
+ * > each worker loads a schema of its own, so that no two threads share
+ *   an EncLayer; OPE and HOM keep state in theirs.
+ * > the rows of tables with a MOPE_int never come here; see
+ *   Import::executeQueries(...).
+ */
+class ImportWorker
+{
+    public:
+        ImportWorker(ImportState &state);
+        ~ImportWorker(){}
+
+        void run();
+
+    private:
+        ImportState &state;
+        ProxyState ps;
+        const std::unique_ptr<Connect> conn;
+        std::string db;
+        std::unique_ptr<SchemaInfo> schema;
+        unsigned int schema_generation;
+
+        bool insert(const ImportJob &job);
+        std::unique_ptr<ResType> backend(const std::string &q);
+};
+
 /**
  * Import database tool class.
  */
@@ -11,11 +151,12 @@ class Import
         Import(const char *fname) : filename(fname){}
         ~Import(){}
 
-        void executeQueries(ProxyState& ps);
+        // returns false if a statement failed
+        bool executeQueries(ImportState &state, unsigned int threads,
+                            unsigned long batch_rows, std::string db);
         void printOutOnly(void);
 
     private:
         std::string filename;
 };
 };
-
@@ -1,9 +1,17 @@
 /*
  * prototype
+ *
+ * Replays a query trace through CryptDB, recording which onions (and
+ * down to which level) each column is rewritten against; then writes a
+ * per column onion layout that keeps only those onions.
+ *
+ * Start the proxy with CRYPTDB_ONION_LAYOUTS=<layout file> and the
+ * tables it creates afterwards will use the pruned layouts.
  */
 #include <algorithm>
 #include <cryptdblearn.hh>
 #include <iostream>
+#include <iomanip>
 #include <sstream>
 #include <fstream>
 #include <errstream.hh>
@@ -12,85 +20,257 @@
 #include <onions.hh> //layout
 #include <Analysis.hh> //for intersect()
 #include <rewrite_main.hh>
+#include <rewrite_util.hh>
 #include <parser/sql_utils.hh>
 
 static void help(const char *prog)
 {
-    std::cout << "Usage: " << prog << 
-        " -u user -p password -d database [-f input file]" << "\n";
+    std::cout << "Usage: " << prog <<
+        " -u user -p password -d database [-f input file]"
+        " [-o layout file] [-k master key] [-e embedded dir]" << "\n";
 }
 
-static bool 
+static bool
 ignore_line(const std::string& line)
 {
     static const std::string begin_match("--");
 
-    return(line.compare(0,2,begin_match) == 0); 
+    return(line.compare(0,2,begin_match) == 0);
 }
 
-void 
+void
 Learn::status()
 {
     std::cout << "Total queries: " << this->m_totalnum << "\n";
     std::cout << "Number of successfully executed queries: " << this->m_success_num << "\n";
+    std::cout << "Number of failed queries: " << this->m_errnum << "\n";
 }
 
+void
+Learn::runQuery(ProxyState &ps, const std::string &query)
+{
+    // The traces record COM_INIT_DB as a bare database name.
+    std::string q = query;
+    if (std::string::npos == q.find_first_of(" \t\n")) {
+        this->m_dbname = q;
+        q = "USE " + q;
+    }
+
+    this->m_totalnum++;
+    if (executeQuery(ps, q, this->m_dbname)) {
+        this->m_success_num++;
+    } else {
+        this->m_errnum++;
+        std::cerr << "failed: " << q << "\n";
+    }
+}
+
+// A statement ends at a line ending with ';' or at a blank line, the
+// traces in traces/ use the latter.
 void
 Learn::trainFromFile(ProxyState &ps)
 {
     std::string line;
     std::string s("");
     std::ifstream input(this->m_filename);
-    assert(input.is_open() == true); 
+    assert(input.is_open() == true);
 
+    OnionUsage::enable(true);
     while(std::getline(input, line )){
         if(ignore_line(line))
             continue;
 
-        if (!line.empty()){
-            char lastChar = *line.rbegin();
-            if(lastChar == ';'){
-                throw CryptDBError("fix Learn::trainFromFile!");
-                /*
-                // FIXME: Use executeQuery.
-                this->m_totalnum++;
-                s += line;
-                Rewriter r;
-                SchemaInfo *out_schema;
-                QueryRewrite qr = r.rewrite(ps, s, &out_schema);
-                // FIXME.
-                ResType *res =
-                    qr.output->doQuery(ps.conn, ps.e_conn);
-                if(res){
-                    if(res->ok)
-                        this->m_success_num++;
-                    delete res;
-                }
-                if (true == qr.output->queryAgain()){ 
-                    this->m_totalnum++;
-                    assert(executeQuery(ps, s));
-                    this->m_success_num++;
-                } 
-                */
+        if (line.empty()){
+            if (!s.empty()){
+                this->runQuery(ps, s);
                 s.clear();
-                continue;
             }
-            s += line;
+            continue;
+        }
+
+        if (!s.empty())
+            s += "\n";
+        const char lastChar = *line.rbegin();
+        if(lastChar == ';'){
+            s += line.substr(0, line.size() - 1);
+            this->runQuery(ps, s);
+            s.clear();
+            continue;
         }
+        s += line;
     }
+    if (!s.empty())
+        this->runQuery(ps, s);
+    OnionUsage::enable(false);
 }
-        
-void 
+
+void
 Learn::trainFromScratch(ProxyState &ps)
 {
     //TODO: implement this
     /*
      *
-     * OK, here we have no queries tracing file at all and we should 
+     * OK, here we have no queries tracing file at all and we should
      * train using as most secure onions layout as possible.
      */
 }
 
+// Ciphertext bytes an onion currently occupies on the backend.
+static uint64_t
+onionBytes(const std::unique_ptr<Connect> &conn, const std::string &db,
+           const std::string &anon_table, const std::string &anon_onion,
+           uint64_t *const rows)
+{
+    const std::string query =
+        " SELECT COUNT(*), IFNULL(SUM(LENGTH(`" + anon_onion + "`)), 0)"
+        "   FROM `" + db + "`.`" + anon_table + "`;";
+    std::unique_ptr<DBResult> dbres;
+    if (false == conn->execute(query, &dbres) || !dbres || !dbres->n) {
+        return 0;
+    }
+
+    const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+    if (NULL == row) {
+        return 0;
+    }
+    *rows = strtoull(row[0], NULL, 10);
+    return strtoull(row[1], NULL, 10);
+}
+
+void
+Learn::learnLayouts(ProxyState &ps)
+{
+    const std::shared_ptr<const SchemaInfo> &schema = ps.getSchemaInfo();
+    const auto &usage = OnionUsage::get();
+
+    this->m_layouts.clear();
+    for (const auto &db_it : schema->getChildren()) {
+        const std::string &db = db_it.first.getValue();
+        for (const auto &table_it : db_it.second->getChildren()) {
+            const std::string &table = table_it.first.getValue();
+            const TableMeta &tm = *table_it.second.get();
+            for (const auto &field_it : tm.getChildren()) {
+                const std::string &field = field_it.first.getValue();
+                const FieldMeta &fm = *field_it.second.get();
+                if (PLAIN_ONION_LAYOUT == fm.getOnionLayout()) {
+                    continue;
+                }
+
+                const OnionUsage::FieldKey key(db, table, field);
+                const auto &used = usage.find(key);
+                ColumnLayout cl = ColumnLayout();
+                for (const auto &onion_it : fm.getChildren()) {
+                    const onion o = onion_it.first.getValue();
+                    const OnionMeta &om = *onion_it.second.get();
+                    const unsigned int layers = om.getLayers().size();
+
+                    uint64_t rows = 0;
+                    const uint64_t bytes =
+                        onionBytes(ps.getConn(), db, tm.getAnonTableName(),
+                                   om.getAnonOnionName(), &rows);
+                    cl.rows = std::max(cl.rows, rows);
+                    cl.bytes_total += bytes;
+                    cl.layers_before += layers;
+
+                    if (usage.end() != used) {
+                        const auto &level = used->second.find(o);
+                        if (used->second.end() != level) {
+                            cl.used[o] = level->second;
+                        }
+                    }
+
+                    // Mirrors FieldMeta::restrictOnionLayout(...).
+                    if (oDET == o || oPLAIN == o
+                        || cl.used.end() != cl.used.find(o)) {
+                        cl.keep.insert(o);
+                        cl.layers_after += layers;
+                        continue;
+                    }
+
+                    cl.dropped.push_back(o);
+                    cl.bytes_dropped += bytes;
+                    if (oAGG == o) {
+                        cl.hom_dropped++;
+                    }
+                }
+
+                this->m_layouts[key] = cl;
+            }
+        }
+    }
+}
+
+static std::string
+onionList(const std::set<onion> &onions)
+{
+    std::string out;
+    for (auto it : onions) {
+        out += (out.empty() ? "" : ",") + TypeText<onion>::toText(it);
+    }
+    return out;
+}
+
+// > '-' for a column the trace did not use; so that onionUsageHint(...)
+//   tells it from one we have no record of
+static std::string
+usageList(const OnionLevelMap &used)
+{
+    std::string out;
+    for (const auto &it : used) {
+        out += (out.empty() ? "" : ",") + TypeText<onion>::toText(it.first)
+               + ":" + TypeText<SECLEVEL>::toText(it.second);
+    }
+    return out.empty() ? "-" : out;
+}
+
+void
+Learn::writeLayouts(std::ostream &out) const
+{
+    out << "# <database> <table> <field> <onion>[,<onion>...]"
+           " <onion>:<level>[,...]\n";
+    for (const auto &it : this->m_layouts) {
+        out << std::get<0>(it.first) << " " << std::get<1>(it.first) << " "
+            << std::get<2>(it.first) << " " << onionList(it.second.keep)
+            << " " << usageList(it.second.used) << "\n";
+    }
+}
+
+void
+Learn::report(std::ostream &out) const
+{
+    uint64_t bytes_total = 0, bytes_dropped = 0, rows = 0;
+    unsigned int layers_before = 0, layers_after = 0, hom_dropped = 0;
+
+    out << std::left << std::setw(48) << "column" << std::setw(24) << "kept"
+        << std::setw(16) << "dropped" << std::right << std::setw(16)
+        << "bytes saved" << "\n";
+    for (const auto &it : this->m_layouts) {
+        const ColumnLayout &cl = it.second;
+        std::set<onion> dropped(cl.dropped.begin(), cl.dropped.end());
+        out << std::left << std::setw(48)
+            << std::get<1>(it.first) + "." + std::get<2>(it.first)
+            << std::setw(24) << onionList(cl.keep)
+            << std::setw(16) << onionList(dropped)
+            << std::right << std::setw(16) << cl.bytes_dropped << "\n";
+
+        bytes_total += cl.bytes_total;
+        bytes_dropped += cl.bytes_dropped;
+        rows += cl.rows;
+        layers_before += cl.layers_before;
+        layers_after += cl.layers_after;
+        hom_dropped += cl.hom_dropped;
+    }
+
+    const double pct =
+        0 == bytes_total ? 0.0 : 100.0 * bytes_dropped / bytes_total;
+    out << "\nOnion storage: " << bytes_dropped << " of " << bytes_total
+        << " bytes (" << std::fixed << std::setprecision(1) << pct
+        << "%) are in onions the trace never used\n";
+    out << "Encryptions per inserted row: " << layers_before << " -> "
+        << layers_after << " (" << hom_dropped
+        << " fewer Paillier encryptions)\n";
+}
+
 int main(int argc, char **argv)
 {
     int c, optind = 0;
@@ -101,6 +281,9 @@ int main(int argc, char **argv)
         {"password", required_argument, 0, 'p'},
         {"dbname", required_argument, 0, 'd'},
         {"file", required_argument, 0, 'f'},
+        {"output", required_argument, 0, 'o'},
+        {"key", required_argument, 0, 'k'},
+        {"embedded", required_argument, 0, 'e'},
         {NULL, 0, 0, 0},
     };
 
@@ -108,10 +291,14 @@ int main(int argc, char **argv)
     std::string password("");
     std::string dbname("");
     std::string filename("");
+    std::string output("");
+    std::string master_key("2392834");
+    std::string embed_dir("/var/lib/shadow-mysql");
 
     while(1)
     {
-        c = getopt_long(argc, argv, "hf:u:p:d:", long_options, &optind);
+        c = getopt_long(argc, argv, "hf:u:p:d:o:k:e:", long_options,
+                        &optind);
         if(c == -1)
             break;
 
@@ -132,6 +319,15 @@ int main(int argc, char **argv)
             case 'd':
                 dbname = optarg;
                 break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'k':
+                master_key = optarg;
+                break;
+            case 'e':
+                embed_dir = optarg;
+                break;
             case '?':
                 break;
             default:
@@ -143,28 +339,37 @@ int main(int argc, char **argv)
     assert(password != "");
     assert(dbname != "");
 
-    
-    /*
     ConnectionInfo ci("localhost", username, password);
-    const std::string master_key = "2392834";
-    SharedProxyState shared_ps(ci, "/var/lib/shadow-mysql", master_key);
+    SharedProxyState shared_ps(ci, embed_dir, master_key,
+                               determineSecurityRating());
     ProxyState ps(shared_ps);
 
-    Learn *learn; 
-    
+    Learn *learn;
+
     if(filename != "")
     {
         learn = new Learn(MODE_FILE, ps, dbname, filename);
         learn->trainFromFile(ps);
         learn->status();
+
+        learn->learnLayouts(ps);
+        learn->report(std::cout);
+        if (output != "") {
+            std::ofstream out(output);
+            assert(out.is_open());
+            learn->writeLayouts(out);
+            std::cout << "Wrote onion layouts to " << output << "\n";
+        } else {
+            std::cout << "\n";
+            learn->writeLayouts(std::cout);
+        }
     }else{
         learn = new Learn(MODE_FROM_SCRATCH, ps, dbname, "");
         learn->trainFromScratch(ps);
         learn->status();
     }
-   
+
     delete learn;
-    */
 
     return 0;
 }
@@ -2,6 +2,8 @@
 
 #include <stdio.h>
 #include <iostream>
+#include <map>
+#include <set>
 #include <rewrite_main.hh>
 
 // Anonymous namespace
@@ -26,6 +28,19 @@ static learn_mode_t __attribute__((unused))modes[]=
     {MODE_INVALID, "FALSE"},
 };
 
+// What pruning a column down to the onions the trace used buys us.
+typedef struct ColumnLayout {
+    std::set<onion> keep;
+    std::vector<onion> dropped;
+    OnionLevelMap used;             // lowest level each onion was used at
+    unsigned int layers_before;     // encryptions per inserted value
+    unsigned int layers_after;
+    unsigned int hom_dropped;       // Paillier encryptions per value
+    uint64_t rows;
+    uint64_t bytes_total;           // ciphertext stored in all onions
+    uint64_t bytes_dropped;         // ... and in the dropped ones
+} ColumnLayout;
+
 class Learn
 {
     public:
@@ -40,6 +55,13 @@ class Learn
         void trainFromFile(ProxyState &ps);
         void trainFromScratch(ProxyState &ps);
 
+        // Walk the schema the trace built and keep the onions each
+        // column was rewritten against.
+        void learnLayouts(ProxyState &ps);
+        // Format read by onionLayoutHint(...); see CRYPTDB_ONION_LAYOUTS.
+        void writeLayouts(std::ostream &out) const;
+        void report(std::ostream &out) const;
+
         void status();
 
     private:
@@ -51,7 +73,9 @@ class Learn
         std::string m_dbname;
         std::string m_filename;
         std::vector<query_parse*>qvec;
+        std::map<OnionUsage::FieldKey, ColumnLayout> m_layouts;
 
+        void runQuery(ProxyState &ps, const std::string &query);
 };
 
 };
@@ -10,6 +10,7 @@
 #include <memory>
 
 #include <crypto/BasicCrypto.hh>
+#include <crypto/aes.hh>
 #include <crypto/blowfish.hh>
 #include <crypto/SWPSearch.hh>
 #include <crypto/paillier.hh>
@@ -55,6 +56,14 @@ char *    cryptdb_decrypt_text_det(UDF_INIT *const initid, UDF_ARGS *const args,
                                    char *const result, unsigned long *const length,
                                    char *const is_null, char *const error);
 
+my_bool   cryptdb_decrypt_text_ffx_init(UDF_INIT *const initid,
+                                        UDF_ARGS *const args,
+                                        char *const message);
+void      cryptdb_decrypt_text_ffx_deinit(UDF_INIT *const initid);
+char *    cryptdb_decrypt_text_ffx(UDF_INIT *const initid, UDF_ARGS *const args,
+                                   char *const result, unsigned long *const length,
+                                   char *const is_null, char *const error);
+
 my_bool   cryptdb_searchSWP_init(UDF_INIT *const initid, UDF_ARGS *const args,
                                  char *const message);
 void      cryptdb_searchSWP_deinit(UDF_INIT *const initid);
@@ -107,42 +116,6 @@ decrypt_SEM(const unsigned char *const eValueBytes, uint64_t eValueLen,
 }
 
 
-static std::unique_ptr<std::list<std::string>>
-split(const std::string &s, unsigned int plen)
-{
-    const unsigned int len = s.length();
-    if (len % plen != 0) {
-        thrower() << "split receives invalid input";
-    }
-
-    const unsigned int num = len / plen;
-    std::unique_ptr<std::list<std::string>>
-        res(new std::list<std::string>());
-
-    for (unsigned int i = 0; i < num; i++) {
-        res.get()->push_back(s.substr(i*plen, plen));
-    }
-
-    return res;
-}
-
-
-static bool
-searchExists(const Token &token, const std::string &overall_ciph)
-{
-    const std::unique_ptr<std::list<std::string>>
-        l(split(overall_ciph, SWPCiphSize));
-    return SWP::searchExists(token, *l.get());
-}
-
-
-static bool
-search(const Token &token, const std::string &overall_ciph)
-{
-   return searchExists(token, overall_ciph);
-}
-
-
 static uint64_t
 getui(UDF_ARGS *const args, int i)
 {
@@ -384,6 +357,74 @@ cryptdb_decrypt_text_det(UDF_INIT *const initid, UDF_ARGS *const args,
     return initid->ptr;
 }
 
+my_bool
+cryptdb_decrypt_text_ffx_init(UDF_INIT *const initid, UDF_ARGS *const args,
+                              char *const message)
+{
+    if (args->arg_count != 2 ||
+        args->arg_type[0] != STRING_RESULT ||
+        args->arg_type[1] != STRING_RESULT)
+    {
+        strcpy(message, "Usage: cryptdb_decrypt_text_ffx(string ciphertext, string key)");
+        return 1;
+    }
+
+    initid->maybe_null = 1;
+    return 0;
+}
+
+void
+cryptdb_decrypt_text_ffx_deinit(UDF_INIT *const initid)
+{
+    if (initid->ptr)
+        delete[] initid->ptr;
+}
+
+char *
+cryptdb_decrypt_text_ffx(UDF_INIT *const initid, UDF_ARGS *const args,
+                         char *const result, unsigned long *const length,
+                         char *const is_null, char *const error)
+{
+    AssignFirst<std::string> value;
+    if (NULL == args->args[0]) {
+        value = "";
+        *is_null = 1;
+    } else {
+        try {
+            uint64_t eValueLen;
+            char *const eValueBytes = getba(args, 0, eValueLen);
+
+            uint64_t keyLen;
+            char *const keyBytes = getba(args, 1, keyLen);
+            const AES key(std::string(keyBytes, keyLen));
+
+            value =
+                decrypt_FFX(std::string(eValueBytes,
+                                static_cast<unsigned int>(eValueLen)),
+                            key);
+        } catch (const CryptoError &e) {
+            std::cerr << e.msg << std::endl;
+            value = "";
+        }
+    }
+
+    // > the buffer of the previous row
+    delete[] initid->ptr;
+    char *const res = new char[value.get().length()];
+    initid->ptr = res;
+    memcpy(res, value.get().data(), value.get().length());
+    *length = value.get().length();
+    return initid->ptr;
+}
+
+struct search_state {
+    Token token;
+    std::string mask;
+    bool bloom;
+
+    search_state() : bloom(false) {}
+};
+
 /*
  * given field of the form:   len1 word1 len2 word2 len3 word3 ...,
  * where each len is the length of the following "word",
@@ -396,16 +437,17 @@ my_bool
 cryptdb_searchSWP_init(UDF_INIT *const initid, UDF_ARGS *const args,
                        char *const message)
 {
-    if (args->arg_count != 3 ||
+    if ((args->arg_count != 3 && args->arg_count != 4) ||
         args->arg_type[0] != STRING_RESULT ||
         args->arg_type[1] != STRING_RESULT ||
-        args->arg_type[2] != STRING_RESULT)
+        args->arg_type[2] != STRING_RESULT ||
+        (args->arg_count == 4 && args->arg_type[3] != STRING_RESULT))
     {
-        strcpy(message, "Usage: cryptdb_searchSWP(string ciphertext, string ciph, string wordKey)");
+        strcpy(message, "Usage: cryptdb_searchSWP(string ciphertext, string ciph, string wordKey[, string bloom mask])");
         return 1;
     }
 
-    Token *const t = new Token();
+    search_state *const st = new search_state();
 
     uint64_t ciphLen;
     char *const ciph = getba(args, 1, ciphLen);
@@ -413,10 +455,18 @@ cryptdb_searchSWP_init(UDF_INIT *const initid, UDF_ARGS *const args,
     uint64_t wordKeyLen;
     char *const wordKey = getba(args, 2, wordKeyLen);
 
-    t->ciph = std::string(ciph, ciphLen);
-    t->wordKey = std::string(wordKey, wordKeyLen);
+    st->token.ciph = std::string(ciph, ciphLen);
+    st->token.wordKey = std::string(wordKey, wordKeyLen);
 
-    initid->ptr = reinterpret_cast<char *>(t);
+    // > the ciphertext then starts with the row's Bloom filter
+    if (args->arg_count == 4) {
+        uint64_t maskLen;
+        char *const mask = getba(args, 3, maskLen);
+        st->mask = std::string(mask, maskLen);
+        st->bloom = true;
+    }
+
+    initid->ptr = reinterpret_cast<char *>(st);
 
     return 0;
 }
@@ -424,8 +474,8 @@ cryptdb_searchSWP_init(UDF_INIT *const initid, UDF_ARGS *const args,
 void
 cryptdb_searchSWP_deinit(UDF_INIT *const initid)
 {
-    Token *const t = reinterpret_cast<Token *>(initid->ptr);
-    delete t;
+    search_state *const st = reinterpret_cast<search_state *>(initid->ptr);
+    delete st;
 }
 
 ulonglong
@@ -433,12 +483,21 @@ cryptdb_searchSWP(UDF_INIT *const initid, UDF_ARGS *const args,
                   char *const is_null, char *const error)
 {
     uint64_t allciphLen;
-    char *const allciph = getba(args, 0, allciphLen);
-    const std::string overallciph = std::string(allciph, allciphLen);
+    const char *allciph = getba(args, 0, allciphLen);
+
+    const search_state *const st =
+        reinterpret_cast<search_state *>(initid->ptr);
 
-    Token *const t = reinterpret_cast<Token *>(initid->ptr);
+    if (st->bloom) {
+        size_t filterLen;
+        if (!SWP::bloomMatch(allciph, allciphLen, st->mask, &filterLen)) {
+            return 0;
+        }
+        allciph += filterLen;
+        allciphLen -= filterLen;
+    }
 
-    return search(*t, overallciph);
+    return SWP::searchExists(st->token, allciph, allciphLen);
 }
 
 
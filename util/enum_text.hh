@@ -64,11 +64,11 @@ public:
     }
 
     static std::vector<std::string> allText() {
-        return TypeText<_type>::instance->allText();
+        return TypeText<_type>::instance->theTexts;
     }
 
     static std::vector<_type> allEnum() {
-        return TypeText<_type>::instance->allEnum();
+        return TypeText<_type>::instance->theEnums;
     }
 
     static std::string toText(_type e) {
@@ -85,7 +85,7 @@ public:
 
     static std::string parenList() {
         std::vector<std::string> texts =
-            *TypeText<_type>::instance->theTexts;
+            TypeText<_type>::instance->theTexts;
         std::stringstream s;
         s << "(";
         for (unsigned int i = 0; i < texts.size(); ++i) {